@@ -0,0 +1,95 @@
+/* generated by configure.sh */
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+extern int luaopen_asi_input(lua_State *);
+extern int luaopen_astra(lua_State *);
+extern int luaopen_log(lua_State *);
+extern int luaopen_timer(lua_State *);
+extern int luaopen_utils(lua_State *);
+extern int luaopen_json(lua_State *);
+extern int luaopen_base64(lua_State *);
+extern int luaopen_sha1(lua_State *);
+extern int luaopen_md5(lua_State *);
+extern int luaopen_rc4(lua_State *);
+extern int luaopen_str2hex(lua_State *);
+extern int luaopen_iso8859(lua_State *);
+extern int luaopen_pidfile(lua_State *);
+extern int luaopen_biss_encrypt(lua_State *);
+extern int luaopen_dvb_input(lua_State *);
+extern int luaopen_dvbls(lua_State *);
+extern int luaopen_ddci(lua_State *);
+extern int luaopen_file_input(lua_State *);
+extern int luaopen_file_output(lua_State *);
+extern int luaopen_file_recorder(lua_State *);
+extern int luaopen_http_server(lua_State *);
+extern int luaopen_http_request(lua_State *);
+extern int luaopen_http_redirect(lua_State *);
+extern int luaopen_http_static(lua_State *);
+extern int luaopen_http_websocket(lua_State *);
+extern int luaopen_http_upstream(lua_State *);
+extern int luaopen_http_downstream(lua_State *);
+extern int luaopen_hls_output(lua_State *);
+extern int luaopen_timeshift(lua_State *);
+extern int luaopen_http_relay(lua_State *);
+extern int luaopen_inscript(lua_State *);
+extern int luaopen_analyze(lua_State *);
+extern int luaopen_channel(lua_State *);
+extern int luaopen_transmit(lua_State *);
+extern int luaopen_postgres(lua_State *);
+extern int luaopen_decrypt(lua_State *);
+extern int luaopen_csa_check(lua_State *);
+extern int luaopen_csa_generator(lua_State *);
+extern int luaopen_newcamd(lua_State *);
+extern int luaopen_newcamd_server(lua_State *);
+extern int luaopen_udp_input(lua_State *);
+extern int luaopen_udp_output(lua_State *);
+
+int (*astra_mods[])(lua_State *) =
+{
+    luaopen_asi_input,
+    luaopen_astra,
+    luaopen_log,
+    luaopen_timer,
+    luaopen_utils,
+    luaopen_json,
+    luaopen_base64,
+    luaopen_sha1,
+    luaopen_md5,
+    luaopen_rc4,
+    luaopen_str2hex,
+    luaopen_iso8859,
+    luaopen_pidfile,
+    luaopen_biss_encrypt,
+    luaopen_dvb_input,
+    luaopen_dvbls,
+    luaopen_ddci,
+    luaopen_file_input,
+    luaopen_file_output,
+    luaopen_file_recorder,
+    luaopen_http_server,
+    luaopen_http_request,
+    luaopen_http_redirect,
+    luaopen_http_static,
+    luaopen_http_websocket,
+    luaopen_http_upstream,
+    luaopen_http_downstream,
+    luaopen_hls_output,
+    luaopen_timeshift,
+    luaopen_http_relay,
+    luaopen_inscript,
+    luaopen_analyze,
+    luaopen_channel,
+    luaopen_transmit,
+    luaopen_postgres,
+    luaopen_decrypt,
+    luaopen_csa_check,
+    luaopen_csa_generator,
+    luaopen_newcamd,
+    luaopen_newcamd_server,
+    luaopen_udp_input,
+    luaopen_udp_output,
+    NULL
+};
+
+#endif /* _CONFIG_H_ */
@@ -16,6 +16,8 @@ Usage: $0 [OPTIONS]
 
     --with-libdvbcsa            - build with libdvbcsa
     --with-igmp-emulation       - build with igmp emulated multicast renew
+    --with-simulators           - build the test modules: newcamd_server,
+                                  csa_generator, csa_check
 
     --cc=GCC                    - custom C compiler (cross-compile)
     --static                    - build static binary
@@ -47,6 +49,7 @@ ARG_CFLAGS=""
 ARG_LDFLAGS=""
 ARG_LIBDVBCSA=0
 ARG_IGMP_EMULATION=0
+ARG_SIMULATORS=0
 ARG_DEBUG=0
 
 set_cc()
@@ -76,6 +79,9 @@ while [ $# -ne 0 ] ; do
         "--with-igmp-emulation")
             ARG_IGMP_EMULATION=1
             ;;
+        "--with-simulators")
+            ARG_SIMULATORS=1
+            ;;
         "--cc="*)
             set_cc `echo $OPT | sed 's/^--cc=//'`
             ;;
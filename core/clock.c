@@ -21,6 +21,13 @@
 
 #include "clock.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#   define CLOCK_TSC 1
+#   include <cpuid.h>
+#endif
+
+static uint64_t clock_now = 0;
+
 __asc_inline
 uint64_t asc_utime(void)
 {
@@ -58,3 +65,196 @@ void asc_usleep(uint64_t usec)
     CloseHandle(timer);
 #endif
 }
+
+#ifdef CLOCK_TSC
+
+/*
+ * TSC ticks are converted to microseconds with the multiplier calibrated
+ * against asc_utime() on the each second. The error is corrected by the
+ * next multiplier, so the fast clock does not step backward.
+ */
+
+#define TSC_SHIFT 32
+#define TSC_CALIBRATE_FIRST 100000  /* us */
+#define TSC_CALIBRATE 1000000       /* us */
+#define TSC_INTERVAL_MAX 16000000   /* us, interval << TSC_SHIFT fits in 64 bits */
+#define TSC_ERROR_MAX 100000        /* us, larger error steps the clock forward or halves the rate */
+
+typedef enum
+{
+    TSC_UNKNOWN = 0,
+    TSC_DISABLED,
+    TSC_CALIBRATION,
+    TSC_READY,
+} tsc_state_t;
+
+typedef struct
+{
+    uint64_t tsc;
+    uint64_t usec;
+    uint64_t mult;
+    uint64_t tsc_max; /* limit of the ticks from the anchor to prevent overflow */
+} tsc_anchor_t;
+
+static struct
+{
+    tsc_state_t state;
+
+    /* last calibration point */
+    uint64_t tsc;
+    uint64_t usec;
+
+    /* seqlock, odd while the anchor is changed */
+    uint32_t seq;
+    tsc_anchor_t anchor;
+} clock_tsc;
+
+static inline uint64_t tsc_read(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+
+static inline uint64_t tsc_time(const tsc_anchor_t *anchor, uint64_t tsc)
+{
+    return anchor->usec + (((tsc - anchor->tsc) * anchor->mult) >> TSC_SHIFT);
+}
+
+static bool tsc_check(void)
+{
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    /* invariant TSC: constant rate in all ACPI P-, C- and T-states */
+    return (edx & (1 << 8)) != 0;
+}
+
+static void tsc_set_anchor(uint64_t tsc, uint64_t usec, uint64_t mult)
+{
+    const uint32_t seq = clock_tsc.seq;
+
+    __atomic_store_n(&clock_tsc.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_tsc.anchor.tsc = tsc;
+    clock_tsc.anchor.usec = usec;
+    clock_tsc.anchor.mult = mult;
+    clock_tsc.anchor.tsc_max = (UINT64_MAX >> 1) / mult;
+
+    __atomic_store_n(&clock_tsc.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void tsc_calibrate(uint64_t usec)
+{
+    const uint64_t tsc = tsc_read();
+
+    switch(clock_tsc.state)
+    {
+        case TSC_UNKNOWN:
+            if(!tsc_check())
+            {
+                clock_tsc.state = TSC_DISABLED;
+                return;
+            }
+            clock_tsc.tsc = tsc;
+            clock_tsc.usec = usec;
+            clock_tsc.state = TSC_CALIBRATION;
+            return;
+        case TSC_DISABLED:
+            return;
+        default:
+            break;
+    }
+
+    const uint64_t interval = usec - clock_tsc.usec;
+    if(interval < ((clock_tsc.state == TSC_READY) ? TSC_CALIBRATE : TSC_CALIBRATE_FIRST))
+        return;
+
+    const uint64_t ticks = tsc - clock_tsc.tsc;
+    clock_tsc.tsc = tsc;
+    clock_tsc.usec = usec;
+
+    if(ticks == 0 || interval > TSC_INTERVAL_MAX)
+    {
+        /* main loop was blocked, start again with the next interval */
+        if(ticks == 0)
+            clock_tsc.state = TSC_DISABLED;
+        return;
+    }
+
+    if(clock_tsc.state == TSC_CALIBRATION)
+    {
+        tsc_set_anchor(tsc, usec, (interval << TSC_SHIFT) / ticks);
+        __atomic_store_n(&clock_tsc.state, TSC_READY, __ATOMIC_RELEASE);
+        return;
+    }
+
+    /* continue from the current fast time, the error is spread to the next second */
+    const uint64_t fast_usec = tsc_time(&clock_tsc.anchor, tsc);
+    const int64_t error = (int64_t)(usec - fast_usec);
+
+    if(error > TSC_ERROR_MAX)
+    {
+        tsc_set_anchor(tsc, usec, (interval << TSC_SHIFT) / ticks);
+        return;
+    }
+
+    /* fast clock is ahead. never goes backwards, slows down to the half rate */
+    if(error < -TSC_ERROR_MAX)
+    {
+        tsc_set_anchor(tsc, fast_usec, (interval << TSC_SHIFT) / ticks / 2);
+        return;
+    }
+
+    int64_t target = (int64_t)interval + error;
+    if(target < (int64_t)interval / 2)
+        target = interval / 2;
+
+    tsc_set_anchor(tsc, fast_usec, ((uint64_t)target << TSC_SHIFT) / ticks);
+}
+
+uint64_t asc_clock_fast(void)
+{
+    if(__atomic_load_n(&clock_tsc.state, __ATOMIC_ACQUIRE) != TSC_READY)
+        return asc_utime();
+
+    tsc_anchor_t anchor;
+    uint32_t seq;
+    do
+    {
+        seq = __atomic_load_n(&clock_tsc.seq, __ATOMIC_ACQUIRE);
+        anchor = clock_tsc.anchor;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while((seq & 1) || seq != __atomic_load_n(&clock_tsc.seq, __ATOMIC_RELAXED));
+
+    const uint64_t tsc = tsc_read();
+    if(tsc - anchor.tsc > anchor.tsc_max)
+        return asc_utime();
+
+    return tsc_time(&anchor, tsc);
+}
+
+#else
+
+uint64_t asc_clock_fast(void)
+{
+    return asc_utime();
+}
+
+#endif /* CLOCK_TSC */
+
+void asc_clock_update(void)
+{
+    clock_now = asc_utime();
+#ifdef CLOCK_TSC
+    tsc_calibrate(clock_now);
+#endif
+}
+
+uint64_t asc_clock_now(void)
+{
+    if(!clock_now)
+        asc_clock_update();
+
+    return clock_now;
+}
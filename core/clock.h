@@ -27,4 +27,14 @@
 uint64_t asc_utime(void);
 void asc_usleep(uint64_t usec);
 
+/*
+ * asc_clock_now() - time of the current main loop iteration. Updated by
+ * asc_clock_update() on the each iteration, only for the main thread.
+ * asc_clock_fast() - the same clock as asc_utime(), without the system call
+ * if the CPU has an invariant TSC. Can be used in the threads.
+ */
+void asc_clock_update(void);
+uint64_t asc_clock_now(void);
+uint64_t asc_clock_fast(void);
+
 #endif /* _ASC_CLOCK_H_ */
@@ -39,6 +39,11 @@
 #   include <netdb.h>
 #endif
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#   include <linux/errqueue.h>
+#   define HAVE_ZEROCOPY 1
+#endif
+
 #ifdef IGMP_EMULATION
 #   define IP_HEADER_SIZE 24
 #   define IGMP_HEADER_SIZE 8
@@ -65,6 +70,7 @@ struct asc_socket_t
     event_callback_t on_read;      /* data read */
     event_callback_t on_close;     /* error occured (connection closed) */
     event_callback_t on_ready;     /* data send is possible now */
+    zerocopy_callback_t on_zerocopy; /* zero-copy send is completed */
 };
 
 /*
@@ -216,9 +222,54 @@ void asc_socket_close(asc_socket_t *sock)
  *
  */
 
+#ifdef HAVE_ZEROCOPY
+/* zero-copy notifications are queued to the socket error queue and wake up
+ * the event loop with EPOLLERR. returns true if any notification is read */
+static bool __asc_socket_on_errqueue(asc_socket_t *sock)
+{
+    bool is_notified = false;
+
+    while(true)
+    {
+        uint8_t control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if(recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break;
+
+        for(struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            const struct sock_extended_err *ee
+                = (const struct sock_extended_err *)CMSG_DATA(cm);
+            if(ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            is_notified = true;
+            sock->on_zerocopy(sock->arg, ee->ee_info, ee->ee_data
+                              , (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+        }
+    }
+
+    if(!is_notified)
+        return false;
+
+    int err = 0;
+    socklen_t slen = sizeof(err);
+    getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, (void *)&err, &slen);
+    return (err == 0);
+}
+#endif
+
 static void __asc_socket_on_close(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
+#ifdef HAVE_ZEROCOPY
+    if(sock->on_zerocopy && __asc_socket_on_errqueue(sock))
+        return;
+#endif
     if(sock->on_close)
         sock->on_close(sock->arg);
 }
@@ -399,21 +450,39 @@ void asc_socket_listen(  asc_socket_t *sock
  *
  */
 
+/* returns false with errno EAGAIN if there are no pending connections */
 bool asc_socket_accept(asc_socket_t *sock, asc_socket_t **client_ptr, void * arg)
 {
-    asc_socket_t *client = (asc_socket_t *)calloc(1, sizeof(asc_socket_t));
-    socklen_t sin_size = sizeof(client->addr);
-    client->fd = accept(sock->fd, (struct sockaddr *)&client->addr, &sin_size);
-    if(client->fd <= 0)
+    struct sockaddr_in addr;
+    socklen_t sin_size = sizeof(addr);
+#if defined(__linux) && defined(SOCK_NONBLOCK)
+    const int fd = accept4(  sock->fd, (struct sockaddr *)&addr, &sin_size
+                           , SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    const int fd = accept(sock->fd, (struct sockaddr *)&addr, &sin_size);
+#endif
+    if(fd <= 0)
     {
-        asc_log_error(MSG("accept() failed [%s]"), asc_socket_error());
-        free(client);
         *client_ptr = NULL;
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            const int err = errno;
+            asc_log_error(MSG("accept() failed [%s]"), asc_socket_error());
+            errno = err;
+        }
         return false;
     }
 
+    asc_socket_t *client = (asc_socket_t *)calloc(1, sizeof(asc_socket_t));
+    client->fd = fd;
+    client->family = sock->family;
+    client->type = sock->type;
+    client->protocol = sock->protocol;
+    client->addr = addr;
     client->arg = arg;
+#if !defined(__linux) || !defined(SOCK_NONBLOCK)
     asc_socket_set_nonblock(client, true);
+#endif
 
     *client_ptr = client;
     return true;
@@ -548,6 +617,53 @@ ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size)
     return ret;
 }
 
+static ssize_t __asc_socket_sendv(  asc_socket_t *sock, const struct iovec *iov, int count
+                                  , int flags)
+{
+#ifdef _WIN32
+    __uarg(flags);
+    ssize_t total = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        const ssize_t ret = asc_socket_send(sock, iov[i].iov_base, iov[i].iov_len);
+        if(ret == -1)
+            return (total > 0) ? total : -1;
+        total += ret;
+        if((size_t)ret != iov[i].iov_len)
+            break;
+    }
+    return total;
+#else
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = count;
+
+    const ssize_t ret = sendmsg(sock->fd, &msg, flags);
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return ret;
+#endif
+}
+
+/* gathered send of the several buffers with one system call */
+ssize_t asc_socket_sendv(asc_socket_t *sock, const struct iovec *iov, int count)
+{
+    return __asc_socket_sendv(sock, iov, count, 0);
+}
+
+/* buffers should not be changed until the on_zerocopy callback reports
+ * completion. each successful call increments the send counter used in the
+ * notification range. on ENOBUFS the data should be sent with sendv() */
+ssize_t asc_socket_sendv_zerocopy(asc_socket_t *sock, const struct iovec *iov, int count)
+{
+#ifdef HAVE_ZEROCOPY
+    return __asc_socket_sendv(sock, iov, count, MSG_ZEROCOPY);
+#else
+    return __asc_socket_sendv(sock, iov, count, 0);
+#endif
+}
+
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size)
 {
     const socklen_t slen = sizeof(struct sockaddr_in);
@@ -727,6 +843,40 @@ void asc_socket_set_buffer(asc_socket_t *sock, int rcvbuf, int sndbuf)
 #endif
 }
 
+/* wake up on_ready only when unsent data in the socket is less than size */
+void asc_socket_set_notsent_lowat(asc_socket_t *sock, int size)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    if(sock->protocol != IPPROTO_TCP)
+        return;
+
+    if(setsockopt(sock->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void *)&size, sizeof(size)) != 0)
+        asc_log_warning(MSG("failed to set notsent_lowat %d (%s)"), size, asc_socket_error());
+#else
+    __uarg(sock);
+    __uarg(size);
+#endif
+}
+
+bool asc_socket_set_zerocopy(asc_socket_t *sock, zerocopy_callback_t on_zerocopy)
+{
+#ifdef HAVE_ZEROCOPY
+    if(sock->protocol != IPPROTO_TCP)
+        return false;
+
+    const int is_on = 1;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, (void *)&is_on, sizeof(is_on)) != 0)
+        return false;
+
+    sock->on_zerocopy = on_zerocopy;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(on_zerocopy);
+    return false;
+#endif
+}
+
 /*
  * oooo     oooo       oooooooo8     o       oooooooo8 ooooooooooo
  *  8888o   888      o888     88    888     888        88  888  88
@@ -24,8 +24,21 @@
 #include "base.h"
 #include "event.h"
 
+#ifdef _WIN32
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#   include <sys/uio.h>
+#endif
+
 typedef struct asc_socket_t asc_socket_t;
 
+/* range of the completed zero-copy sends. is_copied - kernel has copied data */
+typedef void (*zerocopy_callback_t)(void *, uint32_t, uint32_t, bool);
+
 void asc_socket_core_init(void);
 void asc_socket_core_destroy(void);
 
@@ -56,6 +69,8 @@ ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size) __wur
 
 ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size) __wur;
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+ssize_t asc_socket_sendv(asc_socket_t *sock, const struct iovec *iov, int count) __wur;
+ssize_t asc_socket_sendv_zerocopy(asc_socket_t *sock, const struct iovec *iov, int count) __wur;
 
 int asc_socket_fd(asc_socket_t *sock) __wur;
 const char * asc_socket_addr(asc_socket_t *sock) __wur;
@@ -69,6 +84,8 @@ void asc_socket_set_keep_alive(asc_socket_t *sock, int is_on);
 void asc_socket_set_broadcast(asc_socket_t *sock, int is_on);
 void asc_socket_set_timeout(asc_socket_t *sock, int rcvmsec, int sndmsec);
 void asc_socket_set_buffer(asc_socket_t *sock, int rcvbuf, int sndbuf);
+void asc_socket_set_notsent_lowat(asc_socket_t *sock, int size);
+bool asc_socket_set_zerocopy(asc_socket_t *sock, zerocopy_callback_t on_zerocopy);
 
 void asc_socket_set_multicast_if(asc_socket_t *sock, const char *addr);
 void asc_socket_set_multicast_ttl(asc_socket_t *sock, int ttl);
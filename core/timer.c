@@ -64,7 +64,7 @@ void asc_timer_core_loop(void)
             continue;
         }
 
-        const uint64_t cur = asc_utime();
+        const uint64_t cur = asc_clock_now();
         if(cur >= timer->next_shot)
         {
             if(timer->interval == 0)
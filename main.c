@@ -182,6 +182,7 @@ astra_reload_entry:
         while(true)
         {
             is_main_loop_idle = true;
+            asc_clock_update();
 
             asc_event_core_loop();
             asc_timer_core_loop();
@@ -203,7 +204,7 @@ astra_reload_entry:
 
             if(is_main_loop_idle)
             {
-                current_time = asc_utime();
+                current_time = asc_clock_now();
                 if((current_time - gc_check_timeout) >= GC_TIMEOUT)
                 {
                     gc_check_timeout = current_time;
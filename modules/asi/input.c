@@ -38,6 +38,8 @@ struct module_data_t
     asc_event_t *event;
     uint8_t filter[MAX_PID / 8];
 
+    mpegts_sync_t *sync;
+
     uint8_t buffer[ASI_BUFFER_SIZE];
 };
 
@@ -63,8 +65,7 @@ static void asi_on_read(void *arg)
         return;
     }
 
-    for(int i = 0; i < len; i += TS_PACKET_SIZE)
-        module_stream_send(mod, &mod->buffer[i]);
+    mpegts_sync_push(mod->sync, mod->buffer, len);
 }
 
 
@@ -137,6 +138,8 @@ static void module_init(module_data_t *mod)
 
     fsync(mod->fd);
 
+    mod->sync = mpegts_sync_init((ts_callback_t)__module_stream_send, &mod->__stream);
+
     mod->event = asc_event_init(mod->fd, mod);
     asc_event_set_on_read(mod->event, asi_on_read);
     asc_event_set_on_error(mod->event, asi_on_error);
@@ -149,6 +152,8 @@ static void module_destroy(module_data_t *mod)
     asc_event_close(mod->event);
     if(mod->fd)
         close(mod->fd);
+
+    mpegts_sync_destroy(mod->sync);
 }
 
 
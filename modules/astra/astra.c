@@ -66,6 +66,8 @@ LUA_API int luaopen_astra(lua_State *L)
         { NULL, NULL }
     };
 
+    crc32b_init();
+
     luaL_newlib(L, astra_api);
 
     lua_pushboolean(lua,
@@ -38,6 +38,7 @@ uint8_t * str_to_hex(const char *str, uint8_t *hex, int len);
 /* crc32b.c */
 
 #define CRC32_SIZE 4
+void crc32b_init(void);
 uint32_t crc32b(const uint8_t *buffer, int size);
 
 /* sha1.c */
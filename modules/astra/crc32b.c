@@ -3,10 +3,39 @@
  *
  * Based on "File Verification Using CRC" by Mark R. Nelson in
  * Dr. Dobb's Journal, May 1992, pp. 64-67
+ *
+ * CRC-32/MPEG-2: polynomial 0x04C11DB7, initial value 0xFFFFFFFF,
+ * no reflection, no final xor.
+ *
+ * Implementations:
+ * - slicing-by-8 and slicing-by-16 tables, built from crc32_table
+ * - folding with carry-less multiplication: PCLMULQDQ on x86,
+ *   PMULL on ARMv8
+ *
+ * The best one is selected once by crc32b_init() on the module load and
+ * checked against the byte-at-a-time table before use. The table
+ * implementation is used until then.
  */
 
 #include <astra.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#   define CRC32_PCLMUL 1
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#   define CRC32_PMULL 1
+#endif
+
+#if defined(CRC32_PCLMUL)
+#   include <cpuid.h>
+#   include <emmintrin.h>
+#   include <tmmintrin.h>
+#   include <wmmintrin.h>
+#elif defined(CRC32_PMULL)
+#   include <sys/auxv.h>
+#   include <asm/hwcap.h>
+#   include <arm_neon.h>
+#endif
+
 static uint32_t crc32_table[256] = {
     0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
     0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
@@ -53,27 +82,361 @@ static uint32_t crc32_table[256] = {
     0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-uint32_t crc32b(const uint8_t *buffer, int size)
+typedef uint32_t (*crc32_func_t)(uint32_t crc, const uint8_t *buffer, size_t size);
+
+static uint32_t crc32_slice[16][256];
+
+/* CRC-32/MPEG-2 of "123456789" */
+#define CRC32_CHECK 0x0376E6E7
+
+/*
+ *  oooooooo8   ooooooo  ooooooooooo ooooooooooo
+ * 888        o888   888o 888    88   888    88
+ *  888oooooo 888     888 888ooo8     888ooo8
+ *         888888o   o888 888         888    oo
+ * o88oooo888   88ooo88  o888o       o888ooo8888
+ *
+ */
+
+static inline uint32_t crc32_byte(uint32_t crc, const uint8_t *buffer, size_t size)
 {
-    register uint32_t crc = 0xffffffff;
+    for(; size > 0; --size, ++buffer)
+        crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ (*buffer)) & 0xFF];
 
-    int n = (size + 7) / 8;
-    const int m = size % 8;
+    return crc;
+}
 
-#define STEP { crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ (*buffer)) & 0xFF]; ++buffer; }
-    switch(m)
+static uint32_t crc32_table_update(uint32_t crc, const uint8_t *buffer, size_t size)
+{
+    return crc32_byte(crc, buffer, size);
+}
+
+static uint32_t crc32_slice8_update(uint32_t crc, const uint8_t *buffer, size_t size)
+{
+    for(; size >= 8; size -= 8, buffer += 8)
     {
-        case 0: do { STEP;
-        case 7:      STEP;
-        case 6:      STEP;
-        case 5:      STEP;
-        case 4:      STEP;
-        case 3:      STEP;
-        case 2:      STEP;
-        case 1:      STEP;
-                   } while (--n > 0);
+        const uint32_t w = crc ^ BUFFER_TO_U32(buffer);
+        crc = crc32_slice[7][w >> 24]
+            ^ crc32_slice[6][(w >> 16) & 0xFF]
+            ^ crc32_slice[5][(w >> 8) & 0xFF]
+            ^ crc32_slice[4][w & 0xFF]
+            ^ crc32_slice[3][buffer[4]]
+            ^ crc32_slice[2][buffer[5]]
+            ^ crc32_slice[1][buffer[6]]
+            ^ crc32_slice[0][buffer[7]];
     }
-#undef STEP
 
-    return crc;
+    return crc32_byte(crc, buffer, size);
+}
+
+static uint32_t crc32_slice16_update(uint32_t crc, const uint8_t *buffer, size_t size)
+{
+    for(; size >= 16; size -= 16, buffer += 16)
+    {
+        const uint32_t w = crc ^ BUFFER_TO_U32(buffer);
+        crc = crc32_slice[15][w >> 24]
+            ^ crc32_slice[14][(w >> 16) & 0xFF]
+            ^ crc32_slice[13][(w >> 8) & 0xFF]
+            ^ crc32_slice[12][w & 0xFF]
+            ^ crc32_slice[11][buffer[4]]
+            ^ crc32_slice[10][buffer[5]]
+            ^ crc32_slice[9][buffer[6]]
+            ^ crc32_slice[8][buffer[7]]
+            ^ crc32_slice[7][buffer[8]]
+            ^ crc32_slice[6][buffer[9]]
+            ^ crc32_slice[5][buffer[10]]
+            ^ crc32_slice[4][buffer[11]]
+            ^ crc32_slice[3][buffer[12]]
+            ^ crc32_slice[2][buffer[13]]
+            ^ crc32_slice[1][buffer[14]]
+            ^ crc32_slice[0][buffer[15]];
+    }
+
+    return crc32_slice8_update(crc, buffer, size);
+}
+
+static void crc32_slice_init(void)
+{
+    /* crc32_slice[n][b] - CRC of the byte b followed by n zero bytes */
+    memcpy(crc32_slice[0], crc32_table, sizeof(crc32_table));
+    for(int n = 1; n < 16; ++n)
+    {
+        for(int b = 0; b < 256; ++b)
+        {
+            const uint32_t crc = crc32_slice[n - 1][b];
+            crc32_slice[n][b] = (crc << 8) ^ crc32_table[crc >> 24];
+        }
+    }
+}
+
+/*
+ * oooooooooo ooooo oooo     oooo ooooo  oooo ooooo       ooooo
+ *  888    888 888   8888o   888   888    88   888         888
+ *  888oooo88  888   88 888o8 88   888    88   888         888
+ *  888        888   88  888  88   888    88   888      o  888      o
+ * o888o      o888o o88o  8  o88o   888oo88   o888ooooo88 o888ooooo88
+ *
+ * Folding for the non-reflected CRC. 128-bit blocks are loaded big-endian,
+ * so the first bit of the block is the bit 127 of the register.
+ * Block A followed by N bits: A * x^N = H * x^(N+64) + L * x^N,
+ * both x^K mod P fit into 32 bits.
+ * The last 128-bit remainder is reduced with the table.
+ */
+
+#if defined(CRC32_PCLMUL) || defined(CRC32_PMULL)
+
+#define CRC32_FOLD_MIN 64
+
+static struct
+{
+    uint64_t k576, k512; /* fold by 4 blocks */
+    uint64_t k192, k128; /* fold by 1 block */
+} crc32_fold;
+
+/* x^n mod P */
+static uint32_t crc32_xpow(int n)
+{
+    uint32_t v = 1;
+    for(int i = 0; i < n; ++i)
+        v = (v << 1) ^ ((v & 0x80000000) ? 0x04C11DB7 : 0);
+    return v;
+}
+
+static void crc32_fold_init(void)
+{
+    crc32_fold.k576 = crc32_xpow(576);
+    crc32_fold.k512 = crc32_xpow(512);
+    crc32_fold.k192 = crc32_xpow(192);
+    crc32_fold.k128 = crc32_xpow(128);
+}
+
+#endif
+
+#if defined(CRC32_PCLMUL)
+
+#define CRC32_TARGET __attribute__((target("pclmul,ssse3")))
+
+static CRC32_TARGET inline __m128i crc32_pclmul_load(const uint8_t *buffer, __m128i bswap)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buffer), bswap);
+}
+
+static CRC32_TARGET inline __m128i crc32_pclmul_fold(__m128i a, __m128i k)
+{
+    return _mm_xor_si128(  _mm_clmulepi64_si128(a, k, 0x11)
+                         , _mm_clmulepi64_si128(a, k, 0x00));
+}
+
+static CRC32_TARGET uint32_t crc32_pclmul_update(uint32_t crc, const uint8_t *buffer, size_t size)
+{
+    if(size < CRC32_FOLD_MIN)
+        return crc32_slice16_update(crc, buffer, size);
+
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k4 = _mm_set_epi64x(crc32_fold.k576, crc32_fold.k512);
+    const __m128i k1 = _mm_set_epi64x(crc32_fold.k192, crc32_fold.k128);
+
+    __m128i a0 = crc32_pclmul_load(&buffer[0], bswap);
+    __m128i a1 = crc32_pclmul_load(&buffer[16], bswap);
+    __m128i a2 = crc32_pclmul_load(&buffer[32], bswap);
+    __m128i a3 = crc32_pclmul_load(&buffer[48], bswap);
+    buffer += 64;
+    size -= 64;
+
+    /* initial value to the first 32 bits of the message */
+    a0 = _mm_xor_si128(a0, _mm_set_epi32((int)crc, 0, 0, 0));
+
+    for(; size >= 64; size -= 64, buffer += 64)
+    {
+        a0 = _mm_xor_si128(crc32_pclmul_fold(a0, k4), crc32_pclmul_load(&buffer[0], bswap));
+        a1 = _mm_xor_si128(crc32_pclmul_fold(a1, k4), crc32_pclmul_load(&buffer[16], bswap));
+        a2 = _mm_xor_si128(crc32_pclmul_fold(a2, k4), crc32_pclmul_load(&buffer[32], bswap));
+        a3 = _mm_xor_si128(crc32_pclmul_fold(a3, k4), crc32_pclmul_load(&buffer[48], bswap));
+    }
+
+    a0 = _mm_xor_si128(crc32_pclmul_fold(a0, k1), a1);
+    a0 = _mm_xor_si128(crc32_pclmul_fold(a0, k1), a2);
+    a0 = _mm_xor_si128(crc32_pclmul_fold(a0, k1), a3);
+
+    for(; size >= 16; size -= 16, buffer += 16)
+        a0 = _mm_xor_si128(crc32_pclmul_fold(a0, k1), crc32_pclmul_load(buffer, bswap));
+
+    uint8_t remainder[16];
+    _mm_storeu_si128((__m128i *)remainder, _mm_shuffle_epi8(a0, bswap));
+
+    crc = crc32_slice16_update(0, remainder, sizeof(remainder));
+    return crc32_slice8_update(crc, buffer, size);
+}
+
+static bool crc32_pclmul_check(void)
+{
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+}
+
+#elif defined(CRC32_PMULL)
+
+#define CRC32_TARGET __attribute__((target("+crypto")))
+
+static CRC32_TARGET inline uint8x16_t crc32_pmull_load(const uint8_t *buffer)
+{
+    /* big-endian: the first byte to the lane 15 */
+    const uint8x16_t v = vrev64q_u8(vld1q_u8(buffer));
+    return vextq_u8(v, v, 8);
+}
+
+static CRC32_TARGET inline uint8x16_t crc32_pmull_fold(uint8x16_t a, poly64_t kh, poly64_t kl)
+{
+    const uint64x2_t v = vreinterpretq_u64_u8(a);
+    const poly128_t h = vmull_p64((poly64_t)vgetq_lane_u64(v, 1), kh);
+    const poly128_t l = vmull_p64((poly64_t)vgetq_lane_u64(v, 0), kl);
+    return veorq_u8(vreinterpretq_u8_p128(h), vreinterpretq_u8_p128(l));
+}
+
+static CRC32_TARGET uint32_t crc32_pmull_update(uint32_t crc, const uint8_t *buffer, size_t size)
+{
+    if(size < CRC32_FOLD_MIN)
+        return crc32_slice16_update(crc, buffer, size);
+
+    const poly64_t k576 = (poly64_t)crc32_fold.k576;
+    const poly64_t k512 = (poly64_t)crc32_fold.k512;
+    const poly64_t k192 = (poly64_t)crc32_fold.k192;
+    const poly64_t k128 = (poly64_t)crc32_fold.k128;
+
+    uint8x16_t a0 = crc32_pmull_load(&buffer[0]);
+    uint8x16_t a1 = crc32_pmull_load(&buffer[16]);
+    uint8x16_t a2 = crc32_pmull_load(&buffer[32]);
+    uint8x16_t a3 = crc32_pmull_load(&buffer[48]);
+    buffer += 64;
+    size -= 64;
+
+    /* initial value to the first 32 bits of the message */
+    const uint32x4_t init = { 0, 0, 0, crc };
+    a0 = veorq_u8(a0, vreinterpretq_u8_u32(init));
+
+    for(; size >= 64; size -= 64, buffer += 64)
+    {
+        a0 = veorq_u8(crc32_pmull_fold(a0, k576, k512), crc32_pmull_load(&buffer[0]));
+        a1 = veorq_u8(crc32_pmull_fold(a1, k576, k512), crc32_pmull_load(&buffer[16]));
+        a2 = veorq_u8(crc32_pmull_fold(a2, k576, k512), crc32_pmull_load(&buffer[32]));
+        a3 = veorq_u8(crc32_pmull_fold(a3, k576, k512), crc32_pmull_load(&buffer[48]));
+    }
+
+    a0 = veorq_u8(crc32_pmull_fold(a0, k192, k128), a1);
+    a0 = veorq_u8(crc32_pmull_fold(a0, k192, k128), a2);
+    a0 = veorq_u8(crc32_pmull_fold(a0, k192, k128), a3);
+
+    for(; size >= 16; size -= 16, buffer += 16)
+        a0 = veorq_u8(crc32_pmull_fold(a0, k192, k128), crc32_pmull_load(buffer));
+
+    uint8_t remainder[16];
+    const uint8x16_t r = vrev64q_u8(a0);
+    vst1q_u8(remainder, vextq_u8(r, r, 8));
+
+    crc = crc32_slice16_update(0, remainder, sizeof(remainder));
+    return crc32_slice8_update(crc, buffer, size);
+}
+
+static bool crc32_pmull_check(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+}
+
+#endif
+
+/*
+ * ooooo oooo   oooo ooooo ooooooooooo
+ *  888   8888o  88   888  88  888  88
+ *  888   88 888o88   888      888
+ *  888   88   8888   888      888
+ * o888o o88o    88  o888o    o888o
+ *
+ */
+
+/* byte-at-a-time table is used until crc32b_init() */
+static crc32_func_t crc32_update = crc32_table_update;
+
+/* compare with the byte-at-a-time table on all lengths and alignments */
+static bool crc32_conform(crc32_func_t func)
+{
+    static const uint8_t check[] = "123456789";
+    if(func(0xFFFFFFFF, check, sizeof(check) - 1) != CRC32_CHECK)
+        return false;
+
+    uint8_t buffer[512 + 16];
+    for(size_t i = 0; i < sizeof(buffer); ++i)
+        buffer[i] = (i * 167 + 13) & 0xFF;
+
+    for(size_t offset = 0; offset < 16; offset += 3)
+    {
+        for(size_t size = 0; size <= 512; ++size)
+        {
+            const uint8_t *data = &buffer[offset];
+            if(func(0xFFFFFFFF, data, size) != crc32_table_update(0xFFFFFFFF, data, size))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* selects the implementation. called from the main thread before the modules
+ * are started, so the worker threads never see crc32_update changing */
+void crc32b_init(void)
+{
+    if(crc32_update != crc32_table_update)
+        return;
+
+    crc32_slice_init();
+
+    crc32_func_t func = crc32_slice16_update;
+    const char *name = "slicing-by-16";
+
+#if defined(CRC32_PCLMUL)
+    if(crc32_pclmul_check())
+    {
+        crc32_fold_init();
+        if(crc32_conform(crc32_pclmul_update))
+        {
+            func = crc32_pclmul_update;
+            name = "pclmul";
+        }
+        else
+            asc_log_warning("[crc32] pclmul self-check failed");
+    }
+#elif defined(CRC32_PMULL)
+    if(crc32_pmull_check())
+    {
+        crc32_fold_init();
+        if(crc32_conform(crc32_pmull_update))
+        {
+            func = crc32_pmull_update;
+            name = "pmull";
+        }
+        else
+            asc_log_warning("[crc32] pmull self-check failed");
+    }
+#endif
+
+    if(func == crc32_slice16_update && !crc32_conform(func))
+    {
+        asc_log_warning("[crc32] slicing-by-16 self-check failed");
+        func = crc32_table_update;
+        name = "table";
+    }
+
+    asc_log_debug("[crc32] %s", name);
+
+    crc32_update = func;
+}
+
+uint32_t crc32b(const uint8_t *buffer, int size)
+{
+    if(size <= 0)
+        return 0xffffffff;
+
+    return crc32_update(0xffffffff, buffer, size);
 }
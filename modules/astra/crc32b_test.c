@@ -0,0 +1,157 @@
+/*
+ * CRC-32b conformance test and benchmark
+ *
+ * Build from the source root:
+ *      gcc -O2 -std=iso9899:1999 -D_GNU_SOURCE -I. \
+ *          -o crc32b_test modules/astra/crc32b_test.c
+ *
+ * Each implementation is compared with the byte-at-a-time table on
+ * all lengths up to 4096 bytes and all alignments, then the throughput
+ * is measured on typical section sizes.
+ */
+
+#include "crc32b.c"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+void asc_log_warning(const char *msg, ...)
+{
+    va_list ap;
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+void asc_log_debug(const char *msg, ...)
+{
+    __uarg(msg);
+}
+
+#define TEST_SIZE 4096
+#define BENCH_BYTES (256 * 1024 * 1024)
+
+static uint8_t data[TEST_SIZE + 16];
+
+static const struct
+{
+    const char *name;
+    crc32_func_t func;
+} impl_list[] =
+{
+    { "table", crc32_table_update },
+    { "slicing-by-8", crc32_slice8_update },
+    { "slicing-by-16", crc32_slice16_update },
+#if defined(CRC32_PCLMUL)
+    { "pclmul", crc32_pclmul_update },
+#elif defined(CRC32_PMULL)
+    { "pmull", crc32_pmull_update },
+#endif
+};
+
+static bool impl_is_supported(crc32_func_t func)
+{
+#if defined(CRC32_PCLMUL)
+    if(func == crc32_pclmul_update)
+        return crc32_pclmul_check();
+#elif defined(CRC32_PMULL)
+    if(func == crc32_pmull_update)
+        return crc32_pmull_check();
+#endif
+    __uarg(func);
+    return true;
+}
+
+static bool test_conform(crc32_func_t func)
+{
+    for(size_t offset = 0; offset < 16; ++offset)
+    {
+        for(size_t size = 0; size <= TEST_SIZE; ++size)
+        {
+            const uint8_t *buffer = &data[offset];
+            const uint32_t crc = crc32_byte(0xFFFFFFFF, buffer, size);
+            if(func(0xFFFFFFFF, buffer, size) != crc)
+            {
+                printf("  mismatch: offset:%zu size:%zu\n", offset, size);
+                return false;
+            }
+
+            /* continuation from the middle of the buffer */
+            const size_t half = size / 2;
+            if(func(func(0xFFFFFFFF, buffer, half), &buffer[half], size - half) != crc)
+            {
+                printf("  mismatch: offset:%zu size:%zu split:%zu\n", offset, size, half);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static double test_bench(crc32_func_t func, size_t size)
+{
+    const size_t count = BENCH_BYTES / size;
+    uint32_t crc = 0;
+
+    struct timeval tvs, tve;
+    gettimeofday(&tvs, NULL);
+    for(size_t i = 0; i < count; ++i)
+        crc ^= func(0xFFFFFFFF, data, size);
+    gettimeofday(&tve, NULL);
+
+    /* keep the result */
+    data[0] ^= crc & 0x01;
+
+    const double elapsed = (tve.tv_sec - tvs.tv_sec) + 1e-6 * (tve.tv_usec - tvs.tv_usec);
+    return (double)(count * size) / elapsed / 1000000.0;
+}
+
+int main(void)
+{
+    static const size_t bench_size[] = { 32, 188, 1024, 4096 };
+    bool ok = true;
+
+    crc32_slice_init();
+#if defined(CRC32_PCLMUL) || defined(CRC32_PMULL)
+    crc32_fold_init();
+#endif
+
+    uint32_t seed = 1;
+    for(size_t i = 0; i < sizeof(data); ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+
+    /* crc32b() with the runtime selection */
+    static const uint8_t check[] = "123456789";
+    if(crc32b(check, sizeof(check) - 1) != CRC32_CHECK)
+    {
+        printf("crc32b: FAILED\n");
+        ok = false;
+    }
+
+    for(size_t i = 0; i < ASC_ARRAY_SIZE(impl_list); ++i)
+    {
+        if(!impl_is_supported(impl_list[i].func))
+        {
+            printf("%-14s not supported\n", impl_list[i].name);
+            continue;
+        }
+
+        const bool is_ok = test_conform(impl_list[i].func);
+        printf("%-14s %s", impl_list[i].name, (is_ok) ? "OK" : "FAILED");
+        ok = ok && is_ok;
+
+        for(size_t j = 0; j < ASC_ARRAY_SIZE(bench_size); ++j)
+        {
+            printf("  %zu:%.0fMB/s"
+                   , bench_size[j], test_bench(impl_list[i].func, bench_size[j]));
+        }
+        printf("\n");
+    }
+
+    return (ok) ? 0 : 1;
+}
@@ -51,6 +51,27 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts)
     }
 }
 
+void __module_stream_send_tag(module_stream_t *stream, const uint8_t *ts, const void *tag)
+{
+    stream->tag_ts = ts;
+    stream->tag = tag;
+    __module_stream_send(stream, ts);
+    stream->tag_ts = NULL;
+    stream->tag = NULL;
+}
+
+const void * __module_stream_tag(module_stream_t *stream, const uint8_t *ts)
+{
+    /* packet could be forwarded by the other modules without changes */
+    for(; stream; stream = stream->parent)
+    {
+        if(stream->tag_ts == ts)
+            return stream->tag;
+    }
+
+    return NULL;
+}
+
 void __module_stream_init(module_stream_t *stream)
 {
     stream->childs = asc_list_init();
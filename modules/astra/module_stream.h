@@ -36,6 +36,10 @@ struct module_stream_t
 
     asc_list_t *childs;
 
+    // packet metadata, valid only for the packet in the current on_ts() call
+    const uint8_t *tag_ts;
+    const void *tag;
+
     // demux
     void (*join_pid)(module_data_t *mod, uint16_t pid);
     void (*leave_pid)(module_data_t *mod, uint16_t pid);
@@ -51,6 +55,8 @@ void __module_stream_init(module_stream_t *stream);
 void __module_stream_destroy(module_stream_t *stream);
 void __module_stream_attach(module_stream_t *stream, module_stream_t *child);
 void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
+void __module_stream_send_tag(module_stream_t *stream, const uint8_t *ts, const void *tag);
+const void * __module_stream_tag(module_stream_t *stream, const uint8_t *ts);
 
 #define module_stream_init(_mod, _on_ts)                                                        \
     {                                                                                           \
@@ -97,6 +103,14 @@ void __module_stream_send(module_stream_t *stream, const uint8_t *ts);
 #define module_stream_send(_mod, _ts)                                                           \
     __module_stream_send(&_mod->__stream, _ts)
 
+/* send packet with the metadata, for example mpegts_es_tag_t */
+#define module_stream_send_tag(_mod, _ts, _tag)                                                 \
+    __module_stream_send_tag(&_mod->__stream, _ts, _tag)
+
+/* metadata attached to the packet by the one of the upstream modules */
+#define module_stream_tag(_mod, _ts)                                                            \
+    __module_stream_tag(_mod->__stream.parent, _ts)
+
 // demux
 
 #define module_stream_demux_check_pid(_mod, _pid)                                               \
@@ -18,8 +18,71 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      biss_encrypt
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      key         - string, BISS key, 16 chars length
+ *      threads     - number, encryption threads. default: 1. 0 - encrypt in the main loop
+ *      latency     - number, max delay of the packet in milliseconds. default: 100
+ *
+ * Module Methods:
+ *      set_key(key)
+ *                  - load the key to the next parity and switch to it.
+ *                    returns false if the previous switch is in progress
+ *
+ * Only the elementary streams listed in the PMT are encrypted. Other packets
+ * are queued in the same batch to keep the stream order. If the threads are
+ * not in time, packets are dropped.
+ */
+
 #include <astra.h>
-#include <dvbcsa/dvbcsa.h>
+#include <pthread.h>
+
+#ifndef FFDECSA
+#   define FFDECSA 1
+#endif
+
+#ifndef LIBDVBCSA
+#   define LIBDVBCSA 0
+#endif
+
+#if FFDECSA == 1
+#   include "../softcam/FFdecsa/FFdecsa.h"
+#elif LIBDVBCSA == 1
+#   include <dvbcsa/dvbcsa.h>
+#else
+#   error "DVB-CSA is not defined"
+#endif
+
+#define MSG(_msg) "[biss_encrypt] " _msg
+
+#define MAX_THREADS 8
+
+typedef enum
+{
+    BATCH_FREE = 0,     /* filling by the main loop */
+    BATCH_QUEUED,       /* waiting for the thread */
+    BATCH_ENCRYPT,      /* encrypting by the thread */
+    BATCH_READY,        /* waiting for send */
+} batch_status_t;
+
+typedef struct
+{
+    batch_status_t status;
+    uint8_t parity;
+    uint64_t time;      /* first packet */
+
+    uint8_t *buffer;
+    size_t buffer_size;
+
+#if LIBDVBCSA == 1
+    struct dvbcsa_bs_batch_s *batch;
+#endif
+    int batch_skip;
+} batch_t;
 
 struct module_data_t
 {
@@ -30,49 +93,292 @@ struct module_data_t
     mpegts_psi_t *pat;
     mpegts_psi_t *pmt;
 
-    struct dvbcsa_bs_key_s *key;
+#if FFDECSA == 1
+    void *keys;
+#elif LIBDVBCSA == 1
+    struct dvbcsa_bs_key_s *key[2]; /* even, odd */
+#endif
+    uint8_t parity;
 
+    int batch_size;
     size_t storage_size;
-    size_t storage_skip;
 
-    int batch_skip;
-    uint8_t *batch_storage_recv;
-    uint8_t *batch_storage_send;
-    struct dvbcsa_bs_batch_s *batch;
+    batch_t *slot;
+    int slot_count;
+    int slot_write;
+    int slot_send;
+
+    uint64_t latency;
+    asc_timer_t *timer;
+
+    uint64_t drop_count;
+    bool is_overflow;
+
+    /* threads */
+    int thread_count;
+    asc_thread_t *thread[MAX_THREADS];
+    asc_thread_buffer_t *thread_output;
+    bool is_thread_started;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_queued;
 };
 
+static bool parse_key(const char *key_value, size_t key_length, uint8_t key[8])
+{
+    if(key_length != 16)
+        return false;
+
+    str_to_hex(key_value, key, 16);
+    key[3] = (key[0] + key[1] + key[2]) & 0xFF;
+    key[7] = (key[4] + key[5] + key[6]) & 0xFF;
+
+    return true;
+}
+
+static void set_key(module_data_t *mod, uint8_t parity, const uint8_t key[8])
+{
+#if FFDECSA == 1
+    if(parity == 0)
+        set_even_control_word(mod->keys, key);
+    else
+        set_odd_control_word(mod->keys, key);
+#elif LIBDVBCSA == 1
+    dvbcsa_bs_key_set(key, mod->key[parity]);
+#endif
+}
+
+static void batch_encrypt(module_data_t *mod, batch_t *slot)
+{
+#if FFDECSA == 1
+
+    /* packets are marked with the slot parity in process_ts() */
+    uint8_t *cluster[3] = { slot->buffer, &slot->buffer[slot->buffer_size], NULL };
+
+    size_t i = 0, i_size = slot->buffer_size / TS_PACKET_SIZE;
+    while(i < i_size)
+        i += encrypt_packets(mod->keys, cluster);
+
+#elif LIBDVBCSA == 1
+
+    slot->batch[slot->batch_skip].data = NULL;
+    dvbcsa_bs_encrypt(mod->key[slot->parity], slot->batch, TS_BODY_SIZE);
+
+#endif
+}
+
+static void batch_send(module_data_t *mod, batch_t *slot)
+{
+    for(size_t skip = 0; skip < slot->buffer_size; skip += TS_PACKET_SIZE)
+        module_stream_send(mod, &slot->buffer[skip]);
+
+    slot->buffer_size = 0;
+    slot->batch_skip = 0;
+}
+
+/*
+ * ooooooooooo ooooo ooooo oooooooooo  ooooooooooo      o      ooooooooo
+ * 88  888  88  888   888   888    888  888    88      888      888    88o
+ *     888      888ooo888   888oooo88   888ooo8       8  88     888    888
+ *     888      888   888   888  88o    888    oo    8oooo88    888    888
+ *    o888o    o888o o888o o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = arg;
+
+    pthread_mutex_lock(&mod->mutex);
+    while(mod->is_thread_started)
+    {
+        /* the oldest batch first */
+        batch_t *slot = NULL;
+        for(int i = 0; i < mod->slot_count; ++i)
+        {
+            batch_t *item = &mod->slot[i];
+            if(item->status == BATCH_QUEUED && (!slot || item->time < slot->time))
+                slot = item;
+        }
+
+        if(!slot)
+        {
+            pthread_cond_wait(&mod->cond_queued, &mod->mutex);
+            continue;
+        }
+
+        slot->status = BATCH_ENCRYPT;
+        pthread_mutex_unlock(&mod->mutex);
+
+        batch_encrypt(mod, slot);
+
+        pthread_mutex_lock(&mod->mutex);
+        slot->status = BATCH_READY;
+
+        /* wake up the main loop. overflow means on_thread_read is already pending */
+        const uint8_t notify = 0;
+        const ssize_t ret = asc_thread_buffer_write(mod->thread_output, &notify, 1);
+        __uarg(ret);
+    }
+    pthread_mutex_unlock(&mod->mutex);
+}
+
+static void send_ready(module_data_t *mod)
+{
+    while(1)
+    {
+        batch_t *slot = &mod->slot[mod->slot_send];
+
+        pthread_mutex_lock(&mod->mutex);
+        const batch_status_t status = slot->status;
+        pthread_mutex_unlock(&mod->mutex);
+
+        if(status != BATCH_READY)
+            break;
+
+        batch_send(mod, slot);
+
+        pthread_mutex_lock(&mod->mutex);
+        slot->status = BATCH_FREE;
+        pthread_mutex_unlock(&mod->mutex);
+
+        mod->slot_send = (mod->slot_send + 1) % mod->slot_count;
+    }
+}
+
+static void on_thread_read(void *arg)
+{
+    module_data_t *mod = arg;
+
+    uint8_t notify[64];
+    while(asc_thread_buffer_read(mod->thread_output, notify, sizeof(notify)) > 0)
+        ;
+
+    send_ready(mod);
+}
+
+static void on_thread_close(void *arg)
+{
+    module_data_t *mod = arg;
+
+    if(!mod->is_thread_started)
+        return;
+
+    pthread_mutex_lock(&mod->mutex);
+    mod->is_thread_started = false;
+    pthread_cond_broadcast(&mod->cond_queued);
+    pthread_mutex_unlock(&mod->mutex);
+
+    for(int i = 0; i < mod->thread_count; ++i)
+        ASC_FREE(mod->thread[i], asc_thread_destroy);
+
+    ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
+}
+
+/*
+ *  oooooooo8 ooooooooooo oooooooooo  ooooooooooo      o      oooo     oooo
+ * 888        88  888  88  888    888  888    88      888      8888o   888
+ *  888oooooo     888      888oooo88   888ooo8       8  88     88 888o8 88
+ *         888    888      888  88o    888    oo    8oooo88    88  888  88
+ * o88oooo888    o888o    o888o  88o8 o888ooo8888 o88o  o888o o88o  8  o88o
+ *
+ */
+
+static void batch_submit(module_data_t *mod)
+{
+    batch_t *slot = &mod->slot[mod->slot_write];
+    if(slot->buffer_size == 0)
+        return;
+
+    if(mod->thread_count == 0)
+    {
+        batch_encrypt(mod, slot);
+        batch_send(mod, slot);
+        return;
+    }
+
+    pthread_mutex_lock(&mod->mutex);
+    slot->status = BATCH_QUEUED;
+    pthread_cond_signal(&mod->cond_queued);
+    pthread_mutex_unlock(&mod->mutex);
+
+    mod->slot_write = (mod->slot_write + 1) % mod->slot_count;
+
+    send_ready(mod);
+}
+
+/* the main loop never waits for the threads. returns false if all slots are in use */
+static bool is_slot_free(module_data_t *mod, batch_t *slot)
+{
+    pthread_mutex_lock(&mod->mutex);
+    const batch_status_t status = slot->status;
+    pthread_mutex_unlock(&mod->mutex);
+
+    return (status == BATCH_FREE);
+}
+
 static void process_ts(module_data_t *mod, const uint8_t *ts, uint8_t hdr_size)
 {
-    uint8_t *dst = &mod->batch_storage_recv[mod->storage_skip];
-    memcpy(dst, ts, TS_PACKET_SIZE);
+    batch_t *slot = &mod->slot[mod->slot_write];
 
-    if(hdr_size)
+    if(slot->buffer_size == 0)
     {
-        dst[3] |= 0x80;
-        mod->batch[mod->batch_skip].data = &dst[hdr_size];
-        mod->batch[mod->batch_skip].len = TS_PACKET_SIZE - hdr_size;
-        ++mod->batch_skip;
+        if(mod->thread_count > 0 && !is_slot_free(mod, slot))
+        {
+            send_ready(mod);
+            if(!is_slot_free(mod, slot))
+            {
+                if(!mod->is_overflow)
+                {
+                    asc_log_warning(MSG("encryption is too slow. drop packets"));
+                    mod->is_overflow = true;
+                    mod->drop_count = 0;
+                }
+                ++mod->drop_count;
+                return;
+            }
+        }
+
+        if(mod->is_overflow)
+        {
+            asc_log_warning(MSG("%"PRIu64" packets dropped"), mod->drop_count);
+            mod->is_overflow = false;
+        }
+
+        slot->parity = mod->parity;
+        slot->time = asc_clock_now();
     }
 
-    if(mod->batch_storage_send)
-        module_stream_send(mod, &mod->batch_storage_send[mod->storage_skip]);
+    uint8_t *dst = &slot->buffer[slot->buffer_size];
+    memcpy(dst, ts, TS_PACKET_SIZE);
+    slot->buffer_size += TS_PACKET_SIZE;
 
-    mod->storage_skip += TS_PACKET_SIZE;
+    if(hdr_size)
+    {
+        dst[3] = (dst[3] & 0x3F) | ((slot->parity) ? 0xC0 : 0x80);
+#if LIBDVBCSA == 1
+        slot->batch[slot->batch_skip].data = &dst[hdr_size];
+        slot->batch[slot->batch_skip].len = TS_PACKET_SIZE - hdr_size;
+#endif
+        ++slot->batch_skip;
+    }
 
-    if(mod->storage_skip >= mod->storage_size)
+    if(   slot->batch_skip >= mod->batch_size
+       || slot->buffer_size >= mod->storage_size)
     {
-        mod->batch[mod->batch_skip].data = NULL;
-        dvbcsa_bs_encrypt(mod->key, mod->batch, 184);
-        uint8_t *storage_tmp = mod->batch_storage_send;
-        mod->batch_storage_send = mod->batch_storage_recv;
-        if(!storage_tmp)
-            storage_tmp = malloc(mod->storage_size);
-        mod->batch_storage_recv = storage_tmp;
-        mod->batch_skip = 0;
-        mod->storage_skip = 0;
+        batch_submit(mod);
     }
 }
 
+static void on_timer(void *arg)
+{
+    module_data_t *mod = arg;
+
+    batch_t *slot = &mod->slot[mod->slot_write];
+    if(slot->buffer_size > 0 && asc_clock_now() - slot->time >= mod->latency)
+        batch_submit(mod);
+}
+
 static void on_pat(void *arg, mpegts_psi_t *psi)
 {
     module_data_t *mod = arg;
@@ -153,6 +459,51 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
     process_ts(mod, ts, (payload != NULL) ? (payload - ts) : (0));
 }
 
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_set_key(module_data_t *mod)
+{
+    size_t key_length = 0;
+    const char *key_value = luaL_checklstring(lua, 2, &key_length);
+
+    uint8_t key[8];
+    if(!parse_key(key_value, key_length, key))
+        luaL_error(lua, MSG("key must be 16 char length"));
+
+    batch_submit(mod);
+
+    const uint8_t parity = mod->parity ^ 1;
+
+    bool is_busy = false;
+    pthread_mutex_lock(&mod->mutex);
+    for(int i = 0; i < mod->slot_count; ++i)
+    {
+        const batch_t *slot = &mod->slot[i];
+        if(slot->status != BATCH_FREE && slot->parity == parity)
+        {
+            is_busy = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mod->mutex);
+
+    if(!is_busy)
+    {
+        set_key(mod, parity, key);
+        mod->parity = parity;
+    }
+
+    lua_pushboolean(lua, !is_busy);
+    return 1;
+}
+
 static void module_init(module_data_t *mod)
 {
     module_stream_init(mod, on_ts);
@@ -160,32 +511,101 @@ static void module_init(module_data_t *mod)
     size_t biss_length = 0;
     const char *key_value = NULL;
     module_option_string("key", &key_value, &biss_length);
-    asc_assert(key_value != NULL, "[biss_encrypt] option 'key' is required");
-    asc_assert(biss_length == 16, "[biss_encrypt] key must be 16 char length");
+    asc_assert(key_value != NULL, MSG("option 'key' is required"));
 
     uint8_t key[8];
-    str_to_hex(key_value, key, 16);
-    key[3] = (key[0] + key[1] + key[2]) & 0xFF;
-    key[7] = (key[4] + key[5] + key[6]) & 0xFF;
-
-    const int batch_size = dvbcsa_bs_batch_size();
-    mod->batch = calloc(batch_size + 1, sizeof(struct dvbcsa_bs_batch_s));
-    mod->storage_size = batch_size * TS_PACKET_SIZE;
-    mod->batch_storage_recv = malloc(mod->storage_size);
-
-    mod->key = dvbcsa_bs_key_alloc();
-    dvbcsa_bs_key_set(key, mod->key);
+    asc_assert(parse_key(key_value, biss_length, key), MSG("key must be 16 char length"));
+
+#if FFDECSA == 1
+    mod->keys = get_key_struct();
+#elif LIBDVBCSA == 1
+    mod->key[0] = dvbcsa_bs_key_alloc();
+    mod->key[1] = dvbcsa_bs_key_alloc();
+#endif
+    set_key(mod, 0, key);
+    set_key(mod, 1, key);
+
+    mod->thread_count = 1;
+    module_option_number("threads", &mod->thread_count);
+    asc_assert(  mod->thread_count >= 0 && mod->thread_count <= MAX_THREADS
+               , MSG("option 'threads' must be in range 0..%d"), MAX_THREADS);
+
+    int latency = 100;
+    module_option_number("latency", &latency);
+    asc_assert(latency > 0, MSG("option 'latency' must be greater than 0"));
+    mod->latency = latency * 1000;
+
+#if FFDECSA == 1
+    /* full groups only. the slot is encrypted with a few calls */
+    mod->batch_size = get_internal_parallelism() * 2;
+#elif LIBDVBCSA == 1
+    mod->batch_size = dvbcsa_bs_batch_size();
+#endif
+    /* not encrypted packets are in the slot too */
+    mod->storage_size = mod->batch_size * 4 * TS_PACKET_SIZE;
+
+    /* one slot is filling, one is sending, others are encrypting.
+     * twice per thread to not drop on the short delay of the thread */
+    mod->slot_count = (mod->thread_count > 0) ? (mod->thread_count * 2 + 2) : 1;
+    mod->slot = calloc(mod->slot_count, sizeof(batch_t));
+    for(int i = 0; i < mod->slot_count; ++i)
+    {
+        mod->slot[i].buffer = malloc(mod->storage_size);
+#if LIBDVBCSA == 1
+        mod->slot[i].batch = calloc(mod->batch_size + 1, sizeof(struct dvbcsa_bs_batch_s));
+#endif
+    }
 
     mod->stream[0x00] = MPEGTS_PACKET_PAT;
     mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
     mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, 0);
+
+    pthread_mutex_init(&mod->mutex, NULL);
+    pthread_cond_init(&mod->cond_queued, NULL);
+
+    if(mod->thread_count > 0)
+    {
+        mod->is_thread_started = true;
+        mod->thread_output = asc_thread_buffer_init(mod->slot_count * 4);
+        for(int i = 0; i < mod->thread_count; ++i)
+        {
+            mod->thread[i] = asc_thread_init(mod);
+            asc_thread_start(  mod->thread[i]
+                             , thread_loop
+                             , on_thread_read, mod->thread_output
+                             , on_thread_close);
+        }
+    }
+
+    mod->timer = asc_timer_init((latency > 20) ? (latency / 4) : 5, on_timer, mod);
 }
 
 static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
-    dvbcsa_bs_key_free(mod->key);
+    asc_timer_destroy(mod->timer);
+
+    on_thread_close(mod);
+
+    pthread_mutex_destroy(&mod->mutex);
+    pthread_cond_destroy(&mod->cond_queued);
+
+    for(int i = 0; i < mod->slot_count; ++i)
+    {
+        free(mod->slot[i].buffer);
+#if LIBDVBCSA == 1
+        free(mod->slot[i].batch);
+#endif
+    }
+    free(mod->slot);
+
+#if FFDECSA == 1
+    free_key_struct(mod->keys);
+#elif LIBDVBCSA == 1
+    dvbcsa_bs_key_free(mod->key[0]);
+    dvbcsa_bs_key_free(mod->key[1]);
+#endif
 
     mpegts_psi_destroy(mod->pat);
     mpegts_psi_destroy(mod->pmt);
@@ -194,7 +614,8 @@ static void module_destroy(module_data_t *mod)
 MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
-    MODULE_STREAM_METHODS_REF()
+    MODULE_STREAM_METHODS_REF(),
+    { "set_key", method_set_key },
 };
 
 MODULE_LUA_REGISTER(biss_encrypt)
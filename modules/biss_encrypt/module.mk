@@ -1,6 +1,21 @@
 
-if [ $LIBDVBCSA -ne 1 ] ; then
-    ERROR="libdvbcsa is not found. use --with-libdvbcsa option"
+FFDECSA=1
+
+if echo "$APP_CFLAGS" | grep -q "\-DFFDECSA=0" ; then
+    FFDECSA=0
+fi
+
+# FFdecsa is compiled with the softcam module
+if ! echo "$APP_MODULES_LIST" | grep -q "softcam$" ; then
+    FFDECSA=0
+fi
+
+if [ $FFDECSA -eq 1 ] ; then
+    CFLAGS="-DFFDECSA=1"
+elif [ $LIBDVBCSA -eq 1 ] ; then
+    CFLAGS="-DFFDECSA=0 -DLIBDVBCSA=1"
+else
+    ERROR="DVB-CSA is not found. softcam module or --with-libdvbcsa option is required"
 fi
 
 SOURCES="biss_encrypt.c"
@@ -49,6 +49,7 @@ struct module_data_t
     int dvr_fd;
     asc_event_t *dvr_event;
     uint8_t dvr_buffer[1022 * TS_PACKET_SIZE];
+    mpegts_sync_t *dvr_sync;
 
     uint32_t dvr_read;
 
@@ -131,6 +132,19 @@ static void dvr_on_error(void *arg)
     dvr_open(mod);
 }
 
+static void dvr_on_ts(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->ca->ca_fd > 0)
+        ca_on_ts(mod->ca, ts);
+
+    module_stream_send(mod, ts);
+
+    if(TS_GET_PID(ts) == 0)
+        mpegts_psi_mux(mod->pat, ts, on_pat, mod);
+}
+
 static void dvr_on_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -143,18 +157,7 @@ static void dvr_on_read(void *arg)
     }
     mod->dvr_read += len;
 
-    for(int i = 0; i < len; i += TS_PACKET_SIZE)
-    {
-        const uint8_t *ts = &mod->dvr_buffer[i];
-
-        if(mod->ca->ca_fd > 0)
-            ca_on_ts(mod->ca, ts);
-
-        module_stream_send(mod, ts);
-
-        if(TS_IS_SYNC(ts) && TS_GET_PID(ts) == 0)
-            mpegts_psi_mux(mod->pat, ts, on_pat, mod);
-    }
+    mpegts_sync_push(mod->dvr_sync, mod->dvr_buffer, len);
 }
 
 static void dvr_open(module_data_t *mod)
@@ -1003,6 +1006,7 @@ static int method_close(module_data_t *mod)
     on_thread_close(mod);
 
     ASC_FREE(mod->pat, mpegts_psi_destroy);
+    ASC_FREE(mod->dvr_sync, mpegts_sync_destroy);
     ASC_FREE(mod->fe, free);
     ASC_FREE(mod->ca, free);
     ASC_FREE(mod->status_timer, asc_timer_destroy);
@@ -1048,6 +1052,7 @@ static void module_init(module_data_t *mod)
         lua_pop(lua, 1);
 
     mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    mod->dvr_sync = mpegts_sync_init(dvr_on_ts, mod);
 
     if(!mod->no_dvr)
     {
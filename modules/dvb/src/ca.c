@@ -376,6 +376,12 @@ static uint16_t ca_pmt_copy_desc(  const uint8_t *src, uint16_t size, uint8_t *d
     }
 }
 
+static void ca_pmt_destroy(ca_pmt_t *ca_pmt)
+{
+    mpegts_psi_destroy(ca_pmt->psi);
+    free(ca_pmt);
+}
+
 static bool ca_pmt_build(  dvb_ca_t *ca, ca_pmt_t *ca_pmt
                          , uint8_t slot_id, uint8_t session_id
                          , uint8_t list_manage, uint8_t cmd)
@@ -1598,14 +1604,14 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         ca_pmt->pnr = pnr;
         ca_pmt->buffer_size = 0;
         ca_pmt->psi = mpegts_psi_init(MPEGTS_PACKET_PMT, psi->pid);
-        memcpy(ca_pmt->psi, psi, sizeof(mpegts_psi_t));
+        mpegts_psi_copy(ca_pmt->psi, psi);
 
         asc_list_for(ca->ca_pmt_list_new)
         {
             ca_pmt_t *ca_pmt_check = (ca_pmt_t *)asc_list_data(ca->ca_pmt_list_new);
             if(ca_pmt_check->pnr == pnr)
             {
-                free(ca_pmt_check);
+                ca_pmt_destroy(ca_pmt_check);
                 asc_list_remove_current(ca->ca_pmt_list_new);
                 break;
             }
@@ -1803,7 +1809,7 @@ void ca_close(dvb_ca_t *ca)
             ; !asc_list_eol(ca->ca_pmt_list)
             ; asc_list_first(ca->ca_pmt_list))
         {
-            free(asc_list_data(ca->ca_pmt_list));
+            ca_pmt_destroy((ca_pmt_t *)asc_list_data(ca->ca_pmt_list));
             asc_list_remove_current(ca->ca_pmt_list);
         }
         asc_list_destroy(ca->ca_pmt_list);
@@ -1816,7 +1822,7 @@ void ca_close(dvb_ca_t *ca)
             ; !asc_list_eol(ca->ca_pmt_list_new)
             ; asc_list_first(ca->ca_pmt_list_new))
         {
-            free(asc_list_data(ca->ca_pmt_list_new));
+            ca_pmt_destroy((ca_pmt_t *)asc_list_data(ca->ca_pmt_list_new));
             asc_list_remove_current(ca->ca_pmt_list_new);
         }
 
@@ -1919,7 +1925,10 @@ void ca_loop(dvb_ca_t *ca, int is_data)
             }
 
             if(ca_pmt)
+            {
                 ca_pmt_send_one(ca, ca_pmt, CA_PMT_LM_UPDATE, CA_PMT_CMD_NOT_SELECTED);
+                ca_pmt_destroy(ca_pmt);
+            }
 
             pthread_mutex_unlock(&ca->ca_mutex);
         }
@@ -1956,7 +1965,7 @@ void ca_loop(dvb_ca_t *ca, int is_data)
                 if(ca_pmt_current->pnr == ca_pmt->pnr)
                 {
                     is_update = true;
-                    free(ca_pmt_current);
+                    ca_pmt_destroy(ca_pmt_current);
                     asc_list_remove_current(ca->ca_pmt_list);
                     break;
                 }
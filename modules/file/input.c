@@ -26,15 +26,54 @@
  *      filename    - string, input file name
  *      lock        - string, lock file name (to store reading position)
  *      loop        - boolean, if true play a file in an infinite loop
+ *      start       - number, start position in seconds
  *      callback    - function, call function on EOF, without parameters
+ *      check_length
+ *                  - boolean, only get the file length with length().
+ *                    for the TS file the length is known if the index is cached
+ *
+ * Module Methods:
+ *      length()    - return file length in seconds
+ *      seek(pos)   - continue playing from the position in seconds
+ *
+ * File is mapped to the memory. Positions of the PCR are collected once
+ * and cached in the "<filename>.pcr", the cache is rebuilt if the file
+ * size or modification time is changed. The packets between two PCR
+ * are passed to the stream as one block at the time of the first PCR.
  */
 
 #include <astra.h>
 
+#ifndef _WIN32
+#   include <sys/mman.h>
+#endif
+
 #define MSG(_msg) "[file_input %s] " _msg, mod->filename
 
 #define INPUT_BUFFER_SIZE 2
 
+#define INPUT_CHUNK (256 * TS_PACKET_SIZE)
+#define INPUT_MAX_BLOCK_TIME 500000 /* us */
+
+#define INDEX_MAGIC "ASTRAPCR"
+#define INDEX_VERSION 1
+
+typedef struct
+{
+    uint64_t offset;
+    uint64_t time; /* us from the first PCR */
+} input_index_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t packet_size;
+    uint64_t file_size;
+    uint64_t mtime;
+    uint64_t count;
+} input_index_header_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -47,66 +86,203 @@ struct module_data_t
     int idx_callback;
     size_t file_size;
     size_t file_skip; // file position
+    const uint8_t *data;
 
     uint8_t m2ts_header;
+    uint8_t packet_size; /* 188, 192 - M2TS, 204 - with Reed-Solomon parity */
     uint32_t start_time;
     uint32_t length;
 
     bool is_eof;
+    bool is_stopped;
+    int64_t seek_time; /* us, -1 if not defined */
 
     asc_timer_t *timer_skip;
 
     asc_thread_t *thread;
     asc_thread_buffer_t *thread_output;
-
+    size_t buffer_size;
     uint32_t overflow;
-    uint8_t *buffer;
-    uint32_t buffer_size;
-    uint32_t buffer_skip;
-    uint32_t buffer_end;
 
-    uint64_t pcr;
-    uint16_t pcr_pid;
+    input_index_t *index_list;
+    size_t index_count;
 };
 
 /* module code */
 
-static bool seek_pcr(module_data_t *mod, size_t *block_size, uint64_t *pcr)
+static inline uint32_t m2ts_time(const uint8_t *ts)
 {
-    const uint8_t packet_size = mod->m2ts_header + TS_PACKET_SIZE;
-    size_t count = mod->buffer_skip + packet_size;
+    return (ts[0] << 24) | (ts[1] << 16) | (ts[2] << 8) | (ts[3]);
+}
 
-    while(count < mod->buffer_end)
+static void close_file(module_data_t *mod)
+{
+    if(mod->data)
     {
-        const uint8_t *ts = &mod->buffer[mod->m2ts_header + count];
+#ifndef _WIN32
+        munmap((void *)mod->data, mod->file_size);
+#else
+        free((void *)mod->data);
+#endif
+        mod->data = NULL;
+    }
+
+    if(mod->fd > 0)
+    {
+        close(mod->fd);
+        mod->fd = 0;
+    }
+
+    ASC_FREE(mod->index_list, free);
+    mod->index_count = 0;
+}
+
+static bool index_load(module_data_t *mod, const char *filename, const struct stat *sb)
+{
+    const int fd = open(filename, O_RDONLY | O_BINARY);
+    if(fd == -1)
+        return false;
+
+    input_index_header_t header;
+    bool is_valid = (read(fd, &header, sizeof(header)) == sizeof(header))
+                 && !memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic))
+                 && header.version == INDEX_VERSION
+                 && header.packet_size == mod->packet_size
+                 && header.file_size == (uint64_t)sb->st_size
+                 && header.mtime == (uint64_t)sb->st_mtime
+                 && header.count >= 2
+                 && header.count <= mod->file_size / mod->packet_size;
+
+    if(is_valid)
+    {
+        const size_t size = header.count * sizeof(input_index_t);
+        mod->index_list = (input_index_t *)malloc(size);
+        is_valid = (read(fd, mod->index_list, size) == (ssize_t)size);
+        if(is_valid)
+            mod->index_count = header.count;
+        else
+            ASC_FREE(mod->index_list, free);
+    }
+
+    close(fd);
+    return is_valid;
+}
+
+static void index_save(module_data_t *mod, const char *filename, const struct stat *sb)
+{
+    char tmp_filename[PATH_MAX];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.part", filename);
+
+    const int fd = open(tmp_filename, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY
+#ifndef _WIN32
+                        , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+#else
+                        , S_IRUSR | S_IWUSR);
+#endif
+    if(fd == -1)
+    {
+        asc_log_debug(MSG("failed to save PCR index [%s]"), strerror(errno));
+        return;
+    }
+
+    input_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.packet_size = mod->packet_size;
+    header.file_size = sb->st_size;
+    header.mtime = sb->st_mtime;
+    header.count = mod->index_count;
+
+    const size_t size = mod->index_count * sizeof(input_index_t);
+    const bool is_saved = (write(fd, &header, sizeof(header)) == sizeof(header))
+                       && (write(fd, mod->index_list, size) == (ssize_t)size);
+    close(fd);
+
+    if(!is_saved || rename(tmp_filename, filename) != 0)
+    {
+        asc_log_debug(MSG("failed to save PCR index [%s]"), strerror(errno));
+        unlink(tmp_filename);
+    }
+}
+
+/* position and time of the each PCR on the first PCR PID */
+static void index_build(module_data_t *mod, size_t skip)
+{
+    size_t index_size = 0;
+    uint16_t pcr_pid = 0;
+    uint64_t pcr_last = 0;
+    uint64_t time = 0;
+
+    const size_t packet_size = mod->packet_size;
+    while(skip + packet_size <= mod->file_size)
+    {
+        const uint8_t *ts = &mod->data[skip + mod->m2ts_header];
+        if(ts[0] != 0x47)
+        {
+            /* resync on the damaged data */
+            const size_t sync = mpegts_sync_find(  &mod->data[skip + mod->m2ts_header]
+                                                 , mod->file_size - skip - mod->m2ts_header
+                                                 , packet_size);
+            skip += (sync > 0) ? sync : 1;
+            continue;
+        }
+
         if(TS_IS_PCR(ts))
         {
             const uint16_t pid = TS_GET_PID(ts);
-            if(mod->pcr_pid == 0)
-                mod->pcr_pid = pid;
+            if(pcr_pid == 0)
+                pcr_pid = pid;
 
-            if(mod->pcr_pid == pid)
+            if(pcr_pid == pid)
             {
-                *pcr = TS_GET_PCR(ts);
-                *block_size = count - mod->buffer_skip;
-                return true;
+                const uint64_t pcr = TS_GET_PCR(ts);
+                if(mod->index_count > 0)
+                {
+                    /* discontinuity is passed without delay */
+                    const uint64_t block_time = mpegts_pcr_block_us(&pcr_last, &pcr);
+                    if(block_time <= INPUT_MAX_BLOCK_TIME)
+                        time += block_time;
+                }
+                pcr_last = pcr;
+
+                if(mod->index_count == index_size)
+                {
+                    index_size = (index_size) ? (index_size * 2) : 4096;
+                    mod->index_list = (input_index_t *)realloc(
+                        mod->index_list, index_size * sizeof(input_index_t));
+                }
+
+                input_index_t *item = &mod->index_list[mod->index_count];
+                item->offset = skip;
+                item->time = time;
+                ++mod->index_count;
             }
         }
-        count += packet_size;
+
+        skip += packet_size;
     }
 
-    return false;
-}
+    /* the last block is completed by the end of file */
+    if(mod->index_count > 0 && mod->index_list[mod->index_count - 1].offset < skip)
+    {
+        if(mod->index_count == index_size)
+        {
+            mod->index_list = (input_index_t *)realloc(
+                mod->index_list, (index_size + 1) * sizeof(input_index_t));
+        }
 
-static inline uint32_t m2ts_time(const uint8_t *ts)
-{
-    return (ts[0] << 24) | (ts[1] << 16) | (ts[2] << 8) | (ts[3]);
+        input_index_t *item = &mod->index_list[mod->index_count];
+        item->offset = skip;
+        item->time = time;
+        ++mod->index_count;
+    }
 }
 
-static bool open_file(module_data_t *mod)
+/* without is_index the PCR index is loaded from the cache only */
+static bool open_file(module_data_t *mod, bool is_index)
 {
-    if(mod->fd)
-        close(mod->fd);
+    close_file(mod);
 
     mod->fd = open(mod->filename, O_RDONLY | O_BINARY);
     if(mod->fd <= 0)
@@ -119,54 +295,81 @@ static bool open_file(module_data_t *mod)
     fstat(mod->fd, &sb);
     mod->file_size = sb.st_size;
 
-    if(mod->file_skip)
+    if(mod->file_size < TS_PACKET_SIZE * MPEGTS_SYNC_DEPTH)
     {
-        if(mod->file_skip >= mod->file_size)
-        {
-            asc_log_warning(MSG("skip value is greater than the file size"));
-            mod->file_skip = 0;
-        }
+        asc_log_error(MSG("wrong file format"));
+        close_file(mod);
+        return false;
     }
 
-    const ssize_t len = pread(mod->fd, mod->buffer, mod->buffer_size, mod->file_skip);
-    if(len < 0)
+#ifndef _WIN32
+    void *data = mmap(NULL, mod->file_size, PROT_READ, MAP_SHARED, mod->fd, 0);
+    if(data == MAP_FAILED)
+    {
+        asc_log_error(MSG("failed to map file [%s]"), strerror(errno));
+        close_file(mod);
+        return false;
+    }
+    madvise(data, mod->file_size, MADV_SEQUENTIAL);
+    mod->data = (const uint8_t *)data;
+#else
+    uint8_t *data = (uint8_t *)malloc(mod->file_size);
+    mod->data = data;
+    if(pread(mod->fd, data, mod->file_size, 0) != (ssize_t)mod->file_size)
     {
         asc_log_error(MSG("failed to read file"));
-        close(mod->fd);
-        mod->fd = 0;
+        close_file(mod);
         return false;
     }
-    mod->buffer_end = len;
+#endif
 
-    if(mod->buffer[0] == 0x47 && mod->buffer[TS_PACKET_SIZE] == 0x47)
-        mod->m2ts_header = 0;
-    else if(mod->buffer[4] == 0x47 && mod->buffer[4 + M2TS_PACKET_SIZE] == 0x47)
-        mod->m2ts_header = 4;
-    else
+    const size_t check_size = (mod->file_size < mod->buffer_size)
+                            ? mod->file_size
+                            : mod->buffer_size;
+
+    size_t packet_size;
+    size_t frame_skip = mpegts_sync_detect(mod->data, check_size, &packet_size);
+    if(!packet_size)
     {
         asc_log_error(MSG("wrong file format"));
-        close(mod->fd);
-        mod->fd = 0;
+        close_file(mod);
         return false;
     }
 
-    size_t block_size = 0;
-    if(!seek_pcr(mod, &block_size, &mod->pcr))
+    mod->packet_size = packet_size;
+    mod->m2ts_header = (packet_size == M2TS_PACKET_SIZE) ? 4 : 0;
+
+    /* begin of the first frame */
+    if(frame_skip >= mod->m2ts_header)
+        frame_skip -= mod->m2ts_header;
+    else
+        frame_skip += packet_size - mod->m2ts_header;
+
+    if(frame_skip > 0)
+        asc_log_debug(MSG("skip %zu bytes before the first packet"), frame_skip);
+
+    char index_filename[PATH_MAX];
+    snprintf(index_filename, sizeof(index_filename), "%s.pcr", mod->filename);
+    if(!index_load(mod, index_filename, &sb) && is_index)
+    {
+        index_build(mod, frame_skip);
+        if(mod->index_count >= 2)
+            index_save(mod, index_filename, &sb);
+    }
+
+    if(is_index && mod->index_count < 2)
     {
         asc_log_error(MSG("first PCR is not found"));
-        close(mod->fd);
-        mod->fd = 0;
+        close_file(mod);
         return false;
     }
 
     if(mod->m2ts_header == 4)
     {
-        mod->start_time = m2ts_time(mod->buffer) / 1000;
+        mod->start_time = m2ts_time(&mod->data[frame_skip]) / 1000;
 
-        uint8_t tail[M2TS_PACKET_SIZE];
-        const ssize_t len = pread(  mod->fd, tail, M2TS_PACKET_SIZE
-                                  , mod->file_size - M2TS_PACKET_SIZE);
-        if(len != M2TS_PACKET_SIZE || tail[4] != 0x47)
+        const uint8_t *tail = &mod->data[mod->file_size - M2TS_PACKET_SIZE];
+        if(tail[4] != 0x47)
         {
             asc_log_warning(MSG("failed to get M2TS file length"));
         }
@@ -176,130 +379,142 @@ static bool open_file(module_data_t *mod)
             mod->length = stop_time - mod->start_time;
         }
     }
-
-    mod->buffer_skip = block_size;
+    else if(mod->index_count >= 2)
+    {
+        mod->length = mod->index_list[mod->index_count - 1].time / 1000000;
+    }
 
     return true;
 }
 
-static void thread_loop(void *arg)
+/* the first block at the time, the end of file if time is out of range */
+static size_t index_find_time(module_data_t *mod, uint64_t time)
 {
-    module_data_t *mod = (module_data_t *)arg;
-
-    // block sync
-    uint64_t   pcr
-             , system_time, system_time_check
-             , block_time, block_time_total = 0;
-    size_t block_size = 0;
-
-    bool reset = true;
+    size_t lo = 0;
+    size_t hi = mod->index_count - 1;
+    while(lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if(mod->index_list[mid].time < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
 
-    if(!open_file(mod))
+/* the first block after the file position */
+static size_t index_find_offset(module_data_t *mod, uint64_t offset)
+{
+    size_t lo = 0;
+    size_t hi = mod->index_count - 1;
+    while(lo < hi)
     {
-        mod->is_eof = true;
-        return;
+        const size_t mid = (lo + hi) / 2;
+        if(mod->index_list[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    while(mod->fd > 0)
+    if(lo < mod->index_count - 1)
+        return lo;
+
+    asc_log_warning(MSG("skip value is greater than the file size"));
+    return 0;
+}
+
+static void send_block(module_data_t *mod, size_t skip, size_t end)
+{
+    uint8_t buffer[INPUT_CHUNK];
+    size_t buffer_size = 0;
+
+    const size_t packet_size = mod->packet_size;
+    for(; skip + packet_size <= end; skip += packet_size)
     {
-        if(reset)
-        {
-            reset = false;
-            block_time_total = asc_utime();
-        }
+        const uint8_t *ts = &mod->data[skip + mod->m2ts_header];
+        if(ts[0] != 0x47)
+            continue;
 
-        if(!seek_pcr(mod, &block_size, &pcr))
+        memcpy(&buffer[buffer_size], ts, TS_PACKET_SIZE);
+        buffer_size += TS_PACKET_SIZE;
+
+        if(buffer_size == sizeof(buffer))
         {
-            // try to load data
-            mod->file_skip += mod->buffer_skip;
-            const ssize_t len = pread(mod->fd, mod->buffer, mod->buffer_size, mod->file_skip);
-            mod->buffer_end = (len > 0) ? len : 0;
-            mod->buffer_skip = 0;
-            if(!seek_pcr(mod, &block_size, &pcr))
-            {
-                if(!mod->loop)
-                {
-                    mod->is_eof = true;
-                    return;
-                }
-                else
-                {
-                    mod->file_skip = 0;
-                    if(!open_file(mod))
-                    {
-                        mod->is_eof = true;
-                        return;
-                    }
-                    reset = true;
-                    continue;
-                }
-            }
+            if(asc_thread_buffer_write(mod->thread_output, buffer, buffer_size) == -1)
+                ++mod->overflow;
+            buffer_size = 0;
         }
+    }
 
-        // get PCR
-        block_time = mpegts_pcr_block_us(&mod->pcr, &pcr);
-        if(block_time == 0 || block_time > 500000)
-        {
-            asc_log_error(  MSG("block time out of range: %"PRIu64"ms block_size:%lu")
-                          , (uint64_t)(block_time / 1000), block_size);
-            mod->buffer_skip += block_size;
+    if(buffer_size > 0)
+    {
+        if(asc_thread_buffer_write(mod->thread_output, buffer, buffer_size) == -1)
+            ++mod->overflow;
+    }
+}
 
-            reset = true;
-            continue;
-        }
+static void thread_loop(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
 
-        system_time = asc_utime();
-        if(block_time_total > system_time + 100)
-            asc_usleep(block_time_total - system_time);
+    if(!open_file(mod, true))
+    {
+        mod->is_eof = true;
+        return;
+    }
 
-        const uint32_t ts_count = block_size / (mod->m2ts_header + TS_PACKET_SIZE);
-        const uint32_t ts_sync = block_time / ts_count;
-        const uint32_t block_time_tail = block_time % ts_count;
+    size_t i = index_find_offset(mod, mod->file_skip);
+    /* system time of the file start */
+    uint64_t time_base = asc_clock_fast() - mod->index_list[i].time;
 
-        system_time_check = asc_utime();
+    while(!__atomic_load_n(&mod->is_stopped, __ATOMIC_ACQUIRE))
+    {
+        const int64_t seek_time = __atomic_exchange_n(&mod->seek_time, -1, __ATOMIC_ACQ_REL);
+        if(seek_time >= 0)
+        {
+            i = index_find_time(mod, seek_time);
+            time_base = asc_clock_fast() - mod->index_list[i].time;
+        }
 
-        const size_t block_end = mod->buffer_skip + block_size;
-        while(mod->fd > 0 && mod->buffer_skip < block_end)
+        if(i + 1 >= mod->index_count)
         {
-            // send
-            mod->buffer_skip += mod->m2ts_header;
-            if(TS_PACKET_SIZE != asc_thread_buffer_write(  mod->thread_output
-                                                         , &mod->buffer[mod->buffer_skip]
-                                                         , TS_PACKET_SIZE))
+            if(!mod->loop)
             {
-                ;
+                mod->is_eof = true;
+                return;
             }
-            mod->buffer_skip += TS_PACKET_SIZE;
 
-            system_time = asc_utime();
-            block_time_total += ts_sync;
-
-            if(  (system_time < system_time_check) /* <-0s */
-               ||(system_time > system_time_check + 1000000)) /* >+1s */
+            mod->file_skip = 0;
+            if(!open_file(mod, true))
             {
-                asc_log_warning(MSG("system time changed"));
-                mod->buffer_skip = block_end;
-                reset = true;
-                break;
+                mod->is_eof = true;
+                return;
             }
-            system_time_check = system_time;
 
-            if(block_time_total > system_time + 100)
-                asc_usleep(block_time_total - system_time);
+            i = 0;
+            time_base = asc_clock_fast();
+            continue;
         }
 
-        if(reset)
-            continue;
+        const input_index_t *item = &mod->index_list[i];
+        const uint64_t block_time = time_base + item->time;
 
-        system_time = asc_utime();
-        if(system_time > block_time_total + 100000)
+        const uint64_t system_time = asc_clock_fast();
+        if(block_time > system_time + 100)
+        {
+            asc_usleep(block_time - system_time);
+        }
+        else if(system_time > block_time + 100000)
         {
             asc_log_warning(  MSG("wrong syncing time. -%"PRIu64"ms")
-                            , (system_time - block_time_total) / 1000);
-            reset = true;
+                            , (system_time - block_time) / 1000);
+            time_base = system_time - item->time;
         }
 
-        block_time_total += block_time_tail;
+        send_block(mod, item->offset, item[1].offset);
+        mod->file_skip = item[1].offset;
+        ++i;
     }
 }
 
@@ -307,15 +522,14 @@ static void on_thread_close(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    if(mod->fd > 0)
-    {
-        close(mod->fd);
-        mod->fd = 0;
-    }
+    /* file is mapped until the thread is stopped */
+    __atomic_store_n(&mod->is_stopped, true, __ATOMIC_RELEASE);
 
     ASC_FREE(mod->thread, asc_thread_destroy);
     ASC_FREE(mod->thread_output, asc_thread_buffer_destroy);
 
+    close_file(mod);
+
     if(mod->is_eof && mod->idx_callback)
     {
         lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
@@ -327,12 +541,14 @@ static void on_thread_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    uint8_t ts[TS_PACKET_SIZE];
-    const ssize_t r = asc_thread_buffer_read(mod->thread_output, ts, TS_PACKET_SIZE);
-    if(r != TS_PACKET_SIZE)
-        return;
-
-    module_stream_send(mod, ts);
+    uint8_t buffer[INPUT_CHUNK];
+    ssize_t size;
+    do
+    {
+        size = asc_thread_buffer_read(mod->thread_output, buffer, sizeof(buffer));
+        for(ssize_t skip = 0; skip < size; skip += TS_PACKET_SIZE)
+            module_stream_send(mod, &buffer[skip]);
+    } while(size == sizeof(buffer));
 }
 
 static void timer_skip_set(void *arg)
@@ -363,6 +579,14 @@ static int method_length(module_data_t *mod)
     return 1;
 }
 
+static int method_seek(module_data_t *mod)
+{
+    const double position = luaL_checknumber(lua, 2);
+    const int64_t seek_time = (position > 0) ? (int64_t)(position * 1000000) : 0;
+    __atomic_store_n(&mod->seek_time, seek_time, __ATOMIC_RELEASE);
+    return 0;
+}
+
 /* required */
 
 static void module_init(module_data_t *mod)
@@ -373,23 +597,26 @@ static void module_init(module_data_t *mod)
     if(!module_option_number("buffer_size", &buffer_size) || buffer_size <= 0)
         buffer_size = INPUT_BUFFER_SIZE;
     mod->buffer_size = buffer_size * 1024 * 1024;
-    mod->buffer = malloc(mod->buffer_size);
 
+    mod->seek_time = -1;
+
+    /* the file is not scanned on the main loop, length of the TS file
+     * is known only if the PCR index is cached */
     bool check_length;
     if(module_option_boolean("check_length", &check_length) && check_length)
     {
-        open_file(mod);
-        if(mod->fd > 0)
-        {
-            close(mod->fd);
-            mod->fd = 0;
-        }
+        open_file(mod, false);
+        close_file(mod);
         return;
     }
 
     module_option_string("lock", &mod->lock, NULL);
     module_option_boolean("loop", &mod->loop);
 
+    int start = 0;
+    if(module_option_number("start", &start) && start > 0)
+        mod->seek_time = (int64_t)start * 1000000;
+
     // store callback in registry
     lua_getfield(lua, 2, "callback");
     if(lua_type(lua, -1) == LUA_TFUNCTION)
@@ -428,8 +655,6 @@ static void module_destroy(module_data_t *mod)
     if(mod->thread)
         on_thread_close(mod);
 
-    ASC_FREE(mod->buffer, free);
-
     if(mod->idx_callback)
     {
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
@@ -443,7 +668,8 @@ MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
     MODULE_STREAM_METHODS_REF(),
-    { "length", method_length }
+    { "length", method_length },
+    { "seek", method_seek }
 };
 
 MODULE_LUA_REGISTER(file_input)
@@ -1,5 +1,5 @@
-SOURCES="input.c output.c"
-MODULES="file_input file_output"
+SOURCES="input.c output.c recorder.c"
+MODULES="file_input file_output file_recorder"
 
 posix_memalign_test_c()
 {
@@ -0,0 +1,798 @@
+/*
+ * Astra Module: File Recorder
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      file_recorder
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name
+ *      filename    - string, strftime() format of the file name
+ *      duration    - number, file duration in seconds [default : 3600]
+ *                    0 - no limit
+ *      size        - number, max file size in megabytes [default : 0]
+ *                    0 - no limit
+ *      buffer_size - number, write block size in kilobytes [default : 188]
+ *      directio    - boolean, try to avoid all caching operations [default : false]
+ *      disk        - string, name of the writer thread [default : "default"]
+ *
+ * Module Methods:
+ *      status      - return table with items:
+ *                    filename      - string, current file name
+ *                    size          - number, current file size
+ *                    dropped       - number, bytes dropped due to the busy writer
+ *                    queue         - number, blocks in the writer queue
+ *                    latency       - number, last write time in milliseconds
+ *                    latency_max   - number, max write time in milliseconds
+ *
+ * Recordings with the same "disk" share one writer thread. The main loop
+ * fills the write blocks and queues them to the writer, the stream is
+ * never held by the disk: if all blocks of the instance are queued, data
+ * is dropped. Files are written with the ".part" suffix and renamed when
+ * completed. File is changed at the keyframe of the first video stream
+ * (at the PES start of the other stream if the program has no video,
+ * frame types are reused from the channel with es_index) and begins with PAT and PMT. The sidecar "<file>.idx" has a line for the
+ * each keyframe: byte offset, PCR (-1 if not found) and unix time.
+ */
+
+#include <astra.h>
+#include <pthread.h>
+
+#define MSG(_msg) "[file_recorder %s] " _msg, mod->config.name
+
+/* write block is aligned for O_DIRECT and has whole number of packets */
+#define BLOCK_UNIT (1024 * TS_PACKET_SIZE)
+#define BLOCK_COUNT 4
+
+#define ALIGN 4096
+#define align_up(_size) (((_size) + ALIGN - 1) / ALIGN * ALIGN)
+
+typedef struct
+{
+    uint64_t offset;
+    int64_t pcr;
+    uint64_t time; /* ms */
+} recorder_index_t;
+
+/* owned by the main loop until the close job is queued */
+typedef struct
+{
+    char *filename;
+    int fd;
+    bool is_directio;
+    uint64_t size; /* written by the writer */
+
+    recorder_index_t *index_list;
+    size_t index_size;
+    size_t index_count;
+} recorder_file_t;
+
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    bool is_queued;
+} recorder_block_t;
+
+typedef struct recorder_job_t recorder_job_t;
+
+/* block write, or the file close if block is not defined */
+struct recorder_job_t
+{
+    recorder_job_t *next;
+    module_data_t *mod;
+    recorder_file_t *file;
+    recorder_block_t *block;
+    int error;
+};
+
+typedef struct
+{
+    char *disk;
+    int refcount;
+
+    asc_thread_t *thread;
+    bool is_started;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_queued;
+    pthread_cond_t cond_done;
+
+    recorder_job_t *queue_head;
+    recorder_job_t *queue_tail;
+    int queue_count;
+
+    uint64_t latency;
+    uint64_t latency_max;
+} recorder_writer_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *name;
+        const char *filename;
+        uint64_t duration;
+        uint64_t size;
+        size_t block_size;
+        bool directio;
+    } config;
+
+    recorder_writer_t *writer;
+
+    /* writer state, protected by the writer mutex */
+    int job_count;
+    int write_error;
+
+    recorder_block_t block_list[BLOCK_COUNT];
+    recorder_block_t *block;
+    uint64_t block_id;
+
+    recorder_file_t *file;
+    uint64_t file_size;
+    time_t file_time;
+    char filename[PATH_MAX];
+
+    uint64_t dropped;
+    bool is_dropped;
+
+    /* input */
+    mpegts_es_track_t *track;
+    uint16_t pcr_pid;
+    int64_t pcr;
+
+    /* last PES start of es_pid */
+    uint64_t pes_block_id;
+    size_t pes_skip;
+    uint64_t pes_offset;
+
+    /* tables at the start of the each file */
+    mpegts_psi_t *out_pat;
+    mpegts_psi_t *out_pmt;
+    mpegts_carousel_t *carousel;
+};
+
+static asc_list_t *writer_list = NULL;
+
+/* writer thread */
+
+static void file_open(recorder_job_t *job)
+{
+    recorder_file_t *file = job->file;
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s.part", file->filename);
+
+    int flags = O_CREAT | O_TRUNC | O_WRONLY | O_BINARY;
+    const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+#ifdef O_DIRECT
+    if(file->is_directio)
+    {
+        file->fd = open(filename, flags | O_DIRECT, mode);
+        if(file->fd != -1)
+            return;
+
+        /* filesystem without O_DIRECT support */
+        file->is_directio = false;
+    }
+#endif
+
+    file->fd = open(filename, flags, mode);
+    if(file->fd == -1)
+        job->error = errno;
+}
+
+static void file_write(recorder_job_t *job)
+{
+    recorder_file_t *file = job->file;
+    recorder_block_t *block = job->block;
+
+    if(file->fd == -1)
+        return;
+
+    size_t size = block->size;
+    if(file->is_directio && (size % ALIGN) != 0)
+    {
+        /* the last block of the file. tail is removed by file_close() */
+        const size_t tail = align_up(size) - size;
+        memset(&block->buffer[size], 0, tail);
+        size += tail;
+    }
+
+    if(pwrite(file->fd, block->buffer, size, file->size) != (ssize_t)size)
+        job->error = errno;
+
+    file->size += block->size;
+}
+
+static void file_close(recorder_job_t *job)
+{
+    recorder_file_t *file = job->file;
+    char filename[PATH_MAX];
+
+    if(file->fd != -1)
+    {
+        if(file->is_directio && ftruncate(file->fd, file->size) != 0)
+            job->error = errno;
+        close(file->fd);
+
+        snprintf(filename, sizeof(filename), "%s.part", file->filename);
+        if(rename(filename, file->filename) != 0)
+            job->error = errno;
+    }
+
+    if(file->index_count > 0)
+    {
+        snprintf(filename, sizeof(filename), "%s.idx.part", file->filename);
+        FILE *fp = fopen(filename, "w");
+        if(fp)
+        {
+            for(size_t i = 0; i < file->index_count; ++i)
+            {
+                const recorder_index_t *item = &file->index_list[i];
+                fprintf(fp, "%llu %lld %llu.%03u\n"
+                        , (unsigned long long)item->offset
+                        , (long long)item->pcr
+                        , (unsigned long long)(item->time / 1000)
+                        , (unsigned int)(item->time % 1000));
+            }
+            fclose(fp);
+
+            char idx_filename[PATH_MAX];
+            snprintf(idx_filename, sizeof(idx_filename), "%s.idx", file->filename);
+            if(rename(filename, idx_filename) != 0)
+                job->error = errno;
+        }
+        else
+            job->error = errno;
+    }
+
+    free(file->index_list);
+    free(file->filename);
+    free(file);
+}
+
+static void job_run(recorder_job_t *job)
+{
+    if(job->block)
+    {
+        if(job->file->fd == -1 && job->file->size == 0)
+            file_open(job);
+        file_write(job);
+    }
+    else
+        file_close(job);
+}
+
+static void job_done(recorder_job_t *job)
+{
+    if(job->block)
+        job->block->is_queued = false;
+    if(job->error)
+        job->mod->write_error = job->error;
+    --job->mod->job_count;
+    free(job);
+}
+
+static void writer_loop(void *arg)
+{
+    recorder_writer_t *writer = (recorder_writer_t *)arg;
+
+    pthread_mutex_lock(&writer->mutex);
+    /* queue is completed before exit */
+    while(writer->is_started || writer->queue_head)
+    {
+        recorder_job_t *job = writer->queue_head;
+        if(!job)
+        {
+            pthread_cond_wait(&writer->cond_queued, &writer->mutex);
+            continue;
+        }
+
+        writer->queue_head = job->next;
+        if(!writer->queue_head)
+            writer->queue_tail = NULL;
+        --writer->queue_count;
+        pthread_mutex_unlock(&writer->mutex);
+
+        const uint64_t start_time = asc_utime();
+        job_run(job);
+        const uint64_t latency = asc_utime() - start_time;
+
+        pthread_mutex_lock(&writer->mutex);
+        if(job->block)
+        {
+            writer->latency = latency;
+            if(latency > writer->latency_max)
+                writer->latency_max = latency;
+        }
+        job_done(job);
+        pthread_cond_broadcast(&writer->cond_done);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+static void on_writer_close(void *arg)
+{
+    recorder_writer_t *writer = (recorder_writer_t *)arg;
+
+    if(!writer->thread)
+        return;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->is_started = false;
+    pthread_cond_broadcast(&writer->cond_queued);
+    pthread_mutex_unlock(&writer->mutex);
+
+    ASC_FREE(writer->thread, asc_thread_destroy);
+}
+
+static recorder_writer_t * writer_attach(const char *disk)
+{
+    if(!writer_list)
+        writer_list = asc_list_init();
+
+    asc_list_for(writer_list)
+    {
+        recorder_writer_t *writer = (recorder_writer_t *)asc_list_data(writer_list);
+        if(!strcmp(writer->disk, disk))
+        {
+            ++writer->refcount;
+            return writer;
+        }
+    }
+
+    recorder_writer_t *writer = (recorder_writer_t *)calloc(1, sizeof(recorder_writer_t));
+    writer->disk = strdup(disk);
+    writer->refcount = 1;
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond_queued, NULL);
+    pthread_cond_init(&writer->cond_done, NULL);
+
+    writer->is_started = true;
+    writer->thread = asc_thread_init(writer);
+    asc_thread_start(writer->thread, writer_loop, NULL, NULL, on_writer_close);
+
+    asc_list_insert_tail(writer_list, writer);
+
+    return writer;
+}
+
+static void writer_detach(recorder_writer_t *writer)
+{
+    --writer->refcount;
+    if(writer->refcount > 0)
+        return;
+
+    on_writer_close(writer);
+
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->cond_queued);
+    pthread_cond_destroy(&writer->cond_done);
+
+    asc_list_remove_item(writer_list, writer);
+    free(writer->disk);
+    free(writer);
+
+    if(asc_list_size(writer_list) == 0)
+    {
+        asc_list_destroy(writer_list);
+        writer_list = NULL;
+    }
+}
+
+/* main loop */
+
+static void job_submit(module_data_t *mod, recorder_block_t *block)
+{
+    recorder_writer_t *writer = mod->writer;
+
+    recorder_job_t *job = (recorder_job_t *)calloc(1, sizeof(recorder_job_t));
+    job->mod = mod;
+    job->file = mod->file;
+    job->block = block;
+
+    pthread_mutex_lock(&writer->mutex);
+    ++mod->job_count;
+    if(block)
+        block->is_queued = true;
+
+    if(!writer->is_started)
+    {
+        /* writer is stopped on exit */
+        job_run(job);
+        job_done(job);
+    }
+    else
+    {
+        if(writer->queue_tail)
+            writer->queue_tail->next = job;
+        else
+            writer->queue_head = job;
+        writer->queue_tail = job;
+        ++writer->queue_count;
+        pthread_cond_signal(&writer->cond_queued);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+static recorder_block_t * block_next(module_data_t *mod)
+{
+    recorder_block_t *block = NULL;
+
+    pthread_mutex_lock(&mod->writer->mutex);
+    for(int i = 0; i < BLOCK_COUNT; ++i)
+    {
+        if(!mod->block_list[i].is_queued)
+        {
+            block = &mod->block_list[i];
+            break;
+        }
+    }
+    const int write_error = mod->write_error;
+    mod->write_error = 0;
+    pthread_mutex_unlock(&mod->writer->mutex);
+
+    if(write_error)
+        asc_log_error(MSG("write error: %s"), strerror(write_error));
+
+    if(block)
+    {
+        block->size = 0;
+        ++mod->block_id;
+        if(mod->is_dropped)
+        {
+            asc_log_warning(MSG("writer is restored, %llu bytes dropped")
+                            , (unsigned long long)mod->dropped);
+            mod->is_dropped = false;
+        }
+    }
+    else if(!mod->is_dropped)
+    {
+        asc_log_error(MSG("writer is busy, data dropped"));
+        mod->is_dropped = true;
+    }
+
+    return block;
+}
+
+static void block_append(module_data_t *mod, const uint8_t *ts)
+{
+    if(!mod->block)
+    {
+        mod->block = block_next(mod);
+        if(!mod->block)
+        {
+            if(mod->file)
+                mod->dropped += TS_PACKET_SIZE;
+            return;
+        }
+    }
+
+    recorder_block_t *block = mod->block;
+    memcpy(&block->buffer[block->size], ts, TS_PACKET_SIZE);
+    block->size += TS_PACKET_SIZE;
+
+    if(!mod->file)
+    {
+        /* data before the first keyframe */
+        if(block->size == mod->config.block_size)
+            block->size = 0;
+        return;
+    }
+
+    mod->file_size += TS_PACKET_SIZE;
+    if(block->size == mod->config.block_size)
+    {
+        job_submit(mod, block);
+        mod->block = NULL;
+    }
+}
+
+static void on_carousel_ts(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    block_append(mod, ts);
+}
+
+static void file_finish(module_data_t *mod)
+{
+    if(!mod->file)
+        return;
+
+    if(mod->block && mod->block->size > 0)
+    {
+        job_submit(mod, mod->block);
+        mod->block = NULL;
+    }
+
+    job_submit(mod, NULL);
+    mod->file = NULL;
+}
+
+/* data from the cut goes to the new file */
+static void file_rotate(module_data_t *mod, size_t cut)
+{
+    uint8_t *tail = NULL;
+    size_t tail_size = 0;
+
+    if(mod->block && cut < mod->block->size)
+    {
+        tail_size = mod->block->size - cut;
+        tail = (uint8_t *)malloc(tail_size);
+        memcpy(tail, &mod->block->buffer[cut], tail_size);
+        mod->block->size = cut;
+        if(mod->file)
+            mod->file_size -= tail_size;
+    }
+
+    if(mod->file)
+        file_finish(mod);
+    else if(mod->block)
+        mod->block->size = 0;
+
+    mod->file_time = time(NULL);
+    struct tm tm;
+    localtime_r(&mod->file_time, &tm);
+    if(!strftime(mod->filename, sizeof(mod->filename), mod->config.filename, &tm))
+        snprintf(mod->filename, sizeof(mod->filename), "%s", mod->config.filename);
+
+    recorder_file_t *file = (recorder_file_t *)calloc(1, sizeof(recorder_file_t));
+    file->filename = strdup(mod->filename);
+    file->fd = -1;
+    file->is_directio = mod->config.directio;
+    mod->file = file;
+    mod->file_size = 0;
+
+    if(mod->out_pat->buffer_size)
+        mpegts_carousel_send(mod->carousel, mod->out_pat);
+    if(mod->out_pmt->buffer_size)
+        mpegts_carousel_send(mod->carousel, mod->out_pmt);
+
+    mod->pes_block_id = (mod->block) ? mod->block_id : 0;
+    mod->pes_skip = (mod->block) ? mod->block->size : 0;
+    mod->pes_offset = mod->file_size;
+
+    for(size_t skip = 0; skip < tail_size; skip += TS_PACKET_SIZE)
+        block_append(mod, &tail[skip]);
+    free(tail);
+}
+
+static bool file_is_completed(module_data_t *mod)
+{
+    if(!mod->file)
+        return true;
+    if(mod->config.duration && (uint64_t)(time(NULL) - mod->file_time) >= mod->config.duration)
+        return true;
+    if(mod->config.size && mod->file_size >= mod->config.size)
+        return true;
+    return false;
+}
+
+static void index_append(module_data_t *mod, uint64_t offset)
+{
+    recorder_file_t *file = mod->file;
+
+    if(file->index_count == file->index_size)
+    {
+        file->index_size = (file->index_size) ? (file->index_size * 2) : 256;
+        file->index_list = (recorder_index_t *)realloc(
+            file->index_list, file->index_size * sizeof(recorder_index_t));
+    }
+
+    recorder_index_t *item = &file->index_list[file->index_count];
+    item->offset = offset;
+    item->pcr = mod->pcr;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    item->time = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    ++file->index_count;
+}
+
+/* stream_ts callbacks */
+
+static void on_key(module_data_t *mod)
+{
+    if(file_is_completed(mod))
+    {
+        /* PES start is in the queued block if the PES is too large */
+        if(mod->block && mod->pes_block_id == mod->block_id)
+            file_rotate(mod, mod->pes_skip);
+        else
+        {
+            file_rotate(mod, 0);
+            return;
+        }
+    }
+
+    index_append(mod, mod->pes_offset);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    if(pid == NULL_TS_PID)
+        return;
+
+    mpegts_es_track_t *track = mod->track;
+    const uint8_t events = mpegts_es_track_mux(track, ts
+        , (const mpegts_es_tag_t *)module_stream_tag(mod, ts));
+
+    if(events & ES_TRACK_PAT_ERROR)
+        asc_log_error(MSG("PAT checksum error"));
+    else if(events & ES_TRACK_PMT_ERROR)
+        asc_log_error(MSG("PMT checksum error"));
+
+    if(events & ES_TRACK_PAT)
+    {
+        mpegts_psi_copy(mod->out_pat, track->pat);
+        mod->out_pmt->buffer_size = 0;
+    }
+    else if(events & ES_TRACK_PMT)
+    {
+        mpegts_psi_copy(mod->out_pmt, track->pmt);
+
+        if(track->pcr_pid != mod->pcr_pid)
+        {
+            mod->pcr_pid = track->pcr_pid;
+            mod->pcr = -1;
+        }
+    }
+
+    if(pid == mod->pcr_pid && TS_IS_PCR(ts))
+        mod->pcr = TS_GET_PCR(ts);
+
+    if(events & ES_TRACK_PES_START)
+    {
+        mod->pes_block_id = (mod->block) ? mod->block_id : 0;
+        mod->pes_skip = (mod->block) ? mod->block->size : 0;
+        mod->pes_offset = mod->file_size;
+    }
+
+    block_append(mod, ts);
+
+    if(events & ES_TRACK_KEY)
+        on_key(mod);
+}
+
+/* methods */
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushstring(lua, (mod->file) ? mod->filename : "");
+    lua_setfield(lua, -2, "filename");
+    lua_pushnumber(lua, mod->file_size);
+    lua_setfield(lua, -2, "size");
+    lua_pushnumber(lua, mod->dropped);
+    lua_setfield(lua, -2, "dropped");
+
+    recorder_writer_t *writer = mod->writer;
+    pthread_mutex_lock(&writer->mutex);
+    const int queue_count = writer->queue_count;
+    const uint64_t latency = writer->latency;
+    const uint64_t latency_max = writer->latency_max;
+    pthread_mutex_unlock(&writer->mutex);
+
+    lua_pushnumber(lua, queue_count);
+    lua_setfield(lua, -2, "queue");
+    lua_pushnumber(lua, (double)latency / 1000.0);
+    lua_setfield(lua, -2, "latency");
+    lua_pushnumber(lua, (double)latency_max / 1000.0);
+    lua_setfield(lua, -2, "latency_max");
+
+    return 1;
+}
+
+/* required */
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->config.name, NULL);
+    asc_assert(mod->config.name != NULL, "[file_recorder] option 'name' is required");
+
+    module_option_string("filename", &mod->config.filename, NULL);
+    asc_assert(mod->config.filename != NULL, MSG("option 'filename' is required"));
+
+    int duration = 3600;
+    module_option_number("duration", &duration);
+    mod->config.duration = (duration > 0) ? duration : 0;
+
+    int size = 0;
+    module_option_number("size", &size);
+    mod->config.size = (size > 0) ? ((uint64_t)size * 1024 * 1024) : 0;
+
+    int buffer_size = BLOCK_UNIT / 1024;
+    module_option_number("buffer_size", &buffer_size);
+    const size_t block_count = ((size_t)buffer_size * 1024 + BLOCK_UNIT - 1) / BLOCK_UNIT;
+    mod->config.block_size = ((block_count > 0) ? block_count : 1) * BLOCK_UNIT;
+
+#ifdef O_DIRECT
+    module_option_boolean("directio", &mod->config.directio);
+#endif
+
+    const char *disk = "default";
+    module_option_string("disk", &disk, NULL);
+    mod->writer = writer_attach(disk);
+
+    for(int i = 0; i < BLOCK_COUNT; ++i)
+    {
+#ifdef HAVE_POSIX_MEMALIGN
+        if(posix_memalign((void **)&mod->block_list[i].buffer, ALIGN, mod->config.block_size))
+        {
+            asc_log_error(MSG("cannot malloc aligned memory"));
+            astra_abort();
+        }
+#else
+        mod->block_list[i].buffer = (uint8_t *)malloc(mod->config.block_size);
+#endif
+    }
+
+    mod->pcr = -1;
+    /* index the audio stream once per second */
+    mod->track = mpegts_es_track_init(1);
+    mod->out_pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    mod->out_pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
+    mod->carousel = mpegts_carousel_init(on_carousel_ts, mod);
+
+    module_stream_init(mod, on_ts);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    file_finish(mod);
+
+    /* blocks are in use until the writer completes the jobs */
+    recorder_writer_t *writer = mod->writer;
+    pthread_mutex_lock(&writer->mutex);
+    while(mod->job_count > 0)
+        pthread_cond_wait(&writer->cond_done, &writer->mutex);
+    pthread_mutex_unlock(&writer->mutex);
+
+    if(mod->write_error)
+        asc_log_error(MSG("write error: %s"), strerror(mod->write_error));
+
+    writer_detach(writer);
+
+    for(int i = 0; i < BLOCK_COUNT; ++i)
+        free(mod->block_list[i].buffer);
+
+    mpegts_carousel_destroy(mod->carousel);
+    mpegts_es_track_destroy(mod->track);
+    mpegts_psi_destroy(mod->out_pat);
+    mpegts_psi_destroy(mod->out_pmt);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
+};
+MODULE_LUA_REGISTER(file_recorder)
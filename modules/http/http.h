@@ -6,6 +6,7 @@
 #include "parser.h"
 
 #define HTTP_BUFFER_SIZE (16 * 1024)
+#define HTTP_HEADER_SIZE (2 * 1024)
 
 typedef struct http_response_t http_response_t;
 typedef struct http_client_t http_client_t;
@@ -18,8 +19,12 @@ struct http_client_t
     int idx_data;
 
     asc_socket_t *sock;
+    http_client_t *prev;
+    http_client_t *next;
 
-    char buffer[HTTP_BUFFER_SIZE];
+    // request and response headers. released when the response is sent
+    char *buffer;
+    size_t buffer_size;
     size_t buffer_skip;
     size_t chunk_left;
 
@@ -28,6 +33,15 @@ struct http_client_t
     int idx_request;
     int idx_callback;   // route callback
 
+    size_t header_skip; // end of the scanned data
+    int header_state;   // matched bytes of the empty line
+
+    // next requests received with the current request
+    char *pipeline;
+    size_t pipeline_size;
+
+    bool is_keep_alive;
+    bool is_http10;
     bool is_head;
     bool is_content_length;
     string_buffer_t *content;
@@ -39,21 +53,35 @@ struct http_client_t
     http_response_t *response;
 
     int idx_content;
+
+    // egress statistics, updated by the streaming modules
+    uint64_t connect_time;
+    uint64_t send_calls;
+    uint64_t send_bytes;
+    uint64_t send_zerocopy;
+    uint64_t send_copied;
 };
 
 // HTTP Server API
 
 void http_response_code(http_client_t *client, int code, const char *message);
 void http_response_header(http_client_t *client, const char *header, ...);
+void http_response_connection(http_client_t *client);
 void http_response_send(http_client_t *client);
 
 void http_client_warning(http_client_t *client, const char *message, ...);
 void http_client_error(http_client_t *client, const char *message, ...);
 void http_client_close(http_client_t *client);
+void http_client_done(http_client_t *client);
 
 void http_client_redirect(http_client_t *client, int code, const char *location);
 void http_client_abort(http_client_t *client, int code, const char *text);
 
+// HTTP Upstream API
+
+void http_upstream_send(http_client_t *client, module_stream_t *upstream);
+void http_upstream_release(http_client_t *client);
+
 // Utils
 
 void lua_string_to_lower(const char *str, size_t size);
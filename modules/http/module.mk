@@ -3,11 +3,17 @@ modules/redirect.c \
 modules/static.c \
 modules/websocket.c \
 modules/upstream.c \
-modules/downstream.c"
+modules/downstream.c \
+modules/hls.c \
+modules/timeshift.c \
+modules/relay.c"
 
 MODULES="http_server http_request \
 http_redirect \
 http_static \
 http_websocket \
 http_upstream \
-http_downstream"
+http_downstream \
+hls_output \
+timeshift \
+http_relay"
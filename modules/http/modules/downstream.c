@@ -45,7 +45,8 @@ static void on_downstream_read(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
 
-    ssize_t size = asc_socket_recv(client->sock, client->buffer, HTTP_BUFFER_SIZE);
+    uint8_t buffer[HTTP_BUFFER_SIZE];
+    ssize_t size = asc_socket_recv(client->sock, buffer, sizeof(buffer));
     if(size <= 0)
     {
         if(errno == EAGAIN)
@@ -63,12 +64,12 @@ static void on_downstream_read(void *arg)
         uint8_t *dst = &client->response->buffer[client->response->buffer_skip];
         if(size < skip)
         {
-            memcpy(dst, client->buffer, size);
+            memcpy(dst, buffer, size);
             client->response->buffer_skip += size;
         }
         else
         {
-            memcpy(dst, client->buffer, skip);
+            memcpy(dst, buffer, skip);
             module_stream_send(client->response, client->response->buffer);
             client->response->buffer_skip = 0;
         }
@@ -76,7 +77,7 @@ static void on_downstream_read(void *arg)
 
     while(skip < size)
     {
-        const uint8_t *ts = (const uint8_t *)&client->buffer[skip];
+        const uint8_t *ts = &buffer[skip];
 
         const size_t remain = size - skip;
         if(remain < TS_PACKET_SIZE)
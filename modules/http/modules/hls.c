@@ -0,0 +1,636 @@
+/*
+ * Astra Module: HTTP Module: HLS Output
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      hls_output
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name
+ *      duration    - number, target duration of the segment in seconds. default: 5
+ *      segments    - number, segments in the playlist. default: 5
+ *      playlist    - string, playlist file name. default: "index.m3u8"
+ *
+ * Module Methods:
+ *      status()    - return table:
+ *                    sequence  - number, media sequence of the first segment
+ *                    segments  - number, segments in the playlist
+ *                    memory    - number, bytes allocated by the segments
+ *
+ * Instance is the route callback of http_server, the route path should end
+ * with the asterisk. The last part of the request path is the playlist name
+ * or the segment name "<sequence>.ts".
+ *
+ * Segments are cut at the random access points of the first video PID
+ * (at the PES start of the other ES if the program has no video) and
+ * start with PAT and PMT. Video is not parsed again if the upstream
+ * channel has the option es_index. Completed segments are kept in the ring with
+ * a few spare items for the slow clients. Segment buffers are reused
+ * by the ring and released by the last client.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+#define MSG(_msg) "[hls_output %s] " _msg, mod->config.name
+
+#define HLS_SPARE_SEGMENTS 3
+
+#define PTS_MASK 0x1FFFFFFFFULL
+#define PTS_HZ 90000
+
+/* refcounted segment or playlist, released by the last owner */
+typedef struct
+{
+    int refcount;
+    size_t size;
+    size_t buffer_size;
+    uint8_t *buffer;
+} hls_data_t;
+
+typedef struct
+{
+    hls_data_t *data;
+    uint64_t sequence;
+    uint64_t duration; /* 1/90000 */
+    bool is_discontinuity;
+} hls_segment_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *name;
+        int duration;
+        int segments;
+        const char *playlist;
+    } config;
+
+    /* input */
+    mpegts_es_track_t *track;
+
+    /* tables at the start of the each segment */
+    mpegts_psi_t *out_pat;
+    mpegts_psi_t *out_pmt;
+    mpegts_carousel_t *carousel;
+
+    /* current segment */
+    hls_data_t *data;
+    bool is_started;
+    bool is_discontinuity;
+    uint64_t start_pts;
+    uint64_t last_pts;
+    uint64_t duration; /* before the timestamp discontinuity */
+    size_t pes_skip;   /* last PES start of es_pid */
+    uint64_t pes_pts;
+    bool is_pes_pts;
+
+    /* completed segments */
+    hls_segment_t *segment_list;
+    int segment_size;
+    int segment_count;
+    int segment_head;
+    uint64_t sequence;
+    uint64_t discontinuity_sequence;
+
+    hls_data_t *playlist;
+};
+
+struct http_response_t
+{
+    hls_data_t *data;
+    size_t skip;
+};
+
+static const char __path[] = "path";
+
+static hls_data_t * hls_data_alloc(void)
+{
+    hls_data_t *data = (hls_data_t *)calloc(1, sizeof(hls_data_t));
+    data->refcount = 1;
+    return data;
+}
+
+static void hls_data_release(hls_data_t *data)
+{
+    if(!data)
+        return;
+
+    --data->refcount;
+    if(data->refcount > 0)
+        return;
+
+    free(data->buffer);
+    free(data);
+}
+
+static void hls_data_append(hls_data_t *data, const uint8_t *buffer, size_t size)
+{
+    if(data->size + size > data->buffer_size)
+    {
+        size_t buffer_size = (data->buffer_size) ? data->buffer_size : (256 * TS_PACKET_SIZE);
+        while(data->size + size > buffer_size)
+            buffer_size *= 2;
+
+        data->buffer = (uint8_t *)realloc(data->buffer, buffer_size);
+        data->buffer_size = buffer_size;
+    }
+
+    memcpy(&data->buffer[data->size], buffer, size);
+    data->size += size;
+}
+
+/*
+ * oooooooooo  ooooo            o   ooooo  oooo ooooo       ooooo  oooooooo8 ooooooooooo
+ *  888    888  888            888    888  88    888         888  888        88  888  88
+ *  888oooo88   888           8  88     888      888         888   888oooooo     888
+ *  888         888      o   8oooo88    888      888      o  888          888    888
+ * o888o       o888ooooo88 o88o  o888o o888o    o888ooooo88 o888o o88oooo888    o888o
+ *
+ */
+
+static void playlist_update(module_data_t *mod)
+{
+    const int window = (mod->segment_count < mod->config.segments)
+                     ? mod->segment_count
+                     : mod->config.segments;
+
+    hls_data_t *playlist = mod->playlist;
+    if(!playlist || playlist->refcount > 1)
+    {
+        hls_data_release(playlist);
+        playlist = hls_data_alloc();
+        mod->playlist = playlist;
+    }
+
+    const size_t buffer_size = 256 + window * 96;
+    if(playlist->buffer_size < buffer_size)
+    {
+        playlist->buffer = (uint8_t *)realloc(playlist->buffer, buffer_size);
+        playlist->buffer_size = buffer_size;
+    }
+
+    /* the first segment of the window */
+    const int first = (mod->segment_head - window + mod->segment_size) % mod->segment_size;
+
+    uint64_t target = mod->config.duration;
+    for(int i = 0; i < window; ++i)
+    {
+        const hls_segment_t *segment = &mod->segment_list[(first + i) % mod->segment_size];
+        const uint64_t duration = (segment->duration + PTS_HZ - 1) / PTS_HZ;
+        if(duration > target)
+            target = duration;
+    }
+
+    char *buffer = (char *)playlist->buffer;
+    size_t size = snprintf(buffer, buffer_size,
+                           "#EXTM3U\n"
+                           "#EXT-X-VERSION:3\n"
+                           "#EXT-X-TARGETDURATION:%llu\n"
+                           "#EXT-X-MEDIA-SEQUENCE:%llu\n"
+                           "#EXT-X-DISCONTINUITY-SEQUENCE:%llu\n"
+                           , (unsigned long long)target
+                           , (unsigned long long)mod->segment_list[first].sequence
+                           , (unsigned long long)mod->discontinuity_sequence);
+
+    for(int i = 0; i < window; ++i)
+    {
+        const hls_segment_t *segment = &mod->segment_list[(first + i) % mod->segment_size];
+        size += snprintf(&buffer[size], buffer_size - size,
+                         "%s#EXTINF:%.3f,\n%llu.ts\n"
+                         , (segment->is_discontinuity) ? "#EXT-X-DISCONTINUITY\n" : ""
+                         , (double)segment->duration / PTS_HZ
+                         , (unsigned long long)segment->sequence);
+    }
+
+    playlist->size = size;
+}
+
+/*
+ *  oooooooo8 ooooooooooo  ooooooo80 oooo     oooo ooooooooooo oooo   oooo ooooooooooo
+ * 888         888    88 o888    88  8888o   888   888    88   8888o  88  88  888  88
+ *  888oooooo  888ooo8   888    oooo 88 888o8 88   888ooo8     88 888o88      888
+ *         888 888    oo 888o    88  88  888  88   888    oo   88   8888      888
+ * o88oooo888 o888ooo8888 888ooo888 o88o  8  o88o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static void on_carousel_ts(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    hls_data_append(mod->data, ts, TS_PACKET_SIZE);
+}
+
+/* new segment buffer starts with PAT and PMT */
+static void segment_begin(module_data_t *mod)
+{
+    mod->data->size = 0;
+    if(mod->out_pat->buffer_size)
+        mpegts_carousel_send(mod->carousel, mod->out_pat);
+    if(mod->out_pmt->buffer_size)
+        mpegts_carousel_send(mod->carousel, mod->out_pmt);
+}
+
+/* completes the current segment, data from skip goes to the next one */
+static void segment_cut(module_data_t *mod, size_t skip, uint64_t pts)
+{
+    hls_data_t *data = mod->data;
+    hls_segment_t *segment = &mod->segment_list[mod->segment_head];
+
+    /* buffer of the oldest segment is reused if clients are not sending it */
+    hls_data_t *next = segment->data;
+    if(!next || next->refcount > 1)
+    {
+        hls_data_release(next);
+        next = hls_data_alloc();
+    }
+
+    segment->data = data;
+    segment->sequence = mod->sequence;
+    segment->duration = mod->duration + ((mod->last_pts - mod->start_pts) & PTS_MASK);
+    segment->is_discontinuity = mod->is_discontinuity;
+
+    ++mod->sequence;
+    mod->segment_head = (mod->segment_head + 1) % mod->segment_size;
+    if(mod->segment_count < mod->segment_size)
+        ++mod->segment_count;
+
+    if(mod->segment_count > mod->config.segments)
+    {
+        /* segment is removed from the playlist */
+        const int i = (mod->segment_head - mod->config.segments - 1 + mod->segment_size)
+                    % mod->segment_size;
+        if(mod->segment_list[i].is_discontinuity)
+            ++mod->discontinuity_sequence;
+    }
+
+    /* packets after the cut point */
+    mod->data = next;
+    segment_begin(mod);
+    hls_data_append(next, &data->buffer[skip], data->size - skip);
+    data->size = skip;
+
+    mod->start_pts = pts;
+    mod->last_pts = pts;
+    mod->duration = 0;
+    mod->is_discontinuity = false;
+    mod->pes_skip = 0;
+
+    playlist_update(mod);
+}
+
+static void on_es_ts(module_data_t *mod, const uint8_t *ts, uint8_t events)
+{
+    const mpegts_es_tag_t *tag = mod->track->tag;
+
+    /* only the last PES is kept before the first segment */
+    if(!mod->is_started && (tag->flags & ES_TAG_PES_START))
+        mod->data->size = 0;
+
+    const size_t skip = mod->data->size;
+    hls_data_append(mod->data, ts, TS_PACKET_SIZE);
+
+    if(tag->flags & ES_TAG_PES_START)
+    {
+        mod->pes_skip = skip;
+        mod->is_pes_pts = (tag->flags & ES_TAG_PTS) != 0;
+        mod->pes_pts = tag->pts;
+
+        if(mod->is_started && mod->is_pes_pts)
+        {
+            /* timestamp discontinuity: backward or more than the window */
+            const uint64_t delta = (mod->pes_pts - mod->last_pts) & PTS_MASK;
+            const uint64_t window = (uint64_t)mod->config.duration
+                                  * (mod->config.segments + 1) * PTS_HZ;
+            if(delta > window)
+            {
+                mod->duration += (mod->last_pts - mod->start_pts) & PTS_MASK;
+                mod->start_pts = mod->pes_pts;
+                mod->is_discontinuity = true;
+            }
+            mod->last_pts = mod->pes_pts;
+        }
+    }
+
+    if(!(events & ES_TRACK_KEY) || !mod->is_pes_pts)
+        return;
+
+    if(!mod->is_started)
+    {
+        /* packets before the first random access point are dropped */
+        const size_t size = mod->data->size - mod->pes_skip;
+        uint8_t *buffer = (uint8_t *)malloc(size);
+        memcpy(buffer, &mod->data->buffer[mod->pes_skip], size);
+
+        segment_begin(mod);
+        const size_t psi_size = mod->data->size;
+        hls_data_append(mod->data, buffer, size);
+        free(buffer);
+
+        mod->is_started = true;
+        mod->start_pts = mod->pes_pts;
+        mod->last_pts = mod->pes_pts;
+        mod->duration = 0;
+        mod->pes_skip = psi_size;
+        return;
+    }
+
+    const uint64_t duration = mod->duration + ((mod->pes_pts - mod->start_pts) & PTS_MASK);
+    if(duration >= (uint64_t)mod->config.duration * PTS_HZ && mod->pes_skip > 0)
+    {
+        mod->last_pts = mod->pes_pts;
+        segment_cut(mod, mod->pes_skip, mod->pes_pts);
+    }
+}
+
+/*
+ * ooooo oooo   oooo oooooooooo ooooo  oooo ooooooooooo
+ *  888   8888o  88   888    888 888    88  88  888  88
+ *  888   88 888o88   888oooo88  888    88      888
+ *  888   88   8888   888        888    88      888
+ * o888o o88o    88  o888o        888oo88      o888o
+ *
+ */
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    mpegts_es_track_t *track = mod->track;
+    const uint8_t events = mpegts_es_track_mux(track, ts
+        , (const mpegts_es_tag_t *)module_stream_tag(mod, ts));
+
+    if(events & ES_TRACK_PAT_ERROR)
+        asc_log_error(MSG("PAT checksum error"));
+    else if(events & ES_TRACK_PMT_ERROR)
+        asc_log_error(MSG("PMT checksum error"));
+
+    if(events & ES_TRACK_PAT)
+    {
+        mpegts_psi_copy(mod->out_pat, track->pat);
+        mod->out_pmt->buffer_size = 0;
+    }
+    else if(events & ES_TRACK_PMT)
+    {
+        mpegts_psi_copy(mod->out_pmt, track->pmt);
+
+        if(events & ES_TRACK_ES)
+        {
+            mod->is_pes_pts = false;
+            if(mod->is_started)
+                mod->is_discontinuity = true;
+        }
+    }
+
+    if(pid == 0 || pid == track->pmt_pid)
+        return;
+
+    if(pid == NULL_TS_PID || !track->es_pid)
+        return;
+
+    if(pid == track->es_pid)
+    {
+        on_es_ts(mod, ts, events);
+        return;
+    }
+
+    if(mod->is_started)
+        hls_data_append(mod->data, ts, TS_PACKET_SIZE);
+}
+
+/*
+ * ooooo ooooo ooooooooooo ooooooooooo oooooooooo
+ *  888   888  88  888  88 88  888  88  888    888
+ *  888ooo888      888         888      888oooo88
+ *  888   888      888         888      888
+ * o888o o888o    o888o       o888o    o888o
+ *
+ */
+
+static void on_ready_send_data(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    const hls_data_t *data = response->data;
+
+    const ssize_t send_size = asc_socket_send(  client->sock
+                                              , &data->buffer[response->skip]
+                                              , data->size - response->skip);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send data [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+    if(response->skip >= data->size)
+        http_client_done(client);
+}
+
+static hls_data_t * segment_find(module_data_t *mod, const char *name)
+{
+    char *end = NULL;
+    const unsigned long long sequence = strtoull(name, &end, 10);
+    if(end == name || strcmp(end, ".ts") != 0)
+        return NULL;
+
+    for(int i = 0; i < mod->segment_count; ++i)
+    {
+        const hls_segment_t *segment = &mod->segment_list[i];
+        if(segment->sequence == sequence)
+            return segment->data;
+    }
+
+    return NULL;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+        {
+            hls_data_release(client->response->data);
+            free(client->response);
+            client->response = NULL;
+        }
+        return 0;
+    }
+
+    lua_getfield(lua, 4, __path);
+    const char *path = lua_tostring(lua, -1);
+    lua_pop(lua, 1); // path, the string is referenced by the request
+
+    const char *name = strrchr(path, '/');
+    name = (name) ? (name + 1) : path;
+
+    hls_data_t *data = NULL;
+    const bool is_playlist = (strcmp(name, mod->config.playlist) == 0);
+    if(is_playlist)
+        data = (mod->segment_count > 0) ? mod->playlist : NULL;
+    else
+        data = segment_find(mod, name);
+
+    if(!data)
+    {
+        http_client_abort(client, 404, NULL);
+        return 0;
+    }
+
+    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    client->response->data = data;
+    ++data->refcount;
+
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_data;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Length: %zu", data->size);
+    if(is_playlist)
+    {
+        /* clients check the playlist twice per segment */
+        const int max_age = (mod->config.duration > 1) ? (mod->config.duration / 2) : 1;
+        http_response_header(client, "Content-Type: application/vnd.apple.mpegurl");
+        http_response_header(client, "Cache-Control: max-age=%d", max_age);
+    }
+    else
+    {
+        /* segment is never changed */
+        http_response_header(client, "Content-Type: video/MP2T");
+        http_response_header(client, "Cache-Control: max-age=3600");
+    }
+    http_response_header(client, "Access-Control-Allow-Origin: *");
+    http_response_connection(client);
+    http_response_send(client);
+
+    return 0;
+}
+
+static int __module_call(lua_State *L)
+{
+    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
+    return module_call(mod);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    const int window = (mod->segment_count < mod->config.segments)
+                     ? mod->segment_count
+                     : mod->config.segments;
+    const int first = (mod->segment_head - window + mod->segment_size) % mod->segment_size;
+
+    lua_pushnumber(lua, (window > 0) ? mod->segment_list[first].sequence : mod->sequence);
+    lua_setfield(lua, -2, "sequence");
+    lua_pushnumber(lua, window);
+    lua_setfield(lua, -2, "segments");
+
+    size_t memory = mod->data->buffer_size;
+    for(int i = 0; i < mod->segment_count; ++i)
+        memory += mod->segment_list[i].data->buffer_size;
+    lua_pushnumber(lua, memory);
+    lua_setfield(lua, -2, "memory");
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->config.name, NULL);
+    asc_assert(mod->config.name != NULL, "[hls_output] option 'name' is required");
+
+    mod->config.duration = 5;
+    module_option_number("duration", &mod->config.duration);
+    asc_assert(mod->config.duration > 0, MSG("option 'duration' must be greater than 0"));
+
+    mod->config.segments = 5;
+    module_option_number("segments", &mod->config.segments);
+    asc_assert(mod->config.segments > 0, MSG("option 'segments' must be greater than 0"));
+
+    mod->config.playlist = "index.m3u8";
+    module_option_string("playlist", &mod->config.playlist, NULL);
+
+    /* segment could begin with the each audio PES */
+    mod->track = mpegts_es_track_init(0);
+    mod->out_pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    mod->out_pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
+    mod->carousel = mpegts_carousel_init(on_carousel_ts, mod);
+
+    mod->data = hls_data_alloc();
+
+    mod->segment_size = mod->config.segments + HLS_SPARE_SEGMENTS;
+    mod->segment_list = (hls_segment_t *)calloc(mod->segment_size, sizeof(hls_segment_t));
+
+    /* segment names are unique after restart */
+    mod->sequence = (uint64_t)time(NULL);
+
+    module_stream_init(mod, on_ts);
+
+    // Set callback for http route
+    lua_getmetatable(lua, 3);
+    lua_pushlightuserdata(lua, (void *)mod);
+    lua_pushcclosure(lua, __module_call, 1);
+    lua_setfield(lua, -2, "__call");
+    lua_pop(lua, 1);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    mpegts_carousel_destroy(mod->carousel);
+    mpegts_es_track_destroy(mod->track);
+    mpegts_psi_destroy(mod->out_pat);
+    mpegts_psi_destroy(mod->out_pmt);
+
+    /* data in use is released by the clients */
+    for(int i = 0; i < mod->segment_count; ++i)
+        hls_data_release(mod->segment_list[i].data);
+    free(mod->segment_list);
+
+    hls_data_release(mod->data);
+    hls_data_release(mod->playlist);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
+};
+MODULE_LUA_REGISTER(hls_output)
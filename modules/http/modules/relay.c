@@ -0,0 +1,1042 @@
+/*
+ * Astra Module: HTTP Module: Pass-through Relay
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      http_relay
+ *
+ * Module Options:
+ *      host        - string, origin hostname or IP address
+ *      port        - number, origin port (default: 80)
+ *      path        - string, request path (default: "/")
+ *      headers     - table, list of the request headers
+ *      timeout     - number, connection and receiving timeout in seconds (default: 10)
+ *      buffer_size - number, client buffer size in Kb (default: 1024)
+ *      buffer_fill - number, client socket is ready to send when less than
+ *                    buffer_fill Kb are not sent (default: 128)
+ *      stream      - boolean, true to inspect the relayed data as MPEG-TS stream
+ *
+ * Module Methods:
+ *      status()    - return table:
+ *                    active    - boolean, origin connection is open
+ *                    code      - number, origin response code
+ *                    bytes     - number, bytes received from the origin
+ *                    clients   - number, active clients
+ *      close()     - close the origin connection and all clients
+ *
+ * Instance is the route callback of http_server. Response body of the origin
+ * is moved to the clients without the user space copy: the body is spliced
+ * from the origin socket to the pipe, the pipe is duplicated with tee() to
+ * the pipe of the each client, client pipe is spliced to the client socket.
+ * Chunked transfer encoding of the origin is decoded on the fly: only chunk
+ * data is spliced, chunk headers are read to the staging buffer. New client
+ * starts from the packet boundary of the body. Slow client is disconnected
+ * when the pipe is full, partial packets are not passed to the client.
+ * When the origin is closed clients receive the rest of the pipe and are
+ * closed. With the "stream" option the data
+ * is also read to the user space and instance is the stream source.
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+#ifdef __linux
+#   include <fcntl.h>
+#endif
+
+#define MSG(_msg)                                       \
+    "[http_relay %s:%d%s] " _msg, mod->config.host      \
+                                , mod->config.port      \
+                                , mod->config.path
+
+#define RELAY_SPLICE_SIZE (64 * 1024)
+#define RELAY_LINE_SIZE 64 /* chunk headers are read in the small portions */
+
+typedef enum
+{
+    RELAY_STATE_HEADERS = 0,
+    RELAY_STATE_BODY,
+    RELAY_STATE_CHUNK_SIZE,
+    RELAY_STATE_CHUNK_DATA,
+    RELAY_STATE_CHUNK_TAIL,
+} relay_state_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *host;
+        int port;
+        const char *path;
+        size_t buffer_size;
+        size_t buffer_fill;
+        bool is_stream;
+    } config;
+
+    int timeout_ms;
+
+    asc_socket_t *sock;
+    asc_timer_t *timeout;
+    bool is_active;
+
+    /* request */
+    char *request;
+    size_t request_size;
+    size_t request_skip;
+
+    /* response */
+    relay_state_t state;
+    int status_code;
+    bool is_chunked;
+    bool is_content_length;
+    uint64_t chunk_left;
+    uint64_t bytes;
+
+    char buffer[HTTP_BUFFER_SIZE]; /* staging for headers and chunk lines */
+    size_t buffer_skip;
+
+    /* relay */
+    int pipe[2];
+    size_t pipe_size; /* the block fits to the empty client pipe */
+    int spare[2]; /* to complete the short tee() */
+    int null_fd;
+
+    uint8_t *ts_buffer;
+    mpegts_sync_t *ts_sync;
+
+    asc_list_t *client_list;
+};
+
+struct http_response_t
+{
+    module_data_t *mod;
+    int sock_fd;
+
+    int pipe[2];
+    size_t pipe_size;
+    size_t pipe_count;
+
+    /* bytes before the first packet boundary */
+    size_t join_skip;
+    bool is_head; /* response headers are not sent */
+    bool is_socket_busy;
+};
+
+#ifdef __linux
+
+static const char __connection[] = "Connection: ";
+
+/*
+ *   oooooooo8 ooooo       ooooo ooooooooooo oooo   oooo ooooooooooo
+ * o888     88  888         888   888    88   8888o  88  88  888  88
+ * 888          888         888   888ooo8     88 888o88      888
+ * 888o     oo  888      o  888   888    oo   88   8888      888
+ *  888oooo88  o888ooooo88 o888o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static void pipe_flush(module_data_t *mod, int fd, size_t size)
+{
+    while(size > 0)
+    {
+        const ssize_t ret = splice(fd, NULL, mod->null_fd, NULL, size, SPLICE_F_NONBLOCK);
+        if(ret <= 0)
+            break;
+        size -= ret;
+    }
+}
+
+static void client_release(module_data_t *mod, http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    asc_list_remove_item(mod->client_list, client);
+
+    close(response->pipe[0]);
+    close(response->pipe[1]);
+    free(response);
+    client->response = NULL;
+}
+
+/* moves the client pipe to the socket, returns false on error */
+static bool client_send(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    const ssize_t send_size = splice(  response->pipe[0], NULL
+                                     , response->sock_fd, NULL
+                                     , response->pipe_count
+                                     , SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    ++client->send_calls;
+
+    if(send_size > 0)
+    {
+        client->send_bytes += send_size;
+        response->pipe_count -= send_size;
+    }
+    else if(send_size == -1 && errno != EAGAIN)
+    {
+        http_client_error(client, "failed to send data [%s]", asc_socket_error());
+        return false;
+    }
+
+    return true;
+}
+
+static void on_client_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->is_head)
+    {
+        /* client joins the relay with the empty pipe */
+        const uint64_t bytes = response->mod->bytes;
+        response->join_skip = (TS_PACKET_SIZE - bytes % TS_PACKET_SIZE) % TS_PACKET_SIZE;
+        response->is_head = false;
+    }
+
+    if(response->pipe_count > 0 && !client_send(client))
+    {
+        http_client_close(client);
+        return;
+    }
+
+    if(response->pipe_count == 0)
+    {
+        if(!response->mod->sock)
+        {
+            /* origin is closed, all data is sent */
+            client_release(response->mod, client);
+            http_client_close(client);
+            return;
+        }
+
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+}
+
+static void on_client_read(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+
+    uint8_t buffer[1024];
+    const ssize_t size = asc_socket_recv(client->sock, buffer, sizeof(buffer));
+    if(size <= 0)
+        http_client_close(client);
+}
+
+/* clients with the data in the pipe are closed by on_client_ready() */
+static void client_flush_all(module_data_t *mod)
+{
+    asc_list_first(mod->client_list);
+    while(!asc_list_eol(mod->client_list))
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(mod->client_list);
+        http_response_t *response = client->response;
+
+        if(response->pipe_count == 0)
+        {
+            client_release(mod, client);
+            http_client_close(client);
+            asc_list_first(mod->client_list);
+            continue;
+        }
+
+        if(response->is_socket_busy == false)
+        {
+            asc_socket_set_on_ready(client->sock, on_client_ready);
+            response->is_socket_busy = true;
+        }
+        asc_list_next(mod->client_list);
+    }
+}
+
+static void client_close_all(module_data_t *mod)
+{
+    /* release before closing, the route callback could be the Lua wrapper */
+    while(asc_list_size(mod->client_list) > 0)
+    {
+        asc_list_first(mod->client_list);
+        http_client_t *client = (http_client_t *)asc_list_data(mod->client_list);
+        client_release(mod, client);
+        http_client_close(client);
+    }
+}
+
+/*
+ * oooooooooo  ooooooooooo ooooo       o      oooo   oooo
+ *  888    888  888    88   888       888       888  88
+ *  888oooo88   888ooo8     888      8  88        888
+ *  888  88o    888    oo   888   o 8oooo88       888
+ * o888o  88o8 o888ooo8888 o888ooooo88 o88o  o888o   o888o
+ *
+ */
+
+/*
+ * duplicates size bytes of the relay pipe to the client pipe.
+ * returns false on overflow: pipe capacity is counted in the buffers
+ * (about one segment for the spliced data), so tee() could fail before
+ * pipe_size bytes are queued
+ */
+static bool relay_tee(module_data_t *mod, http_client_t *client, size_t size)
+{
+    http_response_t *response = client->response;
+
+    if(response->is_head)
+        return true;
+
+    if(response->join_skip >= size)
+    {
+        response->join_skip -= size;
+        return true;
+    }
+
+    /* the client is slower than the origin or the socket is not ready yet */
+    if(response->pipe_count + size - response->join_skip > response->pipe_size)
+    {
+        if(!client_send(client))
+            return false;
+        if(response->pipe_count + size - response->join_skip > response->pipe_size)
+            return false;
+    }
+
+    ssize_t ret = tee(mod->pipe[0], response->pipe[1], size, SPLICE_F_NONBLOCK);
+    if(ret < 0)
+        ret = 0;
+
+    if((size_t)ret < size)
+    {
+        /* the block is larger than the empty pipe */
+        if(response->pipe_count == 0 || !client_send(client))
+            return false;
+
+        /* the rest of the block is taken from the copy of the relay pipe */
+        if(tee(mod->pipe[0], mod->spare[1], size, SPLICE_F_NONBLOCK) != (ssize_t)size)
+        {
+            pipe_flush(mod, mod->spare[0], size);
+            return false;
+        }
+        pipe_flush(mod, mod->spare[0], ret);
+
+        const size_t left = size - ret;
+        ssize_t tail = splice(  mod->spare[0], NULL, response->pipe[1], NULL
+                              , left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(tail < 0)
+            tail = 0;
+        pipe_flush(mod, mod->spare[0], left - tail);
+
+        ret += tail;
+        response->pipe_count += ret;
+        if((size_t)ret < size)
+            return false;
+
+        return true;
+    }
+
+    /* pipe of the new client is empty */
+    if(response->join_skip > 0)
+    {
+        pipe_flush(mod, response->pipe[0], response->join_skip);
+        size -= response->join_skip;
+        response->join_skip = 0;
+    }
+
+    response->pipe_count += size;
+    return true;
+}
+
+/* duplicates size bytes of the relay pipe to the client pipes, then consumes it */
+static void relay_send(module_data_t *mod, size_t size)
+{
+    mod->bytes += size;
+
+    asc_list_first(mod->client_list);
+    while(!asc_list_eol(mod->client_list))
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(mod->client_list);
+        http_response_t *response = client->response;
+
+        if(!relay_tee(mod, client, size))
+        {
+            /* slow client. client_release() moves the list to the next item */
+            http_client_warning(  client, "pipe overflow, %zu bytes are not sent"
+                                , response->pipe_count);
+            client_release(mod, client);
+            http_client_close(client);
+            continue;
+        }
+
+        /* sends are batched by the notsent_lowat of the socket */
+        if(response->is_socket_busy == false && response->pipe_count > 0)
+        {
+            asc_socket_set_on_ready(client->sock, on_client_ready);
+            response->is_socket_busy = true;
+        }
+
+        asc_list_next(mod->client_list);
+    }
+
+    if(mod->ts_sync)
+    {
+        while(size > 0)
+        {
+            const ssize_t ret = read(mod->pipe[0], mod->ts_buffer
+                                     , (size > RELAY_SPLICE_SIZE) ? RELAY_SPLICE_SIZE : size);
+            if(ret <= 0)
+                break;
+            mpegts_sync_push(mod->ts_sync, mod->ts_buffer, ret);
+            size -= ret;
+        }
+    }
+    else
+    {
+        pipe_flush(mod, mod->pipe[0], size);
+    }
+}
+
+static void on_origin_close(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(!mod->sock)
+        return;
+
+    asc_socket_close(mod->sock);
+    mod->sock = NULL;
+
+    if(mod->timeout)
+    {
+        asc_timer_destroy(mod->timeout);
+        mod->timeout = NULL;
+    }
+
+    if(mod->request)
+    {
+        free(mod->request);
+        mod->request = NULL;
+    }
+
+    client_flush_all(mod);
+}
+
+static void on_origin_error(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->sock && mod->state == RELAY_STATE_HEADERS)
+        asc_log_error(MSG("connection failed [%s]"), asc_socket_error());
+
+    on_origin_close(mod);
+}
+
+static bool relay_parse_headers(module_data_t *mod)
+{
+    size_t eoh = 0;
+    for(size_t skip = 0; skip < mod->buffer_skip; ++skip)
+    {
+        if(   skip + 1 < mod->buffer_skip
+           && mod->buffer[skip] == '\n' && mod->buffer[skip + 1] == '\n')
+        {
+            eoh = skip + 2;
+            break;
+        }
+        if(   skip + 3 < mod->buffer_skip
+           && mod->buffer[skip + 0] == '\r' && mod->buffer[skip + 1] == '\n'
+           && mod->buffer[skip + 2] == '\r' && mod->buffer[skip + 3] == '\n')
+        {
+            eoh = skip + 4;
+            break;
+        }
+    }
+
+    if(!eoh)
+    {
+        if(mod->buffer_skip >= sizeof(mod->buffer))
+        {
+            asc_log_error(MSG("response headers are too large"));
+            on_origin_close(mod);
+        }
+        return false;
+    }
+
+    parse_match_t m[4];
+
+    if(!http_parse_response(mod->buffer, eoh, m))
+    {
+        asc_log_error(MSG("failed to parse response line"));
+        on_origin_close(mod);
+        return false;
+    }
+
+    mod->status_code = atoi(&mod->buffer[m[2].so]);
+    size_t skip = m[0].eo;
+
+    while(skip < eoh)
+    {
+        const char *header = &mod->buffer[skip];
+        if(!http_parse_header(header, eoh - skip, m))
+        {
+            asc_log_error(MSG("failed to parse response headers"));
+            on_origin_close(mod);
+            return false;
+        }
+
+        if(m[1].eo == 0)
+            break; /* empty line */
+
+        const char *value = &header[m[2].so];
+        const size_t value_size = m[2].eo - m[2].so;
+
+        if(m[1].eo == 14 && !strncasecmp(header, "content-length", 14))
+        {
+            mod->chunk_left = strtoull(value, NULL, 10);
+            mod->is_content_length = true;
+        }
+        else if(m[1].eo == 17 && !strncasecmp(header, "transfer-encoding", 17))
+        {
+            mod->is_chunked = (value_size >= 7 && !strncasecmp(value, "chunked", 7));
+        }
+
+        skip += m[0].eo;
+    }
+
+    if(mod->status_code != 200)
+    {
+        asc_log_error(MSG("origin response code %d"), mod->status_code);
+        on_origin_close(mod);
+        return false;
+    }
+
+    if(mod->is_chunked)
+        mod->state = RELAY_STATE_CHUNK_SIZE;
+    else if(mod->is_content_length && mod->chunk_left == 0)
+    {
+        on_origin_close(mod);
+        return false;
+    }
+    else
+        mod->state = RELAY_STATE_BODY;
+
+    mod->buffer_skip -= eoh;
+    memmove(mod->buffer, &mod->buffer[eoh], mod->buffer_skip);
+    return true;
+}
+
+static bool relay_parse_chunk(module_data_t *mod)
+{
+    if(mod->state == RELAY_STATE_CHUNK_TAIL)
+    {
+        size_t skip = 0;
+        if(mod->buffer_skip > 0 && mod->buffer[0] == '\r')
+            skip = 1;
+        if(skip >= mod->buffer_skip)
+            return false;
+        if(mod->buffer[skip] != '\n')
+        {
+            asc_log_error(MSG("invalid chunk"));
+            on_origin_close(mod);
+            return false;
+        }
+        ++skip;
+
+        mod->buffer_skip -= skip;
+        memmove(mod->buffer, &mod->buffer[skip], mod->buffer_skip);
+        mod->state = RELAY_STATE_CHUNK_SIZE;
+    }
+
+    parse_match_t m[2];
+    if(!http_parse_chunk(mod->buffer, mod->buffer_skip, m))
+    {
+        if(   mod->buffer_skip >= RELAY_LINE_SIZE
+           || memchr(mod->buffer, '\n', mod->buffer_skip))
+        {
+            asc_log_error(MSG("invalid chunk"));
+            on_origin_close(mod);
+        }
+        return false;
+    }
+
+    mod->chunk_left = 0;
+    for(size_t i = m[1].so; i < m[1].eo; ++i)
+    {
+        const char c = mod->buffer[i];
+        if(c >= '0' && c <= '9')
+            mod->chunk_left = (mod->chunk_left << 4) | (c - '0');
+        else if(c >= 'a' && c <= 'f')
+            mod->chunk_left = (mod->chunk_left << 4) | (c - 'a' + 0x0A);
+        else if(c >= 'A' && c <= 'F')
+            mod->chunk_left = (mod->chunk_left << 4) | (c - 'A' + 0x0A);
+    }
+
+    if(mod->chunk_left == 0)
+    {
+        /* last chunk */
+        on_origin_close(mod);
+        return false;
+    }
+
+    mod->buffer_skip -= m[0].eo;
+    memmove(mod->buffer, &mod->buffer[m[0].eo], mod->buffer_skip);
+    mod->state = RELAY_STATE_CHUNK_DATA;
+    return true;
+}
+
+/* body data received with the headers goes to the relay pipe with the copy */
+static bool relay_parse_body(module_data_t *mod)
+{
+    size_t size = mod->buffer_skip;
+    if(mod->state == RELAY_STATE_CHUNK_DATA || mod->is_content_length)
+    {
+        if(size > mod->chunk_left)
+            size = mod->chunk_left;
+    }
+
+    const ssize_t ret = write(mod->pipe[1], mod->buffer, size);
+    if(ret <= 0)
+    {
+        asc_log_error(MSG("failed to write to pipe [%s]"), strerror(errno));
+        on_origin_close(mod);
+        return false;
+    }
+
+    mod->buffer_skip -= ret;
+    memmove(mod->buffer, &mod->buffer[ret], mod->buffer_skip);
+
+    relay_send(mod, ret);
+
+    if(mod->state == RELAY_STATE_CHUNK_DATA || mod->is_content_length)
+    {
+        mod->chunk_left -= ret;
+        if(mod->chunk_left == 0)
+        {
+            if(mod->state != RELAY_STATE_CHUNK_DATA)
+            {
+                on_origin_close(mod);
+                return false;
+            }
+            mod->state = RELAY_STATE_CHUNK_TAIL;
+        }
+    }
+
+    return true;
+}
+
+static void relay_parse(module_data_t *mod)
+{
+    while(mod->sock && mod->buffer_skip > 0)
+    {
+        bool is_next;
+        switch(mod->state)
+        {
+            case RELAY_STATE_HEADERS:
+                is_next = relay_parse_headers(mod);
+                break;
+            case RELAY_STATE_CHUNK_SIZE:
+            case RELAY_STATE_CHUNK_TAIL:
+                is_next = relay_parse_chunk(mod);
+                break;
+            default:
+                is_next = relay_parse_body(mod);
+                break;
+        }
+
+        if(!is_next)
+            break;
+    }
+}
+
+static void on_origin_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_active = true;
+
+    if(   mod->buffer_skip == 0
+       && (mod->state == RELAY_STATE_BODY || mod->state == RELAY_STATE_CHUNK_DATA))
+    {
+        size_t size = mod->pipe_size;
+        if(mod->is_chunked || mod->is_content_length)
+        {
+            if(size > mod->chunk_left)
+                size = mod->chunk_left;
+        }
+
+        const ssize_t ret = splice(  asc_socket_fd(mod->sock), NULL
+                                   , mod->pipe[1], NULL
+                                   , size
+                                   , SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(ret == -1 && errno == EAGAIN)
+            return;
+        if(ret <= 0)
+        {
+            if(ret == -1)
+                asc_log_error(MSG("failed to receive data [%s]"), strerror(errno));
+            on_origin_close(mod);
+            return;
+        }
+
+        relay_send(mod, ret);
+
+        if(mod->is_chunked || mod->is_content_length)
+        {
+            mod->chunk_left -= ret;
+            if(mod->chunk_left == 0)
+            {
+                if(!mod->is_chunked)
+                    on_origin_close(mod);
+                else
+                    mod->state = RELAY_STATE_CHUNK_TAIL;
+            }
+        }
+        return;
+    }
+
+    /* response headers and chunk headers */
+    size_t size = sizeof(mod->buffer) - mod->buffer_skip;
+    if(mod->state != RELAY_STATE_HEADERS && size > RELAY_LINE_SIZE)
+        size = RELAY_LINE_SIZE;
+
+    const ssize_t ret = asc_socket_recv(mod->sock, &mod->buffer[mod->buffer_skip], size);
+    if(ret <= 0)
+    {
+        if(ret == -1 && errno == EAGAIN)
+            return;
+        on_origin_close(mod);
+        return;
+    }
+    mod->buffer_skip += ret;
+
+    relay_parse(mod);
+}
+
+static void on_origin_ready(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const ssize_t ret = asc_socket_send(  mod->sock
+                                        , &mod->request[mod->request_skip]
+                                        , mod->request_size - mod->request_skip);
+    if(ret == -1)
+    {
+        asc_log_error(MSG("failed to send request [%s]"), asc_socket_error());
+        on_origin_close(mod);
+        return;
+    }
+
+    mod->request_skip += ret;
+    if(mod->request_skip == mod->request_size)
+    {
+        free(mod->request);
+        mod->request = NULL;
+        asc_socket_set_on_ready(mod->sock, NULL);
+    }
+}
+
+static void on_origin_timeout(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->is_active)
+    {
+        mod->is_active = false;
+        return;
+    }
+
+    asc_log_error(MSG("receiving timeout"));
+    on_origin_close(mod);
+}
+
+static void on_origin_connect(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_active = true;
+
+    asc_socket_set_on_read(mod->sock, on_origin_read);
+    asc_socket_set_on_ready(mod->sock, on_origin_ready);
+}
+
+static void relay_make_request(module_data_t *mod)
+{
+    string_buffer_t *buffer = string_buffer_alloc();
+    string_buffer_addfstring(buffer, "GET %s HTTP/1.1\r\n", mod->config.path);
+
+    bool is_host = false;
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "headers");
+    if(lua_istable(lua, -1))
+    {
+        for(lua_pushnil(lua); lua_next(lua, -2); lua_pop(lua, 1))
+        {
+            const char *h = lua_tostring(lua, -1);
+            if(!h || !strncasecmp(h, __connection, sizeof(__connection) - 1))
+                continue;
+            if(!strncasecmp(h, "Host:", 5))
+                is_host = true;
+
+            string_buffer_addfstring(buffer, "%s\r\n", h);
+        }
+    }
+    lua_pop(lua, 1); // headers
+
+    if(!is_host)
+        string_buffer_addfstring(buffer, "Host: %s:%d\r\n", mod->config.host, mod->config.port);
+    string_buffer_addlstring(buffer, "Connection: close\r\n\r\n", 21);
+
+    mod->request = string_buffer_release(buffer, &mod->request_size);
+    mod->request_skip = 0;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            client_release(mod, client);
+        return 0;
+    }
+
+    if(!mod->sock)
+    {
+        http_client_abort(client, 502, NULL);
+        return 0;
+    }
+
+    int fd[2];
+    if(pipe2(fd, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+        http_client_error(client, "failed to open pipe [%s]", strerror(errno));
+        http_client_abort(client, 500, NULL);
+        return 0;
+    }
+
+    /* limit of the pipe pages for the user or pipe-max-size is reached */
+    if(fcntl(fd[1], F_SETPIPE_SZ, (int)mod->config.buffer_size) == -1)
+    {
+        http_client_error(client, "failed to set pipe size [%s]", strerror(errno));
+        close(fd[0]);
+        close(fd[1]);
+        http_client_abort(client, 503, NULL);
+        return 0;
+    }
+
+    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    http_response_t *response = client->response;
+    response->mod = mod;
+    response->sock_fd = asc_socket_fd(client->sock);
+    response->pipe[0] = fd[0];
+    response->pipe[1] = fd[1];
+
+    const int pipe_size = fcntl(fd[1], F_GETPIPE_SZ);
+    response->pipe_size = (pipe_size > 0) ? (size_t)pipe_size : RELAY_SPLICE_SIZE;
+    response->is_head = true;
+
+    asc_list_insert_tail(mod->client_list, client);
+
+    /* socket is busy with the response headers */
+    response->is_socket_busy = true;
+
+    client->on_send = NULL;
+    client->on_read = on_client_read;
+    client->on_ready = on_client_ready;
+    client->is_keep_alive = false;
+
+    asc_socket_set_notsent_lowat(client->sock, mod->config.buffer_fill);
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, "Pragma: no-cache");
+    http_response_header(client, "Content-Type: application/octet-stream");
+    http_response_connection(client);
+    http_response_send(client);
+
+    return 0;
+}
+
+static int __module_call(lua_State *L)
+{
+    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
+    return module_call(mod);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushboolean(lua, mod->sock != NULL);
+    lua_setfield(lua, -2, "active");
+    lua_pushnumber(lua, mod->status_code);
+    lua_setfield(lua, -2, "code");
+    lua_pushnumber(lua, mod->bytes);
+    lua_setfield(lua, -2, "bytes");
+    lua_pushnumber(lua, asc_list_size(mod->client_list));
+    lua_setfield(lua, -2, "clients");
+
+    return 1;
+}
+
+static int method_close(module_data_t *mod)
+{
+    on_origin_close(mod);
+    client_close_all(mod);
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("host", &mod->config.host, NULL);
+    asc_assert(mod->config.host != NULL, "[http_relay] option 'host' is required");
+
+    mod->config.port = 80;
+    module_option_number("port", &mod->config.port);
+
+    mod->config.path = "/";
+    module_option_string("path", &mod->config.path, NULL);
+
+    int value = 1024;
+    module_option_number("buffer_size", &value);
+    mod->config.buffer_size = value * 1024;
+
+    value = 128;
+    module_option_number("buffer_fill", &value);
+    mod->config.buffer_fill = value * 1024;
+
+    asc_assert(mod->config.buffer_size > mod->config.buffer_fill
+               , MSG("buffer_size must be greater than buffer_fill"));
+
+    mod->timeout_ms = 10;
+    module_option_number("timeout", &mod->timeout_ms);
+    mod->timeout_ms *= 1000;
+
+    asc_assert(pipe2(mod->pipe, O_NONBLOCK | O_CLOEXEC) == 0
+               , MSG("failed to open pipe [%s]"), strerror(errno));
+    asc_assert(pipe2(mod->spare, O_NONBLOCK | O_CLOEXEC) == 0
+               , MSG("failed to open pipe [%s]"), strerror(errno));
+
+    /* relay pipe has half of the client pipe buffers */
+    if(mod->config.buffer_size / 2 < RELAY_SPLICE_SIZE)
+        fcntl(mod->pipe[1], F_SETPIPE_SZ, (int)(mod->config.buffer_size / 2));
+    const int pipe_size = fcntl(mod->pipe[1], F_GETPIPE_SZ);
+    mod->pipe_size = (pipe_size > 0 && pipe_size < RELAY_SPLICE_SIZE)
+                   ? (size_t)pipe_size
+                   : RELAY_SPLICE_SIZE;
+    mod->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    asc_assert(mod->null_fd != -1, MSG("failed to open /dev/null [%s]"), strerror(errno));
+
+    module_option_boolean("stream", &mod->config.is_stream);
+    if(mod->config.is_stream)
+    {
+        module_stream_init(mod, NULL);
+        mod->ts_buffer = (uint8_t *)malloc(RELAY_SPLICE_SIZE);
+        mod->ts_sync = mpegts_sync_init((ts_callback_t)__module_stream_send, &mod->__stream);
+    }
+
+    mod->client_list = asc_list_init();
+
+    relay_make_request(mod);
+
+    mod->timeout = asc_timer_init(mod->timeout_ms, on_origin_timeout, mod);
+    mod->sock = asc_socket_open_tcp4(mod);
+    asc_socket_connect(  mod->sock, mod->config.host, mod->config.port
+                       , on_origin_connect, on_origin_error);
+
+    // Set callback for http route
+    lua_getmetatable(lua, 3);
+    lua_pushlightuserdata(lua, (void *)mod);
+    lua_pushcclosure(lua, __module_call, 1);
+    lua_setfield(lua, -2, "__call");
+    lua_pop(lua, 1);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    on_origin_close(mod);
+    client_close_all(mod);
+    asc_list_destroy(mod->client_list);
+
+    if(mod->config.is_stream)
+    {
+        module_stream_destroy(mod);
+        mpegts_sync_destroy(mod->ts_sync);
+        free(mod->ts_buffer);
+    }
+
+    close(mod->pipe[0]);
+    close(mod->pipe[1]);
+    close(mod->spare[0]);
+    close(mod->spare[1]);
+    close(mod->null_fd);
+}
+
+#else /* __linux */
+
+static int method_status(module_data_t *mod)
+{
+    __uarg(mod);
+    lua_newtable(lua);
+    return 1;
+}
+
+static int method_close(module_data_t *mod)
+{
+    __uarg(mod);
+    return 0;
+}
+
+static void module_init(module_data_t *mod)
+{
+    __uarg(mod);
+    asc_log_error("[http_relay] splice() is not available");
+    astra_abort();
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    __uarg(mod);
+}
+
+#endif /* __linux */
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
+    { "close", method_close },
+};
+
+MODULE_LUA_REGISTER(http_relay)
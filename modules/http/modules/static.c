@@ -18,6 +18,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_static
+ *
+ * Module Options:
+ *      path        - string, path to the directory with files
+ *      skip        - string, part of the request path to skip
+ *      block_size  - number, size of the sendfile() block in Kb. default: 128
+ *      default_mime
+ *                  - string, default value: "application/octet-stream"
+ *      cache_size  - number, total size of the file cache in Kb. default: 65536
+ *                    0 - disable cache
+ *      cache_file  - number, max size of the cached file in Kb. default: 1024
+ *
+ * Files smaller than cache_file are kept in memory and checked for changes
+ * once per second. Larger files are sent with sendfile() if available.
+ * Responses support single byte range, If-None-Match and
+ * If-Modified-Since.
+ */
+
 #include <astra.h>
 
 #if defined(__linux) || defined(__APPLE__) || defined(__FreeBSD__)
@@ -33,6 +53,31 @@
 
 #include "../http.h"
 
+#define CACHE_CHECK_INTERVAL (1 * 1000 * 1000) /* us */
+
+typedef struct cache_item_t cache_item_t;
+
+struct cache_item_t
+{
+    char *filename;
+    uint32_t hash;
+    cache_item_t *next; // hash chain
+
+    // least recently used at the tail
+    cache_item_t *lru_prev;
+    cache_item_t *lru_next;
+
+    uint8_t *data;
+    size_t size;
+    time_t mtime;
+    ino_t ino;
+
+    uint64_t check_time;
+
+    int refcount;       // clients sending the data
+    bool is_removed;    // released by the last client
+};
+
 struct module_data_t
 {
     const char *path;
@@ -41,21 +86,249 @@ struct module_data_t
     size_t block_size;
 
     const char *default_mime;
+
+    size_t cache_size;
+    size_t cache_file;
+    size_t cache_usage;
+
+    cache_item_t **cache_hash;
+    size_t cache_hash_size;
+    size_t cache_count;
+
+    cache_item_t *lru_head;
+    cache_item_t *lru_tail;
 };
 
 struct http_response_t
 {
     module_data_t *mod;
 
+    cache_item_t *item;
+
     int file_fd;
     int sock_fd;
 
     off_t file_skip;
-    off_t file_size;
+    off_t file_size; // end of the range
 };
 
 static const char __path[] = "path";
 
+/*
+ *   oooooooo8     o       oooooooo8 ooooo ooooo ooooooooooo
+ * o888     88    888    o888     88  888   888   888    88
+ * 888           8  88   888          888ooo888   888ooo8
+ * 888o     oo  8oooo88  888o     oo  888   888   888    oo
+ *  888oooo88 o88o  o888o 888oooo88  o888o o888o o888ooo8888
+ *
+ */
+
+static uint32_t cache_hash(const char *filename)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+    for(; *filename; ++filename)
+    {
+        hash ^= (uint8_t)*filename;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void cache_item_free(cache_item_t *item)
+{
+    free(item->filename);
+    free(item->data);
+    free(item);
+}
+
+static void lru_unlink(module_data_t *mod, cache_item_t *item)
+{
+    if(item->lru_prev)
+        item->lru_prev->lru_next = item->lru_next;
+    else
+        mod->lru_head = item->lru_next;
+
+    if(item->lru_next)
+        item->lru_next->lru_prev = item->lru_prev;
+    else
+        mod->lru_tail = item->lru_prev;
+
+    item->lru_prev = NULL;
+    item->lru_next = NULL;
+}
+
+static void lru_link(module_data_t *mod, cache_item_t *item)
+{
+    item->lru_prev = NULL;
+    item->lru_next = mod->lru_head;
+    if(mod->lru_head)
+        mod->lru_head->lru_prev = item;
+    else
+        mod->lru_tail = item;
+    mod->lru_head = item;
+}
+
+static cache_item_t * cache_find(module_data_t *mod, const char *filename, uint32_t hash)
+{
+    if(!mod->cache_hash_size)
+        return NULL;
+
+    cache_item_t *item = mod->cache_hash[hash & (mod->cache_hash_size - 1)];
+    for(; item; item = item->next)
+    {
+        if(item->hash == hash && !strcmp(item->filename, filename))
+            return item;
+    }
+
+    return NULL;
+}
+
+/* item is removed from the cache, data is released with the last client */
+static void cache_remove(module_data_t *mod, cache_item_t *item)
+{
+    cache_item_t **i = &mod->cache_hash[item->hash & (mod->cache_hash_size - 1)];
+    while(*i != item)
+        i = &(*i)->next;
+    *i = item->next;
+
+    lru_unlink(mod, item);
+    --mod->cache_count;
+    mod->cache_usage -= item->size;
+
+    if(item->refcount > 0)
+        item->is_removed = true;
+    else
+        cache_item_free(item);
+}
+
+static void cache_insert(module_data_t *mod, cache_item_t *item)
+{
+    while(mod->lru_tail && mod->cache_usage + item->size > mod->cache_size)
+        cache_remove(mod, mod->lru_tail);
+
+    if((mod->cache_count + 1) * 4 > mod->cache_hash_size * 3)
+    {
+        const size_t hash_size = (mod->cache_hash_size) ? (mod->cache_hash_size * 2) : 64;
+        cache_item_t **cache_hash = (cache_item_t **)calloc(hash_size, sizeof(cache_item_t *));
+
+        for(size_t i = 0; i < mod->cache_hash_size; ++i)
+        {
+            cache_item_t *next = mod->cache_hash[i];
+            while(next)
+            {
+                cache_item_t *bucket = next;
+                next = bucket->next;
+                bucket->next = cache_hash[bucket->hash & (hash_size - 1)];
+                cache_hash[bucket->hash & (hash_size - 1)] = bucket;
+            }
+        }
+
+        free(mod->cache_hash);
+        mod->cache_hash = cache_hash;
+        mod->cache_hash_size = hash_size;
+    }
+
+    cache_item_t **bucket = &mod->cache_hash[item->hash & (mod->cache_hash_size - 1)];
+    item->next = *bucket;
+    *bucket = item;
+
+    lru_link(mod, item);
+    ++mod->cache_count;
+    mod->cache_usage += item->size;
+}
+
+static cache_item_t * cache_load(module_data_t *mod, const char *filename, uint32_t hash
+                                 , int fd, const struct stat *sb)
+{
+    cache_item_t *item = (cache_item_t *)calloc(1, sizeof(cache_item_t));
+    item->data = (uint8_t *)malloc((sb->st_size > 0) ? sb->st_size : 1);
+
+    size_t skip = 0;
+    while(skip < (size_t)sb->st_size)
+    {
+        const ssize_t len = pread(fd, &item->data[skip], sb->st_size - skip, skip);
+        if(len <= 0)
+        {
+            /* file is truncated, serve it from the disk */
+            free(item->data);
+            free(item);
+            return NULL;
+        }
+        skip += len;
+    }
+
+    item->filename = strdup(filename);
+    item->hash = hash;
+    item->size = sb->st_size;
+    item->mtime = sb->st_mtime;
+    item->ino = sb->st_ino;
+    item->check_time = asc_clock_now();
+
+    cache_insert(mod, item);
+
+    return item;
+}
+
+/* cached item if the file is not changed */
+static cache_item_t * cache_get(module_data_t *mod, const char *filename, uint32_t hash)
+{
+    cache_item_t *item = cache_find(mod, filename, hash);
+    if(!item)
+        return NULL;
+
+    const uint64_t current_time = asc_clock_now();
+    if(current_time - item->check_time >= CACHE_CHECK_INTERVAL)
+    {
+        struct stat sb;
+        if(   stat(filename, &sb) == -1
+           || (size_t)sb.st_size != item->size
+           || sb.st_mtime != item->mtime
+           || sb.st_ino != item->ino)
+        {
+            cache_remove(mod, item);
+            return NULL;
+        }
+        item->check_time = current_time;
+    }
+
+    if(item != mod->lru_head)
+    {
+        lru_unlink(mod, item);
+        lru_link(mod, item);
+    }
+
+    return item;
+}
+
+static void cache_clear(module_data_t *mod)
+{
+    while(mod->lru_tail)
+        cache_remove(mod, mod->lru_tail);
+
+    free(mod->cache_hash);
+    mod->cache_hash = NULL;
+    mod->cache_hash_size = 0;
+}
+
+static void response_release(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    if(response->item)
+    {
+        --response->item->refcount;
+        if(response->item->is_removed && response->item->refcount == 0)
+            cache_item_free(response->item);
+    }
+
+    if(response->file_fd != -1)
+        close(response->file_fd);
+
+    free(response);
+    client->response = NULL;
+}
+
 /*
  * client->mod - http_server module
  * client->response->mod - http_static module
@@ -67,54 +340,74 @@ static void on_ready_send_file(void *arg)
     http_response_t *response = client->response;
 
     ssize_t send_size;
+    const size_t tail = response->file_size - response->file_skip;
 
-    if(!response->mod->block_size)
+    if(response->item)
+    {
+        send_size = asc_socket_send(  client->sock
+                                    , &response->item->data[response->file_skip]
+                                    , tail);
+    }
+    else if(!response->mod->block_size)
     {
+        uint8_t buffer[HTTP_BUFFER_SIZE];
         const ssize_t len = pread(  response->file_fd
-                                  , client->buffer, HTTP_BUFFER_SIZE
+                                  , buffer
+                                  , (tail < sizeof(buffer)) ? tail : sizeof(buffer)
                                   , response->file_skip);
         if(len <= 0)
             send_size = -1;
         else
-            send_size = asc_socket_send(client->sock, client->buffer, len);
+            send_size = asc_socket_send(client->sock, buffer, len);
     }
     else
     {
+        const size_t block_size = (tail < response->mod->block_size)
+                                ? tail
+                                : response->mod->block_size;
+
 #if defined(__linux)
 
+        off_t file_skip = response->file_skip;
         send_size = sendfile(  response->sock_fd
                              , response->file_fd
-                             , NULL, response->mod->block_size);
+                             , &file_skip, block_size);
+
+        if(send_size == -1 && errno == EAGAIN)
+            return;
+        if(send_size == 0)
+            send_size = -1; // file is truncated
 
 #elif defined(__APPLE__)
 
-        off_t block_size = response->mod->block_size;
+        off_t send_block = block_size;
         const int r = sendfile(  response->file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , &block_size, NULL, 0);
+                               , &send_block, NULL, 0);
 
-        if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
-            send_size = block_size;
+        if(r == 0 || (r == -1 && errno == EAGAIN && send_block > 0))
+            send_size = send_block;
         else
             send_size = -1;
 
 #elif defined(__FreeBSD__)
 
-        off_t block_size = 0;
+        off_t send_block = 0;
         const int r = sendfile(  response->file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , response->mod->block_size, NULL
-                               , &block_size, 0);
+                               , block_size, NULL
+                               , &send_block, 0);
 
-        if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
-            send_size = block_size;
+        if(r == 0 || (r == -1 && errno == EAGAIN && send_block > 0))
+            send_size = send_block;
         else
             send_size = -1;
 
 #else
 
+        __uarg(block_size);
         send_size = -1;
 
 #endif
@@ -130,7 +423,69 @@ static void on_ready_send_file(void *arg)
     response->file_skip += send_size;
 
     if(response->file_skip >= response->file_size)
-        http_client_close(client);
+        http_client_done(client);
+}
+
+static void format_time(char *buffer, size_t size, time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static bool parse_time(const char *str, time_t *t)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if(!strptime(str, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        return false;
+
+    *t = timegm(&tm);
+    return true;
+}
+
+/* single range "bytes=first-last", returns false if not satisfiable */
+static bool parse_range(const char *str, off_t size, off_t *first, off_t *last)
+{
+    if(strncmp(str, "bytes=", 6) != 0 || strchr(str, ','))
+    {
+        /* unknown unit or multiple ranges, send the whole file */
+        *first = 0;
+        *last = size - 1;
+        return true;
+    }
+    str += 6;
+
+    char *end;
+    if(*str == '-')
+    {
+        /* suffix: the last N bytes */
+        const long long count = strtoll(&str[1], &end, 10);
+        if(end == &str[1] || count <= 0 || size == 0)
+            return false;
+
+        *first = (count < size) ? (size - count) : 0;
+        *last = size - 1;
+        return true;
+    }
+
+    *first = strtoll(str, &end, 10);
+    if(end == str || *end != '-' || *first >= size)
+        return false;
+
+    str = end + 1;
+    if(*str == '\0')
+        *last = size - 1;
+    else
+    {
+        *last = strtoll(str, &end, 10);
+        if(end == str || *last < *first)
+            return false;
+        if(*last >= size)
+            *last = size - 1;
+    }
+
+    return true;
 }
 
 static const char * lua_get_mime(http_client_t *client, const char *path)
@@ -164,6 +519,15 @@ static const char * lua_get_mime(http_client_t *client, const char *path)
     return mime;
 }
 
+/* Stack: -1 - request headers */
+static const char * header_get(const char *name)
+{
+    lua_getfield(lua, -1, name);
+    const char *value = lua_isstring(lua, -1) ? lua_tostring(lua, -1) : NULL;
+    lua_pop(lua, 1);
+    return value;
+}
+
 /* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
 static int module_call(module_data_t *mod)
 {
@@ -172,16 +536,13 @@ static int module_call(module_data_t *mod)
     if(lua_isnil(lua, 4))
     {
         if(client->response)
-        {
-            close(client->response->file_fd);
-            free(client->response);
-            client->response = NULL;
-        }
+            response_release(client);
         return 0;
     }
 
     client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
     client->response->mod = mod;
+    client->response->file_fd = -1;
     client->on_send = NULL;
     client->on_read = NULL;
     client->on_ready = on_ready_send_file;
@@ -190,43 +551,149 @@ static int module_call(module_data_t *mod)
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
     lua_getfield(lua, -1, __path);
     const char *path = lua_tostring(lua, -1);
-    lua_pop(lua, 2); // request + path
+    lua_pop(lua, 1); // path, the string is referenced by the request
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s%s", mod->path, &path[mod->path_skip]);
+
+    const uint32_t hash = cache_hash(filename);
+    cache_item_t *item = (mod->cache_size) ? cache_get(mod, filename, hash) : NULL;
+
+    off_t file_size;
+    time_t mtime;
 
-    char *filename = (char *)malloc(PATH_MAX);
-    sprintf(filename, "%s%s", mod->path, &path[mod->path_skip]);
-    client->response->file_fd = open(filename, O_RDONLY);
-    free(filename);
-    if(client->response->file_fd == -1)
+    if(item)
     {
-        http_client_warning(client, "file not found %s", path);
+        file_size = item->size;
+        mtime = item->mtime;
+    }
+    else
+    {
+        const int fd = open(filename, O_RDONLY);
+        if(fd == -1)
+        {
+            http_client_warning(client, "file not found %s", path);
+            lua_pop(lua, 1); // request
+
+            response_release(client);
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
 
-        free(client->response);
-        client->response = NULL;
+        struct stat sb;
+        fstat(fd, &sb);
 
-        http_client_abort(client, 404, NULL);
-        return 0;
+        if(!S_ISREG(sb.st_mode))
+        {
+            http_client_warning(client, "wrong file type %s", path);
+            lua_pop(lua, 1); // request
+
+            close(fd);
+            response_release(client);
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
+
+        file_size = sb.st_size;
+        mtime = sb.st_mtime;
+
+        if((size_t)sb.st_size <= mod->cache_file && mod->cache_size)
+            item = cache_load(mod, filename, hash, fd, &sb);
+
+        if(item)
+            close(fd);
+        else
+            client->response->file_fd = fd;
     }
 
-    struct stat sb;
-    fstat(client->response->file_fd, &sb);
+    if(item)
+    {
+        ++item->refcount;
+        client->response->item = item;
+    }
 
-    if(!S_ISREG(sb.st_mode))
+    char last_modified[64];
+    format_time(last_modified, sizeof(last_modified), mtime);
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx\""
+             , (unsigned long long)mtime, (unsigned long long)file_size);
+
+    lua_getfield(lua, -1, "headers");
+
+    /* If-None-Match has priority over If-Modified-Since */
+    bool is_not_modified = false;
+    const char *if_none_match = header_get("if-none-match");
+    if(if_none_match)
+        is_not_modified = (strstr(if_none_match, etag) || !strcmp(if_none_match, "*"));
+    else
     {
-        http_client_warning(client, "wrong file type %s", path);
+        time_t ims;
+        const char *if_modified_since = header_get("if-modified-since");
+        if(if_modified_since && parse_time(if_modified_since, &ims))
+            is_not_modified = (mtime <= ims);
+    }
 
-        close(client->response->file_fd);
-        free(client->response);
-        client->response = NULL;
+    off_t first = 0;
+    off_t last = file_size - 1;
+    bool is_range = false;
+    const char *range = (is_not_modified) ? NULL : header_get("range");
+    if(range)
+    {
+        /* If-Range with the other version sends the whole file */
+        const char *if_range = header_get("if-range");
+        if(!if_range || !strcmp(if_range, etag) || !strcmp(if_range, last_modified))
+        {
+            if(!parse_range(range, file_size, &first, &last))
+            {
+                lua_pop(lua, 2); // headers + request
+
+                http_response_code(client, 416, NULL);
+                http_response_header(client, "Content-Range: bytes */%llu"
+                                     , (unsigned long long)file_size);
+                http_response_header(client, "Content-Length: 0");
+                http_response_connection(client);
+                client->is_head = true; // headers only
+                http_response_send(client);
+                return 0;
+            }
+            is_range = (first > 0 || last < file_size - 1);
+        }
+    }
+
+    lua_pop(lua, 2); // headers + request
 
-        http_client_abort(client, 404, NULL);
+    if(is_not_modified)
+    {
+        http_response_code(client, 304, NULL);
+        http_response_header(client, "ETag: %s", etag);
+        http_response_header(client, "Last-Modified: %s", last_modified);
+        http_response_connection(client);
+        client->is_head = true; // headers only
+        http_response_send(client);
         return 0;
     }
 
-    client->response->file_size = sb.st_size;
+    client->response->file_skip = first;
+    client->response->file_size = last + 1;
 
-    http_response_code(client, 200, NULL);
-    http_response_header(client, "Content-Length: %lu", client->response->file_size);
+    http_response_code(client, (is_range) ? 206 : 200, NULL);
+    http_response_header(client, "Content-Length: %llu"
+                         , (unsigned long long)(last + 1 - first));
+    if(is_range)
+    {
+        http_response_header(client, "Content-Range: bytes %llu-%llu/%llu"
+                             , (unsigned long long)first
+                             , (unsigned long long)last
+                             , (unsigned long long)file_size);
+    }
     http_response_header(client, "Content-Type: %s", lua_get_mime(client, path));
+    http_response_header(client, "Last-Modified: %s", last_modified);
+    http_response_header(client, "ETag: %s", etag);
+    http_response_header(client, "Accept-Ranges: bytes");
+    http_response_connection(client);
+    if(file_size == 0)
+        client->is_head = true; // nothing to send
     http_response_send(client);
 
     return 0;
@@ -258,6 +725,16 @@ static void module_init(module_data_t *mod)
         mod->path_skip = luaL_len(lua, -1);
     lua_pop(lua, 1);
 
+    int cache_size = 64 * 1024;
+    module_option_number("cache_size", &cache_size);
+    mod->cache_size = (cache_size > 0) ? (size_t)cache_size * 1024 : 0;
+
+    int cache_file = 1024;
+    module_option_number("cache_file", &cache_file);
+    mod->cache_file = (cache_file > 0) ? (size_t)cache_file * 1024 : 0;
+    if(mod->cache_file > mod->cache_size)
+        mod->cache_file = mod->cache_size;
+
 #ifdef ASC_SENDFILE
     int block_size = 0;
     module_option_number("block_size", &block_size);
@@ -281,7 +758,7 @@ static void module_init(module_data_t *mod)
 
 static void module_destroy(module_data_t *mod)
 {
-    __uarg(mod);
+    cache_clear(mod);
 }
 
 MODULE_LUA_METHODS()
@@ -0,0 +1,672 @@
+/*
+ * Astra Module: HTTP Module: Timeshift
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      timeshift
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, instance name
+ *      path        - string, directory for the ring files
+ *      size        - number, total size of the ring in Mb. default: 1024
+ *      files       - number, files in the ring. default: 16
+ *      block_size  - number, size of the sendfile() block in Kb. default: 128
+ *
+ * Module Methods:
+ *      status()    - return table:
+ *                    start     - number, unix time of the first keyframe
+ *                    stop      - number, unix time of the last keyframe
+ *                    size      - number, bytes available in the ring
+ *                    clients   - number, active clients
+ *
+ * Instance is the route callback of http_server. Query option "start" is
+ * the unix time to begin the stream from, negative value is relative to
+ * the current time. Without "start" the stream begins from the last
+ * keyframe. Keyframes are taken from the upstream channel with es_index
+ * if the option is set.
+ *
+ * Stream is written to the preallocated files "<name>.<n>.ts" in the ring,
+ * the oldest file is overwritten when the ring is full. The index of the
+ * keyframes (arrival time and ring position) is kept in memory, the ring
+ * content is discarded on restart. Clients are not paced: the response
+ * starts with PAT and PMT, then the ring is sent with sendfile() as fast
+ * as the socket accepts. On the live edge the client waits for the writer.
+ */
+
+#include <astra.h>
+
+#ifdef __linux
+#   include <sys/sendfile.h>
+#endif
+
+#include "../http.h"
+
+#define MSG(_msg) "[timeshift %s] " _msg, mod->config.name
+
+#define TIMESHIFT_BLOCK (1024 * TS_PACKET_SIZE) /* write buffer */
+#define TIMESHIFT_FLUSH_INTERVAL 200 /* ms */
+#define TIMESHIFT_SENDFILE (128 * 1024)
+
+typedef struct
+{
+    time_t time;
+    uint64_t pos;
+} timeshift_index_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *name;
+        const char *path;
+        int files;
+        size_t block_size;
+    } config;
+
+    /* input */
+    mpegts_es_track_t *track;
+    uint64_t pes_pos;   /* last PES start of es_pid */
+
+    /* tables at the start of the each response */
+    mpegts_psi_t *out_pat;
+    mpegts_psi_t *out_pmt;
+    mpegts_carousel_t *carousel;
+    uint8_t *psi_ts;
+    size_t psi_size;
+    size_t psi_buffer_size;
+
+    /* ring */
+    int *fd_list;
+    uint64_t file_size;
+    uint64_t tail;      /* start of the valid data */
+    uint64_t flush_pos; /* end of the data available for the clients */
+    bool is_error;
+
+    uint8_t *buffer;    /* write buffer, never crosses the file boundary */
+    uint64_t buffer_pos;
+    size_t buffer_size;
+
+    asc_timer_t *flush_timer;
+
+    /* keyframes, ring of the items sorted by position */
+    timeshift_index_t *index_list;
+    size_t index_size;
+    size_t index_head;
+    size_t index_count;
+
+    asc_list_t *client_list;
+};
+
+struct http_response_t
+{
+    module_data_t *mod;
+    int sock_fd;
+
+    uint8_t *psi_ts;
+    size_t psi_size;
+    size_t psi_skip;
+
+    uint64_t pos;
+    bool is_waiting;
+};
+
+static const char __query[] = "query";
+
+static void on_ready_send_ring(void *arg);
+
+/*
+ * ooooo oooo   oooo ooooooooo  ooooooooooo ooooo  oooo
+ *  888   8888o  88   888    88o 888    88    888  88
+ *  888   88 888o88   888    888 888ooo8        888
+ *  888   88   8888   888    888 888    oo     88 888
+ * o888o o88o    88  o888ooo88  o888ooo8888 o88o  o888o
+ *
+ */
+
+#define INDEX_ITEM(_mod, _i) (&(_mod)->index_list[((_mod)->index_head + (_i)) % (_mod)->index_size])
+
+static void index_append(module_data_t *mod, uint64_t pos)
+{
+    if(mod->index_count == mod->index_size)
+    {
+        const size_t index_size = (mod->index_size) ? (mod->index_size * 2) : 1024;
+        timeshift_index_t *index_list =
+            (timeshift_index_t *)malloc(index_size * sizeof(timeshift_index_t));
+        for(size_t i = 0; i < mod->index_count; ++i)
+            index_list[i] = *INDEX_ITEM(mod, i);
+
+        free(mod->index_list);
+        mod->index_list = index_list;
+        mod->index_size = index_size;
+        mod->index_head = 0;
+    }
+
+    timeshift_index_t *item = &mod->index_list[
+        (mod->index_head + mod->index_count) % mod->index_size];
+    item->time = time(NULL);
+    item->pos = pos;
+    ++mod->index_count;
+}
+
+/* first keyframe since the time, or the last keyframe */
+static const timeshift_index_t * index_find(module_data_t *mod, time_t t)
+{
+    size_t lo = 0;
+    size_t hi = mod->index_count;
+    while(lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if(INDEX_ITEM(mod, mid)->time < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == mod->index_count)
+        lo = mod->index_count - 1;
+
+    return INDEX_ITEM(mod, lo);
+}
+
+/*
+ * oooooooooo  ooooo oooo   oooo  ooooooo8
+ *  888    888  888   8888o  88 o888    88
+ *  888oooo88   888   88 888o88 888    oooo
+ *  888  88o    888   88   8888 888o    88
+ * o888o  88o8 o888o o88o    88  888ooo888
+ *
+ */
+
+static void ring_wake(module_data_t *mod)
+{
+    asc_list_for(mod->client_list)
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(mod->client_list);
+        if(client->response->is_waiting)
+        {
+            client->response->is_waiting = false;
+            asc_socket_set_on_ready(client->sock, on_ready_send_ring);
+        }
+    }
+}
+
+static void ring_flush(module_data_t *mod)
+{
+    const uint64_t pos = mod->buffer_pos + mod->buffer_size;
+    if(mod->flush_pos >= pos)
+        return;
+
+    const size_t skip = mod->flush_pos - mod->buffer_pos;
+    const size_t size = mod->buffer_size - skip;
+    const int fd = mod->fd_list[(mod->buffer_pos / mod->file_size) % mod->config.files];
+
+    if(pwrite(fd, &mod->buffer[skip], size, mod->flush_pos % mod->file_size) != (ssize_t)size)
+    {
+        /* data is lost, the stream continues with the next block */
+        if(!mod->is_error)
+        {
+            asc_log_error(MSG("write error: %s"), strerror(errno));
+            mod->is_error = true;
+        }
+    }
+    else if(mod->is_error)
+    {
+        asc_log_info(MSG("write restored"));
+        mod->is_error = false;
+    }
+
+    mod->flush_pos = pos;
+    ring_wake(mod);
+}
+
+static void on_flush_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    ring_flush(mod);
+}
+
+/* the next file of the ring, the oldest data is dropped */
+static void ring_next_file(module_data_t *mod)
+{
+    const uint64_t file_id = mod->buffer_pos / mod->file_size;
+    if(file_id < (uint64_t)mod->config.files)
+        return;
+
+    mod->tail = (file_id - mod->config.files + 1) * mod->file_size;
+
+    while(mod->index_count > 0 && INDEX_ITEM(mod, 0)->pos < mod->tail)
+    {
+        mod->index_head = (mod->index_head + 1) % mod->index_size;
+        --mod->index_count;
+    }
+}
+
+static void ring_append(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->buffer_size == TIMESHIFT_BLOCK)
+    {
+        ring_flush(mod);
+
+        mod->buffer_pos += TIMESHIFT_BLOCK;
+        mod->buffer_size = 0;
+        if(mod->buffer_pos % mod->file_size == 0)
+            ring_next_file(mod);
+    }
+
+    memcpy(&mod->buffer[mod->buffer_size], ts, TS_PACKET_SIZE);
+    mod->buffer_size += TS_PACKET_SIZE;
+}
+
+static void on_carousel_ts(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->psi_size + TS_PACKET_SIZE > mod->psi_buffer_size)
+    {
+        mod->psi_buffer_size = mod->psi_size + 4 * TS_PACKET_SIZE;
+        mod->psi_ts = (uint8_t *)realloc(mod->psi_ts, mod->psi_buffer_size);
+    }
+
+    memcpy(&mod->psi_ts[mod->psi_size], ts, TS_PACKET_SIZE);
+    mod->psi_size += TS_PACKET_SIZE;
+}
+
+static void psi_update(module_data_t *mod)
+{
+    mod->psi_size = 0;
+    if(mod->out_pat->buffer_size)
+        mpegts_carousel_send(mod->carousel, mod->out_pat);
+    if(mod->out_pmt->buffer_size)
+        mpegts_carousel_send(mod->carousel, mod->out_pmt);
+}
+
+/*
+ * ooooo oooo   oooo oooooooooo ooooo  oooo ooooooooooo
+ *  888   8888o  88   888    888 888    88  88  888  88
+ *  888   88 888o88   888oooo88  888    88      888
+ *  888   88   8888   888        888    88      888
+ * o888o o88o    88  o888o        888oo88      o888o
+ *
+ */
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    if(pid == NULL_TS_PID)
+        return;
+
+    mpegts_es_track_t *track = mod->track;
+    const uint8_t events = mpegts_es_track_mux(track, ts
+        , (const mpegts_es_tag_t *)module_stream_tag(mod, ts));
+
+    if(events & ES_TRACK_PAT_ERROR)
+        asc_log_error(MSG("PAT checksum error"));
+    else if(events & ES_TRACK_PMT_ERROR)
+        asc_log_error(MSG("PMT checksum error"));
+
+    if(events & ES_TRACK_PAT)
+    {
+        mpegts_psi_copy(mod->out_pat, track->pat);
+        mod->out_pmt->buffer_size = 0;
+        psi_update(mod);
+    }
+    else if(events & ES_TRACK_PMT)
+    {
+        mpegts_psi_copy(mod->out_pmt, track->pmt);
+        psi_update(mod);
+    }
+
+    if(events & ES_TRACK_PES_START)
+        mod->pes_pos = mod->buffer_pos + mod->buffer_size;
+
+    ring_append(mod, ts);
+
+    if(events & ES_TRACK_KEY)
+        index_append(mod, mod->pes_pos);
+}
+
+/*
+ * ooooo ooooo ooooooooooo ooooooooooo oooooooooo
+ *  888   888  88  888  88 88  888  88  888    888
+ *  888ooo888      888         888      888oooo88
+ *  888   888      888         888      888
+ * o888o o888o    o888o       o888o    o888o
+ *
+ */
+
+static void on_ready_send_ring(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    module_data_t *mod = response->mod;
+
+    ssize_t send_size;
+
+    if(response->psi_skip < response->psi_size)
+    {
+        send_size = asc_socket_send(  client->sock
+                                    , &response->psi_ts[response->psi_skip]
+                                    , response->psi_size - response->psi_skip);
+        if(send_size == -1)
+        {
+            http_client_error(client, "failed to send data [%s]", asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+
+        response->psi_skip += send_size;
+        return;
+    }
+
+    if(response->pos < mod->tail)
+    {
+        http_client_warning(client, "data is overwritten, client is too slow");
+        http_client_close(client);
+        return;
+    }
+
+    if(response->pos >= mod->flush_pos)
+    {
+        /* live edge, ring_flush() resumes the client */
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_waiting = true;
+        return;
+    }
+
+    const uint64_t file_end = response->pos - (response->pos % mod->file_size) + mod->file_size;
+    const uint64_t end = (mod->flush_pos < file_end) ? mod->flush_pos : file_end;
+
+    size_t block_size = end - response->pos;
+    if(block_size > mod->config.block_size)
+        block_size = mod->config.block_size;
+
+    const int fd = mod->fd_list[(response->pos / mod->file_size) % mod->config.files];
+    off_t file_skip = response->pos % mod->file_size;
+
+#ifdef __linux
+
+    send_size = sendfile(response->sock_fd, fd, &file_skip, block_size);
+
+    if(send_size == -1 && errno == EAGAIN)
+        return;
+    if(send_size == 0)
+        send_size = -1;
+
+#else
+
+    uint8_t buffer[HTTP_BUFFER_SIZE];
+    const ssize_t len = pread(  fd, buffer
+                              , (block_size < sizeof(buffer)) ? block_size : sizeof(buffer)
+                              , file_skip);
+    if(len <= 0)
+        send_size = -1;
+    else
+        send_size = asc_socket_send(client->sock, buffer, len);
+
+#endif
+
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send data [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->pos += send_size;
+}
+
+static void on_read_check(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+
+    uint8_t buffer[1024];
+    const ssize_t size = asc_socket_recv(client->sock, buffer, sizeof(buffer));
+    if(size <= 0)
+        http_client_close(client);
+}
+
+static void response_release(module_data_t *mod, http_client_t *client)
+{
+    asc_list_remove_item(mod->client_list, client);
+
+    free(client->response->psi_ts);
+    free(client->response);
+    client->response = NULL;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+            response_release(mod, client);
+        return 0;
+    }
+
+    if(!mod->index_count)
+    {
+        http_client_abort(client, 404, NULL);
+        return 0;
+    }
+
+    const timeshift_index_t *item = INDEX_ITEM(mod, mod->index_count - 1);
+
+    lua_getfield(lua, 4, __query);
+    if(lua_istable(lua, -1))
+    {
+        lua_getfield(lua, -1, "start");
+        if(!lua_isnil(lua, -1))
+        {
+            const char *value = lua_tostring(lua, -1);
+            char *end = NULL;
+            long long start = (value) ? strtoll(value, &end, 10) : 0;
+            if(!value || end == value || *end != '\0')
+            {
+                lua_pop(lua, 2); // start + query
+                http_client_abort(client, 400, "wrong start value");
+                return 0;
+            }
+
+            if(start <= 0)
+                start += time(NULL);
+            item = index_find(mod, (time_t)start);
+        }
+        lua_pop(lua, 1); // start
+    }
+    lua_pop(lua, 1); // query
+
+    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    http_response_t *response = client->response;
+    response->mod = mod;
+    response->sock_fd = asc_socket_fd(client->sock);
+    response->pos = item->pos;
+
+    if(mod->psi_size)
+    {
+        response->psi_ts = (uint8_t *)malloc(mod->psi_size);
+        memcpy(response->psi_ts, mod->psi_ts, mod->psi_size);
+        response->psi_size = mod->psi_size;
+    }
+
+    asc_list_insert_tail(mod->client_list, client);
+
+    client->on_send = NULL;
+    client->on_read = on_read_check;
+    client->on_ready = on_ready_send_ring;
+    client->is_keep_alive = false;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, "Pragma: no-cache");
+    http_response_header(client, "Content-Type: video/MP2T");
+    http_response_connection(client);
+    http_response_send(client);
+
+    return 0;
+}
+
+static int __module_call(lua_State *L)
+{
+    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
+    return module_call(mod);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    if(mod->index_count > 0)
+    {
+        lua_pushnumber(lua, INDEX_ITEM(mod, 0)->time);
+        lua_setfield(lua, -2, "start");
+        lua_pushnumber(lua, INDEX_ITEM(mod, mod->index_count - 1)->time);
+        lua_setfield(lua, -2, "stop");
+    }
+
+    lua_pushnumber(lua, mod->flush_pos - mod->tail);
+    lua_setfield(lua, -2, "size");
+    lua_pushnumber(lua, asc_list_size(mod->client_list));
+    lua_setfield(lua, -2, "clients");
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->config.name, NULL);
+    asc_assert(mod->config.name != NULL, "[timeshift] option 'name' is required");
+
+    module_option_string("path", &mod->config.path, NULL);
+    asc_assert(mod->config.path != NULL, MSG("option 'path' is required"));
+
+    int size = 1024;
+    module_option_number("size", &size);
+    asc_assert(size > 0, MSG("option 'size' must be greater than 0"));
+
+    mod->config.files = 16;
+    module_option_number("files", &mod->config.files);
+    asc_assert(mod->config.files > 1, MSG("option 'files' must be greater than 1"));
+
+    int block_size = 0;
+    module_option_number("block_size", &block_size);
+    mod->config.block_size = (block_size > 0) ? ((size_t)block_size * 1024) : TIMESHIFT_SENDFILE;
+
+    /* file is the whole number of the write blocks */
+    mod->file_size = (uint64_t)size * 1024 * 1024 / mod->config.files;
+    mod->file_size -= mod->file_size % TIMESHIFT_BLOCK;
+    asc_assert(mod->file_size > 0, MSG("option 'size' is too small for %d files")
+               , mod->config.files);
+
+    mod->fd_list = (int *)calloc(mod->config.files, sizeof(int));
+    for(int i = 0; i < mod->config.files; ++i)
+    {
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s/%s.%d.ts"
+                 , mod->config.path, mod->config.name, i);
+
+        const int fd = open(filename, O_CREAT | O_RDWR
+#ifdef O_CLOEXEC
+                            | O_CLOEXEC
+#endif
+                            , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        asc_assert(fd != -1, MSG("failed to open %s [%s]"), filename, strerror(errno));
+        mod->fd_list[i] = fd;
+
+#ifdef __linux
+        const int ret = posix_fallocate(fd, 0, mod->file_size);
+        if(ret != 0)
+            asc_log_warning(MSG("failed to allocate %s [%s]"), filename, strerror(ret));
+#else
+        if(ftruncate(fd, mod->file_size) != 0)
+            asc_log_warning(MSG("failed to allocate %s [%s]"), filename, strerror(errno));
+#endif
+    }
+
+    mod->buffer = (uint8_t *)malloc(TIMESHIFT_BLOCK);
+    mod->client_list = asc_list_init();
+
+    /* index the audio stream once per second */
+    mod->track = mpegts_es_track_init(1);
+    mod->out_pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    mod->out_pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
+    mod->carousel = mpegts_carousel_init(on_carousel_ts, mod);
+
+    mod->flush_timer = asc_timer_init(TIMESHIFT_FLUSH_INTERVAL, on_flush_timer, mod);
+
+    module_stream_init(mod, on_ts);
+
+    // Set callback for http route
+    lua_getmetatable(lua, 3);
+    lua_pushlightuserdata(lua, (void *)mod);
+    lua_pushcclosure(lua, __module_call, 1);
+    lua_setfield(lua, -2, "__call");
+    lua_pop(lua, 1);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    /* clients are released by the route callback */
+    while(asc_list_size(mod->client_list) > 0)
+    {
+        asc_list_first(mod->client_list);
+        http_client_close((http_client_t *)asc_list_data(mod->client_list));
+    }
+    asc_list_destroy(mod->client_list);
+
+    asc_timer_destroy(mod->flush_timer);
+    ring_flush(mod);
+
+    for(int i = 0; i < mod->config.files; ++i)
+        close(mod->fd_list[i]);
+    free(mod->fd_list);
+    free(mod->buffer);
+    free(mod->index_list);
+
+    mpegts_carousel_destroy(mod->carousel);
+    mpegts_es_track_destroy(mod->track);
+    mpegts_psi_destroy(mod->out_pat);
+    mpegts_psi_destroy(mod->out_pmt);
+    free(mod->psi_ts);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
+};
+MODULE_LUA_REGISTER(timeshift)
@@ -24,6 +24,17 @@
 #define DEFAULT_BUFFER_SIZE (1024 * 1024)
 #define DEFAULT_BUFFER_FILL (128 * 1024)
 
+/* smaller sends are cheaper to copy than to pin and notify */
+#define ZEROCOPY_MIN_SIZE (32 * 1024)
+#define ZEROCOPY_LIST_SIZE 64
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t size;
+    bool is_done;
+} zerocopy_item_t;
+
 struct module_data_t
 {
     int idx_callback;
@@ -43,7 +54,16 @@ struct http_response_t
     size_t buffer_size;
     size_t buffer_fill;
 
+    /* sent data reserved in the buffer until the zero-copy completion */
+    size_t buffer_pending;
+
     bool is_socket_busy;
+    bool is_zerocopy;
+
+    uint32_t zerocopy_id;
+    zerocopy_item_t zerocopy_list[ZEROCOPY_LIST_SIZE];
+    size_t zerocopy_head;
+    size_t zerocopy_count;
 };
 
 /*
@@ -51,6 +71,67 @@ struct http_response_t
  * client->response->mod - http_upstream module
  */
 
+static void zerocopy_push(http_response_t *response, uint32_t size, bool is_done)
+{
+    if(response->zerocopy_count > 0)
+    {
+        const size_t tail = (response->zerocopy_head + response->zerocopy_count - 1)
+                          % ZEROCOPY_LIST_SIZE;
+        zerocopy_item_t *item = &response->zerocopy_list[tail];
+        if(is_done && item->is_done)
+        {
+            item->size += size;
+            response->buffer_pending += size;
+            return;
+        }
+    }
+
+    const size_t tail = (response->zerocopy_head + response->zerocopy_count)
+                      % ZEROCOPY_LIST_SIZE;
+    zerocopy_item_t *item = &response->zerocopy_list[tail];
+    item->id = (is_done) ? 0 : response->zerocopy_id++;
+    item->size = size;
+    item->is_done = is_done;
+    ++response->zerocopy_count;
+    response->buffer_pending += size;
+}
+
+static void on_upstream_zerocopy(void *arg, uint32_t lo, uint32_t hi, bool is_copied)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(!response || !response->buffer)
+        return;
+
+    for(size_t i = 0; i < response->zerocopy_count; ++i)
+    {
+        zerocopy_item_t *item
+            = &response->zerocopy_list[(response->zerocopy_head + i) % ZEROCOPY_LIST_SIZE];
+        if(!item->is_done && (uint32_t)(item->id - lo) <= (uint32_t)(hi - lo))
+            item->is_done = true;
+    }
+
+    while(response->zerocopy_count > 0)
+    {
+        zerocopy_item_t *item = &response->zerocopy_list[response->zerocopy_head];
+        if(!item->is_done)
+            break;
+
+        response->buffer_pending -= item->size;
+        response->zerocopy_head = (response->zerocopy_head + 1) % ZEROCOPY_LIST_SIZE;
+        --response->zerocopy_count;
+    }
+
+    if(is_copied)
+    {
+        /* kernel falls back to copy (loopback, no scatter-gather).
+         * plain send is cheaper in that case */
+        ++client->send_copied;
+        response->is_zerocopy = false;
+    }
+}
+
 static void on_upstream_ready(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
@@ -58,28 +139,71 @@ static void on_upstream_ready(void *arg)
 
     if(response->buffer_count > 0)
     {
-        size_t block_size = (response->buffer_write > response->buffer_read)
-                          ? (response->buffer_write - response->buffer_read)
-                          : (response->buffer_size - response->buffer_read);
+        /* send wrapped data with one call */
+        struct iovec iov[2];
+        int iov_count = 1;
+
+        const size_t head = response->buffer_size - response->buffer_read;
+        iov[0].iov_base = &response->buffer[response->buffer_read];
+        if(head >= response->buffer_count)
+        {
+            iov[0].iov_len = response->buffer_count;
+        }
+        else
+        {
+            iov[0].iov_len = head;
+            iov[1].iov_base = response->buffer;
+            iov[1].iov_len = response->buffer_count - head;
+            iov_count = 2;
+        }
 
-        if(block_size > response->buffer_count)
-            block_size = response->buffer_count;
+        /* the last list item is reserved for the copied data */
+        bool is_zerocopy = (   response->is_zerocopy
+                            && response->buffer_count >= ZEROCOPY_MIN_SIZE
+                            && response->zerocopy_count < ZEROCOPY_LIST_SIZE - 1);
 
-        const ssize_t send_size = asc_socket_send(  client->sock
-                                                  , &response->buffer[response->buffer_read]
-                                                  , block_size);
+        ssize_t send_size;
+        if(is_zerocopy)
+        {
+            send_size = asc_socket_sendv_zerocopy(client->sock, iov, iov_count);
+            if(send_size == -1 && errno == ENOBUFS)
+            {
+                /* optmem limit is reached */
+                is_zerocopy = false;
+                send_size = asc_socket_sendv(client->sock, iov, iov_count);
+            }
+        }
+        else
+        {
+            send_size = asc_socket_sendv(client->sock, iov, iov_count);
+        }
+
+        ++client->send_calls;
 
         if(send_size > 0)
         {
+            client->send_bytes += send_size;
+
+            if(is_zerocopy)
+            {
+                ++client->send_zerocopy;
+                zerocopy_push(response, send_size, false);
+            }
+            else if(response->zerocopy_count > 0)
+            {
+                /* keep the order of the reserved data */
+                zerocopy_push(response, send_size, true);
+            }
+
             response->buffer_count -= send_size;
             response->buffer_read += send_size;
             if(response->buffer_read >= response->buffer_size)
-                response->buffer_read = 0;
+                response->buffer_read -= response->buffer_size;
         }
         else if(send_size == -1)
         {
             http_client_error(  client, "failed to send ts (%d bytes) [%s]"
-                              , block_size, asc_socket_error());
+                              , response->buffer_count, asc_socket_error());
             http_client_close(client);
             return;
         }
@@ -97,17 +221,12 @@ static void on_ts(void *arg, const uint8_t *ts)
     http_client_t *client = (http_client_t *)arg;
     http_response_t *response = client->response;
 
-    if(response->buffer_count + TS_PACKET_SIZE >= response->buffer_size)
+    if(  response->buffer_count + response->buffer_pending + TS_PACKET_SIZE
+       >= response->buffer_size)
     {
-        // overflow
+        // overflow. drop unsent data. on_upstream_ready() releases the socket
         response->buffer_count = 0;
-        response->buffer_read = 0;
-        response->buffer_write = 0;
-        if(response->is_socket_busy)
-        {
-            asc_socket_set_on_ready(client->sock, NULL);
-            response->is_socket_busy = false;
-        }
+        response->buffer_write = response->buffer_read;
         return;
     }
 
@@ -143,11 +262,42 @@ static void on_upstream_read(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
 
-    ssize_t size = asc_socket_recv(client->sock, client->buffer, HTTP_BUFFER_SIZE);
+    uint8_t buffer[1024];
+    ssize_t size = asc_socket_recv(client->sock, buffer, sizeof(buffer));
     if(size <= 0)
         http_client_close(client);
 }
 
+static void upstream_attach(  http_client_t *client, module_stream_t *upstream
+                            , const char *content_type)
+{
+    client->response->buffer = (uint8_t *)malloc(client->response->buffer_size);
+
+    // like module_stream_init()
+    client->response->__stream.self = (void *)client;
+    client->response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ts;
+    __module_stream_init(&client->response->__stream);
+    __module_stream_attach(upstream, &client->response->__stream);
+
+    client->on_read = on_upstream_read;
+    client->on_ready = on_upstream_ready;
+
+    /* wake up only when less than buffer_fill bytes are waiting in the socket */
+    asc_socket_set_notsent_lowat(client->sock, client->response->buffer_fill);
+    client->response->is_zerocopy = asc_socket_set_zerocopy(client->sock, on_upstream_zerocopy);
+
+    /* socket is busy with the response headers */
+    client->response->is_socket_busy = true;
+    client->is_keep_alive = false;
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Cache-Control: no-cache");
+    http_response_header(client, "Pragma: no-cache");
+    http_response_header(client, "Content-Type: %s", content_type);
+    http_response_header(client, "Connection: close");
+    http_response_send(client);
+}
+
 static void on_upstream_send(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
@@ -200,27 +350,33 @@ static void on_upstream_send(void *arg)
         return;
     }
 
-    client->response->buffer = (uint8_t *)malloc(client->response->buffer_size);
-
-    // like module_stream_init()
-    client->response->__stream.self = (void *)client;
-    client->response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ts;
-    __module_stream_init(&client->response->__stream);
-    __module_stream_attach(upstream, &client->response->__stream);
-
-    client->on_read = on_upstream_read;
-    client->on_ready = NULL;
-
     const char *content_type = lua_isstring(lua, 4)
                              ? lua_tostring(lua, 4)
                              : "application/octet-stream";
 
-    http_response_code(client, 200, NULL);
-    http_response_header(client, "Cache-Control: no-cache");
-    http_response_header(client, "Pragma: no-cache");
-    http_response_header(client, "Content-Type: %s", content_type);
-    http_response_header(client, "Connection: close");
-    http_response_send(client);
+    upstream_attach(client, upstream, content_type);
+}
+
+/* route to the stream without the Lua callback */
+void http_upstream_send(http_client_t *client, module_stream_t *upstream)
+{
+    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    client->response->buffer_size = DEFAULT_BUFFER_SIZE;
+    client->response->buffer_fill = DEFAULT_BUFFER_FILL;
+
+    upstream_attach(client, upstream, "application/octet-stream");
+}
+
+void http_upstream_release(http_client_t *client)
+{
+    if(!client->response)
+        return;
+
+    module_stream_destroy(client->response);
+
+    free(client->response->buffer);
+    free(client->response);
+    client->response = NULL;
 }
 
 static int module_call(module_data_t *mod)
@@ -237,11 +393,7 @@ static int module_call(module_data_t *mod)
             lua_pushvalue(lua, 4);
             lua_call(lua, 3, 0);
 
-            module_stream_destroy(client->response);
-
-            free(client->response->buffer);
-            free(client->response);
-            client->response = NULL;
+            http_upstream_release(client);
         }
         return 0;
     }
@@ -47,6 +47,8 @@ struct http_response_t
     uint32_t header_size;
     uint32_t data_size;
 
+    uint8_t header[FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE + FRAME_KEY_SIZE];
+
     uint8_t frame_key[FRAME_KEY_SIZE];
     uint8_t frame_key_i;
 
@@ -149,11 +151,11 @@ static void on_websocket_read(void *arg)
     http_response_t *response = client->response;
 
     ssize_t size;
-    uint8_t *data = (uint8_t *)client->buffer;
+    uint8_t *header = response->header;
 
     if(response->header_size == 0)
     {
-        size = asc_socket_recv(client->sock, data, FRAME_HEADER_SIZE);
+        size = asc_socket_recv(client->sock, header, FRAME_HEADER_SIZE);
         if(size <= 0)
         {
             http_client_close(client);
@@ -161,9 +163,9 @@ static void on_websocket_read(void *arg)
         }
 
         // TODO: check FIN, OPCODE
-        // const bool fin = ((data[0] & 0x80) == 0x80);
+        // const bool fin = ((header[0] & 0x80) == 0x80);
 
-        const uint8_t opcode = data[0] & 0x0F;
+        const uint8_t opcode = header[0] & 0x0F;
         if(opcode == 0x08)
         {
             http_client_close(client);
@@ -176,7 +178,7 @@ static void on_websocket_read(void *arg)
             return;
         }
 
-        const uint8_t data_size = data[1] & 0x7F;
+        const uint8_t data_size = header[1] & 0x7F;
         if(data_size < 126)
             response->header_size = FRAME_HEADER_SIZE + FRAME_SIZE8_SIZE + FRAME_KEY_SIZE;
         else if(data_size == 126)
@@ -196,7 +198,7 @@ static void on_websocket_read(void *arg)
     if(response->data_size == 0)
     {
         size = asc_socket_recv(  client->sock
-                                       , &data[FRAME_HEADER_SIZE]
+                                       , &header[FRAME_HEADER_SIZE]
                                        , response->header_size - FRAME_HEADER_SIZE);
         if(size <= 0)
         {
@@ -204,36 +206,37 @@ static void on_websocket_read(void *arg)
             return;
         }
 
-        const uint8_t data_size = data[1] & 0x7F;
+        const uint8_t data_size = header[1] & 0x7F;
         if(data_size < 126)
         {
             response->data_size = data_size;
         }
         else if(data_size == 126)
         {
-            response->data_size = (data[2] << 8) | data[3];
+            response->data_size = (header[2] << 8) | header[3];
         }
         else if(data_size == 127)
         {
-            if(data[2] || data[3] || data[4] || data[5])
+            if(header[2] || header[3] || header[4] || header[5])
             {
                 http_client_error(client, "wrong frame size");
                 http_client_close(client);
                 return;
             }
-            response->data_size = (  (data[6] << 24)
-                                   | (data[7] << 16)
-                                   | (data[8] << 8 )
-                                   | (data[9]      ));
+            response->data_size = (  (header[6] << 24)
+                                   | (header[7] << 16)
+                                   | (header[8] << 8 )
+                                   | (header[9]      ));
         }
 
         response->frame_key_i = 0;
         memcpy(  response->frame_key
-               , &data[response->header_size - FRAME_KEY_SIZE]
+               , &header[response->header_size - FRAME_KEY_SIZE]
                , FRAME_KEY_SIZE);
         return;
     }
 
+    uint8_t data[HTTP_BUFFER_SIZE];
     const uint32_t data_size = (response->data_size <= HTTP_BUFFER_SIZE)
                              ? response->data_size
                              : HTTP_BUFFER_SIZE;
@@ -497,7 +497,10 @@ bool http_parse_chunk(const char *str, size_t size, parse_match_t *match)
             return true;
         }
         else if(c == ';')
+        {
+            match[1].eo = skip;
             break;
+        }
         else
             return false;
     }
@@ -126,6 +126,8 @@ struct module_data_t
         size_t buffer_fill;
     } sync;
 
+    mpegts_sync_t *ts_sync;
+
     uint64_t pcr;
 };
 
@@ -276,6 +278,12 @@ static void on_close(void *arg)
         mod->sync.buffer = NULL;
     }
 
+    if(mod->ts_sync)
+    {
+        mpegts_sync_destroy(mod->ts_sync);
+        mod->ts_sync = NULL;
+    }
+
     if(mod->idx_response)
     {
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_response);
@@ -316,27 +324,9 @@ static bool seek_pcr(  module_data_t *mod
 {
     size_t count;
 
-    while(1)
-    {
-        if(mod->sync.buffer_count < 2 * TS_PACKET_SIZE)
-            return false;
-
-        count = mod->sync.buffer_read + TS_PACKET_SIZE;
-        if(count >= mod->sync.buffer_size)
-            count -= mod->sync.buffer_size;
-
-        if(   mod->sync.buffer[mod->sync.buffer_read] == 0x47
-           && mod->sync.buffer[count] == 0x47)
-        {
-            break;
-        }
-
-        ++mod->sync.buffer_read;
-        if(mod->sync.buffer_read >= mod->sync.buffer_size)
-            mod->sync.buffer_read = 0;
-
-        --mod->sync.buffer_count;
-    }
+    /* buffer is aligned by thread_on_ts() */
+    if(mod->sync.buffer_count < 2 * TS_PACKET_SIZE)
+        return false;
 
     uint8_t *ptr, ts[TS_PACKET_SIZE];
 
@@ -406,6 +396,44 @@ static void on_thread_read(void *arg)
         module_stream_send(mod, ts);
 }
 
+/* appends the packet to the ring buffer */
+static void thread_on_ts(void *arg, const uint8_t *ts)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->sync.buffer_count + TS_PACKET_SIZE > mod->sync.buffer_size)
+        return; /* overflow */
+
+    const size_t tail = mod->sync.buffer_size - mod->sync.buffer_write;
+    if(tail > TS_PACKET_SIZE)
+    {
+        memcpy(&mod->sync.buffer[mod->sync.buffer_write], ts, TS_PACKET_SIZE);
+        mod->sync.buffer_write += TS_PACKET_SIZE;
+    }
+    else
+    {
+        memcpy(&mod->sync.buffer[mod->sync.buffer_write], ts, tail);
+        mod->sync.buffer_write = TS_PACKET_SIZE - tail;
+        memcpy(mod->sync.buffer, &ts[tail], mod->sync.buffer_write);
+    }
+
+    mod->sync.buffer_count += TS_PACKET_SIZE;
+}
+
+/* receives into the staging buffer, packets are queued by thread_on_ts() */
+static ssize_t thread_recv(module_data_t *mod)
+{
+    size_t size = mod->sync.buffer_size - mod->sync.buffer_count;
+    if(size > sizeof(mod->buffer))
+        size = sizeof(mod->buffer);
+
+    const ssize_t len = asc_socket_recv(mod->sock, mod->buffer, size);
+    if(len > 0)
+        mpegts_sync_push(mod->ts_sync, (const uint8_t *)mod->buffer, len);
+
+    return len;
+}
+
 static void thread_loop(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -430,22 +458,19 @@ static void thread_loop(void *arg)
         mod->sync.buffer_count = 0;
         mod->sync.buffer_write = 0;
         mod->sync.buffer_read = 0;
+        mpegts_sync_reset(mod->ts_sync);
 
         // check timeout
-        system_time_check = asc_utime();
+        system_time_check = asc_clock_fast();
 
         while(   mod->is_thread_started
-              && mod->sync.buffer_write < mod->sync.buffer_size)
+              && mod->sync.buffer_count + TS_PACKET_SIZE <= mod->sync.buffer_size)
         {
-            system_time = asc_utime();
+            system_time = asc_clock_fast();
 
-            const ssize_t size = asc_socket_recv(  mod->sock
-                                                 , &mod->sync.buffer[mod->sync.buffer_write]
-                                                 , mod->sync.buffer_size - mod->sync.buffer_write);
-            if(size > 0)
+            if(thread_recv(mod) > 0)
             {
                 system_time_check = system_time;
-                mod->sync.buffer_write += size;
             }
             else
             {
@@ -457,10 +482,6 @@ static void thread_loop(void *arg)
                 asc_usleep(1000);
             }
         }
-        mod->sync.buffer_count = mod->sync.buffer_write;
-        if(mod->sync.buffer_write == mod->sync.buffer_size)
-            mod->sync.buffer_write = 0;
-
         if(!seek_pcr(mod, &block_size, &next_block, &mod->pcr))
         {
             asc_log_error(MSG("first PCR is not found"));
@@ -477,26 +498,13 @@ static void thread_loop(void *arg)
             if(reset)
             {
                 reset = false;
-                block_time_total = asc_utime();
+                block_time_total = asc_clock_fast();
             }
 
             if(   mod->is_thread_started
-               && mod->sync.buffer_count < mod->sync.buffer_size)
+               && mod->sync.buffer_count + TS_PACKET_SIZE <= mod->sync.buffer_size)
             {
-                const size_t tail = (mod->sync.buffer_read > mod->sync.buffer_write)
-                                  ? (mod->sync.buffer_read - mod->sync.buffer_write)
-                                  : (mod->sync.buffer_size - mod->sync.buffer_write);
-
-                const ssize_t l = asc_socket_recv(  mod->sock
-                                                  , &mod->sync.buffer[mod->sync.buffer_write]
-                                                  , tail);
-                if(l > 0)
-                {
-                    mod->sync.buffer_write += l;
-                    if(mod->sync.buffer_write >= mod->sync.buffer_size)
-                        mod->sync.buffer_write = 0;
-                    mod->sync.buffer_count += l;
-                }
+                thread_recv(mod);
             }
 
             // get PCR
@@ -519,7 +527,7 @@ static void thread_loop(void *arg)
                 continue;
             }
 
-            system_time = asc_utime();
+            system_time = asc_clock_fast();
             if(block_time_total > system_time + 100)
                 asc_usleep(block_time_total - system_time);
 
@@ -527,7 +535,7 @@ static void thread_loop(void *arg)
             const uint32_t ts_sync = block_time / ts_count;
             const uint32_t block_time_tail = block_time % ts_count;
 
-            system_time_check = asc_utime();
+            system_time_check = asc_clock_fast();
 
             while(mod->is_thread_started && mod->sync.buffer_read != next_block)
             {
@@ -559,7 +567,7 @@ static void thread_loop(void *arg)
                     // overflow
                 }
 
-                system_time = asc_utime();
+                system_time = asc_clock_fast();
                 block_time_total += ts_sync;
 
                 if(  (system_time < system_time_check) /* <-0s */
@@ -582,7 +590,7 @@ static void thread_loop(void *arg)
             if(reset)
                 continue;
 
-            system_time = asc_utime();
+            system_time = asc_clock_fast();
             if(system_time > block_time_total + 100000)
             {
                 asc_log_warning(  MSG("wrong syncing time. -%"PRIu64"ms")
@@ -613,9 +621,7 @@ static void on_ts_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    ssize_t size = asc_socket_recv(  mod->sock
-                                   , &mod->sync.buffer[mod->sync.buffer_write]
-                                   , mod->sync.buffer_size - mod->sync.buffer_write);
+    ssize_t size = asc_socket_recv(mod->sock, mod->sync.buffer, mod->sync.buffer_size);
     if(size <= 0)
     {
         on_close(mod);
@@ -623,34 +629,7 @@ static void on_ts_read(void *arg)
     }
 
     mod->is_active = true;
-    mod->sync.buffer_write += size;
-    mod->sync.buffer_read = 0;
-
-    while(1)
-    {
-        while(mod->sync.buffer[mod->sync.buffer_read] != 0x47)
-        {
-            ++mod->sync.buffer_read;
-            if(mod->sync.buffer_read >= mod->sync.buffer_write)
-            {
-                mod->sync.buffer_write = 0;
-                return;
-            }
-        }
-
-        const size_t next = mod->sync.buffer_read + TS_PACKET_SIZE;
-        if(next > mod->sync.buffer_write)
-        {
-            const size_t tail = mod->sync.buffer_write - mod->sync.buffer_read;
-            if(tail > 0)
-                memmove(mod->sync.buffer, &mod->sync.buffer[mod->sync.buffer_read], tail);
-            mod->sync.buffer_write = tail;
-            return;
-        }
-
-        module_stream_send(mod, &mod->sync.buffer[mod->sync.buffer_read]);
-        mod->sync.buffer_read += TS_PACKET_SIZE;
-    }
+    mpegts_sync_push(mod->ts_sync, mod->sync.buffer, size);
 }
 
 /*
@@ -866,6 +845,9 @@ static void on_read(void *arg)
 
             if(!mod->config.sync)
             {
+                mod->ts_sync = mpegts_sync_init(  (ts_callback_t)__module_stream_send
+                                                , &mod->__stream);
+
                 mod->timeout = asc_timer_init(mod->timeout_ms, check_is_active, mod);
 
                 asc_socket_set_on_read(mod->sock, on_ts_read);
@@ -877,6 +859,8 @@ static void on_read(void *arg)
                 asc_socket_set_on_ready(mod->sock, NULL);
                 asc_socket_set_on_close(mod->sock, NULL);
 
+                mod->ts_sync = mpegts_sync_init(thread_on_ts, mod);
+
                 mod->thread = asc_thread_init(mod);
                 mod->thread_output = asc_thread_buffer_init(mod->sync.buffer_size);
                 asc_thread_start(  mod->thread
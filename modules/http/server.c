@@ -29,6 +29,9 @@
  *      http_version - string, default value: "HTTP/1.1"
  *      sctp         - boolean, use sctp instead of tcp
  *      route        - list, format: { { "/path", callback }, ... }
+ *                     callback could be a module instance with the stream,
+ *                     the client is attached to the stream without Lua.
+ *                     the instance is referenced while the route exists
  *
  * Module Methods:
  *      port()      - return number, server port
@@ -43,12 +46,54 @@
  *                    * content - string, response body from the string
  *      data(client)
  *                  - return table, client data
+ *      stat(client)
+ *                  - return table, egress statistics of the streaming client:
+ *                    bytes, syscalls, bytes_per_syscall, syscalls_per_sec,
+ *                    zerocopy - number of the zero-copy sends,
+ *                    zerocopy_copied - zero-copy sends copied by the kernel
+ *      add_route(path, callback)
+ *                  - add route or replace callback of the existing one
+ *      remove_route(path)
+ *                  - remove route, return true if the route is found.
+ *                    connected clients are not closed
+ *
+ * Route path is an exact path or a pattern with the asterisk. The asterisk
+ * at the end matches any tail of the path, in the middle it matches the part
+ * between the prefix and the suffix. Exact paths are checked first, then
+ * patterns with the longest prefix.
+ *
+ * Connection is kept open after the response with the content, requests
+ * pipelined by the client are processed in order. The callback is called
+ * with nil request when the response is sent. Headers of the request are
+ * parsed on the first access to request.headers.
  */
 
 #include "http.h"
 
 #define MSG(_msg) "[http_server %s:%d] " _msg, mod->addr, mod->port
 
+/* pause of the accept if the process is out of the file descriptors */
+#define ACCEPT_PAUSE_INTERVAL 1000
+
+typedef struct route_t route_t;
+
+struct route_t
+{
+    char *path;
+    size_t path_size;
+    uint32_t hash;
+    route_t *next;
+
+    // pattern: prefix*suffix
+    size_t prefix_size;
+    const char *suffix;
+    size_t suffix_size;
+
+    // callback or the stream instance
+    int idx_callback;
+    module_stream_t *upstream;
+};
+
 struct module_data_t
 {
     int idx_self;
@@ -58,17 +103,22 @@ struct module_data_t
     const char *server_name;
     const char *http_version;
 
-    asc_list_t *routes;
+    // exact paths
+    route_t **route_hash;
+    size_t route_hash_size;
+    size_t route_count;
+    // paths with the wildcard, ordered by the prefix size
+    route_t **pattern_list;
+    size_t pattern_count;
 
     asc_socket_t *sock;
-    asc_list_t *clients;
-};
+    http_client_t *clients;
+    size_t client_count;
 
-typedef struct
-{
-    const char *path;
-    int idx_callback;
-} route_t;
+    asc_timer_t *accept_timer;
+
+    int idx_request_meta;
+};
 
 static const char __method[] = "method";
 static const char __version[] = "version";
@@ -81,6 +131,10 @@ static const char __message[] = "message";
 
 static const char __content_length[] = "Content-Length: ";
 static const char __connection_close[] = "Connection: close";
+static const char __connection_keep_alive[] = "Connection: keep-alive";
+
+/* key of the raw headers in the request table */
+static const char __header_block[] = "header_block";
 
 /*
  *   oooooooo8 ooooo       ooooo ooooooooooo oooo   oooo ooooooooooo
@@ -93,6 +147,14 @@ static const char __connection_close[] = "Connection: close";
 
 static void callback(http_client_t *client)
 {
+    if(!client->idx_callback)
+    {
+        /* stream route */
+        if(client->status != 3)
+            http_upstream_release(client);
+        return;
+    }
+
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_callback);
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->mod->idx_self);
     lua_pushlightuserdata(lua, client);
@@ -103,26 +165,54 @@ static void callback(http_client_t *client)
     lua_call(lua, 3, 0);
 }
 
-static void on_client_close(void *arg)
+static void client_buffer_alloc(http_client_t *client, size_t size)
 {
-    http_client_t *client = (http_client_t *)arg;
-    module_data_t *mod = client->mod;
-
-    if(!client->sock)
+    if(size <= client->buffer_size)
         return;
 
-    asc_socket_close(client->sock);
-    client->sock = NULL;
+    client->buffer = (char *)realloc(client->buffer, size);
+    client->buffer_size = size;
+}
 
-    if(client->status == 3)
+static void client_buffer_release(http_client_t *client)
+{
+    free(client->buffer);
+    client->buffer = NULL;
+    client->buffer_size = 0;
+    client->buffer_skip = 0;
+}
+
+static void client_link(module_data_t *mod, http_client_t *client)
+{
+    client->prev = NULL;
+    client->next = mod->clients;
+    if(mod->clients)
+        mod->clients->prev = client;
+    mod->clients = client;
+    ++mod->client_count;
+}
+
+static void client_unlink(module_data_t *mod, http_client_t *client)
+{
+    if(client->prev)
+        client->prev->next = client->next;
+    else
+        mod->clients = client->next;
+
+    if(client->next)
+        client->next->prev = client->prev;
+
+    --mod->client_count;
+}
+
+static void client_release_request(http_client_t *client)
+{
+    if(client->idx_callback)
     {
-        client->status = 0;
-        callback(client);
+        luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_callback);
+        client->idx_callback = 0;
     }
 
-    if(client->response)
-        asc_log_error(MSG("client instance is not released"));
-
     if(client->idx_content)
     {
         luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_content);
@@ -146,38 +236,308 @@ static void on_client_close(void *arg)
         string_buffer_free(client->content);
         client->content = NULL;
     }
+}
+
+static void on_client_close(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    module_data_t *mod = client->mod;
+
+    if(!client->sock)
+        return;
+
+    asc_socket_close(client->sock);
+    client->sock = NULL;
+
+    if(client->status == 3)
+    {
+        client->status = 0;
+        callback(client);
+    }
+
+    if(client->response)
+        asc_log_error(MSG("client instance is not released"));
 
-    asc_list_remove_item(mod->clients, client);
+    client_release_request(client);
+
+    client_unlink(mod, client);
+    free(client->pipeline);
+    free(client->buffer);
     free(client);
 }
 
-static bool routecmp(const char *path, const char *route)
+/*
+ * oooooooooo    ooooooo  ooooo  oooo ooooooooooo ooooooooooo
+ *  888    888 o888   888o 888    88  88  888  88  888    88
+ *  888oooo88  888     888 888    88      888      888ooo8
+ *  888  88o   888o   o888 888    88      888      888    oo
+ * o888o  88o8   88ooo88    888oo88      o888o    o888ooo8888
+ *
+ */
+
+static uint32_t route_hash(const char *path, size_t size)
 {
-    size_t skip = 0;
-    while(1)
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+    for(size_t i = 0; i < size; ++i)
     {
-        const char cp = path[skip];
-        const char cr = route[skip];
+        hash ^= (uint8_t)path[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
 
-        if(cp == cr)
+static void route_free(route_t *route)
+{
+    if(route->idx_callback)
+        luaL_unref(lua, LUA_REGISTRYINDEX, route->idx_callback);
+    free(route->path);
+    free(route);
+}
+
+static route_t ** route_find_exact(module_data_t *mod, const char *path, size_t size, uint32_t hash)
+{
+    if(!mod->route_hash_size)
+        return NULL;
+
+    route_t **route = &mod->route_hash[hash & (mod->route_hash_size - 1)];
+    for(; *route; route = &(*route)->next)
+    {
+        if(   (*route)->hash == hash
+           && (*route)->path_size == size
+           && memcmp((*route)->path, path, size) == 0)
         {
-            if(cp == '\0')
-                return true;
+            return route;
+        }
+    }
 
-            ++skip;
+    return NULL;
+}
+
+static void route_insert_exact(module_data_t *mod, route_t *route)
+{
+    if((mod->route_count + 1) * 4 > mod->route_hash_size * 3)
+    {
+        const size_t hash_size = (mod->route_hash_size) ? (mod->route_hash_size * 2) : 64;
+        route_t **route_hash = (route_t **)calloc(hash_size, sizeof(route_t *));
+
+        for(size_t i = 0; i < mod->route_hash_size; ++i)
+        {
+            route_t *item = mod->route_hash[i];
+            while(item)
+            {
+                route_t *next = item->next;
+                route_t **bucket = &route_hash[item->hash & (hash_size - 1)];
+                item->next = *bucket;
+                *bucket = item;
+                item = next;
+            }
         }
-        else
+
+        free(mod->route_hash);
+        mod->route_hash = route_hash;
+        mod->route_hash_size = hash_size;
+    }
+
+    route_t **bucket = &mod->route_hash[route->hash & (mod->route_hash_size - 1)];
+    route->next = *bucket;
+    *bucket = route;
+    ++mod->route_count;
+}
+
+static void route_insert_pattern(module_data_t *mod, route_t *route)
+{
+    mod->pattern_list = (route_t **)realloc(
+        mod->pattern_list, (mod->pattern_count + 1) * sizeof(route_t *));
+
+    /* after the patterns with the same prefix size */
+    size_t i = mod->pattern_count;
+    while(i > 0 && mod->pattern_list[i - 1]->prefix_size < route->prefix_size)
+    {
+        mod->pattern_list[i] = mod->pattern_list[i - 1];
+        --i;
+    }
+    mod->pattern_list[i] = route;
+    ++mod->pattern_count;
+}
+
+static route_t * route_find(module_data_t *mod, const char *path)
+{
+    const size_t size = strlen(path);
+
+    route_t **exact = route_find_exact(mod, path, size, route_hash(path, size));
+    if(exact)
+        return *exact;
+
+    for(size_t i = 0; i < mod->pattern_count; ++i)
+    {
+        route_t *route = mod->pattern_list[i];
+        if(   size >= route->prefix_size + route->suffix_size
+           && memcmp(path, route->path, route->prefix_size) == 0
+           && memcmp(&path[size - route->suffix_size], route->suffix, route->suffix_size) == 0)
         {
-            if(cr == '*')
-                return true;
+            return route;
+        }
+    }
 
-            break;
+    return NULL;
+}
+
+/* route with the same path */
+static route_t * route_get(module_data_t *mod, const char *path)
+{
+    if(!strchr(path, '*'))
+    {
+        const size_t size = strlen(path);
+        route_t **item = route_find_exact(mod, path, size, route_hash(path, size));
+        return (item) ? *item : NULL;
+    }
+
+    for(size_t i = 0; i < mod->pattern_count; ++i)
+    {
+        if(strcmp(mod->pattern_list[i]->path, path) == 0)
+            return mod->pattern_list[i];
+    }
+
+    return NULL;
+}
+
+/* Stack: -1 - callback or stream */
+static bool lua_is_call(int idx)
+{
+    bool is_call = false;
+
+    if(lua_isfunction(lua, idx))
+        is_call = true;
+    else if(lua_istable(lua, idx))
+    {
+        if(lua_getmetatable(lua, idx))
+        {
+            lua_getfield(lua, -1, "__call");
+            is_call = lua_isfunction(lua, -1);
+            lua_pop(lua, 2);
+        }
+    }
+
+    return is_call;
+}
+
+/* module instance with the stream, the callable instance is the callback */
+static bool lua_is_stream(int idx)
+{
+    bool is_stream = false;
+
+    if(lua_istable(lua, idx))
+    {
+        lua_getfield(lua, idx, "stream");
+        is_stream = lua_isfunction(lua, -1);
+        lua_pop(lua, 1);
+    }
+
+    return is_stream;
+}
+
+static void route_set(module_data_t *mod, const char *path)
+{
+    const size_t size = strlen(path);
+    const char *wildcard = strchr(path, '*');
+
+    route_t *route = route_get(mod, path);
+    if(!route)
+    {
+        route = (route_t *)calloc(1, sizeof(route_t));
+        route->path = strdup(path);
+        route->path_size = size;
+
+        if(!wildcard)
+        {
+            route->hash = route_hash(path, size);
+            route->prefix_size = size;
+            route_insert_exact(mod, route);
         }
+        else
+        {
+            route->prefix_size = wildcard - path;
+            route->suffix = &route->path[route->prefix_size + 1];
+            route->suffix_size = size - route->prefix_size - 1;
+            route_insert_pattern(mod, route);
+        }
+    }
+
+    if(route->idx_callback)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, route->idx_callback);
+        route->idx_callback = 0;
+    }
+
+    route->upstream = NULL;
+    if(!lua_is_call(-1) && lua_is_stream(-1))
+    {
+        lua_getfield(lua, -1, "stream");
+        lua_pushvalue(lua, -2);
+        lua_call(lua, 1, 1);
+        route->upstream = (module_stream_t *)lua_touserdata(lua, -1);
+        lua_pop(lua, 1);
+    }
+    route->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+}
+
+static bool route_remove(module_data_t *mod, const char *path)
+{
+    const size_t size = strlen(path);
+    if(!strchr(path, '*'))
+    {
+        route_t **item = route_find_exact(mod, path, size, route_hash(path, size));
+        if(!item)
+            return false;
+
+        route_t *route = *item;
+        *item = route->next;
+        --mod->route_count;
+        route_free(route);
+        return true;
+    }
+
+    for(size_t i = 0; i < mod->pattern_count; ++i)
+    {
+        route_t *route = mod->pattern_list[i];
+        if(strcmp(route->path, path) != 0)
+            continue;
+
+        --mod->pattern_count;
+        memmove(  &mod->pattern_list[i], &mod->pattern_list[i + 1]
+                , (mod->pattern_count - i) * sizeof(route_t *));
+        route_free(route);
+        return true;
     }
 
     return false;
 }
 
+static void route_clear(module_data_t *mod)
+{
+    for(size_t i = 0; i < mod->route_hash_size; ++i)
+    {
+        route_t *route = mod->route_hash[i];
+        while(route)
+        {
+            route_t *next = route->next;
+            route_free(route);
+            route = next;
+        }
+    }
+    free(mod->route_hash);
+    mod->route_hash = NULL;
+    mod->route_hash_size = 0;
+    mod->route_count = 0;
+
+    for(size_t i = 0; i < mod->pattern_count; ++i)
+        route_free(mod->pattern_list[i]);
+    free(mod->pattern_list);
+    mod->pattern_list = NULL;
+    mod->pattern_count = 0;
+}
+
 /*
  * oooooooooo  ooooooooooo      o      ooooooooo
  *  888    888  888    88      888      888    88o
@@ -187,60 +547,147 @@ static bool routecmp(const char *path, const char *route)
  *
  */
 
-static void on_client_read(void *arg)
+/* resumable search of the empty line, the each byte is checked once */
+static bool client_find_eoh(http_client_t *client)
 {
-    http_client_t *client = (http_client_t *)arg;
-    module_data_t *mod = client->mod;
+    static const char eoh[] = "\r\n\r\n";
 
-    ssize_t size = asc_socket_recv(  client->sock
-                                   , &client->buffer[client->buffer_skip]
-                                   , HTTP_BUFFER_SIZE - client->buffer_skip);
-    if(size <= 0)
+    size_t skip = client->header_skip;
+    int state = client->header_state;
+
+    while(skip < client->buffer_skip)
     {
-        on_client_close(client);
-        return;
+        if(state == 0)
+        {
+            const char *cr = (const char *)memchr(  &client->buffer[skip], '\r'
+                                                  , client->buffer_skip - skip);
+            if(!cr)
+            {
+                skip = client->buffer_skip;
+                break;
+            }
+            skip = cr - client->buffer;
+        }
+
+        const char c = client->buffer[skip];
+        ++skip;
+
+        if(c == eoh[state])
+        {
+            ++state;
+            if(state == 4)
+                break;
+        }
+        else
+            state = (c == '\r') ? 1 : 0;
     }
 
-    if(client->status == 3)
+    client->header_skip = skip;
+    client->header_state = state;
+
+    return (state == 4);
+}
+
+static bool header_is(const char *header, const parse_match_t *m, const char *name)
+{
+    const size_t size = strlen(name);
+    return (m[1].eo == size && strncasecmp(header, name, size) == 0);
+}
+
+static bool header_has_token(const char *header, const parse_match_t *m, const char *token)
+{
+    const size_t size = strlen(token);
+    for(size_t i = m[2].so; i + size <= m[2].eo; ++i)
     {
-        asc_log_warning(MSG("received data after request"));
-        return;
+        if(strncasecmp(&header[i], token, size) == 0)
+            return true;
     }
+    return false;
+}
+
+static void push_headers(const char *buffer, size_t size)
+{
+    parse_match_t m[4];
+    size_t skip = 0;
+
+    lua_newtable(lua);
+    while(skip < size && http_parse_header(&buffer[skip], size - skip, m))
+    {
+        if(m[1].eo == 0)
+            break;
+
+        lua_string_to_lower(&buffer[skip], m[1].eo);
+        lua_pushlstring(lua, &buffer[skip + m[2].so], m[2].eo - m[2].so);
+        lua_settable(lua, -3);
+
+        skip += m[0].eo;
+    }
+}
+
+/* request.headers is created on the first access */
+static int request_index(lua_State *L)
+{
+    __uarg(L);
+
+    const int request = 1;
+    if(lua_type(lua, 2) != LUA_TSTRING || strcmp(lua_tostring(lua, 2), __headers) != 0)
+        return 0;
+
+    lua_pushlightuserdata(lua, (void *)__header_block);
+    lua_rawget(lua, request);
+    if(!lua_isstring(lua, -1))
+        return 0;
+
+    size_t size = 0;
+    const char *block = lua_tolstring(lua, -1, &size);
+    push_headers(block, size);
+
+    lua_pushstring(lua, __headers);
+    lua_pushvalue(lua, -2);
+    lua_rawset(lua, request);
+
+    lua_pushlightuserdata(lua, (void *)__header_block);
+    lua_pushnil(lua);
+    lua_rawset(lua, request);
+
+    return 1;
+}
+
+/* the next requests are processed when the response is sent */
+static void client_pipeline_save(http_client_t *client, size_t skip)
+{
+    const size_t size = client->buffer_skip - skip;
+    if(size > 0)
+    {
+        client->pipeline = (char *)realloc(client->pipeline, client->pipeline_size + size);
+        memcpy(&client->pipeline[client->pipeline_size], &client->buffer[skip], size);
+        client->pipeline_size += size;
+    }
+    client->buffer_skip = 0;
+}
+
+static void client_process(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
 
     char *uri_host = NULL;
     size_t uri_host_size = 0;
 
-    size_t eoh = 0; // end of headers
     size_t skip = 0;
-    client->buffer_skip += size;
 
     if(client->status == 0)
     {
-        // check empty line
-        while(skip < client->buffer_skip)
-        {
-            if(   client->buffer[skip + 0] == '\r'
-               && client->buffer[skip + 1] == '\n'
-               && client->buffer[skip + 2] == '\r'
-               && client->buffer[skip + 3] == '\n')
-            {
-                eoh = skip + 4;
-                client->status = 1; // empty line is found
-                break;
-            }
-            ++skip;
-        }
-
-        if(client->status != 1)
+        if(!client_find_eoh(client))
             return;
+
+        client->status = 1; // empty line is found
     }
 
     if(client->status == 1)
     {
+        const size_t eoh = client->header_skip; // end of headers
         parse_match_t m[4];
 
-        skip = 0;
-
 /*
  *     oooooooooo  ooooooooooo  ooooooo  ooooo  oooo ooooooooooo  oooooooo8 ooooooooooo
  *      888    888  888    88 o888   888o 888    88   888    88  888        88  888  88
@@ -260,6 +707,9 @@ static void on_client_read(void *arg)
         lua_newtable(lua);
         const int request = lua_gettop(lua);
 
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_request_meta);
+        lua_setmetatable(lua, request);
+
         lua_pushvalue(lua, -1);
         if(client->idx_request)
             luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_request);
@@ -332,6 +782,9 @@ static void on_client_read(void *arg)
         lua_pushlstring(lua, &client->buffer[m[3].so], m[3].eo - m[3].so);
         lua_setfield(lua, request, __version);
 
+        client->is_http10 = (   m[3].eo - m[3].so == 8
+                             && memcmp(&client->buffer[m[3].so], "HTTP/1.0", 8) == 0);
+
         skip = m[0].eo;
 
 /*
@@ -343,16 +796,20 @@ static void on_client_read(void *arg)
  *
  */
 
-        lua_newtable(lua);
-        lua_pushvalue(lua, -1);
-        lua_setfield(lua, request, __headers);
-        const int headers = lua_gettop(lua);
+        /* Lua table is created by request_index(), only the required
+         * headers are parsed here */
+        const size_t header_skip = skip;
+        bool is_close = client->is_http10;
+
+        client->chunk_left = 0;
+        client->is_content_length = false;
 
         while(skip < eoh)
         {
             if(!http_parse_header(&client->buffer[skip], eoh - skip, m))
             {
                 asc_log_error(MSG("failed to parse request headers"));
+                lua_pop(lua, 1); // request
                 on_client_close(client);
                 return;
             }
@@ -364,63 +821,82 @@ static void on_client_read(void *arg)
                 break;
             }
 
-            lua_string_to_lower(&client->buffer[skip], m[1].eo);
-            lua_pushlstring(lua, &client->buffer[skip + m[2].so], m[2].eo - m[2].so);
-            lua_settable(lua, headers);
+            const char *header = &client->buffer[skip];
+            if(header_is(header, m, "content-length"))
+            {
+                client->chunk_left = strtoul(&header[m[2].so], NULL, 10);
+            }
+            else if(header_is(header, m, "connection"))
+            {
+                if(header_has_token(header, m, "close"))
+                    is_close = true;
+                else if(header_has_token(header, m, "keep-alive"))
+                    is_close = false;
+            }
 
             skip += m[0].eo;
         }
 
+        client->is_keep_alive = !is_close;
+
+        lua_pushlightuserdata(lua, (void *)__header_block);
+        lua_pushlstring(lua, &client->buffer[header_skip], skip - header_skip);
+        lua_rawset(lua, request);
+
         if(uri_host)
         {
+            lua_getfield(lua, request, __headers);
             lua_pushlstring(lua, uri_host, uri_host_size);
-            lua_setfield(lua, headers, "host");
+            lua_setfield(lua, -2, "host");
+            lua_pop(lua, 1); // headers
         }
 
-        lua_getfield(lua, headers, "content-length");
-        if(lua_isnumber(lua, -1))
+        if(client->chunk_left > 0)
         {
-            client->chunk_left = lua_tonumber(lua, -1);
-            if(client->chunk_left > 0)
-            {
-                if(client->content)
-                    string_buffer_free(client->content);
-                client->content = string_buffer_alloc();
-                client->is_content_length = true;
-            }
+            if(client->content)
+                string_buffer_free(client->content);
+            client->content = string_buffer_alloc();
+            client->is_content_length = true;
         }
-        lua_pop(lua, 1); // content-length
 
-        lua_pop(lua, 2); // headers + request
+        lua_pop(lua, 1); // request
 
-        client->idx_callback = 0;
-        asc_list_for(mod->routes)
+        const route_t *route = route_find(mod, path);
+        if(!route)
         {
-            route_t *route = (route_t *)asc_list_data(mod->routes);
-            if(routecmp(path, route->path))
-            {
-                client->idx_callback = route->idx_callback;
-                break;
-            }
+            http_client_warning(client, "route not found %s", path);
+            http_client_abort(client, 404, NULL);
+            return;
         }
 
-        if(!client->idx_callback)
+        if(route->upstream && !route->upstream->self)
         {
-            http_client_warning(client, "route not found %s", path);
+            /* module is destroyed but the instance is still referenced */
+            http_client_warning(client, "stream is destroyed %s", path);
+            route_remove(mod, route->path);
             http_client_abort(client, 404, NULL);
             return;
         }
 
-        if(!client->content)
+        if(route->upstream)
         {
+            /* request content is ignored */
             client->status = 3;
-            callback(client);
+            client->is_keep_alive = false;
+            client_pipeline_save(client, client->buffer_skip);
+            http_upstream_send(client, route->upstream);
             return;
         }
 
-        if(skip >= client->buffer_skip)
+        /* route could be removed before the client is closed */
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, route->idx_callback);
+        client->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+        if(!client->content)
         {
-            client->buffer_skip = 0;
+            client->status = 3;
+            client_pipeline_save(client, skip);
+            callback(client);
             return;
         }
     }
@@ -437,33 +913,126 @@ static void on_client_read(void *arg)
     // Content-Length: *
     if(client->is_content_length)
     {
-        const size_t tail = client->buffer_skip - skip;
+        size_t tail = client->buffer_skip - skip;
+        if(tail > client->chunk_left)
+            tail = client->chunk_left;
 
-        if(client->chunk_left > tail)
+        string_buffer_addlstring(client->content, &client->buffer[skip], tail);
+        client->chunk_left -= tail;
+        skip += tail;
+
+        if(client->chunk_left > 0)
         {
-            string_buffer_addlstring(client->content,
-                &client->buffer[skip], client->buffer_skip - skip);
-            client->chunk_left -= tail;
+            client->buffer_skip = 0;
+            return;
         }
-        else
+
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
+        string_buffer_push(lua, client->content);
+        client->content = NULL;
+        lua_setfield(lua, -2, __content);
+        lua_pop(lua, 1); // request
+
+        client->status = 3;
+        client_pipeline_save(client, skip);
+        callback(client);
+    }
+}
+
+static void on_client_read(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    module_data_t *mod = client->mod;
+
+    if(client->status == 3)
+    {
+        /* pipelined request */
+        char buffer[HTTP_HEADER_SIZE];
+        const ssize_t size = asc_socket_recv(client->sock, buffer, sizeof(buffer));
+        if(size <= 0)
         {
-            string_buffer_addlstring(client->content,
-                &client->buffer[skip], client->chunk_left);
-            client->chunk_left = 0;
-
-            lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
-            string_buffer_push(lua, client->content);
-            client->content = NULL;
-            lua_setfield(lua, -2, __content);
-            lua_pop(lua, 1); // request
+            on_client_close(client);
+            return;
+        }
 
-            client->status = 3;
-            callback(client);
+        if(client->pipeline_size + size > HTTP_BUFFER_SIZE)
+        {
+            asc_log_error(MSG("request is too large"));
+            on_client_close(client);
+            return;
         }
 
-        client->buffer_skip = 0;
+        client->pipeline = (char *)realloc(client->pipeline, client->pipeline_size + size);
+        memcpy(&client->pipeline[client->pipeline_size], buffer, size);
+        client->pipeline_size += size;
+        return;
+    }
+
+    if(client->buffer_skip == client->buffer_size)
+    {
+        if(client->buffer_size >= HTTP_BUFFER_SIZE)
+        {
+            asc_log_error(MSG("request is too large"));
+            on_client_close(client);
+            return;
+        }
+
+        client_buffer_alloc(client, (client->buffer_size < HTTP_HEADER_SIZE)
+                                    ? HTTP_HEADER_SIZE
+                                    : HTTP_BUFFER_SIZE);
+    }
+
+    const ssize_t size = asc_socket_recv(  client->sock
+                                         , &client->buffer[client->buffer_skip]
+                                         , client->buffer_size - client->buffer_skip);
+    if(size <= 0)
+    {
+        on_client_close(client);
         return;
     }
+
+    client->buffer_skip += size;
+    client_process(client);
+}
+
+/* response is sent, wait for the next request on the same connection */
+static void client_next_request(http_client_t *client)
+{
+    /* request is completed, like on_client_close() but the socket
+     * is detached to ignore :close() from the callback */
+    asc_socket_t *sock = client->sock;
+    client->sock = NULL;
+    client->status = 0;
+    callback(client);
+    client->sock = sock;
+
+    client_release_request(client);
+    client_buffer_release(client);
+
+    client->idx_callback = 0;
+    client->chunk_left = 0;
+    client->header_skip = 0;
+    client->header_state = 0;
+    client->is_head = false;
+    client->is_content_length = false;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = NULL;
+
+    if(client->pipeline)
+    {
+        client->buffer = client->pipeline;
+        client->buffer_size = client->pipeline_size;
+        client->buffer_skip = client->pipeline_size;
+        client->pipeline = NULL;
+        client->pipeline_size = 0;
+    }
+
+    asc_socket_set_on_ready(client->sock, NULL);
+    asc_socket_set_on_read(client->sock, on_client_read);
+
+    if(client->buffer_skip > 0)
+        client_process(client);
 }
 
 /*
@@ -506,7 +1075,12 @@ static void on_ready_send_content(void *arg)
     client->chunk_left -= send_size;
 
     if(client->chunk_left == 0)
-        on_client_close(client);
+    {
+        if(client->is_keep_alive)
+            client_next_request(client);
+        else
+            on_client_close(client);
+    }
 }
 
 /* Stack: 1 - server, 2 - client, 3 - response */
@@ -554,8 +1128,14 @@ static int method_send(module_data_t *mod)
         client->on_ready = on_ready_send_content;
     }
     else
+    {
         lua_pop(lua, 1); // content
 
+        /* end of the response is not defined */
+        client->is_keep_alive = false;
+    }
+
+    bool is_connection = false;
     lua_getfield(lua, idx_response, __headers);
     if(lua_istable(lua, -1))
     {
@@ -563,10 +1143,20 @@ static int method_send(module_data_t *mod)
         {
             const char *header = lua_tostring(lua, -1);
             http_response_header(client, "%s", header);
+
+            if(!strncasecmp(header, "Connection:", 11))
+            {
+                is_connection = true;
+                if(strcasestr(&header[11], "close"))
+                    client->is_keep_alive = false;
+            }
         }
     }
     lua_pop(lua, 1); // headers
 
+    if(!is_connection)
+        http_response_connection(client);
+
     http_response_send(client);
 
     return 0;
@@ -604,17 +1194,21 @@ static void on_ready_send_response(void *arg)
 
     if(client->chunk_left == 0)
     {
+        /* request is completed, the stream doesn't need headers */
+        client_buffer_release(client);
+
         if(   (client->idx_content || client->response)
            && (client->is_head == false))
         {
-            client->buffer_skip = 0;
-
             asc_socket_set_on_read(client->sock, client->on_read);
             asc_socket_set_on_ready(client->sock, client->on_ready);
             return;
         }
 
-        on_client_close(client);
+        if(client->is_keep_alive)
+            client_next_request(client); // HEAD
+        else
+            on_client_close(client);
     }
 }
 
@@ -623,6 +1217,7 @@ static const char * http_code(int code)
     switch(code)
     {
         case 200: return "Ok";
+        case 206: return "Partial Content";
 
         case 301: return "Moved Permanently";
         case 302: return "Found";
@@ -633,6 +1228,7 @@ static const char * http_code(int code)
         case 403: return "Forbidden";
         case 404: return "Not Found";
         case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
         case 429: return "Too Many Requests";
 
         case 500: return "Internal Server Error";
@@ -649,24 +1245,31 @@ void http_response_code(http_client_t *client, int code, const char *message)
     if(!message)
         message = http_code(code);
 
-    client->chunk_left  = snprintf(client->buffer, HTTP_BUFFER_SIZE
-                                   , "%s %d %s\r\n"
-                                   , client->mod->http_version, code, message);
+    client_buffer_alloc(client, HTTP_HEADER_SIZE);
 
-    client->chunk_left += snprintf(&client->buffer[client->chunk_left]
-                                   , HTTP_BUFFER_SIZE - client->chunk_left
-                                   , "Server: %s\r\n"
-                                   , client->mod->server_name);
+    client->chunk_left = 0;
+    http_response_header(client, "%s %d %s", client->mod->http_version, code, message);
+    http_response_header(client, "Server: %s", client->mod->server_name);
 }
 
 void http_response_header(http_client_t *client, const char *header, ...)
 {
-    va_list ap;
+    va_list ap, ap_retry;
     va_start(ap, header);
+    va_copy(ap_retry, ap);
 
-    client->chunk_left += vsnprintf(&client->buffer[client->chunk_left]
-                                    , HTTP_BUFFER_SIZE - client->chunk_left
-                                    , header, ap);
+    /* 4 - line end and the empty line for http_response_send() */
+    size_t tail = client->buffer_size - client->chunk_left;
+    const size_t len = vsnprintf(&client->buffer[client->chunk_left], tail, header, ap);
+    if(len + 4 > tail)
+    {
+        client_buffer_alloc(client, client->chunk_left + len + 4 + HTTP_HEADER_SIZE);
+        tail = client->buffer_size - client->chunk_left;
+        vsnprintf(&client->buffer[client->chunk_left], tail, header, ap_retry);
+    }
+    va_end(ap_retry);
+
+    client->chunk_left += len;
     client->buffer[client->chunk_left + 0] = '\r';
     client->buffer[client->chunk_left + 1] = '\n';
     client->chunk_left += 2;
@@ -674,6 +1277,15 @@ void http_response_header(http_client_t *client, const char *header, ...)
     va_end(ap);
 }
 
+/* Connection header for the current state of the keep-alive */
+void http_response_connection(http_client_t *client)
+{
+    if(client->is_keep_alive && client->is_http10)
+        http_response_header(client, __connection_keep_alive);
+    else if(!client->is_keep_alive && !client->is_http10)
+        http_response_header(client, __connection_close);
+}
+
 void http_response_send(http_client_t *client)
 {
     client->buffer[client->chunk_left + 0] = '\r';
@@ -719,6 +1331,15 @@ void http_client_close(http_client_t *client)
     on_client_close(client);
 }
 
+/* response is sent, close connection or wait for the next request */
+void http_client_done(http_client_t *client)
+{
+    if(client->is_keep_alive)
+        client_next_request(client);
+    else
+        on_client_close(client);
+}
+
 void http_client_abort(http_client_t *client, int code, const char *text)
 {
     module_data_t *mod = client->mod;
@@ -749,6 +1370,7 @@ void http_client_abort(http_client_t *client, int code, const char *text)
 
     client->on_read = NULL;
     client->on_ready = on_ready_send_content;
+    client->is_keep_alive = false;
 
     http_response_code(client, code, message);
     http_response_header(client, "Content-Type: text/html");
@@ -772,6 +1394,7 @@ void http_client_redirect(http_client_t *client, int code, const char *location)
     client->on_ready = NULL;
 
     client->is_head = true; // hack to close connection after response
+    client->is_keep_alive = false;
 
     http_response_code(client, code, NULL);
     http_response_header(client, "Location: %s", location);
@@ -795,42 +1418,28 @@ static void on_server_close(void *arg)
     if(!mod->sock)
         return;
 
+    ASC_FREE(mod->accept_timer, asc_timer_destroy);
+
     asc_socket_close(mod->sock);
     mod->sock = NULL;
 
-    if(mod->clients)
+    http_client_t *prev_client = NULL;
+    while(mod->clients)
     {
-        http_client_t *prev_client = NULL;
-        for(  asc_list_first(mod->clients)
-            ; !asc_list_eol(mod->clients)
-            ; asc_list_first(mod->clients))
-        {
-            http_client_t *client = (http_client_t *)asc_list_data(mod->clients);
-            asc_assert(client != prev_client
-                       , MSG("loop on on_server_close() client:%p")
-                       , (void *)client);
-            on_client_close(client);
-            prev_client = client;
-        }
-
-        asc_list_destroy(mod->clients);
-        mod->clients = NULL;
+        http_client_t *client = mod->clients;
+        asc_assert(client != prev_client
+                   , MSG("loop on on_server_close() client:%p")
+                   , (void *)client);
+        on_client_close(client);
+        prev_client = client;
     }
 
-    if(mod->routes)
-    {
-        for(  asc_list_first(mod->routes)
-            ; !asc_list_eol(mod->routes)
-            ; asc_list_first(mod->routes))
-        {
-            route_t *route = (route_t *)asc_list_data(mod->routes);
-            luaL_unref(lua, LUA_REGISTRYINDEX, route->idx_callback);
-            free(route);
-            asc_list_remove_current(mod->routes);
-        }
+    route_clear(mod);
 
-        asc_list_destroy(mod->routes);
-        mod->routes = NULL;
+    if(mod->idx_request_meta)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_request_meta);
+        mod->idx_request_meta = 0;
     }
 
     if(mod->idx_self)
@@ -840,30 +1449,73 @@ static void on_server_close(void *arg)
     }
 }
 
-static void on_server_accept(void *arg)
+static void on_server_accept(void *arg);
+
+static void on_accept_timer(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    http_client_t *client = (http_client_t *)calloc(1, sizeof(http_client_t));
-    client->mod = mod;
-    client->idx_server = mod->idx_self;
+    mod->accept_timer = NULL;
+    asc_socket_set_on_read(mod->sock, on_server_accept);
+}
 
-    if(!asc_socket_accept(mod->sock, &client->sock, client))
+static void on_server_accept(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    /* accept all pending connections, the buffer is allocated on the first read */
+    http_client_t *client = NULL;
+    while(true)
     {
-        free(client);
-        on_server_close(mod);
-        astra_abort(); // TODO: try to restart server
-    }
+        if(!client)
+        {
+            client = (http_client_t *)calloc(1, sizeof(http_client_t));
+            client->mod = mod;
+            client->idx_server = mod->idx_self;
+            client->connect_time = asc_utime();
+        }
 
-    asc_list_insert_tail(mod->clients, client);
+        if(!asc_socket_accept(mod->sock, &client->sock, client))
+        {
+            if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+                continue;
 
-    asc_log_debug(MSG("client connected %s:%d (%lu clients)")
-                      , asc_socket_addr(client->sock)
-                      , asc_socket_port(client->sock)
-                      , asc_list_size(mod->clients));
+            if(   errno == EMFILE || errno == ENFILE
+               || errno == ENOBUFS || errno == ENOMEM)
+            {
+                /* pending connections are kept in the backlog */
+                asc_log_warning(MSG("accept paused for %dms")
+                                , ACCEPT_PAUSE_INTERVAL);
+                asc_socket_set_on_read(mod->sock, NULL);
+                mod->accept_timer = asc_timer_one_shot(  ACCEPT_PAUSE_INTERVAL
+                                                       , on_accept_timer, mod);
+                break;
+            }
 
-    asc_socket_set_on_read(client->sock, on_client_read);
-    asc_socket_set_on_close(client->sock, on_client_close);
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                free(client);
+                on_server_close(mod);
+                astra_abort(); // TODO: try to restart server
+            }
+
+            break;
+        }
+
+        client_link(mod, client);
+
+        asc_log_debug(MSG("client connected %s:%d (%lu clients)")
+                          , asc_socket_addr(client->sock)
+                          , asc_socket_port(client->sock)
+                          , mod->client_count);
+
+        asc_socket_set_on_read(client->sock, on_client_read);
+        asc_socket_set_on_close(client->sock, on_client_close);
+
+        client = NULL;
+    }
+
+    free(client);
 }
 
 /*
@@ -889,6 +1541,33 @@ static int method_data(module_data_t *mod)
     return 1;
 }
 
+static int method_stat(module_data_t *mod)
+{
+    asc_assert(lua_islightuserdata(lua, 2), MSG(":stat() client instance required"));
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 2);
+
+    const uint64_t uptime = asc_utime() - client->connect_time;
+
+    lua_newtable(lua);
+    lua_pushnumber(lua, client->send_bytes);
+    lua_setfield(lua, -2, "bytes");
+    lua_pushnumber(lua, client->send_calls);
+    lua_setfield(lua, -2, "syscalls");
+    lua_pushnumber(lua, (client->send_calls > 0)
+                        ? (double)client->send_bytes / client->send_calls
+                        : 0);
+    lua_setfield(lua, -2, "bytes_per_syscall");
+    lua_pushnumber(lua, (uptime > 0)
+                        ? (double)client->send_calls * 1000000 / uptime
+                        : 0);
+    lua_setfield(lua, -2, "syscalls_per_sec");
+    lua_pushnumber(lua, client->send_zerocopy);
+    lua_setfield(lua, -2, "zerocopy");
+    lua_pushnumber(lua, client->send_copied);
+    lua_setfield(lua, -2, "zerocopy_copied");
+    return 1;
+}
+
 static int method_close(module_data_t *mod)
 {
     if(lua_gettop(lua) == 1)
@@ -926,21 +1605,22 @@ static int method_abort(module_data_t *mod)
     return 0;
 }
 
-static bool lua_is_call(int idx)
+static int method_add_route(module_data_t *mod)
 {
-    bool is_call = false;
+    asc_assert(lua_isstring(lua, 2), MSG(":add_route() path required"));
+    asc_assert(lua_is_call(3) || lua_is_stream(3)
+               , MSG(":add_route() callback required"));
 
-    if(lua_isfunction(lua, idx))
-        is_call = true;
-    else if(lua_istable(lua, idx))
-    {
-        lua_getmetatable(lua, idx);
-        lua_getfield(lua, -1, "__call");
-        is_call = lua_isfunction(lua, -1);
-        lua_pop(lua, 2);
-    }
+    lua_pushvalue(lua, 3);
+    route_set(mod, lua_tostring(lua, 2));
+    return 0;
+}
 
-    return is_call;
+static int method_remove_route(module_data_t *mod)
+{
+    asc_assert(lua_isstring(lua, 2), MSG(":remove_route() path required"));
+    lua_pushboolean(lua, route_remove(mod, lua_tostring(lua, 2)));
+    return 1;
 }
 
 static void module_init(module_data_t *mod)
@@ -959,7 +1639,6 @@ static void module_init(module_data_t *mod)
     module_option_string("http_version", &mod->http_version, NULL);
 
     // store routes in registry
-    mod->routes = asc_list_init();
     lua_getfield(lua, MODULE_OPTIONS_IDX, "route");
     asc_assert(lua_istable(lua, -1), MSG("option 'route' is required"));
     for(lua_pushnil(lua); lua_next(lua, -2); lua_pop(lua, 1))
@@ -976,19 +1655,22 @@ static void module_init(module_data_t *mod)
                 break;
 
             lua_rawgeti(lua, item, 2); // callback
-            if(!lua_is_call(-1))
+            if(!lua_is_call(-1) && !lua_is_stream(-1))
                 break;
 
             is_ok = true;
         } while(0);
         asc_assert(is_ok, MSG("route format: { { \"/path\", callback }, ... }"));
 
-        route_t *route = (route_t *)malloc(sizeof(route_t));
-        route->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
-        route->path = lua_tostring(lua, -1);
+        /* the first route with the same path is used */
+        const char *path = lua_tostring(lua, -2);
+        if(route_get(mod, path))
+        {
+            lua_pop(lua, 2); // callback + path
+            continue;
+        }
+        route_set(mod, path);
         lua_pop(lua, 1); // path
-
-        asc_list_insert_tail(mod->routes, route);
     }
     lua_pop(lua, 1); // route
 
@@ -996,7 +1678,11 @@ static void module_init(module_data_t *mod)
     lua_pushvalue(lua, 3);
     mod->idx_self = luaL_ref(lua, LUA_REGISTRYINDEX);
 
-    mod->clients = asc_list_init();
+    // metatable for the requests
+    lua_newtable(lua);
+    lua_pushcfunction(lua, request_index);
+    lua_setfield(lua, -2, "__index");
+    mod->idx_request_meta = luaL_ref(lua, LUA_REGISTRYINDEX);
 
     bool sctp = false;
     module_option_boolean("sctp", &sctp);
@@ -1027,8 +1713,11 @@ MODULE_LUA_METHODS()
     { "send", method_send },
     { "close", method_close },
     { "data", method_data },
+    { "stat", method_stat },
     { "redirect", method_redirect },
-    { "abort", method_abort }
+    { "abort", method_abort },
+    { "add_route", method_add_route },
+    { "remove_route", method_remove_route }
 };
 
 MODULE_LUA_REGISTER(http_server)
@@ -105,8 +105,7 @@ static void pack_es(module_data_t *mod, uint8_t *data, size_t size)
     {
         // copy PES header from original PES
         const size_t pes_hdr = 6 + 3 + mod->pes_i->buffer[8];
-        memcpy(mod->pes_o->buffer, mod->pes_i->buffer, pes_hdr);
-        mod->pes_o->buffer_size = pes_hdr;
+        mpegts_pes_add_data(mod->pes_o, mod->pes_i->buffer, pes_hdr);
     }
 
     mpegts_pes_add_data(mod->pes_o, data, size);
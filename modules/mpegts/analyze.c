@@ -27,21 +27,167 @@
  *      name        - string, analyzer name
  *      rate_stat   - boolean, dump bitrate with 10ms interval
  *      join_pid    - boolean, request all SI tables on the upstream module
- *      callback    - function(data), events callback:
+ *      pcr_accuracy - boolean, check PCR accuracy. only for the complete
+ *                    transport stream with constant bitrate
+ *      events      - boolean, call the callback only when the stream status
+ *                    or the error state is changed, instead of the statistics
+ *                    on the each second
+ *      callback    - function(data), events callback. optional:
  *                    data.error    - string,
  *                    data.psi      - table, psi information (PAT, PMT, CAT, SDT)
  *                    data.analyze  - table, per pid information: errors, bitrate
  *                    data.on_air   - boolean, comes with data.analyze, stream status
+ *                    data.total    - table, comes with data.on_air:
+ *                                    bitrate, cc_errors, pes_errors, scrambled
+ *                    data.tr101290 - table, comes with data.analyze,
+ *                                    ETSI TR 101 290 errors in the last second
  *                    data.rate     - table, rate_stat array
+ *                    with the events option:
+ *                    data.on_air   - boolean, with data.total, on the status change
+ *                    data.event    - string, TR 101 290 indicator name
+ *                    data.count    - number, errors in the last second,
+ *                                    0 if the error is gone
+ *
+ * Module Methods:
+ *      get_stats() - return the statistics of the last second, the same table
+ *                    as data in the callback: analyze, total, tr101290, on_air
+ *      dump([format], [delta])
+ *                  - return the counters accumulated since start as a string,
+ *                    format: "json" (default) or "binary". if delta is true
+ *                    return the counters since the previous delta dump
+ *
+ * Binary dump, all numbers are big-endian:
+ *      4 bytes     - "ANLZ"
+ *      1 byte      - version, 1
+ *      1 byte      - flags: 0x01 - on_air, 0x02 - scrambled, 0x04 - delta
+ *      2 bytes     - number of PIDs
+ *      4 bytes     - interval, ms
+ *      4 bytes     - bitrate in the last second, kbit/s
+ *      8 bytes     - each TR 101 290 indicator, in the order of tr_error_name
+ *      for the each PID:
+ *      2 bytes     - pid
+ *      2 bytes     - reserved
+ *      4 bytes     - type, mpegts_packet_type_t
+ *      4 bytes     - bitrate in the last second, kbit/s
+ *      8 bytes     - each counter, in the order of stat_name
  */
 
 #include <astra.h>
 
+/* ETSI TR 101 290 indicators */
+typedef enum
+{
+    // priority 1
+    TR_SYNC_LOSS = 0,
+    TR_SYNC_BYTE,
+    TR_PAT,
+    TR_CC,
+    TR_PMT,
+    TR_PID,
+    // priority 2
+    TR_TRANSPORT,
+    TR_CRC,
+    TR_PCR_REPETITION,
+    TR_PCR_DISCONTINUITY,
+    TR_PCR_ACCURACY,
+    TR_PTS,
+    TR_CAT,
+    // priority 3
+    TR_NIT,
+    TR_SI_REPETITION,
+    TR_UNREFERENCED_PID,
+    TR_SDT,
+    TR_EIT,
+    TR_TDT,
+
+    TR_COUNT
+} tr_error_t;
+
+static const char *tr_error_name[TR_COUNT] =
+{
+    "sync_loss",
+    "sync_byte_error",
+    "pat_error",
+    "cc_error",
+    "pmt_error",
+    "pid_error",
+    "transport_error",
+    "crc_error",
+    "pcr_repetition_error",
+    "pcr_discontinuity_error",
+    "pcr_accuracy_error",
+    "pts_error",
+    "cat_error",
+    "nit_error",
+    "si_repetition_error",
+    "unreferenced_pid",
+    "sdt_error",
+    "eit_error",
+    "tdt_error",
+};
+
+#define TR_P2_FIRST TR_TRANSPORT
+#define TR_P3_FIRST TR_NIT
+
+#define PSI_INTERVAL_MAX 500000     /* PAT, PMT. us */
+#define PCR_INTERVAL_MAX 40000      /* us */
+#define PCR_DIFF_MAX (100 * 27000)  /* 100ms in 27MHz */
+#define PCR_ACCURACY_MAX 13         /* 500ns in 27MHz */
+#define PCR_WRAP (0x200000000ULL * 300)
+#define PTS_INTERVAL_MAX 700000     /* us */
+#define PID_TIMEOUT 5               /* s */
+#define SI_INTERVAL_MIN 25000       /* us */
+
+/* SI tables with the repetition limits */
+static const struct
+{
+    uint8_t table_id;
+    uint32_t interval_max; /* us */
+    tr_error_t error;
+} si_table[] =
+{
+    { 0x40, 10000000, TR_NIT }, // NIT actual
+    { 0x42, 2000000, TR_SDT },  // SDT actual
+    { 0x4E, 2000000, TR_EIT },  // EIT actual present/following
+    { 0x70, 30000000, TR_TDT }, // TDT
+};
+
+#define SI_TABLE_COUNT ASC_ARRAY_SIZE(si_table)
+
+/* per PID counters */
+typedef enum
+{
+    STAT_PACKETS = 0,
+    STAT_CC,
+    STAT_SC,
+    STAT_PES,
+    STAT_TEI,
+    STAT_CRC,
+    STAT_PCR,
+    STAT_PTS,
+
+    STAT_COUNT
+} stat_counter_t;
+
+static const char *stat_name[STAT_COUNT] =
+{
+    "packets",
+    "cc_error",
+    "sc_error",
+    "pes_error",
+    "tei_error",
+    "crc_error",
+    "pcr_error",
+    "pts_error",
+};
+
 typedef struct
 {
     mpegts_packet_type_t type;
 
     uint8_t cc;
+    uint8_t cc_dup;     // repeated packets
+    uint8_t idle;       // seconds without packets
 
     uint32_t packets;
 
@@ -49,6 +195,25 @@ typedef struct
     uint32_t cc_error;  // Continuity Counter
     uint32_t sc_error;  // Scrambled
     uint32_t pes_error; // PES header
+    uint32_t tei_error; // Transport error indicator
+    uint32_t crc_error; // PSI/SI checksum
+    uint32_t pcr_error; // PCR repetition, discontinuity, accuracy
+    uint32_t pts_error; // PTS repetition
+
+    // counters of the last second and accumulated since start
+    uint32_t last[STAT_COUNT];
+    uint64_t total[STAT_COUNT];
+    uint64_t total_dump[STAT_COUNT]; // total on the last delta dump
+
+    // arrival time, us
+    uint64_t section_time;
+    uint64_t pcr_time;
+    uint64_t pts_time;
+
+    uint64_t pcr;
+    uint64_t pcr_offset;        // stream offset of the last PCR, bytes
+    uint64_t pcr_diff;          // last PCR interval
+    uint64_t pcr_diff_size;     // last PCR interval, bytes
 } analyze_item_t;
 
 typedef struct
@@ -57,6 +222,10 @@ typedef struct
     uint32_t crc;
 } pmt_checksum_t;
 
+/* per PID items are allocated by blocks, only for PIDs found in the stream */
+#define STREAM_BLOCK_SIZE 64
+#define STREAM_BLOCK_COUNT (MAX_PID / STREAM_BLOCK_SIZE)
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -66,6 +235,8 @@ struct module_data_t
     int cc_limit;
     int bitrate_limit;
     bool join_pid;
+    bool pcr_accuracy;
+    bool events;
 
     bool cc_check; // to skip initial cc errors
     bool video_check; // increase bitrate_limit for channel with video stream
@@ -75,12 +246,15 @@ struct module_data_t
     uint16_t tsid;
 
     asc_timer_t *check_stat;
-    analyze_item_t *stream[MAX_PID];
+    analyze_item_t **stream_block[STREAM_BLOCK_COUNT];
 
     mpegts_psi_t *pat;
     mpegts_psi_t *cat;
     mpegts_psi_t *pmt;
     mpegts_psi_t *sdt;
+    mpegts_psi_t *nit;
+    mpegts_psi_t *eit;
+    mpegts_psi_t *tdt;
 
     int pmt_ready;
     int pmt_count;
@@ -89,6 +263,27 @@ struct module_data_t
     uint8_t sdt_max_section_id;
     uint32_t *sdt_checksum_list;
 
+    // TR 101 290
+    uint32_t tr_error[TR_COUNT];
+    uint64_t ts_offset;
+    uint32_t sync_error;
+    bool is_cat;
+    uint64_t si_time[SI_TABLE_COUNT];
+
+    // statistics of the last second
+    bool on_air;
+    bool on_air_event;  // last state sent in the events mode
+    bool is_on_air_event;
+    bool scrambled;
+    uint32_t bitrate;
+    uint32_t cc_errors;
+    uint32_t pes_errors;
+    uint32_t tr_last[TR_COUNT];
+    uint64_t tr_total[TR_COUNT];
+    uint64_t tr_total_dump[TR_COUNT];
+    uint64_t start_time;
+    uint64_t dump_time;
+
     // rate_stat
     uint64_t last_ts;
     uint32_t ts_count;
@@ -98,6 +293,27 @@ struct module_data_t
 
 #define MSG(_msg) "[analyze %s] " _msg, mod->name
 
+static inline analyze_item_t * stream_find(module_data_t *mod, uint16_t pid)
+{
+    analyze_item_t **block = mod->stream_block[pid / STREAM_BLOCK_SIZE];
+    return (block) ? block[pid % STREAM_BLOCK_SIZE] : NULL;
+}
+
+static analyze_item_t * stream_item(module_data_t *mod, uint16_t pid)
+{
+    analyze_item_t **block = mod->stream_block[pid / STREAM_BLOCK_SIZE];
+    if(!block)
+    {
+        block = (analyze_item_t **)calloc(STREAM_BLOCK_SIZE, sizeof(analyze_item_t *));
+        mod->stream_block[pid / STREAM_BLOCK_SIZE] = block;
+    }
+
+    analyze_item_t **item = &block[pid % STREAM_BLOCK_SIZE];
+    if(!*item)
+        *item = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
+    return *item;
+}
+
 static const char __pid[] = "pid";
 static const char __crc32[] = "crc32";
 static const char __pnr[] = "pnr";
@@ -111,6 +327,12 @@ static void callback(module_data_t *mod)
 {
     asc_assert((lua_type(lua, -1) == LUA_TTABLE), "table required");
 
+    if(!mod->idx_callback)
+    {
+        lua_pop(lua, 1); // data
+        return;
+    }
+
     lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_callback);
     lua_pushvalue(lua, -2);
     lua_call(lua, 1, 0);
@@ -118,6 +340,21 @@ static void callback(module_data_t *mod)
     lua_pop(lua, 1); // data
 }
 
+static inline void tr_error(module_data_t *mod, tr_error_t error)
+{
+    ++mod->tr_error[error];
+}
+
+static void set_ca_pid(module_data_t *mod, uint16_t pid, mpegts_packet_type_t type)
+{
+    if(pid >= NULL_TS_PID)
+        return;
+
+    analyze_item_t *item = stream_item(mod, pid);
+    if(item->type == MPEGTS_PACKET_UNKNOWN)
+        item->type = type;
+}
+
 /*
  * oooooooooo   o   ooooooooooo
  *  888    888 888  88  888  88
@@ -144,15 +381,6 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     lua_pushnumber(lua, psi->pid);
     lua_setfield(lua, -2, __pid);
 
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        lua_pushstring(lua, "PAT checksum error");
-        lua_setfield(lua, -2, __err);
-        callback(mod);
-        return;
-    }
-
     psi->crc32 = crc32;
     mod->tsid = PAT_GET_TSID(psi);
 
@@ -187,19 +415,20 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         lua_setfield(lua, -2, __pid);
         lua_settable(lua, -3); // append to the "programs" table
 
-        if(!mod->stream[pid])
-            mod->stream[pid] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
+        analyze_item_t *item = stream_item(mod, pid);
 
         if(pnr != 0)
         {
-            mod->stream[pid]->type = MPEGTS_PACKET_PMT;
+            item->type = MPEGTS_PACKET_PMT;
+            if(!item->section_time)
+                item->section_time = asc_clock_now();
             if(mod->join_pid)
                 module_stream_demux_join_pid(mod, pid);
             ++ mod->pmt_count;
         }
         else
         {
-            mod->stream[pid]->type = MPEGTS_PACKET_NIT;
+            item->type = MPEGTS_PACKET_NIT;
             if(mod->join_pid)
                 module_stream_demux_join_pid(mod, pid);
         }
@@ -243,14 +472,6 @@ static void on_cat(void *arg, mpegts_psi_t *psi)
     lua_pushnumber(lua, psi->pid);
     lua_setfield(lua, -2, __pid);
 
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        lua_pushstring(lua, "CAT checksum error");
-        lua_setfield(lua, -2, __err);
-        callback(mod);
-        return;
-    }
     psi->crc32 = crc32;
 
     lua_pushstring(lua, "cat");
@@ -264,6 +485,9 @@ static void on_cat(void *arg, mpegts_psi_t *psi)
     const uint8_t *desc_pointer = CAT_DESC_FIRST(psi);
     while(!CAT_DESC_EOL(psi, desc_pointer))
     {
+        if(desc_pointer[0] == 0x09)
+            set_ca_pid(mod, DESC_CA_PID(desc_pointer), MPEGTS_PACKET_EMM);
+
         lua_pushnumber(lua, descriptors_count++);
         mpegts_desc_to_lua(desc_pointer);
         lua_settable(lua, -3); // append to the "descriptors" table
@@ -292,21 +516,6 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         return;
 
     const uint32_t crc32 = PSI_GET_CRC32(psi);
-
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        lua_newtable(lua);
-
-        lua_pushnumber(lua, psi->pid);
-        lua_setfield(lua, -2, __pid);
-
-        lua_pushstring(lua, "PMT checksum error");
-        lua_setfield(lua, -2, __err);
-        callback(mod);
-        return;
-    }
-
     const uint16_t pnr = PMT_GET_PNR(psi);
 
     // check changes
@@ -355,6 +564,9 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     const uint8_t *desc_pointer = PMT_DESC_FIRST(psi);
     while(!PMT_DESC_EOL(psi, desc_pointer))
     {
+        if(desc_pointer[0] == 0x09)
+            set_ca_pid(mod, DESC_CA_PID(desc_pointer), MPEGTS_PACKET_ECM);
+
         lua_pushnumber(lua, descriptors_count++);
         mpegts_desc_to_lua(desc_pointer);
         lua_settable(lua, -3); // append to the "descriptors" table
@@ -380,10 +592,8 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         lua_pushnumber(lua, streams_count++);
         lua_newtable(lua);
 
-        if(!mod->stream[pid])
-            mod->stream[pid] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-
-        mod->stream[pid]->type = mpegts_pes_type(type);
+        analyze_item_t *item = stream_item(mod, pid);
+        item->type = mpegts_pes_type(type);
 
         lua_pushnumber(lua, pid);
         lua_setfield(lua, -2, __pid);
@@ -397,15 +607,18 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
             mpegts_desc_to_lua(desc_pointer);
             lua_settable(lua, -3); // append to the "streams[X].descriptors" table
 
+            if(desc_pointer[0] == 0x09)
+                set_ca_pid(mod, DESC_CA_PID(desc_pointer), MPEGTS_PACKET_ECM);
+
             if(type == 0x06)
             {
                 switch(desc_pointer[0])
                 {
                     case 0x59:
-                        mod->stream[pid]->type = MPEGTS_PACKET_SUB;
+                        item->type = MPEGTS_PACKET_SUB;
                         break;
                     case 0x6A:
-                        mod->stream[pid]->type = MPEGTS_PACKET_AUDIO;
+                        item->type = MPEGTS_PACKET_AUDIO;
                         break;
                     default:
                         break;
@@ -414,7 +627,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         }
         lua_setfield(lua, -2, __descriptors);
 
-        lua_pushstring(lua, mpegts_type_name(mod->stream[pid]->type));
+        lua_pushstring(lua, mpegts_type_name(item->type));
         lua_setfield(lua, -2, "type_name");
 
         lua_pushnumber(lua, type);
@@ -422,11 +635,20 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
 
         lua_settable(lua, -3); // append to the "streams" table
 
-        if(mod->stream[pid]->type == MPEGTS_PACKET_VIDEO)
+        if(item->type == MPEGTS_PACKET_VIDEO)
             mod->video_check = true;
     }
     lua_setfield(lua, -2, "streams");
 
+    // PCR on the separate PID
+    const uint16_t pcr_pid = PMT_GET_PCR(psi);
+    if(pcr_pid < NULL_TS_PID)
+    {
+        analyze_item_t *item = stream_item(mod, pcr_pid);
+        if(item->type == MPEGTS_PACKET_UNKNOWN)
+            item->type = MPEGTS_PACKET_DATA;
+    }
+
     callback(mod);
 }
 
@@ -451,20 +673,6 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
 
     const uint32_t crc32 = PSI_GET_CRC32(psi);
 
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        lua_newtable(lua);
-
-        lua_pushnumber(lua, psi->pid);
-        lua_setfield(lua, -2, __pid);
-
-        lua_pushstring(lua, "SDT checksum error");
-        lua_setfield(lua, -2, __err);
-        callback(mod);
-        return;
-    }
-
     // check changes
     if(!mod->sdt_checksum_list)
     {
@@ -537,6 +745,99 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     callback(mod);
 }
 
+/*
+ * Checksum and repetition of the all sections on PSI/SI PIDs
+ */
+
+static void on_section(void *arg, mpegts_psi_t *psi)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint8_t table_id = psi->buffer[0];
+
+    // TOT has CRC without section_syntax_indicator
+    if((psi->buffer[1] & 0x80) || table_id == 0x73)
+    {
+        if(psi->buffer_size < PSI_HEADER_SIZE + CRC32_SIZE)
+            return;
+
+        const uint32_t crc32 = PSI_GET_CRC32(psi);
+        if(crc32 != PSI_CALC_CRC32(psi))
+        {
+            analyze_item_t *item = stream_find(mod, psi->pid);
+            if(item)
+                ++item->crc_error;
+            tr_error(mod, TR_CRC);
+
+            const char *name = NULL;
+            switch(psi->type)
+            {
+                case MPEGTS_PACKET_PAT: name = "PAT"; break;
+                case MPEGTS_PACKET_CAT: name = "CAT"; break;
+                case MPEGTS_PACKET_PMT: name = "PMT"; break;
+                case MPEGTS_PACKET_SDT: name = "SDT"; break;
+                default: break;
+            }
+
+            if(name)
+            {
+                char error[32];
+                snprintf(error, sizeof(error), "%s checksum error", name);
+
+                lua_newtable(lua);
+                lua_pushnumber(lua, psi->pid);
+                lua_setfield(lua, -2, __pid);
+                lua_pushstring(lua, error);
+                lua_setfield(lua, -2, __err);
+                callback(mod);
+            }
+            return;
+        }
+    }
+
+    for(size_t i = 0; i < SI_TABLE_COUNT; ++i)
+    {
+        if(si_table[i].table_id != table_id)
+            continue;
+
+        // the first section of the table
+        if((psi->buffer[1] & 0x80) && psi->buffer_size > 6 && psi->buffer[6] != 0)
+            break;
+
+        const uint64_t current_time = asc_clock_now();
+        const uint64_t last_time = mod->si_time[i];
+        if(last_time)
+        {
+            const uint64_t interval = current_time - last_time;
+            if(interval < SI_INTERVAL_MIN)
+                tr_error(mod, TR_SI_REPETITION);
+            else if(interval > si_table[i].interval_max)
+                tr_error(mod, si_table[i].error);
+        }
+        mod->si_time[i] = current_time;
+        break;
+    }
+
+    switch(psi->type)
+    {
+        case MPEGTS_PACKET_PAT:
+            on_pat(mod, psi);
+            break;
+        case MPEGTS_PACKET_CAT:
+            mod->is_cat = true;
+            on_cat(mod, psi);
+            break;
+        case MPEGTS_PACKET_PMT:
+            on_pmt(mod, psi);
+            break;
+        case MPEGTS_PACKET_SDT:
+            on_sdt(mod, psi);
+            break;
+        default:
+            break;
+    }
+}
+
 /*
  * ooooooooooo  oooooooo8
  * 88  888  88 888
@@ -566,6 +867,125 @@ static void append_rate(module_data_t *mod, int rate)
     }
 }
 
+static void check_pcr(module_data_t *mod, analyze_item_t *item, const uint8_t *ts)
+{
+    const uint64_t pcr = TS_GET_PCR(ts);
+    const uint64_t current_time = asc_clock_now();
+
+    if(item->pcr_time)
+    {
+        if(current_time - item->pcr_time > PCR_INTERVAL_MAX)
+        {
+            ++item->pcr_error;
+            tr_error(mod, TR_PCR_REPETITION);
+        }
+
+        const bool is_discontinuity = (ts[5] & 0x80);
+        const uint64_t diff = (pcr >= item->pcr)
+                            ? (pcr - item->pcr)
+                            : (pcr + PCR_WRAP - item->pcr);
+        const uint64_t size = mod->ts_offset - item->pcr_offset;
+
+        if(is_discontinuity)
+        {
+            item->pcr_diff = 0;
+        }
+        else if(diff > PCR_DIFF_MAX)
+        {
+            ++item->pcr_error;
+            tr_error(mod, TR_PCR_DISCONTINUITY);
+            item->pcr_diff = 0;
+        }
+        else
+        {
+            // PCR is compared with the value expected by the previous interval
+            if(mod->pcr_accuracy && item->pcr_diff)
+            {
+                const uint64_t expect = size * item->pcr_diff / item->pcr_diff_size;
+                const uint64_t delta = (diff > expect) ? (diff - expect) : (expect - diff);
+                if(delta > PCR_ACCURACY_MAX)
+                {
+                    ++item->pcr_error;
+                    tr_error(mod, TR_PCR_ACCURACY);
+                }
+            }
+
+            item->pcr_diff = diff;
+            item->pcr_diff_size = size;
+        }
+    }
+
+    item->pcr = pcr;
+    item->pcr_time = current_time;
+    item->pcr_offset = mod->ts_offset;
+}
+
+static void check_section(module_data_t *mod, analyze_item_t *item, const uint8_t *ts)
+{
+    if(TS_IS_SCRAMBLED(ts))
+    {
+        if(item->type == MPEGTS_PACKET_PAT)
+            tr_error(mod, TR_PAT);
+        else if(item->type == MPEGTS_PACKET_PMT)
+            tr_error(mod, TR_PMT);
+        return;
+    }
+
+    if(!TS_IS_PAYLOAD_START(ts))
+        return;
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return;
+
+    const uint8_t *table = &payload[1 + payload[0]]; // pointer_field
+    if(table >= ts + TS_PACKET_SIZE || table[0] == 0xFF)
+        return;
+
+    const uint8_t table_id = table[0];
+    switch(item->type)
+    {
+        case MPEGTS_PACKET_PAT:
+        case MPEGTS_PACKET_PMT:
+        {
+            const tr_error_t error = (item->type == MPEGTS_PACKET_PAT) ? TR_PAT : TR_PMT;
+            if(table_id != ((item->type == MPEGTS_PACKET_PAT) ? 0x00 : 0x02))
+            {
+                tr_error(mod, error);
+                break;
+            }
+
+            const uint64_t current_time = asc_clock_now();
+            if(item->section_time && current_time - item->section_time > PSI_INTERVAL_MAX)
+                tr_error(mod, error);
+            item->section_time = current_time;
+            break;
+        }
+        case MPEGTS_PACKET_CAT:
+            if(table_id != 0x01)
+                tr_error(mod, TR_CAT);
+            break;
+        case MPEGTS_PACKET_NIT:
+            if(table_id != 0x40 && table_id != 0x41 && table_id != 0x72)
+                tr_error(mod, TR_NIT);
+            break;
+        case MPEGTS_PACKET_SDT:
+            if(table_id != 0x42 && table_id != 0x46 && table_id != 0x4A && table_id != 0x72)
+                tr_error(mod, TR_SDT);
+            break;
+        case MPEGTS_PACKET_EIT:
+            if((table_id < 0x4E || table_id > 0x6F) && table_id != 0x72)
+                tr_error(mod, TR_EIT);
+            break;
+        case MPEGTS_PACKET_TDT:
+            if(table_id != 0x70 && table_id != 0x72 && table_id != 0x73)
+                tr_error(mod, TR_TDT);
+            break;
+        default:
+            break;
+    }
+}
+
 static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
     if(mod->rate_stat)
@@ -573,7 +993,7 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
         ++mod->ts_count;
 
         uint64_t diff_interval = 0;
-        const uint64_t cur = asc_utime() / 10000;
+        const uint64_t cur = asc_clock_now() / 10000;
 
         if(cur != mod->last_ts)
         {
@@ -596,38 +1016,84 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
         }
     }
 
+    mod->ts_offset += TS_PACKET_SIZE;
+
+    if(ts[0] != 0x47)
+    {
+        tr_error(mod, TR_SYNC_BYTE);
+        ++mod->sync_error;
+        if(mod->sync_error == 2)
+            tr_error(mod, TR_SYNC_LOSS);
+
+        ++stream_find(mod, NULL_TS_PID)->packets;
+        return;
+    }
+    mod->sync_error = 0;
+
     const uint16_t pid = TS_GET_PID(ts);
-    analyze_item_t *item = NULL;
-    if(ts[0] == 0x47 && pid < MAX_PID)
-        item = mod->stream[pid];
+    analyze_item_t *item = stream_find(mod, pid);
     if(!item)
-        item = mod->stream[NULL_TS_PID];
+    {
+        item = stream_find(mod, NULL_TS_PID);
+
+        // reserved PIDs and PIDs before the complete program information
+        if(pid >= 0x20 && pid != NULL_TS_PID
+           && mod->pmt_count > 0 && mod->pmt_ready == mod->pmt_count)
+        {
+            tr_error(mod, TR_UNREFERENCED_PID);
+        }
+    }
 
     ++item->packets;
 
+    if(ts[1] & 0x80)
+    {
+        ++item->tei_error;
+        tr_error(mod, TR_TRANSPORT);
+    }
+
     if(item->type == MPEGTS_PACKET_NULL)
         return;
 
+    if(TS_IS_PCR(ts))
+        check_pcr(mod, item, ts);
+
     if(item->type & (MPEGTS_PACKET_PSI | MPEGTS_PACKET_SI))
     {
+        check_section(mod, item, ts);
+
+        mpegts_psi_t *psi = NULL;
         switch(item->type)
         {
             case MPEGTS_PACKET_PAT:
-                mpegts_psi_mux(mod->pat, ts, on_pat, mod);
+                psi = mod->pat;
                 break;
             case MPEGTS_PACKET_CAT:
-                mpegts_psi_mux(mod->cat, ts, on_cat, mod);
+                psi = mod->cat;
                 break;
             case MPEGTS_PACKET_PMT:
-                mod->pmt->pid = pid;
-                mpegts_psi_mux(mod->pmt, ts, on_pmt, mod);
+                psi = mod->pmt;
+                psi->pid = pid;
+                break;
+            case MPEGTS_PACKET_NIT:
+                psi = mod->nit;
+                psi->pid = pid;
                 break;
             case MPEGTS_PACKET_SDT:
-                mpegts_psi_mux(mod->sdt, ts, on_sdt, mod);
+                psi = mod->sdt;
+                break;
+            case MPEGTS_PACKET_EIT:
+                psi = mod->eit;
+                break;
+            case MPEGTS_PACKET_TDT:
+                psi = mod->tdt;
                 break;
             default:
                 break;
         }
+
+        if(psi && !TS_IS_SCRAMBLED(ts))
+            mpegts_psi_mux(psi, ts, on_section, mod);
     }
 
     // Analyze
@@ -637,23 +1103,62 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
         return;
 
     const uint8_t cc = TS_GET_CC(ts);
-    const uint8_t last_cc = (item->cc + 1) & 0x0F;
-    item->cc = cc;
+    if(cc == item->cc)
+    {
+        // the same packet could be sent twice
+        ++item->cc_dup;
+        if(item->cc_dup > 1)
+        {
+            ++item->cc_error;
+            tr_error(mod, TR_CC);
+        }
+    }
+    else
+    {
+        item->cc_dup = 0;
 
-    if(cc != last_cc)
-        ++item->cc_error;
+        const bool is_discontinuity = (TS_IS_AF(ts) && ts[4] > 0 && (ts[5] & 0x80));
+        if(cc != ((item->cc + 1) & 0x0F) && !is_discontinuity)
+        {
+            ++item->cc_error;
+            tr_error(mod, TR_CC);
+        }
+    }
+    item->cc = cc;
 
     if(TS_IS_SCRAMBLED(ts))
+    {
         ++item->sc_error;
+        return;
+    }
 
     if(!(item->type & MPEGTS_PACKET_PES))
         return;
 
-    if(item->type == MPEGTS_PACKET_VIDEO && TS_IS_PAYLOAD_START(ts))
+    if(!TS_IS_PAYLOAD_START(ts))
+        return;
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload)
+        return;
+
+    if(PES_BUFFER_GET_HEADER(payload) != 0x000001)
     {
-        const uint8_t *payload = TS_GET_PAYLOAD(ts);
-        if(payload && PES_BUFFER_GET_HEADER(payload) != 0x000001)
+        if(item->type == MPEGTS_PACKET_VIDEO)
             ++item->pes_error;
+        return;
+    }
+
+    // PTS_DTS_flags
+    if(ts + TS_PACKET_SIZE - payload > 9 && (payload[6] & 0xC0) == 0x80 && (payload[7] & 0x80))
+    {
+        const uint64_t current_time = asc_clock_now();
+        if(item->pts_time && current_time - item->pts_time > PTS_INTERVAL_MAX)
+        {
+            ++item->pts_error;
+            tr_error(mod, TR_PTS);
+        }
+        item->pts_time = current_time;
     }
 }
 
@@ -666,13 +1171,74 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
  *
  */
 
-static void on_check_stat(void *arg)
+/* tables and PIDs which are not received */
+static void check_timeout(module_data_t *mod)
 {
-    module_data_t *mod = (module_data_t *)arg;
+    const uint64_t current_time = asc_utime();
+    bool scrambled = false;
 
-    int items_count = 1;
-    lua_newtable(lua);
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        analyze_item_t *item = stream_find(mod, i);
+        if(!item)
+            continue;
 
+        if(item->sc_error)
+            scrambled = true;
+
+        // time is updated to count the error once per interval
+        if(item->type == MPEGTS_PACKET_PAT || item->type == MPEGTS_PACKET_PMT)
+        {
+            if(item->section_time && current_time - item->section_time > PSI_INTERVAL_MAX)
+            {
+                tr_error(mod, (item->type == MPEGTS_PACKET_PAT) ? TR_PAT : TR_PMT);
+                item->section_time = current_time;
+            }
+        }
+
+        if(item->pcr_time && current_time - item->pcr_time > PCR_INTERVAL_MAX)
+        {
+            ++item->pcr_error;
+            tr_error(mod, TR_PCR_REPETITION);
+            item->pcr_time = current_time;
+        }
+
+        if(item->pts_time && !item->sc_error
+           && current_time - item->pts_time > PTS_INTERVAL_MAX)
+        {
+            ++item->pts_error;
+            tr_error(mod, TR_PTS);
+            item->pts_time = current_time;
+        }
+
+        // PIDs referred in PMT
+        if(item->type & MPEGTS_PACKET_PES)
+        {
+            if(item->packets > 0)
+                item->idle = 0;
+            else if(item->idle < PID_TIMEOUT)
+                ++item->idle;
+            else
+                tr_error(mod, TR_PID);
+        }
+    }
+
+    for(size_t i = 0; i < SI_TABLE_COUNT; ++i)
+    {
+        if(mod->si_time[i] && current_time - mod->si_time[i] > si_table[i].interval_max)
+        {
+            tr_error(mod, si_table[i].error);
+            mod->si_time[i] = current_time;
+        }
+    }
+
+    if(scrambled && !mod->is_cat)
+        tr_error(mod, TR_CAT);
+}
+
+/* moves the counters of the last second to the snapshot */
+static void stat_update(module_data_t *mod)
+{
     bool on_air = true;
 
     uint32_t bitrate = 0;
@@ -684,10 +1250,9 @@ static void on_check_stat(void *arg)
                                  ? ((uint32_t)mod->bitrate_limit)
                                  : ((mod->video_check) ? 256 : 32);
 
-    lua_newtable(lua);
     for(int i = 0; i < MAX_PID; ++i)
     {
-        analyze_item_t *item = mod->stream[i];
+        analyze_item_t *item = stream_find(mod, i);
 
         if(!item)
             continue;
@@ -695,25 +1260,19 @@ static void on_check_stat(void *arg)
         if(!mod->cc_check)
             item->cc_error = 0;
 
-        lua_pushnumber(lua, items_count++);
-        lua_newtable(lua);
+        item->last[STAT_PACKETS] = item->packets;
+        item->last[STAT_CC] = item->cc_error;
+        item->last[STAT_SC] = item->sc_error;
+        item->last[STAT_PES] = item->pes_error;
+        item->last[STAT_TEI] = item->tei_error;
+        item->last[STAT_CRC] = item->crc_error;
+        item->last[STAT_PCR] = item->pcr_error;
+        item->last[STAT_PTS] = item->pts_error;
 
-        lua_pushnumber(lua, i);
-        lua_setfield(lua, -2, __pid);
-
-        const uint32_t item_bitrate = (item->packets * TS_PACKET_SIZE * 8) / 1000;
-        bitrate += item_bitrate;
-
-        lua_pushnumber(lua, item_bitrate);
-        lua_setfield(lua, -2, "bitrate");
-
-        lua_pushnumber(lua, item->cc_error);
-        lua_setfield(lua, -2, "cc_error");
-        lua_pushnumber(lua, item->sc_error);
-        lua_setfield(lua, -2, "sc_error");
-        lua_pushnumber(lua, item->pes_error);
-        lua_setfield(lua, -2, "pes_error");
+        for(int j = 0; j < STAT_COUNT; ++j)
+            item->total[j] += item->last[j];
 
+        bitrate += (item->packets * TS_PACKET_SIZE * 8) / 1000;
         cc_errors += item->cc_error;
         pes_errors += item->pes_error;
 
@@ -732,26 +1291,24 @@ static void on_check_stat(void *arg)
         item->cc_error = 0;
         item->sc_error = 0;
         item->pes_error = 0;
-
-        lua_settable(lua, -3);
+        item->tei_error = 0;
+        item->crc_error = 0;
+        item->pcr_error = 0;
+        item->pts_error = 0;
     }
-    lua_setfield(lua, -2, "analyze");
 
-    lua_newtable(lua);
+    if(!mod->cc_check)
     {
-        lua_pushnumber(lua, bitrate);
-        lua_setfield(lua, -2, "bitrate");
-        lua_pushnumber(lua, cc_errors);
-        lua_setfield(lua, -2, "cc_errors");
-        lua_pushnumber(lua, pes_errors);
-        lua_setfield(lua, -2, "pes_errors");
-        lua_pushboolean(lua, scrambled);
-        lua_setfield(lua, -2, "scrambled");
+        mod->tr_error[TR_CC] = 0;
+        mod->cc_check = true;
     }
-    lua_setfield(lua, -2, "total");
 
-    if(!mod->cc_check)
-        mod->cc_check = true;
+    for(int i = 0; i < TR_COUNT; ++i)
+    {
+        mod->tr_last[i] = mod->tr_error[i];
+        mod->tr_total[i] += mod->tr_error[i];
+        mod->tr_error[i] = 0;
+    }
 
     if(bitrate < bitrate_limit)
         on_air = false;
@@ -760,10 +1317,281 @@ static void on_check_stat(void *arg)
     if(mod->pmt_ready == 0 || mod->pmt_ready != mod->pmt_count)
         on_air = false;
 
-    lua_pushboolean(lua, on_air);
+    mod->bitrate = bitrate;
+    mod->cc_errors = cc_errors;
+    mod->pes_errors = pes_errors;
+    mod->scrambled = scrambled;
+    mod->on_air = on_air;
+}
+
+static void push_total(module_data_t *mod)
+{
+    lua_newtable(lua);
+    lua_pushnumber(lua, mod->bitrate);
+    lua_setfield(lua, -2, "bitrate");
+    lua_pushnumber(lua, mod->cc_errors);
+    lua_setfield(lua, -2, "cc_errors");
+    lua_pushnumber(lua, mod->pes_errors);
+    lua_setfield(lua, -2, "pes_errors");
+    lua_pushboolean(lua, mod->scrambled);
+    lua_setfield(lua, -2, "scrambled");
+}
+
+/* table with the statistics of the last second */
+static void push_stats(module_data_t *mod)
+{
+    int items_count = 1;
+    lua_newtable(lua);
+
+    lua_newtable(lua);
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        const analyze_item_t *item = stream_find(mod, i);
+
+        if(!item)
+            continue;
+
+        lua_pushnumber(lua, items_count++);
+        lua_newtable(lua);
+
+        lua_pushnumber(lua, i);
+        lua_setfield(lua, -2, __pid);
+
+        lua_pushnumber(lua, (item->last[STAT_PACKETS] * TS_PACKET_SIZE * 8) / 1000);
+        lua_setfield(lua, -2, "bitrate");
+
+        for(int j = STAT_CC; j < STAT_COUNT; ++j)
+        {
+            lua_pushnumber(lua, item->last[j]);
+            lua_setfield(lua, -2, stat_name[j]);
+        }
+
+        lua_settable(lua, -3);
+    }
+    lua_setfield(lua, -2, "analyze");
+
+    push_total(mod);
+    lua_setfield(lua, -2, "total");
+
+    lua_newtable(lua);
+    {
+        uint32_t priority[3] = { 0, 0, 0 };
+        for(int i = 0; i < TR_COUNT; ++i)
+        {
+            const int p = (i < TR_P2_FIRST) ? 0 : ((i < TR_P3_FIRST) ? 1 : 2);
+            priority[p] += mod->tr_last[i];
+
+            lua_pushnumber(lua, mod->tr_last[i]);
+            lua_setfield(lua, -2, tr_error_name[i]);
+        }
+
+        lua_pushnumber(lua, priority[0]);
+        lua_setfield(lua, -2, "p1");
+        lua_pushnumber(lua, priority[1]);
+        lua_setfield(lua, -2, "p2");
+        lua_pushnumber(lua, priority[2]);
+        lua_setfield(lua, -2, "p3");
+    }
+    lua_setfield(lua, -2, "tr101290");
+
+    lua_pushboolean(lua, mod->on_air);
     lua_setfield(lua, -2, "on_air");
+}
 
-    callback(mod);
+/* events mode: the callback is called only on the state changes */
+static void send_events(module_data_t *mod, const uint32_t *tr_prev)
+{
+    for(int i = 0; i < TR_COUNT; ++i)
+    {
+        if((tr_prev[i] == 0) == (mod->tr_last[i] == 0))
+            continue;
+
+        lua_newtable(lua);
+        lua_pushstring(lua, tr_error_name[i]);
+        lua_setfield(lua, -2, "event");
+        lua_pushnumber(lua, mod->tr_last[i]);
+        lua_setfield(lua, -2, "count");
+        callback(mod);
+    }
+
+    if(!mod->is_on_air_event || mod->on_air != mod->on_air_event)
+    {
+        mod->is_on_air_event = true;
+        mod->on_air_event = mod->on_air;
+
+        lua_newtable(lua);
+        lua_pushboolean(lua, mod->on_air);
+        lua_setfield(lua, -2, "on_air");
+        push_total(mod);
+        lua_setfield(lua, -2, "total");
+        callback(mod);
+    }
+}
+
+static void on_check_stat(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    check_timeout(mod);
+
+    uint32_t tr_prev[TR_COUNT];
+    memcpy(tr_prev, mod->tr_last, sizeof(tr_prev));
+
+    stat_update(mod);
+
+    if(!mod->idx_callback)
+        return;
+
+    if(mod->events)
+        send_events(mod, tr_prev);
+    else
+    {
+        push_stats(mod);
+        callback(mod);
+    }
+}
+
+#define DUMP_HEADER_SIZE (16 + TR_COUNT * 8)
+#define DUMP_ITEM_SIZE (12 + STAT_COUNT * 8)
+
+static uint8_t * put_u16(uint8_t *ptr, uint16_t value)
+{
+    ptr[0] = value >> 8;
+    ptr[1] = value & 0xFF;
+    return ptr + 2;
+}
+
+static uint8_t * put_u32(uint8_t *ptr, uint32_t value)
+{
+    ptr = put_u16(ptr, value >> 16);
+    return put_u16(ptr, value & 0xFFFF);
+}
+
+static uint8_t * put_u64(uint8_t *ptr, uint64_t value)
+{
+    ptr = put_u32(ptr, value >> 32);
+    return put_u32(ptr, value & 0xFFFFFFFF);
+}
+
+/* accumulated counters, or the difference with the previous delta dump */
+static inline uint64_t dump_value(uint64_t *total, uint64_t *total_dump, bool delta)
+{
+    const uint64_t value = (delta) ? (*total - *total_dump) : *total;
+    if(delta)
+        *total_dump = *total;
+    return value;
+}
+
+static void dump_binary(module_data_t *mod, bool delta, uint32_t interval)
+{
+    int item_count = 0;
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        if(stream_find(mod, i))
+            ++item_count;
+    }
+
+    const size_t size = DUMP_HEADER_SIZE + item_count * DUMP_ITEM_SIZE;
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    uint8_t *ptr = buffer;
+
+    memcpy(ptr, "ANLZ", 4);
+    ptr += 4;
+    *ptr++ = 1; // version
+    *ptr++ = (mod->on_air ? 0x01 : 0) | (mod->scrambled ? 0x02 : 0) | (delta ? 0x04 : 0);
+    ptr = put_u16(ptr, item_count);
+    ptr = put_u32(ptr, interval);
+    ptr = put_u32(ptr, mod->bitrate);
+    for(int i = 0; i < TR_COUNT; ++i)
+        ptr = put_u64(ptr, dump_value(&mod->tr_total[i], &mod->tr_total_dump[i], delta));
+
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        analyze_item_t *item = stream_find(mod, i);
+        if(!item)
+            continue;
+
+        ptr = put_u16(ptr, i);
+        ptr = put_u16(ptr, 0);
+        ptr = put_u32(ptr, item->type);
+        ptr = put_u32(ptr, (item->last[STAT_PACKETS] * TS_PACKET_SIZE * 8) / 1000);
+        for(int j = 0; j < STAT_COUNT; ++j)
+            ptr = put_u64(ptr, dump_value(&item->total[j], &item->total_dump[j], delta));
+    }
+
+    lua_pushlstring(lua, (const char *)buffer, size);
+    free(buffer);
+}
+
+static void dump_json(module_data_t *mod, bool delta, uint32_t interval)
+{
+    string_buffer_t *buffer = string_buffer_alloc();
+
+    string_buffer_addfstring(buffer
+                             , "{\"interval\":%u,\"delta\":%s,\"on_air\":%s"
+                               ",\"scrambled\":%s,\"bitrate\":%u,\"tr101290\":{"
+                             , interval, (delta) ? "true" : "false"
+                             , (mod->on_air) ? "true" : "false"
+                             , (mod->scrambled) ? "true" : "false"
+                             , mod->bitrate);
+    for(int i = 0; i < TR_COUNT; ++i)
+    {
+        const uint64_t value = dump_value(&mod->tr_total[i], &mod->tr_total_dump[i], delta);
+        string_buffer_addfstring(buffer, "%s\"%s\":%"PRIu64
+                                 , (i > 0) ? "," : "", tr_error_name[i], value);
+    }
+    string_buffer_addlstring(buffer, "},\"pids\":[", 10);
+
+    bool is_first = true;
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        analyze_item_t *item = stream_find(mod, i);
+        if(!item)
+            continue;
+
+        string_buffer_addfstring(buffer, "%s{\"pid\":%d,\"type\":\"%s\",\"bitrate\":%u"
+                                 , (is_first) ? "" : ","
+                                 , i, mpegts_type_name(item->type)
+                                 , (item->last[STAT_PACKETS] * TS_PACKET_SIZE * 8) / 1000);
+        is_first = false;
+
+        for(int j = 0; j < STAT_COUNT; ++j)
+        {
+            const uint64_t value = dump_value(&item->total[j], &item->total_dump[j], delta);
+            string_buffer_addfstring(buffer, ",\"%s\":%"PRIu64, stat_name[j], value);
+        }
+        string_buffer_addchar(buffer, '}');
+    }
+    string_buffer_addlstring(buffer, "]}", 2);
+
+    string_buffer_push(lua, buffer);
+}
+
+static int method_get_stats(module_data_t *mod)
+{
+    push_stats(mod);
+    return 1;
+}
+
+static int method_dump(module_data_t *mod)
+{
+    const char *format = luaL_optstring(lua, 2, "json");
+    const bool delta = lua_toboolean(lua, 3);
+
+    const uint64_t current_time = asc_utime();
+    const uint64_t interval_start = (delta) ? mod->dump_time : mod->start_time;
+    const uint32_t interval = (current_time - interval_start) / 1000;
+    if(delta)
+        mod->dump_time = current_time;
+
+    if(!strcmp(format, "json"))
+        dump_json(mod, delta, interval);
+    else if(!strcmp(format, "binary"))
+        dump_binary(mod, delta, interval);
+    else
+        luaL_error(lua, MSG("unknown dump format: %s"), format);
+
+    return 1;
 }
 
 /*
@@ -781,13 +1609,17 @@ static void module_init(module_data_t *mod)
     asc_assert(mod->name != NULL, "[analyze] option 'name' is required");
 
     lua_getfield(lua, MODULE_OPTIONS_IDX, __callback);
-    asc_assert(lua_isfunction(lua, -1), MSG("option 'callback' is required"));
-    mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+    if(lua_isfunction(lua, -1))
+        mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
+    else
+        lua_pop(lua, 1);
 
     module_option_boolean("rate_stat", &mod->rate_stat);
     module_option_number("cc_limit", &mod->cc_limit);
     module_option_number("bitrate_limit", &mod->bitrate_limit);
     module_option_boolean("join_pid", &mod->join_pid);
+    module_option_boolean("pcr_accuracy", &mod->pcr_accuracy);
+    module_option_boolean("events", &mod->events);
 
     module_stream_init(mod, on_ts);
     if(mod->join_pid)
@@ -795,31 +1627,39 @@ static void module_init(module_data_t *mod)
         module_stream_demux_set(mod, NULL, NULL);
         module_stream_demux_join_pid(mod, 0x00);
         module_stream_demux_join_pid(mod, 0x01);
+        module_stream_demux_join_pid(mod, 0x10);
         module_stream_demux_join_pid(mod, 0x11);
         module_stream_demux_join_pid(mod, 0x12);
+        module_stream_demux_join_pid(mod, 0x14);
     }
 
     // PAT
-    mod->stream[0x00] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x00]->type = MPEGTS_PACKET_PAT;
+    analyze_item_t *pat_item = stream_item(mod, 0x00);
+    pat_item->type = MPEGTS_PACKET_PAT;
+    pat_item->section_time = asc_utime();
     mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0x00);
     // CAT
-    mod->stream[0x01] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x01]->type = MPEGTS_PACKET_CAT;
+    stream_item(mod, 0x01)->type = MPEGTS_PACKET_CAT;
     mod->cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 0x01);
+    // NIT
+    stream_item(mod, 0x10)->type = MPEGTS_PACKET_NIT;
+    mod->nit = mpegts_psi_init(MPEGTS_PACKET_NIT, 0x10);
     // SDT
-    mod->stream[0x11] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x11]->type = MPEGTS_PACKET_SDT;
+    stream_item(mod, 0x11)->type = MPEGTS_PACKET_SDT;
     mod->sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
     // EIT
-    mod->stream[0x12] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[0x12]->type = MPEGTS_PACKET_EIT;
+    stream_item(mod, 0x12)->type = MPEGTS_PACKET_EIT;
+    mod->eit = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
+    // TDT, TOT
+    stream_item(mod, 0x14)->type = MPEGTS_PACKET_TDT;
+    mod->tdt = mpegts_psi_init(MPEGTS_PACKET_TDT, 0x14);
     // PMT
     mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
     // NULL
-    mod->stream[NULL_TS_PID] = (analyze_item_t *)calloc(1, sizeof(analyze_item_t));
-    mod->stream[NULL_TS_PID]->type = MPEGTS_PACKET_NULL;
+    stream_item(mod, NULL_TS_PID)->type = MPEGTS_PACKET_NULL;
 
+    mod->start_time = asc_utime();
+    mod->dump_time = mod->start_time;
     mod->check_stat = asc_timer_init(1000, on_check_stat, mod);
 }
 
@@ -833,16 +1673,27 @@ static void module_destroy(module_data_t *mod)
         mod->idx_callback = 0;
     }
 
-    for(int i = 0; i < MAX_PID; ++i)
+    for(int i = 0; i < STREAM_BLOCK_COUNT; ++i)
     {
-        if(mod->stream[i])
-            free(mod->stream[i]);
+        analyze_item_t **block = mod->stream_block[i];
+        if(!block)
+            continue;
+
+        for(int j = 0; j < STREAM_BLOCK_SIZE; ++j)
+        {
+            if(block[j])
+                free(block[j]);
+        }
+        free(block);
     }
 
     mpegts_psi_destroy(mod->pat);
     mpegts_psi_destroy(mod->cat);
     mpegts_psi_destroy(mod->sdt);
     mpegts_psi_destroy(mod->pmt);
+    mpegts_psi_destroy(mod->nit);
+    mpegts_psi_destroy(mod->eit);
+    mpegts_psi_destroy(mod->tdt);
 
     asc_timer_destroy(mod->check_stat);
 
@@ -855,6 +1706,8 @@ static void module_destroy(module_data_t *mod)
 MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
-    MODULE_STREAM_METHODS_REF()
+    MODULE_STREAM_METHODS_REF(),
+    { "get_stats", method_get_stats },
+    { "dump", method_dump },
 };
 MODULE_LUA_REGISTER(analyze)
@@ -35,6 +35,16 @@
  *                    type: video, audio, rus, eng... and other languages code
  *                     pid: number identifier in range 32-8190
  *      filter      - list, drop PID
+ *      es_index    - boolean, find access units and frame types in the video PIDs,
+ *                    packets are sent with mpegts_es_tag_t, see module_stream_tag().
+ *                    hls_output, timeshift and file_recorder use the tags
+ *
+ * Module Methods:
+ *      status()    - return table:
+ *                    memory        - number, bytes allocated by the instance
+ *                    shared_memory - number, bytes of the PSI cache shared with
+ *                                    other channels of the same upstream
+ *                    pids          - number, PIDs joined on the upstream
  */
 
 #include <astra.h>
@@ -47,6 +57,22 @@ typedef struct
     bool is_set;
 } map_item_t;
 
+typedef struct
+{
+    mpegts_packet_type_t type;
+    uint16_t custom_pid; /* 0 - original PID, MAX_PID - filtered */
+} pid_item_t;
+
+typedef struct
+{
+    uint16_t pid;
+    mpegts_es_index_t index;
+} es_index_item_t;
+
+/* PID state is allocated by blocks, only for PIDs in use */
+#define PID_BLOCK_SIZE 64
+#define PID_BLOCK_COUNT (MAX_PID / PID_BLOCK_SIZE)
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -61,6 +87,7 @@ struct module_data_t
         bool no_eit;
         bool no_reload;
         bool cas;
+        bool es_index;
 
         bool pass_sdt;
         bool pass_eit;
@@ -68,16 +95,16 @@ struct module_data_t
 
     /* */
     asc_list_t *map;
-    uint16_t pid_map[MAX_PID];
+    uint16_t pid_default; /* custom_pid of the PIDs without state */
+    pid_item_t *pid_block[PID_BLOCK_COUNT];
+    int pid_block_count;
     uint8_t custom_ts[TS_PACKET_SIZE];
 
-    mpegts_psi_t *pat;
-    mpegts_psi_t *cat;
-    mpegts_psi_t *pmt;
-    mpegts_psi_t *sdt;
-    mpegts_psi_t *eit;
-
-    mpegts_packet_type_t stream[MAX_PID];
+    mpegts_psi_cache_t *psi_cache;
+    uint32_t pat_crc32;
+    uint32_t cat_crc32;
+    uint32_t pmt_crc32;
+    uint16_t pmt_pid;
 
     uint16_t tsid;
     mpegts_psi_t *custom_pat;
@@ -86,21 +113,92 @@ struct module_data_t
     mpegts_psi_t *custom_sdt;
 
     /* */
-    uint8_t sdt_original_section_id;
     uint8_t sdt_max_section_id;
     uint32_t *sdt_checksum_list;
 
-    uint8_t eit_cc;
+    mpegts_psi_t *custom_eit;
+    mpegts_psi_t *custom_eit_pf[2]; /* present, following */
+    uint32_t eit_pf_crc32[2];
 
     uint8_t pat_version;
-    asc_timer_t *si_timer;
+    mpegts_carousel_t *carousel;
+
+    es_index_item_t *es_index_list;
+    int es_index_count;
 };
 
 #define MSG(_msg) "[channel %s] " _msg, mod->config.name
 
+static inline const pid_item_t * pid_find(module_data_t *mod, uint16_t pid)
+{
+    const pid_item_t *block = mod->pid_block[pid / PID_BLOCK_SIZE];
+    return (block) ? &block[pid % PID_BLOCK_SIZE] : NULL;
+}
+
+static inline mpegts_packet_type_t pid_type(module_data_t *mod, uint16_t pid)
+{
+    const pid_item_t *item = pid_find(mod, pid);
+    return (item) ? item->type : MPEGTS_PACKET_UNKNOWN;
+}
+
+static inline uint16_t pid_map(module_data_t *mod, uint16_t pid)
+{
+    const pid_item_t *item = pid_find(mod, pid);
+    return (item) ? item->custom_pid : mod->pid_default;
+}
+
+static pid_item_t * pid_item(module_data_t *mod, uint16_t pid)
+{
+    pid_item_t *block = mod->pid_block[pid / PID_BLOCK_SIZE];
+    if(!block)
+    {
+        block = (pid_item_t *)malloc(PID_BLOCK_SIZE * sizeof(pid_item_t));
+        for(int i = 0; i < PID_BLOCK_SIZE; ++i)
+        {
+            block[i].type = MPEGTS_PACKET_UNKNOWN;
+            block[i].custom_pid = mod->pid_default;
+        }
+        mod->pid_block[pid / PID_BLOCK_SIZE] = block;
+        ++mod->pid_block_count;
+    }
+    return &block[pid % PID_BLOCK_SIZE];
+}
+
+/* repetition interval of the custom tables, ms */
+#define PAT_INTERVAL 100
+#define CAT_INTERVAL 500
+#define PMT_INTERVAL 100
+#define SDT_INTERVAL 2000
+#define EIT_PF_INTERVAL 2000
+
+static void on_pat(void *arg, mpegts_psi_t *psi);
+static void on_cat(void *arg, mpegts_psi_t *psi);
+static void on_pmt(void *arg, mpegts_psi_t *psi);
+static void on_sdt(void *arg, mpegts_psi_t *psi);
+static void on_eit(void *arg, mpegts_psi_t *psi);
+
+/* sections are assembled by the cache shared with other channels of the same source.
+ * SDT and EIT callbacks get the repeated sections: SDT is dropped until PAT
+ * is received and EIT schedule is passed as is */
+static void join_psi(  module_data_t *mod, uint16_t pid, mpegts_packet_type_t type
+                     , psi_callback_t callback, bool is_repeat)
+{
+    pid_item(mod, pid)->type = type;
+    module_stream_demux_join_pid(mod, pid);
+    if(callback)
+        mpegts_psi_cache_subscribe(mod->psi_cache, pid, callback, mod, is_repeat);
+}
+
 static void stream_reload(module_data_t *mod)
 {
-    memset(mod->stream, 0, sizeof(mod->stream));
+    for(int i = 0; i < PID_BLOCK_COUNT; ++i)
+    {
+        pid_item_t *block = mod->pid_block[i];
+        if(!block)
+            continue;
+        for(int j = 0; j < PID_BLOCK_SIZE; ++j)
+            block[j].type = MPEGTS_PACKET_UNKNOWN;
+    }
 
     for(int __i = 0; __i < MAX_PID; ++__i)
     {
@@ -108,23 +206,29 @@ static void stream_reload(module_data_t *mod)
             module_stream_demux_leave_pid(mod, __i);
     }
 
-    mod->pat->crc32 = 0;
-    mod->pmt->crc32 = 0;
+    mpegts_psi_cache_unsubscribe_all(mod->psi_cache, mod);
 
-    mod->stream[0x00] = MPEGTS_PACKET_PAT;
-    module_stream_demux_join_pid(mod, 0x00);
+    mod->es_index_count = 0;
+
+    mod->pat_crc32 = 0;
+    mod->pmt_crc32 = 0;
+    mod->eit_pf_crc32[0] = 0;
+    mod->eit_pf_crc32[1] = 0;
+
+    /* tables are sent again when the new version is received */
+    mpegts_carousel_clear(mod->carousel);
+
+    join_psi(mod, 0x00, MPEGTS_PACKET_PAT, on_pat, false);
 
     if(mod->config.cas)
     {
-        mod->cat->crc32 = 0;
-        mod->stream[0x01] = MPEGTS_PACKET_CAT;
-        module_stream_demux_join_pid(mod, 0x01);
+        mod->cat_crc32 = 0;
+        join_psi(mod, 0x01, MPEGTS_PACKET_CAT, on_cat, false);
     }
 
     if(mod->config.no_sdt == false)
     {
-        mod->stream[0x11] = MPEGTS_PACKET_SDT;
-        module_stream_demux_join_pid(mod, 0x11);
+        join_psi(mod, 0x11, MPEGTS_PACKET_SDT, (mod->config.pass_sdt) ? NULL : on_sdt, true);
         if(mod->sdt_checksum_list)
         {
             free(mod->sdt_checksum_list);
@@ -134,10 +238,9 @@ static void stream_reload(module_data_t *mod)
 
     if(mod->config.no_eit == false)
     {
-        mod->stream[0x12] = MPEGTS_PACKET_EIT;
-        module_stream_demux_join_pid(mod, 0x12);
+        join_psi(mod, 0x12, MPEGTS_PACKET_EIT, (mod->config.pass_eit) ? NULL : on_eit, true);
 
-        mod->stream[0x14] = MPEGTS_PACKET_TDT;
+        pid_item(mod, 0x14)->type = MPEGTS_PACKET_TDT;
         module_stream_demux_join_pid(mod, 0x14);
     }
 
@@ -151,23 +254,6 @@ static void stream_reload(module_data_t *mod)
     }
 }
 
-static void on_si_timer(void *arg)
-{
-    module_data_t *mod = (module_data_t *)arg;
-
-    if(mod->custom_pat)
-        mpegts_psi_demux(mod->custom_pat, (ts_callback_t)__module_stream_send, &mod->__stream);
-
-    if(mod->custom_cat)
-        mpegts_psi_demux(mod->custom_cat, (ts_callback_t)__module_stream_send, &mod->__stream);
-
-    if(mod->custom_pmt)
-        mpegts_psi_demux(mod->custom_pmt, (ts_callback_t)__module_stream_send, &mod->__stream);
-
-    if(mod->custom_sdt)
-        mpegts_psi_demux(mod->custom_sdt, (ts_callback_t)__module_stream_send, &mod->__stream);
-}
-
 /*
  * oooooooooo   o   ooooooooooo
  *  888    888 888  88  888  88
@@ -185,28 +271,17 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         return;
 
     // check changes
-    const uint32_t crc32 = PSI_GET_CRC32(psi);
-    if(crc32 == psi->crc32)
-    {
-        mpegts_psi_demux(mod->custom_pat, (ts_callback_t)__module_stream_send, &mod->__stream);
+    if(psi->crc32 == mod->pat_crc32)
         return;
-    }
-
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        asc_log_error(MSG("PAT checksum error"));
-        return;
-    }
 
     // reload stream
-    if(psi->crc32 != 0)
+    if(mod->pat_crc32 != 0)
     {
         asc_log_warning(MSG("PAT changed. Reload stream info"));
         stream_reload(mod);
     }
 
-    psi->crc32 = crc32;
+    mod->pat_crc32 = psi->crc32;
 
     mod->tsid = PAT_GET_TSID(psi);
 
@@ -224,10 +299,9 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
         if(pnr == mod->config.pnr)
         {
             const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
-            mod->stream[pid] = MPEGTS_PACKET_PMT;
-            module_stream_demux_join_pid(mod, pid);
-            mod->pmt->pid = pid;
-            mod->pmt->crc32 = 0;
+            join_psi(mod, pid, MPEGTS_PACKET_PMT, on_pmt, false);
+            mod->pmt_pid = pid;
+            mod->pmt_crc32 = 0;
             break;
         }
     }
@@ -235,6 +309,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     if(PAT_ITEMS_EOL(psi, pointer))
     {
         mod->custom_pat->buffer_size = 0;
+        mpegts_carousel_remove(mod->carousel, mod->custom_pat);
         asc_log_error(MSG("PAT: stream with id %d is not found"), mod->config.pnr);
         return;
     }
@@ -243,7 +318,7 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     PAT_INIT(mod->custom_pat, mod->tsid, pat_version);
     memcpy(PAT_ITEMS_FIRST(mod->custom_pat), pointer, 4);
 
-    mod->custom_pmt->pid = mod->pmt->pid;
+    mod->custom_pmt->pid = mod->pmt_pid;
 
     if(mod->config.set_pnr)
     {
@@ -259,11 +334,11 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
             if(map_item->is_set)
                 continue;
 
-            if(   (map_item->origin_pid && map_item->origin_pid == mod->pmt->pid)
+            if(   (map_item->origin_pid && map_item->origin_pid == mod->pmt_pid)
                || (!strcmp(map_item->type, "pmt")) )
             {
                 map_item->is_set = true;
-                mod->pid_map[mod->pmt->pid] = map_item->custom_pid;
+                pid_item(mod, mod->pmt_pid)->custom_pid = map_item->custom_pid;
 
                 uint8_t *custom_pointer = PAT_ITEMS_FIRST(mod->custom_pat);
                 PAT_ITEM_SET_PID(mod->custom_pat, custom_pointer, map_item->custom_pid);
@@ -281,10 +356,13 @@ static void on_pat(void *arg, mpegts_psi_t *psi)
     PSI_SET_SIZE(mod->custom_pat);
     PSI_SET_CRC32(mod->custom_pat);
 
-    mpegts_psi_demux(mod->custom_pat, (ts_callback_t)__module_stream_send, &mod->__stream);
+    mpegts_carousel_set(mod->carousel, mod->custom_pat, PAT_INTERVAL);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+    {
+        pid_item(mod, psi->pid)->type = MPEGTS_PACKET_UNKNOWN;
+        mpegts_psi_cache_unsubscribe(mod->psi_cache, psi->pid, mod);
+    }
 }
 
 /*
@@ -304,29 +382,18 @@ static void on_cat(void *arg, mpegts_psi_t *psi)
         return;
 
     // check changes
-    const uint32_t crc32 = PSI_GET_CRC32(psi);
-    if(crc32 == psi->crc32)
-    {
-        mpegts_psi_demux(mod->custom_cat, (ts_callback_t)__module_stream_send, &mod->__stream);
+    if(psi->crc32 == mod->cat_crc32)
         return;
-    }
-
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        asc_log_error(MSG("CAT checksum error"));
-        return;
-    }
 
     // reload stream
-    if(psi->crc32 != 0)
+    if(mod->cat_crc32 != 0)
     {
         asc_log_warning(MSG("CAT changed. Reload stream info"));
         stream_reload(mod);
         return;
     }
 
-    psi->crc32 = crc32;
+    mod->cat_crc32 = psi->crc32;
 
     const uint8_t *desc_pointer;
 
@@ -335,24 +402,27 @@ static void on_cat(void *arg, mpegts_psi_t *psi)
         if(desc_pointer[0] == 0x09)
         {
             const uint16_t ca_pid = DESC_CA_PID(desc_pointer);
-            if(mod->stream[ca_pid] == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
+            if(pid_type(mod, ca_pid) == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
             {
-                mod->stream[ca_pid] = MPEGTS_PACKET_CA;
-                if(mod->pid_map[ca_pid] == MAX_PID)
-                    mod->pid_map[ca_pid] = 0;
+                pid_item(mod, ca_pid)->type = MPEGTS_PACKET_CA;
+                if(pid_map(mod, ca_pid) == MAX_PID)
+                    pid_item(mod, ca_pid)->custom_pid = 0;
                 module_stream_demux_join_pid(mod, ca_pid);
             }
         }
     }
 
+    mpegts_psi_reserve(mod->custom_cat, psi->buffer_size);
     memcpy(mod->custom_cat->buffer, psi->buffer, psi->buffer_size);
     mod->custom_cat->buffer_size = psi->buffer_size;
-    mod->custom_cat->cc = 0;
 
-    mpegts_psi_demux(mod->custom_cat, (ts_callback_t)__module_stream_send, &mod->__stream);
+    mpegts_carousel_set(mod->carousel, mod->custom_cat, CAT_INTERVAL);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+    {
+        pid_item(mod, psi->pid)->type = MPEGTS_PACKET_UNKNOWN;
+        mpegts_psi_cache_unsubscribe(mod->psi_cache, psi->pid, mod);
+    }
 }
 
 /*
@@ -376,7 +446,7 @@ static uint16_t map_custom_pid(module_data_t *mod, uint16_t pid, const char *typ
            || (!strcmp(map_item->type, type)) )
         {
             map_item->is_set = true;
-            mod->pid_map[pid] = map_item->custom_pid;
+            pid_item(mod, pid)->custom_pid = map_item->custom_pid;
 
             return map_item->custom_pid;
         }
@@ -397,31 +467,21 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         return;
 
     // check changes
-    const uint32_t crc32 = PSI_GET_CRC32(psi);
-    if(crc32 == psi->crc32)
-    {
-        mpegts_psi_demux(mod->custom_pmt, (ts_callback_t)__module_stream_send, &mod->__stream);
-        return;
-    }
-
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        asc_log_error(MSG("PMT checksum error"));
+    if(psi->crc32 == mod->pmt_crc32)
         return;
-    }
 
     // reload stream
-    if(psi->crc32 != 0)
+    if(mod->pmt_crc32 != 0)
     {
         asc_log_warning(MSG("PMT changed. Reload stream info"));
         stream_reload(mod);
         return;
     }
 
-    psi->crc32 = crc32;
+    mod->pmt_crc32 = psi->crc32;
 
     uint16_t skip = 12;
+    mpegts_psi_reserve(mod->custom_pmt, psi->buffer_size);
     memcpy(mod->custom_pmt->buffer, psi->buffer, 10);
 
     const uint16_t pcr_pid = PMT_GET_PCR(psi);
@@ -437,11 +497,11 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
                 continue;
 
             const uint16_t ca_pid = DESC_CA_PID(desc_pointer);
-            if(mod->stream[ca_pid] == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
+            if(pid_type(mod, ca_pid) == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
             {
-                mod->stream[ca_pid] = MPEGTS_PACKET_CA;
-                if(mod->pid_map[ca_pid] == MAX_PID)
-                    mod->pid_map[ca_pid] = 0;
+                pid_item(mod, ca_pid)->type = MPEGTS_PACKET_CA;
+                if(pid_map(mod, ca_pid) == MAX_PID)
+                    pid_item(mod, ca_pid)->custom_pid = 0;
                 module_stream_demux_join_pid(mod, ca_pid);
             }
         }
@@ -467,7 +527,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     {
         const uint16_t pid = PMT_ITEM_GET_PID(psi, pointer);
 
-        if(mod->pid_map[pid] == MAX_PID) // skip filtered pid
+        if(pid_map(mod, pid) == MAX_PID) // skip filtered pid
             continue;
 
         const uint8_t item_type = PMT_ITEM_GET_TYPE(psi, pointer);
@@ -479,7 +539,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
         memcpy(&mod->custom_pmt->buffer[skip], pointer, 5);
         skip += 5;
 
-        mod->stream[pid] = MPEGTS_PACKET_PES;
+        pid_item(mod, pid)->type = MPEGTS_PACKET_PES;
         module_stream_demux_join_pid(mod, pid);
 
         if(pid == pcr_pid)
@@ -495,11 +555,11 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
                     continue;
 
                 const uint16_t ca_pid = DESC_CA_PID(desc_pointer);
-                if(mod->stream[ca_pid] == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
+                if(pid_type(mod, ca_pid) == MPEGTS_PACKET_UNKNOWN && ca_pid != NULL_TS_PID)
                 {
-                    mod->stream[ca_pid] = MPEGTS_PACKET_CA;
-                    if(mod->pid_map[ca_pid] == MAX_PID)
-                        mod->pid_map[ca_pid] = 0;
+                    pid_item(mod, ca_pid)->type = MPEGTS_PACKET_CA;
+                    if(pid_map(mod, ca_pid) == MAX_PID)
+                        pid_item(mod, ca_pid)->custom_pid = 0;
                     module_stream_demux_join_pid(mod, ca_pid);
                 }
             }
@@ -533,6 +593,17 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
             mod->custom_pmt->buffer[skip_last + 4] = (size & 0xFF);
         }
 
+        const mpegts_es_codec_t es_codec = mpegts_es_codec(item_type);
+        if(mod->config.es_index && es_codec != MPEGTS_ES_UNKNOWN)
+        {
+            mod->es_index_list = (es_index_item_t *)realloc(
+                mod->es_index_list, (mod->es_index_count + 1) * sizeof(es_index_item_t));
+            es_index_item_t *es_index = &mod->es_index_list[mod->es_index_count];
+            ++mod->es_index_count;
+            es_index->pid = pid;
+            mpegts_es_index_init(&es_index->index, es_codec);
+        }
+
         if(mod->map)
         {
             uint16_t custom_pid = 0;
@@ -578,24 +649,28 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
 
     if(join_pcr)
     {
-        mod->stream[pcr_pid] = MPEGTS_PACKET_PES;
-        if(mod->pid_map[pcr_pid] == MAX_PID)
-            mod->pid_map[pcr_pid] = 0;
+        pid_item(mod, pcr_pid)->type = MPEGTS_PACKET_PES;
+        if(pid_map(mod, pcr_pid) == MAX_PID)
+            pid_item(mod, pcr_pid)->custom_pid = 0;
         module_stream_demux_join_pid(mod, pcr_pid);
     }
 
     if(mod->map)
     {
-        if(mod->pid_map[pcr_pid])
-            PMT_SET_PCR(mod->custom_pmt, mod->pid_map[pcr_pid]);
+        const uint16_t custom_pcr_pid = pid_map(mod, pcr_pid);
+        if(custom_pcr_pid)
+            PMT_SET_PCR(mod->custom_pmt, custom_pcr_pid);
     }
 
     PSI_SET_SIZE(mod->custom_pmt);
     PSI_SET_CRC32(mod->custom_pmt);
-    mpegts_psi_demux(mod->custom_pmt, (ts_callback_t)__module_stream_send, &mod->__stream);
+    mpegts_carousel_set(mod->carousel, mod->custom_pmt, PMT_INTERVAL);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+    {
+        pid_item(mod, psi->pid)->type = MPEGTS_PACKET_UNKNOWN;
+        mpegts_psi_cache_unsubscribe(mod->psi_cache, psi->pid, mod);
+    }
 }
 
 /*
@@ -617,14 +692,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     if(mod->tsid != SDT_GET_TSID(psi))
         return;
 
-    const uint32_t crc32 = PSI_GET_CRC32(psi);
-
-    // check crc
-    if(crc32 != PSI_CALC_CRC32(psi))
-    {
-        asc_log_error(MSG("SDT checksum error"));
-        return;
-    }
+    const uint32_t crc32 = psi->crc32;
 
     // check changes
     if(!mod->sdt_checksum_list)
@@ -640,12 +708,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
         return;
     }
     if(mod->sdt_checksum_list[section_id] == crc32)
-    {
-        if(mod->sdt_original_section_id == section_id)
-            mpegts_psi_demux(mod->custom_sdt, (ts_callback_t)__module_stream_send, &mod->__stream);
-
         return;
-    }
 
     if(mod->sdt_checksum_list[section_id] != 0)
     {
@@ -666,8 +729,7 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     if(SDT_ITEMS_EOL(psi, pointer))
         return;
 
-    mod->sdt_original_section_id = section_id;
-
+    mpegts_psi_reserve(mod->custom_sdt, psi->buffer_size);
     memcpy(mod->custom_sdt->buffer, psi->buffer, 11); // copy SDT header
     SDT_SET_SECTION_NUMBER(mod->custom_sdt, 0);
     SDT_SET_LAST_SECTION_NUMBER(mod->custom_sdt, 0);
@@ -686,10 +748,13 @@ static void on_sdt(void *arg, mpegts_psi_t *psi)
     PSI_SET_SIZE(mod->custom_sdt);
     PSI_SET_CRC32(mod->custom_sdt);
 
-    mpegts_psi_demux(mod->custom_sdt, (ts_callback_t)__module_stream_send, &mod->__stream);
+    mpegts_carousel_set(mod->carousel, mod->custom_sdt, SDT_INTERVAL);
 
     if(mod->config.no_reload)
-        mod->stream[psi->pid] = MPEGTS_PACKET_UNKNOWN;
+    {
+        pid_item(mod, psi->pid)->type = MPEGTS_PACKET_UNKNOWN;
+        mpegts_psi_cache_unsubscribe(mod->psi_cache, psi->pid, mod);
+    }
 }
 
 /*
@@ -716,17 +781,33 @@ static void on_eit(void *arg, mpegts_psi_t *psi)
     if(mod->config.pnr != EIT_GET_PNR(psi))
         return;
 
-    psi->cc = mod->eit_cc;
+    // present/following are repeated by the carousel, schedule is passed as is
+    mpegts_psi_t *custom_eit = mod->custom_eit;
+    const uint8_t section_id = psi->buffer[6];
+    const bool is_pf = (table_id == 0x4E && section_id <= 1);
+    if(is_pf)
+    {
+        if(mod->eit_pf_crc32[section_id] == psi->crc32)
+            return;
+        mod->eit_pf_crc32[section_id] = psi->crc32;
+        custom_eit = mod->custom_eit_pf[section_id];
+    }
+
+    // the section is shared with other channels
+    mpegts_psi_reserve(custom_eit, psi->buffer_size);
+    memcpy(custom_eit->buffer, psi->buffer, psi->buffer_size);
+    custom_eit->buffer_size = psi->buffer_size;
 
     if(mod->config.set_pnr)
     {
-        EIT_SET_PNR(psi, mod->config.set_pnr);
-        PSI_SET_CRC32(psi);
+        EIT_SET_PNR(custom_eit, mod->config.set_pnr);
+        PSI_SET_CRC32(custom_eit);
     }
 
-    mpegts_psi_demux(psi, (ts_callback_t)__module_stream_send, &mod->__stream);
-
-    mod->eit_cc = psi->cc;
+    if(is_pf)
+        mpegts_carousel_set(mod->carousel, custom_eit, EIT_PF_INTERVAL);
+    else
+        mpegts_carousel_send(mod->carousel, custom_eit);
 }
 
 /*
@@ -740,6 +821,9 @@ static void on_eit(void *arg, mpegts_psi_t *psi)
 
 static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
+    if(mod->carousel)
+        mpegts_carousel_input(mod->carousel);
+
     const uint16_t pid = TS_GET_PID(ts);
     if(!module_stream_demux_check_pid(mod, pid))
         return;
@@ -747,28 +831,28 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
     if(pid == NULL_TS_PID)
         return;
 
-    switch(mod->stream[pid])
+    const pid_item_t *item = pid_find(mod, pid);
+    if(!item)
+        return;
+
+    switch(item->type)
     {
         case MPEGTS_PACKET_PES:
             break;
         case MPEGTS_PACKET_PAT:
-            mpegts_psi_mux(mod->pat, ts, on_pat, mod);
-            return;
         case MPEGTS_PACKET_CAT:
-            mpegts_psi_mux(mod->cat, ts, on_cat, mod);
-            return;
         case MPEGTS_PACKET_PMT:
-            mpegts_psi_mux(mod->pmt, ts, on_pmt, mod);
+            mpegts_psi_cache_mux(mod->psi_cache, ts);
             return;
         case MPEGTS_PACKET_SDT:
             if(mod->config.pass_sdt)
                 break;
-            mpegts_psi_mux(mod->sdt, ts, on_sdt, mod);
+            mpegts_psi_cache_mux(mod->psi_cache, ts);
             return;
         case MPEGTS_PACKET_EIT:
             if(mod->config.pass_eit)
                 break;
-            mpegts_psi_mux(mod->eit, ts, on_eit, mod);
+            mpegts_psi_cache_mux(mod->psi_cache, ts);
             return;
         case MPEGTS_PACKET_UNKNOWN:
             return;
@@ -776,22 +860,71 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
             break;
     }
 
-    if(mod->pid_map[pid] == MAX_PID)
+    if(item->custom_pid == MAX_PID)
         return;
 
+    const mpegts_es_tag_t *tag = NULL;
+    for(int i = 0; i < mod->es_index_count; ++i)
+    {
+        if(mod->es_index_list[i].pid == pid)
+        {
+            tag = mpegts_es_index_mux(&mod->es_index_list[i].index, ts);
+            break;
+        }
+    }
+
     if(mod->map)
     {
-        const uint16_t custom_pid = mod->pid_map[pid];
+        const uint16_t custom_pid = item->custom_pid;
         if(custom_pid)
         {
             memcpy(mod->custom_ts, ts, TS_PACKET_SIZE);
             TS_SET_PID(mod->custom_ts, custom_pid);
-            module_stream_send(mod, mod->custom_ts);
+            module_stream_send_tag(mod, mod->custom_ts, tag);
             return;
         }
     }
 
-    module_stream_send(mod, ts);
+    module_stream_send_tag(mod, ts, tag);
+}
+
+static int method_status(module_data_t *mod)
+{
+    size_t memory = sizeof(module_data_t) + MAX_PID /* demux pid_list */
+                  + mod->pid_block_count * PID_BLOCK_SIZE * sizeof(pid_item_t)
+                  + mpegts_psi_memory(mod->custom_pat)
+                  + mpegts_psi_memory(mod->custom_cat)
+                  + mpegts_psi_memory(mod->custom_pmt)
+                  + mpegts_psi_memory(mod->custom_sdt)
+                  + mpegts_psi_memory(mod->custom_eit)
+                  + mpegts_psi_memory(mod->custom_eit_pf[0])
+                  + mpegts_psi_memory(mod->custom_eit_pf[1]);
+
+    if(mod->carousel)
+        memory += mpegts_carousel_memory(mod->carousel);
+    if(mod->sdt_checksum_list)
+        memory += (mod->sdt_max_section_id + 1) * sizeof(uint32_t);
+    if(mod->map)
+        memory += asc_list_size(mod->map) * sizeof(map_item_t);
+    memory += mod->es_index_count * sizeof(es_index_item_t);
+
+    int pids = 0;
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        if(mod->__stream.pid_list[i])
+            ++pids;
+    }
+
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, memory);
+    lua_setfield(lua, -2, "memory");
+    lua_pushnumber(lua, (mod->psi_cache) ? mpegts_psi_cache_memory(mod->psi_cache) : 0);
+    lua_setfield(lua, -2, "shared_memory");
+    lua_pushnumber(lua, pids);
+    lua_setfield(lua, -2, "pids");
+
+    return 1;
 }
 
 /*
@@ -816,48 +949,47 @@ static void module_init(module_data_t *mod)
         module_option_number("set_pnr", &mod->config.set_pnr);
 
         module_option_boolean("cas", &mod->config.cas);
+        module_option_boolean("es_index", &mod->config.es_index);
+
+        const module_stream_t *source = (mod->__stream.parent)
+                                      ? mod->__stream.parent
+                                      : &mod->__stream;
+        mod->psi_cache = mpegts_psi_cache_attach(source);
+        mod->carousel = mpegts_carousel_init((ts_callback_t)__module_stream_send, &mod->__stream);
 
-        mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
-        mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
         mod->custom_pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
         mod->custom_pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
-        mod->stream[0] = MPEGTS_PACKET_PAT;
-        module_stream_demux_join_pid(mod, 0);
+        join_psi(mod, 0, MPEGTS_PACKET_PAT, on_pat, false);
         if(mod->config.cas)
         {
-            mod->cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 1);
             mod->custom_cat = mpegts_psi_init(MPEGTS_PACKET_CAT, 1);
-            mod->stream[1] = MPEGTS_PACKET_CAT;
-            module_stream_demux_join_pid(mod, 1);
+            join_psi(mod, 1, MPEGTS_PACKET_CAT, on_cat, false);
         }
 
         module_option_boolean("no_sdt", &mod->config.no_sdt);
         if(mod->config.no_sdt == false)
         {
-            mod->sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
-            mod->custom_sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
-            mod->stream[0x11] = MPEGTS_PACKET_SDT;
-            module_stream_demux_join_pid(mod, 0x11);
-
             module_option_boolean("pass_sdt", &mod->config.pass_sdt);
+
+            mod->custom_sdt = mpegts_psi_init(MPEGTS_PACKET_SDT, 0x11);
+            join_psi(mod, 0x11, MPEGTS_PACKET_SDT, (mod->config.pass_sdt) ? NULL : on_sdt, true);
         }
 
         module_option_boolean("no_eit", &mod->config.no_eit);
         if(mod->config.no_eit == false)
         {
-            mod->eit = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
-            mod->stream[0x12] = MPEGTS_PACKET_EIT;
-            module_stream_demux_join_pid(mod, 0x12);
+            module_option_boolean("pass_eit", &mod->config.pass_eit);
 
-            mod->stream[0x14] = MPEGTS_PACKET_TDT;
-            module_stream_demux_join_pid(mod, 0x14);
+            mod->custom_eit = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
+            mod->custom_eit_pf[0] = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
+            mod->custom_eit_pf[1] = mpegts_psi_init(MPEGTS_PACKET_EIT, 0x12);
+            join_psi(mod, 0x12, MPEGTS_PACKET_EIT, (mod->config.pass_eit) ? NULL : on_eit, true);
 
-            module_option_boolean("pass_eit", &mod->config.pass_eit);
+            pid_item(mod, 0x14)->type = MPEGTS_PACKET_TDT;
+            module_stream_demux_join_pid(mod, 0x14);
         }
 
         module_option_boolean("no_reload", &mod->config.no_reload);
-        if(mod->config.no_reload)
-            mod->si_timer = asc_timer_init(500, on_si_timer, mod);
     }
     else
     {
@@ -867,7 +999,7 @@ static void module_init(module_data_t *mod)
             lua_foreach(lua, -2)
             {
                 const int pid = lua_tonumber(lua, -1);
-                mod->stream[pid] = MPEGTS_PACKET_PES;
+                pid_item(mod, pid)->type = MPEGTS_PACKET_PES;
                 module_stream_demux_join_pid(mod, pid);
             }
         }
@@ -910,7 +1042,7 @@ static void module_init(module_data_t *mod)
         lua_foreach(lua, -2)
         {
             const int pid = lua_tonumber(lua, -1);
-            mod->pid_map[pid] = MAX_PID;
+            pid_item(mod, pid)->custom_pid = MAX_PID;
         }
     }
     lua_pop(lua, 1); // filter
@@ -918,13 +1050,20 @@ static void module_init(module_data_t *mod)
     lua_getfield(lua, MODULE_OPTIONS_IDX, "filter~");
     if(lua_istable(lua, -1))
     {
-        for(uint32_t i = 0; i < ASC_ARRAY_SIZE(mod->pid_map); ++i)
-            mod->pid_map[i] = MAX_PID;
+        mod->pid_default = MAX_PID;
+        for(int i = 0; i < PID_BLOCK_COUNT; ++i)
+        {
+            pid_item_t *block = mod->pid_block[i];
+            if(!block)
+                continue;
+            for(int j = 0; j < PID_BLOCK_SIZE; ++j)
+                block[j].custom_pid = MAX_PID;
+        }
 
         lua_foreach(lua, -2)
         {
             const int pid = lua_tonumber(lua, -1);
-            mod->pid_map[pid] = 0;
+            pid_item(mod, pid)->custom_pid = 0;
         }
     }
     lua_pop(lua, 1); // filter~
@@ -934,27 +1073,33 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
-    mpegts_psi_destroy(mod->pat);
-    if(mod->cat)
+    if(mod->psi_cache)
     {
-        mpegts_psi_destroy(mod->cat);
-        mpegts_psi_destroy(mod->custom_cat);
+        mpegts_psi_cache_unsubscribe_all(mod->psi_cache, mod);
+        mpegts_psi_cache_detach(mod->psi_cache);
     }
-    mpegts_psi_destroy(mod->pmt);
+
+    mpegts_carousel_destroy(mod->carousel);
+
     mpegts_psi_destroy(mod->custom_pat);
+    mpegts_psi_destroy(mod->custom_cat);
     mpegts_psi_destroy(mod->custom_pmt);
+    mpegts_psi_destroy(mod->custom_sdt);
+    mpegts_psi_destroy(mod->custom_eit);
+    mpegts_psi_destroy(mod->custom_eit_pf[0]);
+    mpegts_psi_destroy(mod->custom_eit_pf[1]);
 
-    if(mod->sdt)
+    for(int i = 0; i < PID_BLOCK_COUNT; ++i)
     {
-        mpegts_psi_destroy(mod->sdt);
-        mpegts_psi_destroy(mod->custom_sdt);
-
-        if(mod->sdt_checksum_list)
-            free(mod->sdt_checksum_list);
+        if(mod->pid_block[i])
+            free(mod->pid_block[i]);
     }
 
-    if(mod->eit)
-        mpegts_psi_destroy(mod->eit);
+    if(mod->sdt_checksum_list)
+        free(mod->sdt_checksum_list);
+
+    if(mod->es_index_list)
+        free(mod->es_index_list);
 
     if(mod->map)
     {
@@ -965,14 +1110,12 @@ static void module_destroy(module_data_t *mod)
         }
         asc_list_destroy(mod->map);
     }
-
-    if(mod->si_timer)
-        asc_timer_destroy(mod->si_timer);
 }
 
 MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
-    MODULE_STREAM_METHODS_REF()
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
 };
 MODULE_LUA_REGISTER(channel)
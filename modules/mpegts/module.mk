@@ -1,3 +1,3 @@
-SOURCES="src/pcr.c src/psi.c src/pes.c src/types.c"
+SOURCES="src/pcr.c src/psi.c src/psi_cache.c src/carousel.c src/pes.c src/es_index.c src/es_track.c src/sync.c src/types.c"
 SOURCES="$SOURCES analyze.c channel.c transmit.c"
 MODULES="analyze channel transmit"
@@ -37,6 +37,7 @@
 #define TS_BODY_SIZE (TS_PACKET_SIZE - TS_HEADER_SIZE)
 
 #define M2TS_PACKET_SIZE 192
+#define RS_PACKET_SIZE 204
 
 #define MAX_PID 8192
 #define NULL_TS_PID (MAX_PID - 1)
@@ -69,6 +70,28 @@
 
 typedef void (*ts_callback_t)(void *, const uint8_t *);
 
+/*
+ * Framing of the byte streams. A frame starts with the sync byte:
+ * 188 - TS, 192 - M2TS (4 bytes header before the next packet),
+ * 204 - TS with 16 bytes Reed-Solomon parity. The callback gets
+ * 188 bytes of the each TS packet.
+ */
+
+#define MPEGTS_SYNC_DEPTH 3 /* packets to confirm the framing */
+
+size_t mpegts_sync_find(const uint8_t *buffer, size_t size, size_t packet_size);
+size_t mpegts_sync_detect(const uint8_t *buffer, size_t size, size_t *packet_size);
+size_t mpegts_sync_check(const uint8_t *buffer, size_t count, size_t packet_size);
+
+typedef struct mpegts_sync_t mpegts_sync_t;
+
+mpegts_sync_t * mpegts_sync_init(ts_callback_t callback, void *arg);
+void mpegts_sync_destroy(mpegts_sync_t *sync);
+void mpegts_sync_reset(mpegts_sync_t *sync);
+void mpegts_sync_push(mpegts_sync_t *sync, const uint8_t *buffer, size_t size);
+size_t mpegts_sync_packet_size(const mpegts_sync_t *sync);
+uint64_t mpegts_sync_skip(const mpegts_sync_t *sync);
+
 /*
  * ooooooooooo ooooo  oooo oooooooooo ooooooooooo  oooooooo8
  * 88  888  88   888  88    888    888 888    88  888
@@ -138,17 +161,58 @@ typedef struct
     // mux
     uint16_t buffer_size;
     uint16_t buffer_skip;
-    uint8_t buffer[PSI_MAX_SIZE];
+    uint16_t buffer_alloc;
+    uint8_t *buffer;
 } mpegts_psi_t;
 
 typedef void (*psi_callback_t)(void *, mpegts_psi_t *);
 
+/* buffer starts with PSI_INIT_SIZE bytes and grows up to PSI_MAX_SIZE.
+ * mpegts_psi_reserve() should be called before the section is built */
+#define PSI_INIT_SIZE 256
+
 mpegts_psi_t * mpegts_psi_init(mpegts_packet_type_t type, uint16_t pid);
 void mpegts_psi_destroy(mpegts_psi_t *psi);
+void mpegts_psi_reserve(mpegts_psi_t *psi, size_t size);
+void mpegts_psi_copy(mpegts_psi_t *dst, const mpegts_psi_t *src);
+size_t mpegts_psi_memory(const mpegts_psi_t *psi);
 
 void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callback, void *arg);
 void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg);
 
+/* sections shared by all modules attached to the same source.
+ * callback gets verified sections with psi->crc32 set and must not modify it.
+ * is_repeat - false to receive only changed sections after the complete table */
+typedef struct mpegts_psi_cache_t mpegts_psi_cache_t;
+
+mpegts_psi_cache_t * mpegts_psi_cache_attach(const void *source);
+void mpegts_psi_cache_detach(mpegts_psi_cache_t *cache);
+
+void mpegts_psi_cache_subscribe(  mpegts_psi_cache_t *cache, uint16_t pid
+                                , psi_callback_t callback, void *arg, bool is_repeat);
+void mpegts_psi_cache_unsubscribe(mpegts_psi_cache_t *cache, uint16_t pid, void *arg);
+void mpegts_psi_cache_unsubscribe_all(mpegts_psi_cache_t *cache, void *arg);
+
+void mpegts_psi_cache_mux(mpegts_psi_cache_t *cache, const uint8_t *ts);
+size_t mpegts_psi_cache_memory(const mpegts_psi_cache_t *cache);
+
+/* tables repeated with the interval in milliseconds. 0 - only on changes.
+ * mpegts_carousel_set() should be called again when the table is changed,
+ * the new version is sent on the next tick.
+ * mpegts_carousel_input() - called on each input packet. when it is used,
+ * tables are not repeated if the input is lost */
+typedef struct mpegts_carousel_t mpegts_carousel_t;
+
+mpegts_carousel_t * mpegts_carousel_init(ts_callback_t callback, void *arg);
+void mpegts_carousel_destroy(mpegts_carousel_t *carousel);
+
+void mpegts_carousel_set(mpegts_carousel_t *carousel, const mpegts_psi_t *psi, uint32_t interval);
+void mpegts_carousel_remove(mpegts_carousel_t *carousel, const mpegts_psi_t *psi);
+void mpegts_carousel_clear(mpegts_carousel_t *carousel);
+void mpegts_carousel_send(mpegts_carousel_t *carousel, const mpegts_psi_t *psi);
+void mpegts_carousel_input(mpegts_carousel_t *carousel);
+size_t mpegts_carousel_memory(const mpegts_carousel_t *carousel);
+
 #define PSI_CALC_CRC32(_psi) crc32b(_psi->buffer, _psi->buffer_size - CRC32_SIZE)
 
 // with inline function we have nine more instructions
@@ -185,6 +249,13 @@ void mpegts_psi_demux(mpegts_psi_t *psi, ts_callback_t callback, void *arg);
 
 #define PES_MAX_SIZE 0x000A0000
 
+/* buffers are taken from the pool of the size classes, from PES_MIN_SIZE
+ * to PES_MAX_SIZE, and grow on demand. mpegts_pes_mux() returns the buffer
+ * to the pool when the callback is completed. For the demux buffer is kept
+ * by the instance, mpegts_pes_reserve() should be called before the PES is
+ * built (PES_INIT and mpegts_pes_add_data() do it) */
+#define PES_MIN_SIZE 0x00000800
+
 #define PES_HEADER_SIZE 6
 
 #define PES_BUFFER_GET_SIZE(_b) (((_b[4] << 8) | _b[5]) + 6)
@@ -209,7 +280,9 @@ typedef struct
     // mux
     uint32_t buffer_size;
     uint32_t buffer_skip;
-    uint8_t buffer[PES_MAX_SIZE];
+    uint32_t buffer_alloc;
+    uint32_t buffer_hint; /* size of the previous PES */
+    uint8_t *buffer;
 } mpegts_pes_t;
 
 typedef void (*pes_callback_t)(void *, mpegts_pes_t *);
@@ -217,6 +290,9 @@ typedef void (*pes_callback_t)(void *, mpegts_pes_t *);
 mpegts_pes_t * mpegts_pes_init(mpegts_packet_type_t type, uint16_t pid, uint32_t pcr_interval);
 void mpegts_pes_destroy(mpegts_pes_t *pes);
 
+void mpegts_pes_reserve(mpegts_pes_t *pes, uint32_t size);
+void mpegts_pes_add_data(mpegts_pes_t *pes, const uint8_t *data, uint32_t size);
+
 void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callback, void *arg);
 void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
@@ -235,6 +311,7 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 #define PES_INIT(_pes, _stream_id, _is_pts, _is_dts)                                            \
     {                                                                                           \
         const uint8_t __stream_id = _stream_id;                                                 \
+        mpegts_pes_reserve(_pes, PES_HEADER_SIZE + 3 + 10);                                     \
         _pes->buffer[0] = 0x00;                                                                 \
         _pes->buffer[1] = 0x00;                                                                 \
         _pes->buffer[2] = 0x01;                                                                 \
@@ -323,6 +400,117 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
         }                                                                                       \
     }
 
+/*
+ * ooooooooooo  oooooooo8
+ *  888    88  888
+ *  888ooo8     888oooooo
+ *  888    oo          888
+ * o888ooo8888 o88oooo888
+ *
+ */
+
+typedef enum
+{
+    MPEGTS_ES_UNKNOWN   = 0,
+    MPEGTS_ES_MPEG2     = 1, // ISO/IEC 13818-2
+    MPEGTS_ES_H264      = 2, // ISO/IEC 14496-10
+    MPEGTS_ES_HEVC      = 3, // ISO/IEC 23008-2
+} mpegts_es_codec_t;
+
+typedef enum
+{
+    MPEGTS_FRAME_UNKNOWN    = 0,
+    MPEGTS_FRAME_I          = 1,
+    MPEGTS_FRAME_P          = 2,
+    MPEGTS_FRAME_B          = 3,
+} mpegts_frame_type_t;
+
+#define ES_TAG_PES_START    0x01 /* PES header in the packet */
+#define ES_TAG_AU_START     0x02 /* access unit begins in the packet */
+#define ES_TAG_FRAME        0x04 /* slice header of the first slice in the packet */
+#define ES_TAG_RAP          0x08 /* random access point: IDR, IRAP, I after sequence header */
+#define ES_TAG_PTS          0x10
+#define ES_TAG_DTS          0x20
+
+/* Per-packet tag. If the access unit starts with the long headers (SPS, SEI)
+ * the frame type can be reported by the one of the next packets.
+ * au_count is incremented on each access unit to bind them */
+typedef struct
+{
+    uint8_t flags;
+    mpegts_frame_type_t frame;
+    uint32_t au_count;
+    uint64_t pts;
+    uint64_t dts;
+} mpegts_es_tag_t;
+
+#define ES_HEADER_SIZE 12
+
+/* fixed size state, could be embedded into the module data */
+typedef struct
+{
+    mpegts_es_codec_t codec;
+    uint8_t cc;
+    bool is_sync;       /* PES header found */
+
+    uint32_t sc_state;  /* last bytes of the previous payload */
+
+    /* bytes after the start code, without the emulation prevention */
+    uint8_t header[ES_HEADER_SIZE];
+    uint8_t header_size;
+    uint8_t header_zero;
+    bool is_header;
+
+    bool is_vcl;        /* slice of the current access unit is found */
+    bool is_rap_header; /* MPEG-2 sequence header or GOP before the picture */
+    uint8_t hevc_pps_extra[64]; /* num_extra_slice_header_bits by pps_id */
+
+    mpegts_es_tag_t tag;
+} mpegts_es_index_t;
+
+mpegts_es_codec_t mpegts_es_codec(uint8_t type_id);
+void mpegts_es_index_init(mpegts_es_index_t *index, mpegts_es_codec_t codec);
+const mpegts_es_tag_t * mpegts_es_index_mux(mpegts_es_index_t *index, const uint8_t *ts);
+
+/* events returned by mpegts_es_track_mux() */
+#define ES_TRACK_PAT        0x01 /* PAT is changed */
+#define ES_TRACK_PMT        0x02 /* PMT is changed */
+#define ES_TRACK_ES         0x04 /* selected stream or its codec is changed */
+#define ES_TRACK_PAT_ERROR  0x08 /* PAT checksum error */
+#define ES_TRACK_PMT_ERROR  0x10 /* PMT checksum error */
+#define ES_TRACK_PES_START  0x20 /* PES header of the selected stream in the packet */
+#define ES_TRACK_KEY        0x40 /* key of the current PES is found */
+
+/* Follows the first program: PAT, PMT, PCR PID and the stream for the
+ * segmentation - the first video stream, or the first PES stream if there
+ * is no video. Key is the random access point of the video PES, or the
+ * audio PES not earlier than key_interval seconds after the previous key,
+ * reported once per PES */
+typedef struct
+{
+    mpegts_psi_t *pat;
+    mpegts_psi_t *pmt;
+    uint16_t pmt_pid;
+    uint16_t pcr_pid;
+    uint16_t es_pid;
+    mpegts_es_codec_t es_codec;
+
+    uint32_t key_interval;  /* 0 - each audio PES is the key */
+    time_t key_time;
+    bool is_pes_key;        /* key of the current PES is reported */
+
+    mpegts_es_index_t index; /* if the upstream doesn't tag the packets */
+    const mpegts_es_tag_t *tag; /* tag of the last es_pid packet */
+
+    uint8_t events;
+} mpegts_es_track_t;
+
+mpegts_es_track_t * mpegts_es_track_init(uint32_t key_interval);
+void mpegts_es_track_destroy(mpegts_es_track_t *track);
+/* tag - attached by the upstream (module_stream_tag()), NULL to index here */
+uint8_t mpegts_es_track_mux(mpegts_es_track_t *track, const uint8_t *ts
+                            , const mpegts_es_tag_t *tag);
+
 /*
  * ooooooooo  ooooooooooo  oooooooo8    oooooooo8
  *  888    88o 888    88  888         o888     88
@@ -346,6 +534,7 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
  #define PAT_INIT(_psi, _tsid, _version)                                                        \
     {                                                                                           \
+        mpegts_psi_reserve(_psi, 8 + CRC32_SIZE);                                               \
         _psi->buffer[0] = 0x00;                                                                 \
         _psi->buffer[1] = 0x80 | 0x30;                                                          \
         PAT_SET_TSID(_psi, _tsid);                                                              \
@@ -378,6 +567,7 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
 #define PAT_ITEMS_APPEND(_psi, _pnr, _pid)                                                      \
     {                                                                                           \
+        mpegts_psi_reserve(_psi, _psi->buffer_size + 4);                                        \
         uint8_t *const __pointer_a = &_psi->buffer[_psi->buffer_size - CRC32_SIZE];             \
         PAT_ITEM_SET_PNR(_psi, __pointer_a, _pnr);                                              \
         PAT_ITEM_SET_PID(_psi, __pointer_a, _pid);                                              \
@@ -441,6 +631,7 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
 #define PMT_INIT(_psi, _pnr, _version, _pcr, _desc, _desc_size)                                 \
     {                                                                                           \
+        mpegts_psi_reserve(_psi, 12 + (_desc_size) + CRC32_SIZE);                               \
         _psi->buffer[0] = 0x02;                                                                 \
         _psi->buffer[1] = 0x80 | 0x30;                                                          \
         PMT_SET_PNR(_psi, _pnr);                                                                \
@@ -505,6 +696,7 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
 #define PMT_ITEMS_APPEND(_psi, _type, _pid, _desc, _desc_size)                                  \
     {                                                                                           \
+        mpegts_psi_reserve(_psi, _psi->buffer_size + 5 + (_desc_size));                         \
         uint8_t *const __pointer_a = &_psi->buffer[_psi->buffer_size - CRC32_SIZE];             \
         PMT_ITEM_SET_TYPE(_psi, __pointer_a, _type);                                            \
         PMT_ITEM_SET_PID(_psi, __pointer_a, _pid);                                              \
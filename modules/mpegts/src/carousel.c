@@ -0,0 +1,395 @@
+/*
+ * Astra Module: MPEG-TS (SI carousel)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Repeats tables with the interval of the each table. Sections are
+ * packetized once when the table is changed, on the emission only
+ * the continuity counter is updated. Tables with the same PID share
+ * the counter.
+ *
+ * All carousels with the repeated tables are served by one shared timer.
+ * Carousel used only with mpegts_carousel_send() is not in the list.
+ * If the owner reports the input with mpegts_carousel_input(), tables are
+ * not repeated while the input is lost.
+ */
+
+#include "../mpegts.h"
+
+#define CAROUSEL_TICK 20 /* ms */
+#define CAROUSEL_INPUT_TIMEOUT (1000 * 1000) /* us */
+
+typedef struct
+{
+    const mpegts_psi_t *psi;
+    uint16_t pid;
+
+    uint64_t interval;
+    uint64_t next_time;
+
+    uint8_t *ts;
+    size_t ts_count;
+    size_t ts_size;
+} carousel_item_t;
+
+typedef struct
+{
+    uint16_t pid;
+    uint8_t cc;
+} carousel_cc_t;
+
+struct mpegts_carousel_t
+{
+    ts_callback_t callback;
+    void *arg;
+
+    bool is_scheduled;      /* in the carousel_list */
+
+    /* mpegts_carousel_input() */
+    bool is_input;
+    uint64_t input_time;
+
+    carousel_item_t *item_list;
+    size_t item_count;
+
+    carousel_cc_t *cc_list;
+    size_t cc_count;
+
+    /* mpegts_carousel_send() */
+    uint8_t *ts;
+    size_t ts_size;
+};
+
+static size_t carousel_packetize(const mpegts_psi_t *psi, uint8_t **buffer, size_t *size)
+{
+    const size_t buffer_size = psi->buffer_size;
+    if(!buffer_size)
+        return 0;
+
+    /* 1 - pointer field */
+    const size_t count = (buffer_size + 1 + TS_BODY_SIZE - 1) / TS_BODY_SIZE;
+    if(count * TS_PACKET_SIZE > *size)
+    {
+        *size = count * TS_PACKET_SIZE;
+        *buffer = (uint8_t *)realloc(*buffer, *size);
+    }
+
+    size_t buffer_skip = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t *ts = &(*buffer)[i * TS_PACKET_SIZE];
+
+        ts[0] = 0x47;
+        ts[1] = psi->pid >> 8;
+        ts[2] = psi->pid & 0xff;
+        ts[3] = 0x10; /* payload without adaptation field */
+
+        size_t ts_skip = TS_HEADER_SIZE;
+        if(i == 0)
+        {
+            ts[1] |= 0x40; /* PUSI */
+            ts[4] = 0x00;
+            ++ts_skip;
+        }
+
+        size_t ts_size = TS_PACKET_SIZE - ts_skip;
+        const size_t buffer_tail = buffer_size - buffer_skip;
+        if(buffer_tail < ts_size)
+        {
+            ts_size = buffer_tail;
+            memset(&ts[ts_skip + ts_size], 0xFF, TS_PACKET_SIZE - ts_skip - ts_size);
+        }
+
+        memcpy(&ts[ts_skip], &psi->buffer[buffer_skip], ts_size);
+        buffer_skip += ts_size;
+    }
+
+    return count;
+}
+
+static void carousel_emit(  mpegts_carousel_t *carousel, uint16_t pid
+                          , uint8_t *buffer, size_t count)
+{
+    carousel_cc_t *cc = NULL;
+    for(size_t i = 0; i < carousel->cc_count; ++i)
+    {
+        if(carousel->cc_list[i].pid == pid)
+        {
+            cc = &carousel->cc_list[i];
+            break;
+        }
+    }
+
+    if(!cc)
+    {
+        carousel->cc_list = (carousel_cc_t *)realloc(
+            carousel->cc_list, (carousel->cc_count + 1) * sizeof(carousel_cc_t));
+        cc = &carousel->cc_list[carousel->cc_count];
+        ++carousel->cc_count;
+        cc->pid = pid;
+        cc->cc = 0;
+    }
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint8_t *ts = &buffer[i * TS_PACKET_SIZE];
+        ts[3] = (ts[3] & 0xF0) | cc->cc;
+        cc->cc = (cc->cc + 1) & 0x0F;
+        carousel->callback(carousel->arg, ts);
+    }
+}
+
+/* carousels with the repeated tables. slot is NULL if the carousel
+ * is removed by the callback, the list is compacted after the tick */
+static struct
+{
+    mpegts_carousel_t **list;
+    size_t count;
+    size_t size;
+
+    asc_timer_t *timer;
+    bool is_tick;
+    bool is_removed;
+} carousel_list;
+
+static void carousel_list_release(void)
+{
+    ASC_FREE(carousel_list.timer, asc_timer_destroy);
+    ASC_FREE(carousel_list.list, free);
+    carousel_list.size = 0;
+}
+
+static void carousel_tick(mpegts_carousel_t *carousel, uint64_t current_time)
+{
+    if(carousel->input_time)
+    {
+        if(carousel->is_input)
+        {
+            carousel->is_input = false;
+            carousel->input_time = current_time;
+        }
+        else if(current_time - carousel->input_time >= CAROUSEL_INPUT_TIMEOUT)
+            return;
+    }
+
+    for(size_t i = 0; i < carousel->item_count; ++i)
+    {
+        carousel_item_t *item = &carousel->item_list[i];
+        if(current_time < item->next_time)
+            continue;
+
+        if(!item->interval)
+            item->next_time = UINT64_MAX;
+        else
+        {
+            item->next_time += item->interval;
+            if(item->next_time <= current_time)
+                item->next_time = current_time + item->interval;
+        }
+
+        carousel_emit(carousel, item->pid, item->ts, item->ts_count);
+    }
+}
+
+static void on_carousel_timer(void *arg)
+{
+    __uarg(arg);
+
+    const uint64_t current_time = asc_utime();
+
+    /* carousels added by the callbacks are served on the next tick */
+    const size_t count = carousel_list.count;
+    carousel_list.is_tick = true;
+    for(size_t i = 0; i < count; ++i)
+    {
+        mpegts_carousel_t *carousel = carousel_list.list[i];
+        if(carousel)
+            carousel_tick(carousel, current_time);
+    }
+    carousel_list.is_tick = false;
+
+    if(carousel_list.is_removed)
+    {
+        size_t j = 0;
+        for(size_t i = 0; i < carousel_list.count; ++i)
+        {
+            if(carousel_list.list[i])
+                carousel_list.list[j++] = carousel_list.list[i];
+        }
+        carousel_list.count = j;
+        carousel_list.is_removed = false;
+    }
+
+    if(!carousel_list.count)
+        carousel_list_release();
+}
+
+static void carousel_schedule(mpegts_carousel_t *carousel)
+{
+    if(carousel->is_scheduled)
+        return;
+
+    if(carousel_list.count == carousel_list.size)
+    {
+        carousel_list.size = (carousel_list.size) ? (carousel_list.size * 2) : 16;
+        carousel_list.list = (mpegts_carousel_t **)realloc(
+            carousel_list.list, carousel_list.size * sizeof(mpegts_carousel_t *));
+    }
+    carousel_list.list[carousel_list.count++] = carousel;
+    carousel->is_scheduled = true;
+
+    if(!carousel_list.timer)
+        carousel_list.timer = asc_timer_init(CAROUSEL_TICK, on_carousel_timer, NULL);
+}
+
+static void carousel_unschedule(mpegts_carousel_t *carousel)
+{
+    if(!carousel->is_scheduled)
+        return;
+
+    carousel->is_scheduled = false;
+    for(size_t i = 0; i < carousel_list.count; ++i)
+    {
+        if(carousel_list.list[i] != carousel)
+            continue;
+
+        if(carousel_list.is_tick)
+        {
+            carousel_list.list[i] = NULL;
+            carousel_list.is_removed = true;
+        }
+        else
+        {
+            --carousel_list.count;
+            carousel_list.list[i] = carousel_list.list[carousel_list.count];
+            if(!carousel_list.count)
+                carousel_list_release();
+        }
+        return;
+    }
+}
+
+mpegts_carousel_t * mpegts_carousel_init(ts_callback_t callback, void *arg)
+{
+    mpegts_carousel_t *carousel = (mpegts_carousel_t *)calloc(1, sizeof(mpegts_carousel_t));
+    carousel->callback = callback;
+    carousel->arg = arg;
+    return carousel;
+}
+
+void mpegts_carousel_destroy(mpegts_carousel_t *carousel)
+{
+    if(!carousel)
+        return;
+
+    mpegts_carousel_clear(carousel);
+    free(carousel->item_list);
+    free(carousel->cc_list);
+    free(carousel->ts);
+    free(carousel);
+}
+
+void mpegts_carousel_set(mpegts_carousel_t *carousel, const mpegts_psi_t *psi, uint32_t interval)
+{
+    if(!psi->buffer_size)
+    {
+        mpegts_carousel_remove(carousel, psi);
+        return;
+    }
+
+    carousel_item_t *item = NULL;
+    for(size_t i = 0; i < carousel->item_count; ++i)
+    {
+        if(carousel->item_list[i].psi == psi)
+        {
+            item = &carousel->item_list[i];
+            break;
+        }
+    }
+
+    if(!item)
+    {
+        carousel->item_list = (carousel_item_t *)realloc(
+            carousel->item_list, (carousel->item_count + 1) * sizeof(carousel_item_t));
+        item = &carousel->item_list[carousel->item_count];
+        ++carousel->item_count;
+        memset(item, 0, sizeof(carousel_item_t));
+        item->psi = psi;
+    }
+
+    item->pid = psi->pid;
+    item->interval = (uint64_t)interval * 1000;
+    item->ts_count = carousel_packetize(psi, &item->ts, &item->ts_size);
+
+    /* new version goes out on the next tick */
+    item->next_time = 0;
+
+    carousel_schedule(carousel);
+}
+
+void mpegts_carousel_remove(mpegts_carousel_t *carousel, const mpegts_psi_t *psi)
+{
+    for(size_t i = 0; i < carousel->item_count; ++i)
+    {
+        carousel_item_t *item = &carousel->item_list[i];
+        if(item->psi != psi)
+            continue;
+
+        free(item->ts);
+        --carousel->item_count;
+        if(i < carousel->item_count)
+            *item = carousel->item_list[carousel->item_count];
+        if(!carousel->item_count)
+            carousel_unschedule(carousel);
+        return;
+    }
+}
+
+void mpegts_carousel_clear(mpegts_carousel_t *carousel)
+{
+    for(size_t i = 0; i < carousel->item_count; ++i)
+        free(carousel->item_list[i].ts);
+    carousel->item_count = 0;
+
+    carousel_unschedule(carousel);
+}
+
+void mpegts_carousel_input(mpegts_carousel_t *carousel)
+{
+    carousel->is_input = true;
+    if(!carousel->input_time)
+        carousel->input_time = asc_clock_now();
+}
+
+void mpegts_carousel_send(mpegts_carousel_t *carousel, const mpegts_psi_t *psi)
+{
+    const size_t count = carousel_packetize(psi, &carousel->ts, &carousel->ts_size);
+    carousel_emit(carousel, psi->pid, carousel->ts, count);
+}
+
+size_t mpegts_carousel_memory(const mpegts_carousel_t *carousel)
+{
+    size_t size = sizeof(mpegts_carousel_t)
+                + carousel->item_count * sizeof(carousel_item_t)
+                + carousel->cc_count * sizeof(carousel_cc_t)
+                + carousel->ts_size;
+    for(size_t i = 0; i < carousel->item_count; ++i)
+        size += carousel->item_list[i].ts_size;
+    return size;
+}
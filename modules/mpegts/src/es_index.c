@@ -0,0 +1,504 @@
+/*
+ * Astra Module: MPEG-TS (ES indexer)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Finds access units and frame types in the video stream packet by packet,
+ * without the PES assembling. Only the few bytes after each start code are
+ * kept, start codes split between packets are found by the last bytes
+ * of the previous payload.
+ */
+
+#include "../mpegts.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#   include <emmintrin.h>
+#   define ES_SSE2
+#endif
+
+mpegts_es_codec_t mpegts_es_codec(uint8_t type_id)
+{
+    switch(type_id)
+    {
+        case 0x01:  // ISO/IEC 11172 Video
+        case 0x02:  // ISO/IEC 13818-2 Video
+            return MPEGTS_ES_MPEG2;
+        case 0x1B:  // ISO/IEC 14496-10 Video | H.264
+            return MPEGTS_ES_H264;
+        case 0x24:  // ISO/IEC 23008-2 Video | H.265
+            return MPEGTS_ES_HEVC;
+        default:
+            return MPEGTS_ES_UNKNOWN;
+    }
+}
+
+void mpegts_es_index_init(mpegts_es_index_t *index, mpegts_es_codec_t codec)
+{
+    memset(index, 0, sizeof(mpegts_es_index_t));
+    index->codec = codec;
+    index->sc_state = 0xFFFFFFFF;
+    index->is_vcl = true;
+}
+
+/*
+ * Exp-Golomb reader for the slice headers
+ */
+
+typedef struct
+{
+    const uint8_t *buffer;
+    uint32_t size; /* bits */
+    uint32_t skip; /* bits */
+} es_bits_t;
+
+static int bits_get(es_bits_t *bits, uint32_t count)
+{
+    if(bits->skip + count > bits->size)
+        return -1;
+
+    int value = 0;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        const uint32_t skip = bits->skip + i;
+        value = (value << 1) | ((bits->buffer[skip / 8] >> (7 - (skip % 8))) & 0x01);
+    }
+    bits->skip += count;
+
+    return value;
+}
+
+static int bits_get_ue(es_bits_t *bits)
+{
+    uint32_t zeros = 0;
+    while(true)
+    {
+        const int bit = bits_get(bits, 1);
+        if(bit < 0 || zeros > 16)
+            return -1;
+        if(bit)
+            break;
+        ++zeros;
+    }
+
+    const int value = bits_get(bits, zeros);
+    if(value < 0)
+        return -1;
+
+    return (1 << zeros) - 1 + value;
+}
+
+/*
+ * Start code search
+ */
+
+static const uint8_t * find_start_code_c(const uint8_t *ptr, const uint8_t *end)
+{
+    while(ptr + 3 <= end)
+    {
+        if(ptr[2] > 0x01)
+            ptr += 3;
+        else if(ptr[2] == 0x01)
+        {
+            if(ptr[1] == 0x00 && ptr[0] == 0x00)
+                return ptr + 3;
+            ptr += 3;
+        }
+        else
+            ++ptr;
+    }
+
+    return NULL;
+}
+
+/* returns pointer to the byte after 00 00 01 */
+static const uint8_t * find_start_code(const uint8_t *ptr, const uint8_t *end)
+{
+#ifdef ES_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    /* 16 bytes and 2 bytes ahead for the last pair of zeros */
+    while(ptr + 18 <= end)
+    {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)ptr);
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(ptr + 1));
+        uint32_t mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(v0, zero), _mm_cmpeq_epi8(v1, zero)));
+
+        while(mask)
+        {
+            const int i = __builtin_ctz(mask);
+            if(ptr[i + 2] == 0x01)
+                return ptr + i + 3;
+            mask &= mask - 1;
+        }
+
+        ptr += 16;
+    }
+#endif
+
+    return find_start_code_c(ptr, end);
+}
+
+/*
+ * Access units
+ */
+
+static void es_au_begin(mpegts_es_index_t *index)
+{
+    /* access unit is opened by the first non-VCL unit after the slices */
+    if(!index->is_vcl)
+        return;
+
+    index->is_vcl = false;
+    index->is_rap_header = false;
+    ++index->tag.au_count;
+    index->tag.flags |= ES_TAG_AU_START;
+}
+
+static void es_frame(mpegts_es_index_t *index, mpegts_frame_type_t frame, bool is_rap)
+{
+    if(!(index->tag.flags & ES_TAG_FRAME))
+    {
+        index->tag.flags |= ES_TAG_FRAME;
+        index->tag.frame = frame;
+    }
+
+    if(is_rap)
+        index->tag.flags |= ES_TAG_RAP;
+}
+
+static void es_parse_mpeg2(mpegts_es_index_t *index)
+{
+    const uint8_t *header = index->header;
+
+    switch(header[0])
+    {
+        case 0xB3: /* sequence header */
+        case 0xB8: /* group of pictures */
+            es_au_begin(index);
+            index->is_rap_header = true;
+            break;
+        case 0x00: /* picture */
+        {
+            es_au_begin(index);
+
+            mpegts_frame_type_t frame = MPEGTS_FRAME_UNKNOWN;
+            if(index->header_size >= 3)
+            {
+                switch((header[2] >> 3) & 0x07)
+                {
+                    case 1: frame = MPEGTS_FRAME_I; break;
+                    case 2: frame = MPEGTS_FRAME_P; break;
+                    case 3: frame = MPEGTS_FRAME_B; break;
+                    default: break;
+                }
+            }
+
+            es_frame(index, frame, (frame == MPEGTS_FRAME_I && index->is_rap_header));
+            index->is_rap_header = false;
+            index->is_vcl = true;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void es_parse_h264(mpegts_es_index_t *index)
+{
+    const uint8_t nal_type = index->header[0] & 0x1F;
+
+    switch(nal_type)
+    {
+        case 1: /* non-IDR slice */
+        case 5: /* IDR slice */
+        {
+            es_bits_t bits = { &index->header[1], (index->header_size - 1) * 8, 0 };
+            if(bits_get_ue(&bits) == 0)
+            {
+                /* first_mb_in_slice == 0 */
+                es_au_begin(index);
+
+                mpegts_frame_type_t frame = MPEGTS_FRAME_UNKNOWN;
+                switch(bits_get_ue(&bits))
+                {
+                    case 0: case 3: case 5: case 8:
+                        frame = MPEGTS_FRAME_P;
+                        break;
+                    case 1: case 6:
+                        frame = MPEGTS_FRAME_B;
+                        break;
+                    case 2: case 4: case 7: case 9:
+                        frame = MPEGTS_FRAME_I;
+                        break;
+                    default:
+                        if(nal_type == 5)
+                            frame = MPEGTS_FRAME_I;
+                        break;
+                }
+
+                es_frame(index, frame, (nal_type == 5));
+            }
+            index->is_vcl = true;
+            break;
+        }
+        case 6:  /* SEI */
+        case 7:  /* SPS */
+        case 8:  /* PPS */
+        case 9:  /* access unit delimiter */
+        case 14: case 15: case 16: case 17: case 18:
+            es_au_begin(index);
+            break;
+        default:
+            break;
+    }
+}
+
+static void es_parse_hevc(mpegts_es_index_t *index)
+{
+    if(index->header_size < 2)
+        return;
+
+    const uint8_t nal_type = (index->header[0] >> 1) & 0x3F;
+    es_bits_t bits = { &index->header[2], (index->header_size - 2) * 8, 0 };
+
+    if(nal_type < 32)
+    {
+        /* first_slice_segment_in_pic_flag */
+        if(bits_get(&bits, 1) == 1)
+        {
+            es_au_begin(index);
+
+            const bool is_irap = (nal_type >= 16 && nal_type <= 23);
+            if(is_irap)
+                bits_get(&bits, 1); /* no_output_of_prior_pics_flag */
+
+            mpegts_frame_type_t frame = (is_irap) ? MPEGTS_FRAME_I : MPEGTS_FRAME_UNKNOWN;
+            const int pps_id = bits_get_ue(&bits);
+            if(pps_id >= 0 && pps_id < 64)
+            {
+                bits_get(&bits, index->hevc_pps_extra[pps_id]);
+                switch(bits_get_ue(&bits))
+                {
+                    case 0: frame = MPEGTS_FRAME_B; break;
+                    case 1: frame = MPEGTS_FRAME_P; break;
+                    case 2: frame = MPEGTS_FRAME_I; break;
+                    default: break;
+                }
+            }
+
+            es_frame(index, frame, is_irap);
+        }
+        index->is_vcl = true;
+        return;
+    }
+
+    switch(nal_type)
+    {
+        case 34: /* PPS */
+        {
+            es_au_begin(index);
+
+            const int pps_id = bits_get_ue(&bits);
+            bits_get_ue(&bits); /* pps_seq_parameter_set_id */
+            bits_get(&bits, 2); /* dependent_slice_segments_enabled_flag,
+                                 * output_flag_present_flag */
+            const int extra = bits_get(&bits, 3);
+            if(pps_id >= 0 && pps_id < 64 && extra >= 0)
+                index->hevc_pps_extra[pps_id] = extra;
+            break;
+        }
+        case 32: /* VPS */
+        case 33: /* SPS */
+        case 35: /* access unit delimiter */
+        case 39: /* prefix SEI */
+        case 41: case 42: case 43: case 44:
+        case 48: case 49: case 50: case 51: case 52: case 53: case 54: case 55:
+            es_au_begin(index);
+            break;
+        default:
+            break;
+    }
+}
+
+static void es_parse(mpegts_es_index_t *index)
+{
+    index->is_header = false;
+    if(!index->header_size)
+        return;
+
+    switch(index->codec)
+    {
+        case MPEGTS_ES_MPEG2:
+            es_parse_mpeg2(index);
+            break;
+        case MPEGTS_ES_H264:
+            es_parse_h264(index);
+            break;
+        case MPEGTS_ES_HEVC:
+            es_parse_hevc(index);
+            break;
+        default:
+            break;
+    }
+}
+
+static void es_header_append(mpegts_es_index_t *index, const uint8_t *ptr, const uint8_t *end)
+{
+    const bool is_epb = (index->codec != MPEGTS_ES_MPEG2);
+
+    while(ptr < end && index->header_size < ES_HEADER_SIZE)
+    {
+        const uint8_t c = *ptr++;
+
+        /* emulation_prevention_three_byte */
+        if(is_epb && c == 0x03 && index->header_zero >= 2)
+        {
+            index->header_zero = 0;
+            continue;
+        }
+
+        index->header_zero = (c == 0x00) ? (index->header_zero + 1) : 0;
+        index->header[index->header_size++] = c;
+    }
+
+    if(index->header_size == ES_HEADER_SIZE)
+        es_parse(index);
+}
+
+static void es_start_code(mpegts_es_index_t *index, const uint8_t *ptr, const uint8_t *end)
+{
+    /* previous unit is shorter than the header */
+    if(index->is_header)
+        es_parse(index);
+
+    index->is_header = true;
+    index->header_size = 0;
+    index->header_zero = 0;
+    es_header_append(index, ptr, end);
+}
+
+static void es_scan(mpegts_es_index_t *index, const uint8_t *ptr, const uint8_t *end)
+{
+    if(index->is_header)
+        es_header_append(index, ptr, end);
+
+    /* start code on the boundary of the payloads */
+    uint32_t state = index->sc_state;
+    for(int i = 0; i < 2 && ptr + i < end; ++i)
+    {
+        state = (state << 8) | ptr[i];
+        if((state & 0x00FFFFFF) == 0x000001)
+        {
+            es_start_code(index, ptr + i + 1, end);
+            break;
+        }
+    }
+
+    const uint8_t *skip = ptr;
+    while((skip = find_start_code(skip, end)) != NULL)
+        es_start_code(index, skip, end);
+
+    state = index->sc_state;
+    for(const uint8_t *i = (end - ptr > 3) ? (end - 3) : ptr; i < end; ++i)
+        state = (state << 8) | *i;
+    index->sc_state = state;
+}
+
+static inline uint64_t es_get_timestamp(const uint8_t *b)
+{
+    return ((uint64_t)(b[0] & 0x0E) << 29)
+         | ((uint64_t)(b[1]       ) << 22)
+         | ((uint64_t)(b[2] & 0xFE) << 14)
+         | ((uint64_t)(b[3]       ) << 7 )
+         | ((uint64_t)(b[4]       ) >> 1 );
+}
+
+static void es_reset(mpegts_es_index_t *index)
+{
+    index->is_sync = false;
+    index->is_header = false;
+    index->is_vcl = true;
+    index->sc_state = 0xFFFFFFFF;
+}
+
+const mpegts_es_tag_t * mpegts_es_index_mux(mpegts_es_index_t *index, const uint8_t *ts)
+{
+    mpegts_es_tag_t *tag = &index->tag;
+    tag->flags = 0;
+    tag->frame = MPEGTS_FRAME_UNKNOWN;
+
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+    if(!payload || TS_IS_SCRAMBLED(ts))
+        return tag;
+
+    const uint8_t *const end = ts + TS_PACKET_SIZE;
+    const uint8_t cc = TS_GET_CC(ts);
+
+    if(TS_IS_PAYLOAD_START(ts))
+    {
+        if(end - payload < 9 || PES_BUFFER_GET_HEADER(payload) != 0x000001)
+        {
+            es_reset(index);
+            return tag;
+        }
+
+        const uint8_t *es = &payload[9 + payload[8]];
+        if(es > end)
+        {
+            es_reset(index);
+            return tag;
+        }
+
+        tag->flags |= ES_TAG_PES_START;
+        if((payload[7] & 0x80) && payload[8] >= 5)
+        {
+            tag->flags |= ES_TAG_PTS;
+            tag->pts = es_get_timestamp(&payload[9]);
+        }
+        if((payload[7] & 0x40) && payload[8] >= 10)
+        {
+            tag->flags |= ES_TAG_DTS;
+            tag->dts = es_get_timestamp(&payload[14]);
+        }
+
+        index->is_sync = true;
+        payload = es;
+    }
+    else
+    {
+        if(!index->is_sync)
+            return tag;
+
+        if(((index->cc + 1) & 0x0F) != cc)
+        {
+            /* duplicate packet */
+            if(index->cc == cc)
+                return tag;
+
+            es_reset(index);
+            return tag;
+        }
+    }
+
+    index->cc = cc;
+    es_scan(index, payload, end);
+
+    return tag;
+}
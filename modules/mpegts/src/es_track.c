@@ -0,0 +1,185 @@
+/*
+ * Astra Module: MPEG-TS (ES tracker)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Selects the stream to split or to index the recorded stream by the keys.
+ * Tables are only parsed, the owner keeps the copies for the output.
+ * Packets tagged by the upstream channel (option es_index) are not indexed
+ * again.
+ */
+
+#include "../mpegts.h"
+
+static void on_pat(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_es_track_t *track = (mpegts_es_track_t *)arg;
+
+    if(psi->buffer[0] != 0x00)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return;
+    if(crc32 != PSI_CALC_CRC32(psi))
+    {
+        track->events |= ES_TRACK_PAT_ERROR;
+        return;
+    }
+    psi->crc32 = crc32;
+
+    track->pmt_pid = 0;
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pnr = PAT_ITEM_GET_PNR(psi, pointer);
+        if(pnr)
+        {
+            track->pmt_pid = PAT_ITEM_GET_PID(psi, pointer);
+            break;
+        }
+    }
+
+    track->pmt->pid = track->pmt_pid;
+    track->pmt->crc32 = 0;
+    track->es_pid = 0;
+
+    track->events |= ES_TRACK_PAT;
+}
+
+static void on_pmt(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_es_track_t *track = (mpegts_es_track_t *)arg;
+
+    if(psi->buffer[0] != 0x02)
+        return;
+
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return;
+    if(crc32 != PSI_CALC_CRC32(psi))
+    {
+        track->events |= ES_TRACK_PMT_ERROR;
+        return;
+    }
+    psi->crc32 = crc32;
+
+    uint16_t es_pid = 0;
+    mpegts_es_codec_t es_codec = MPEGTS_ES_UNKNOWN;
+
+    const uint8_t *pointer;
+    PMT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint8_t type = PMT_ITEM_GET_TYPE(psi, pointer);
+        const uint16_t pid = PMT_ITEM_GET_PID(psi, pointer);
+
+        const mpegts_es_codec_t codec = mpegts_es_codec(type);
+        if(codec != MPEGTS_ES_UNKNOWN)
+        {
+            es_pid = pid;
+            es_codec = codec;
+            break;
+        }
+
+        if(!es_pid && (mpegts_pes_type(type) & MPEGTS_PACKET_PES))
+            es_pid = pid;
+    }
+
+    track->pcr_pid = PMT_GET_PCR(psi);
+    track->events |= ES_TRACK_PMT;
+
+    if(es_pid != track->es_pid || es_codec != track->es_codec)
+    {
+        track->es_pid = es_pid;
+        track->es_codec = es_codec;
+        mpegts_es_index_init(&track->index, es_codec);
+        /* stream could be switched in the middle of the PES */
+        track->is_pes_key = true;
+        track->events |= ES_TRACK_ES;
+    }
+}
+
+static void on_es_ts(mpegts_es_track_t *track, const uint8_t *ts
+                     , const mpegts_es_tag_t *tag)
+{
+    if(!tag)
+        tag = mpegts_es_index_mux(&track->index, ts);
+    track->tag = tag;
+
+    if(tag->flags & ES_TAG_PES_START)
+    {
+        track->is_pes_key = false;
+        track->events |= ES_TRACK_PES_START;
+    }
+
+    if(track->is_pes_key)
+        return;
+
+    if(track->es_codec != MPEGTS_ES_UNKNOWN)
+    {
+        if(!(tag->flags & ES_TAG_RAP))
+            return;
+    }
+    else if(track->key_interval)
+    {
+        const time_t now = time(NULL);
+        if(now - track->key_time < (time_t)track->key_interval)
+            return;
+        track->key_time = now;
+    }
+
+    track->is_pes_key = true;
+    track->events |= ES_TRACK_KEY;
+}
+
+mpegts_es_track_t * mpegts_es_track_init(uint32_t key_interval)
+{
+    mpegts_es_track_t *track = (mpegts_es_track_t *)calloc(1, sizeof(mpegts_es_track_t));
+    track->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    track->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, MAX_PID);
+    track->key_interval = key_interval;
+    track->is_pes_key = true;
+    return track;
+}
+
+void mpegts_es_track_destroy(mpegts_es_track_t *track)
+{
+    if(!track)
+        return;
+
+    mpegts_psi_destroy(track->pat);
+    mpegts_psi_destroy(track->pmt);
+    free(track);
+}
+
+uint8_t mpegts_es_track_mux(mpegts_es_track_t *track, const uint8_t *ts
+                            , const mpegts_es_tag_t *tag)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+    track->events = 0;
+
+    if(pid == 0)
+        mpegts_psi_mux(track->pat, ts, on_pat, track);
+    else if(pid == track->pmt_pid)
+        mpegts_psi_mux(track->pmt, ts, on_pmt, track);
+    else if(pid == track->es_pid && pid != NULL_TS_PID)
+        on_es_ts(track, ts, tag);
+
+    return track->events;
+}
@@ -20,9 +20,77 @@
 
 #include "../mpegts.h"
 
+/* buffers are shared by all instances in the main thread.
+ * free buffer keeps the pointer to the next one in the first bytes */
+
+#define POOL_DEPTH 8 /* free buffers kept in the each class */
+
+static const uint32_t pool_class[] =
+{
+    PES_MIN_SIZE,
+    PES_MIN_SIZE * 4,
+    PES_MIN_SIZE * 16,
+    PES_MIN_SIZE * 64,
+    PES_MAX_SIZE,
+};
+
+#define POOL_CLASS_COUNT ASC_ARRAY_SIZE(pool_class)
+
+static struct
+{
+    void *head;
+    uint32_t count;
+} pool[POOL_CLASS_COUNT];
+
+static uint8_t * pool_get(uint32_t size, uint32_t *alloc)
+{
+    size_t i = 0;
+    while(pool_class[i] < size)
+        ++i;
+
+    *alloc = pool_class[i];
+
+    void *buffer = pool[i].head;
+    if(buffer)
+    {
+        memcpy(&pool[i].head, buffer, sizeof(void *));
+        --pool[i].count;
+        return (uint8_t *)buffer;
+    }
+
+    return (uint8_t *)malloc(pool_class[i]);
+}
+
+static void pool_put(uint8_t *buffer, uint32_t alloc)
+{
+    if(!buffer)
+        return;
+
+    size_t i = 0;
+    while(pool_class[i] < alloc)
+        ++i;
+
+    if(pool[i].count >= POOL_DEPTH)
+    {
+        free(buffer);
+        return;
+    }
+
+    memcpy(buffer, &pool[i].head, sizeof(void *));
+    pool[i].head = buffer;
+    ++pool[i].count;
+}
+
+static void pes_release(mpegts_pes_t *pes)
+{
+    pool_put(pes->buffer, pes->buffer_alloc);
+    pes->buffer = NULL;
+    pes->buffer_alloc = 0;
+}
+
 mpegts_pes_t * mpegts_pes_init(mpegts_packet_type_t type, uint16_t pid, uint32_t pcr_interval)
 {
-    mpegts_pes_t *pes = (mpegts_pes_t *)malloc(sizeof(mpegts_pes_t));
+    mpegts_pes_t *pes = (mpegts_pes_t *)calloc(1, sizeof(mpegts_pes_t));
     pes->type = type;
     pes->pid = pid;
     pes->cc = 0;
@@ -45,9 +113,58 @@ void mpegts_pes_destroy(mpegts_pes_t *pes)
     if(!pes)
         return;
 
+    pes_release(pes);
     free(pes);
 }
 
+void mpegts_pes_reserve(mpegts_pes_t *pes, uint32_t size)
+{
+    if(size <= pes->buffer_alloc)
+        return;
+
+    asc_assert(size <= PES_MAX_SIZE, "[mpegts/pes] buffer overflow");
+
+    uint32_t alloc;
+    uint8_t *buffer = pool_get(size, &alloc);
+    if(pes->buffer)
+    {
+        memcpy(buffer, pes->buffer, pes->buffer_alloc);
+        pool_put(pes->buffer, pes->buffer_alloc);
+    }
+
+    pes->buffer = buffer;
+    pes->buffer_alloc = alloc;
+}
+
+void mpegts_pes_add_data(mpegts_pes_t *pes, const uint8_t *data, uint32_t size)
+{
+    mpegts_pes_reserve(pes, pes->buffer_size + size);
+    memcpy(&pes->buffer[pes->buffer_size], data, size);
+    pes->buffer_size += size;
+}
+
+static void mux_append(mpegts_pes_t *pes, const uint8_t *payload, uint8_t payload_len)
+{
+    if(pes->buffer_skip + payload_len > pes->buffer_alloc)
+    {
+        /* size of the previous PES for the stream without PES_packet_length */
+        uint32_t size = pes->buffer_skip + payload_len;
+        if(size < pes->buffer_hint && pes->buffer_hint <= PES_MAX_SIZE)
+            size = pes->buffer_hint;
+        mpegts_pes_reserve(pes, size);
+    }
+
+    memcpy(&pes->buffer[pes->buffer_skip], payload, payload_len);
+    pes->buffer_skip += payload_len;
+}
+
+static void mux_complete(mpegts_pes_t *pes, pes_callback_t callback, void *arg)
+{
+    pes->buffer_hint = pes->buffer_size;
+    callback(arg, pes);
+    pes_release(pes);
+}
+
 void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callback, void *arg)
 {
     const uint8_t *payload = TS_GET_PAYLOAD(ts);
@@ -63,8 +180,8 @@ void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callbac
         {
             pes->buffer_size = pes->buffer_skip;
             pes->buffer_skip = 0;
-            pes->block_time_total = asc_utime() - pes->block_time_begin;
-            callback(arg, pes);
+            pes->block_time_total = asc_clock_now() - pes->block_time_begin;
+            mux_complete(pes, callback, arg);
         }
 
         if(payload_len < PES_HEADER_SIZE)
@@ -74,16 +191,18 @@ void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callbac
             return;
 
         pes->buffer_size = PES_BUFFER_GET_SIZE(payload);
-        pes->block_time_begin = asc_utime();
+        pes->block_time_begin = asc_clock_now();
+
+        if(pes->buffer_size > PES_HEADER_SIZE)
+            pes->buffer_hint = pes->buffer_size;
 
-        memcpy(pes->buffer, payload, payload_len);
-        pes->buffer_skip = payload_len;
+        mux_append(pes, payload, payload_len);
 
         if(pes->buffer_size == pes->buffer_skip)
         {
             pes->buffer_skip = 0;
             pes->block_time_total = 0;
-            callback(arg, pes);
+            mux_complete(pes, callback, arg);
         }
     }
     else
@@ -91,20 +210,21 @@ void mpegts_pes_mux(mpegts_pes_t *pes, const uint8_t *ts, pes_callback_t callbac
         if(!pes->buffer_skip)
             return;
 
-        if(((pes->cc + 1) & 0x0f) != cc)
-        { // discontinuity error
+        if(((pes->cc + 1) & 0x0f) != cc
+           || pes->buffer_skip + payload_len > PES_MAX_SIZE)
+        { // discontinuity error or overflow
             pes->buffer_skip = 0;
+            pes_release(pes);
             return;
         }
 
-        memcpy(&pes->buffer[pes->buffer_skip], payload, payload_len);
-        pes->buffer_skip += payload_len;
+        mux_append(pes, payload, payload_len);
 
         if(pes->buffer_size == pes->buffer_skip)
         {
             pes->buffer_skip = 0;
-            pes->block_time_total = asc_utime() - pes->block_time_begin;
-            callback(arg, pes);
+            pes->block_time_total = asc_clock_now() - pes->block_time_begin;
+            mux_complete(pes, callback, arg);
         }
     }
     pes->cc = cc;
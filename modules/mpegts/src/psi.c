@@ -29,6 +29,8 @@ mpegts_psi_t * mpegts_psi_init(mpegts_packet_type_t type, uint16_t pid)
     psi->buffer_size = 0;
     psi->buffer_skip = 0;
     psi->crc32 = 0;
+    psi->buffer_alloc = PSI_INIT_SIZE;
+    psi->buffer = (uint8_t *)calloc(1, PSI_INIT_SIZE);
     return psi;
 }
 
@@ -37,9 +39,43 @@ void mpegts_psi_destroy(mpegts_psi_t *psi)
     if(!psi)
         return;
 
+    free(psi->buffer);
     free(psi);
 }
 
+void mpegts_psi_reserve(mpegts_psi_t *psi, size_t size)
+{
+    if(size <= psi->buffer_alloc)
+        return;
+
+    size_t buffer_alloc = psi->buffer_alloc;
+    while(buffer_alloc < size)
+        buffer_alloc *= 2;
+    if(buffer_alloc > PSI_MAX_SIZE)
+        buffer_alloc = PSI_MAX_SIZE;
+
+    psi->buffer = (uint8_t *)realloc(psi->buffer, buffer_alloc);
+    psi->buffer_alloc = buffer_alloc;
+}
+
+void mpegts_psi_copy(mpegts_psi_t *dst, const mpegts_psi_t *src)
+{
+    mpegts_psi_reserve(dst, src->buffer_alloc);
+
+    dst->type = src->type;
+    dst->pid = src->pid;
+    dst->cc = src->cc;
+    dst->crc32 = src->crc32;
+    dst->buffer_size = src->buffer_size;
+    dst->buffer_skip = src->buffer_skip;
+    memcpy(dst->buffer, src->buffer, src->buffer_alloc);
+}
+
+size_t mpegts_psi_memory(const mpegts_psi_t *psi)
+{
+    return (psi) ? (sizeof(mpegts_psi_t) + psi->buffer_alloc) : 0;
+}
+
 void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callback, void *arg)
 {
     const uint8_t *payload = TS_GET_PAYLOAD(ts);
@@ -67,6 +103,12 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
                     psi->buffer_skip = 0;
                     return;
                 }
+                if(psi->buffer_skip + ptr_field > PSI_MAX_SIZE)
+                {
+                    psi->buffer_skip = 0;
+                    return;
+                }
+                mpegts_psi_reserve(psi, psi->buffer_skip + ptr_field);
                 memcpy(&psi->buffer[psi->buffer_skip], payload, ptr_field);
                 if(psi->buffer_size == 0)
                 { // incomplete PSI header
@@ -109,6 +151,7 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
                 break;
 
             psi->buffer_size = psi_buffer_size;
+            mpegts_psi_reserve(psi, psi_buffer_size);
             if(psi_buffer_size > cpy_len)
             {
                 memcpy(psi->buffer, payload, cpy_len);
@@ -148,6 +191,7 @@ void mpegts_psi_mux(mpegts_psi_t *psi, const uint8_t *ts, psi_callback_t callbac
                 return;
             }
             psi->buffer_size = psi_buffer_size;
+            mpegts_psi_reserve(psi, psi_buffer_size);
         }
         const size_t remain = psi->buffer_size - psi->buffer_skip;
         if(remain <= TS_BODY_SIZE)
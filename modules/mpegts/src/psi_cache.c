@@ -0,0 +1,389 @@
+/*
+ * Astra Module: MPEG-TS (PSI cache)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Section cache shared by all modules attached to the same source.
+ * Many channels on one transponder receive the same PAT/PMT/SDT/EIT
+ * packets. The cache assembles each section once and keeps the copy of
+ * the last verified section. The checksum is verified when the section
+ * content is new or differs from the copy. Repeated sections are recognized
+ * by the content and are not verified again.
+ *
+ * Subscriber without the is_repeat flag receives only changed sections.
+ * New subscriber receives all sections until the first received section
+ * is repeated, so it gets the complete table once.
+ */
+
+#include "../mpegts.h"
+
+#define SECTION_KEY(_b) (((uint32_t)_b[0] << 24) | (_b[3] << 16) | (_b[4] << 8) | _b[6])
+
+typedef struct
+{
+    uint32_t key;       /* table_id, table_id_extension, section_number */
+    bool is_set;
+
+    uint8_t *buffer;
+    uint16_t buffer_size;
+} cache_section_t;
+
+typedef struct
+{
+    psi_callback_t callback;
+    void *arg;
+
+    bool is_repeat;     /* all sections */
+    bool is_sync;       /* complete table is received */
+    bool is_key;
+    uint32_t sync_key;  /* first received section */
+} cache_subscriber_t;
+
+typedef struct
+{
+    mpegts_psi_t *psi;
+
+    /* the last packet to skip the same packet from the other subscribers */
+    const uint8_t *last_ptr;
+    uint8_t last_ts[TS_PACKET_SIZE];
+
+    cache_section_t *section_list;
+    uint32_t section_size;
+    uint32_t section_count;
+
+    cache_subscriber_t *subscriber_list;
+    uint32_t subscriber_size;
+    uint32_t subscriber_count;
+    bool is_dispatch;
+    bool is_removed;
+} cache_pid_t;
+
+struct mpegts_psi_cache_t
+{
+    const void *source;
+    int refcount;
+
+    cache_pid_t *pid_list[MAX_PID];
+};
+
+static asc_list_t *cache_list = NULL;
+
+mpegts_psi_cache_t * mpegts_psi_cache_attach(const void *source)
+{
+    if(!cache_list)
+        cache_list = asc_list_init();
+
+    asc_list_for(cache_list)
+    {
+        mpegts_psi_cache_t *cache = (mpegts_psi_cache_t *)asc_list_data(cache_list);
+        if(cache->source == source)
+        {
+            ++cache->refcount;
+            return cache;
+        }
+    }
+
+    mpegts_psi_cache_t *cache = (mpegts_psi_cache_t *)calloc(1, sizeof(mpegts_psi_cache_t));
+    cache->source = source;
+    cache->refcount = 1;
+    asc_list_insert_tail(cache_list, cache);
+
+    return cache;
+}
+
+void mpegts_psi_cache_detach(mpegts_psi_cache_t *cache)
+{
+    if(!cache)
+        return;
+
+    --cache->refcount;
+    if(cache->refcount > 0)
+        return;
+
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        cache_pid_t *item = cache->pid_list[i];
+        if(!item)
+            continue;
+
+        mpegts_psi_destroy(item->psi);
+        for(uint32_t j = 0; j < item->section_size; ++j)
+            free(item->section_list[j].buffer);
+        free(item->section_list);
+        free(item->subscriber_list);
+        free(item);
+    }
+
+    asc_list_remove_item(cache_list, cache);
+    free(cache);
+
+    if(asc_list_size(cache_list) == 0)
+    {
+        asc_list_destroy(cache_list);
+        cache_list = NULL;
+    }
+}
+
+void mpegts_psi_cache_subscribe(  mpegts_psi_cache_t *cache, uint16_t pid
+                                , psi_callback_t callback, void *arg, bool is_repeat)
+{
+    cache_pid_t *item = cache->pid_list[pid];
+    if(!item)
+    {
+        item = (cache_pid_t *)calloc(1, sizeof(cache_pid_t));
+        item->psi = mpegts_psi_init(MPEGTS_PACKET_PSI, pid);
+        cache->pid_list[pid] = item;
+    }
+
+    if(item->subscriber_count == item->subscriber_size)
+    {
+        item->subscriber_size = (item->subscriber_size) ? (item->subscriber_size * 2) : 4;
+        item->subscriber_list = (cache_subscriber_t *)realloc(
+            item->subscriber_list, item->subscriber_size * sizeof(cache_subscriber_t));
+    }
+
+    cache_subscriber_t *subscriber = &item->subscriber_list[item->subscriber_count];
+    memset(subscriber, 0, sizeof(cache_subscriber_t));
+    subscriber->callback = callback;
+    subscriber->arg = arg;
+    subscriber->is_repeat = is_repeat;
+    ++item->subscriber_count;
+}
+
+static void subscriber_cleanup(cache_pid_t *item)
+{
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < item->subscriber_count; ++i)
+    {
+        if(item->subscriber_list[i].callback)
+        {
+            item->subscriber_list[count] = item->subscriber_list[i];
+            ++count;
+        }
+    }
+    item->subscriber_count = count;
+    item->is_removed = false;
+}
+
+void mpegts_psi_cache_unsubscribe(mpegts_psi_cache_t *cache, uint16_t pid, void *arg)
+{
+    cache_pid_t *item = cache->pid_list[pid];
+    if(!item)
+        return;
+
+    /* subscribers are removed from the callback,
+     * the list is compacted when the dispatch is completed */
+    for(uint32_t i = 0; i < item->subscriber_count; ++i)
+    {
+        if(item->subscriber_list[i].arg == arg)
+        {
+            item->subscriber_list[i].callback = NULL;
+            item->is_removed = true;
+        }
+    }
+
+    if(item->is_removed && !item->is_dispatch)
+        subscriber_cleanup(item);
+}
+
+void mpegts_psi_cache_unsubscribe_all(mpegts_psi_cache_t *cache, void *arg)
+{
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        if(cache->pid_list[i])
+            mpegts_psi_cache_unsubscribe(cache, i, arg);
+    }
+}
+
+static cache_section_t * section_find(cache_pid_t *item, uint32_t key)
+{
+    if(!item->section_size)
+        return NULL;
+
+    const uint32_t mask = item->section_size - 1;
+    uint32_t i = (key * 2654435761U) & mask;
+    while(item->section_list[i].is_set)
+    {
+        if(item->section_list[i].key == key)
+            return &item->section_list[i];
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+static cache_section_t * section_insert(cache_pid_t *item, uint32_t key)
+{
+    if((item->section_count + 1) * 4 > item->section_size * 3)
+    {
+        cache_section_t *section_list = item->section_list;
+        const uint32_t section_size = item->section_size;
+
+        item->section_size = (section_size) ? (section_size * 2) : 16;
+        item->section_list = (cache_section_t *)calloc(
+            item->section_size, sizeof(cache_section_t));
+        item->section_count = 0;
+
+        for(uint32_t i = 0; i < section_size; ++i)
+        {
+            if(section_list[i].is_set)
+                *section_insert(item, section_list[i].key) = section_list[i];
+        }
+        free(section_list);
+    }
+
+    const uint32_t mask = item->section_size - 1;
+    uint32_t i = (key * 2654435761U) & mask;
+    while(item->section_list[i].is_set)
+        i = (i + 1) & mask;
+
+    cache_section_t *section = &item->section_list[i];
+    section->key = key;
+    section->is_set = true;
+    ++item->section_count;
+
+    return section;
+}
+
+static bool is_section_equal(const cache_section_t *section, const mpegts_psi_t *psi)
+{
+    return (   section->buffer_size == psi->buffer_size
+            && !memcmp(section->buffer, psi->buffer, psi->buffer_size));
+}
+
+static void section_store(cache_section_t *section, const mpegts_psi_t *psi)
+{
+    if(section->buffer_size < psi->buffer_size)
+    {
+        free(section->buffer);
+        section->buffer = (uint8_t *)malloc(psi->buffer_size);
+    }
+    memcpy(section->buffer, psi->buffer, psi->buffer_size);
+    section->buffer_size = psi->buffer_size;
+}
+
+static void on_section(void *arg, mpegts_psi_t *psi)
+{
+    cache_pid_t *item = (cache_pid_t *)arg;
+
+    uint32_t key = 0;
+    bool is_changed = true;
+
+    if(psi->buffer[1] & 0x80)
+    {
+        /* section_syntax_indicator: header and CRC */
+        if(psi->buffer_size < 8 + CRC32_SIZE)
+            return;
+
+        key = SECTION_KEY(psi->buffer);
+        const uint32_t crc32 = PSI_GET_CRC32(psi);
+
+        cache_section_t *section = section_find(item, key);
+        if(section && is_section_equal(section, psi))
+        {
+            is_changed = false;
+        }
+        else
+        {
+            if(crc32 != PSI_CALC_CRC32(psi))
+                return;
+
+            if(!section)
+                section = section_insert(item, key);
+            section_store(section, psi);
+        }
+
+        psi->crc32 = crc32;
+    }
+    else
+    {
+        psi->crc32 = 0;
+    }
+
+    /* subscribers added by the callbacks are not called for the current section */
+    const uint32_t subscriber_count = item->subscriber_count;
+    item->is_dispatch = true;
+    for(uint32_t i = 0; i < subscriber_count; ++i)
+    {
+        cache_subscriber_t *subscriber = &item->subscriber_list[i];
+        if(!subscriber->callback)
+            continue;
+
+        if(!subscriber->is_repeat)
+        {
+            if(!is_changed)
+            {
+                if(subscriber->is_sync)
+                    continue;
+                if(subscriber->is_key && subscriber->sync_key == key)
+                {
+                    subscriber->is_sync = true;
+                    continue;
+                }
+            }
+            if(!subscriber->is_key)
+            {
+                subscriber->is_key = true;
+                subscriber->sync_key = key;
+            }
+        }
+
+        subscriber->callback(subscriber->arg, psi);
+    }
+    item->is_dispatch = false;
+
+    if(item->is_removed)
+        subscriber_cleanup(item);
+}
+
+void mpegts_psi_cache_mux(mpegts_psi_cache_t *cache, const uint8_t *ts)
+{
+    cache_pid_t *item = cache->pid_list[TS_GET_PID(ts)];
+    if(!item || !item->subscriber_count)
+        return;
+
+    /* all modules attached to the source get the same packet */
+    if(ts == item->last_ptr && !memcmp(ts, item->last_ts, TS_PACKET_SIZE))
+        return;
+
+    item->last_ptr = ts;
+    memcpy(item->last_ts, ts, TS_PACKET_SIZE);
+
+    mpegts_psi_mux(item->psi, ts, on_section, item);
+}
+
+size_t mpegts_psi_cache_memory(const mpegts_psi_cache_t *cache)
+{
+    size_t size = sizeof(mpegts_psi_cache_t);
+    for(int i = 0; i < MAX_PID; ++i)
+    {
+        const cache_pid_t *item = cache->pid_list[i];
+        if(!item)
+            continue;
+
+        size += sizeof(cache_pid_t)
+              + mpegts_psi_memory(item->psi)
+              + item->section_size * sizeof(cache_section_t)
+              + item->subscriber_size * sizeof(cache_subscriber_t);
+
+        for(uint32_t j = 0; j < item->section_size; ++j)
+            size += item->section_list[j].buffer_size;
+    }
+    return size;
+}
@@ -0,0 +1,421 @@
+/*
+ * Astra Module: MPEG-TS (Sync)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * TS framing for the byte streams. The sync search compares a block of
+ * positions with the sync byte and with the bytes at one and two packets
+ * ahead, so a position is accepted only if MPEGTS_SYNC_DEPTH packets
+ * follow with the same stride. Aligned streams go directly from the input
+ * buffer to the callback, the internal buffer is used only for the frame
+ * split between two reads and to search the sync after the loss.
+ */
+
+#include "../mpegts.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#   include <emmintrin.h>
+#   define SYNC_SSE2
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#   include <immintrin.h>
+#   define SYNC_AVX2
+#endif
+
+#if defined(__ARM_NEON) && defined(__GNUC__)
+#   include <arm_neon.h>
+#   define SYNC_NEON
+#endif
+
+#define SYNC_BYTE 0x47
+#define SYNC_BUFFER_SIZE (16 * RS_PACKET_SIZE)
+
+static const size_t sync_packet_size[] =
+{
+    TS_PACKET_SIZE,
+    M2TS_PACKET_SIZE,
+    RS_PACKET_SIZE,
+};
+
+typedef size_t (*sync_find_func_t)(const uint8_t *buffer, size_t count, size_t packet_size);
+
+/*
+ * Sync search. count - number of the positions to check,
+ * the buffer should have count + 2 * packet_size bytes.
+ * Returns the first position or count if not found.
+ */
+
+static size_t sync_find_c(const uint8_t *buffer, size_t count, size_t packet_size)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(   buffer[i] == SYNC_BYTE
+           && buffer[i + packet_size] == SYNC_BYTE
+           && buffer[i + packet_size * 2] == SYNC_BYTE)
+        {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+#ifdef SYNC_SSE2
+static size_t sync_find_sse2(const uint8_t *buffer, size_t count, size_t packet_size)
+{
+    const __m128i sync = _mm_set1_epi8(SYNC_BYTE);
+
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        const uint8_t *ptr = &buffer[i];
+        const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)ptr), sync);
+        const __m128i b = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)&ptr[packet_size]), sync);
+        const __m128i c = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)&ptr[packet_size * 2]), sync);
+
+        const int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + sync_find_c(&buffer[i], count - i, packet_size);
+}
+#endif
+
+#ifdef SYNC_AVX2
+#define SYNC_AVX2_TARGET __attribute__((target("avx2")))
+
+static SYNC_AVX2_TARGET size_t sync_find_avx2(  const uint8_t *buffer, size_t count
+                                              , size_t packet_size)
+{
+    const __m256i sync = _mm256_set1_epi8(SYNC_BYTE);
+
+    size_t i = 0;
+    for(; i + 32 <= count; i += 32)
+    {
+        const uint8_t *ptr = &buffer[i];
+        const __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)ptr), sync);
+        const __m256i b = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)&ptr[packet_size]), sync);
+        const __m256i c = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)&ptr[packet_size * 2]), sync);
+
+        const uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), c));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + sync_find_c(&buffer[i], count - i, packet_size);
+}
+#endif
+
+#ifdef SYNC_NEON
+static size_t sync_find_neon(const uint8_t *buffer, size_t count, size_t packet_size)
+{
+    const uint8x16_t sync = vdupq_n_u8(SYNC_BYTE);
+
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        const uint8_t *ptr = &buffer[i];
+        const uint8x16_t a = vceqq_u8(vld1q_u8(ptr), sync);
+        const uint8x16_t b = vceqq_u8(vld1q_u8(&ptr[packet_size]), sync);
+        const uint8x16_t c = vceqq_u8(vld1q_u8(&ptr[packet_size * 2]), sync);
+        const uint8x16_t m = vandq_u8(vandq_u8(a, b), c);
+
+        /* 4 bits for the each byte */
+        const uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if(mask)
+            return i + (__builtin_ctzll(mask) >> 2);
+    }
+
+    return i + sync_find_c(&buffer[i], count - i, packet_size);
+}
+#endif
+
+static size_t sync_find_init(const uint8_t *buffer, size_t count, size_t packet_size);
+
+static sync_find_func_t sync_find = sync_find_init;
+
+static size_t sync_find_init(const uint8_t *buffer, size_t count, size_t packet_size)
+{
+    sync_find = sync_find_c;
+
+#if defined(SYNC_NEON)
+    sync_find = sync_find_neon;
+#else
+#   if defined(SYNC_SSE2)
+    sync_find = sync_find_sse2;
+#   endif
+#   if defined(SYNC_AVX2)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        sync_find = sync_find_avx2;
+#   endif
+#endif
+
+    return sync_find(buffer, count, packet_size);
+}
+
+/* offset of the sync byte confirmed by the next packets, size if not found */
+size_t mpegts_sync_find(const uint8_t *buffer, size_t size, size_t packet_size)
+{
+    const size_t tail = packet_size * (MPEGTS_SYNC_DEPTH - 1);
+    if(size <= tail)
+        return size;
+
+    const size_t count = size - tail;
+    const size_t offset = sync_find(buffer, count, packet_size);
+    return (offset < count) ? offset : size;
+}
+
+/*
+ * detects the packet size. returns offset of the first packet.
+ * if not found packet_size is 0 and the return value is the number of
+ * the checked bytes which can be dropped
+ */
+size_t mpegts_sync_detect(const uint8_t *buffer, size_t size, size_t *packet_size)
+{
+    size_t offset = size;
+    *packet_size = 0;
+
+    for(size_t i = 0; i < ASC_ARRAY_SIZE(sync_packet_size); ++i)
+    {
+        const size_t tail = sync_packet_size[i] * (MPEGTS_SYNC_DEPTH - 1);
+        if(size <= tail)
+            continue;
+
+        /* the next sizes are checked only before the found position */
+        size_t count = size - tail;
+        if(count > offset)
+            count = offset;
+
+        const size_t skip = sync_find(buffer, count, sync_packet_size[i]);
+        if(skip < count)
+        {
+            offset = skip;
+            *packet_size = sync_packet_size[i];
+        }
+    }
+
+    if(*packet_size)
+        return offset;
+
+    const size_t tail = RS_PACKET_SIZE * (MPEGTS_SYNC_DEPTH - 1);
+    return (size > tail) ? (size - tail) : 0;
+}
+
+/* number of the leading packets with the sync byte */
+size_t mpegts_sync_check(const uint8_t *buffer, size_t count, size_t packet_size)
+{
+    size_t i = 0;
+
+    for(; i + 8 <= count; i += 8)
+    {
+        const uint8_t *ptr = &buffer[i * packet_size];
+        const uint8_t diff = (ptr[0] ^ SYNC_BYTE)
+                           | (ptr[packet_size] ^ SYNC_BYTE)
+                           | (ptr[packet_size * 2] ^ SYNC_BYTE)
+                           | (ptr[packet_size * 3] ^ SYNC_BYTE)
+                           | (ptr[packet_size * 4] ^ SYNC_BYTE)
+                           | (ptr[packet_size * 5] ^ SYNC_BYTE)
+                           | (ptr[packet_size * 6] ^ SYNC_BYTE)
+                           | (ptr[packet_size * 7] ^ SYNC_BYTE);
+        if(diff)
+            break;
+    }
+
+    for(; i < count; ++i)
+    {
+        if(buffer[i * packet_size] != SYNC_BYTE)
+            break;
+    }
+
+    return i;
+}
+
+/*
+ *  oooooooo8 ooooooooooo oooooooooo  ooooooooooo      o      oooo     oooo
+ * 888        88  888  88  888    888  888    88      888      8888o   888
+ *  888oooooo     888      888oooo88   888ooo8       8  88     88 888o8 88
+ *         888    888      888  88o    888    oo    8oooo88    88  888  88
+ * o88oooo888    o888o    o888o  88o8 o888ooo8888 o88o  o888o o88o  8  o88o
+ *
+ */
+
+struct mpegts_sync_t
+{
+    ts_callback_t callback;
+    void *arg;
+
+    size_t packet_size; /* 0 - sync is not found */
+    size_t frame_skip;  /* tail of the frame after the sent packet */
+    uint64_t skip;      /* dropped bytes */
+
+    uint8_t buffer[SYNC_BUFFER_SIZE];
+    size_t buffer_size;
+};
+
+mpegts_sync_t * mpegts_sync_init(ts_callback_t callback, void *arg)
+{
+    mpegts_sync_t *sync = (mpegts_sync_t *)calloc(1, sizeof(mpegts_sync_t));
+    sync->callback = callback;
+    sync->arg = arg;
+    return sync;
+}
+
+void mpegts_sync_destroy(mpegts_sync_t *sync)
+{
+    free(sync);
+}
+
+void mpegts_sync_reset(mpegts_sync_t *sync)
+{
+    sync->packet_size = 0;
+    sync->frame_skip = 0;
+    sync->buffer_size = 0;
+}
+
+size_t mpegts_sync_packet_size(const mpegts_sync_t *sync)
+{
+    return sync->packet_size;
+}
+
+uint64_t mpegts_sync_skip(const mpegts_sync_t *sync)
+{
+    return sync->skip;
+}
+
+/* sends the aligned packets, returns the number of the processed bytes */
+static size_t sync_send(mpegts_sync_t *sync, const uint8_t *buffer, size_t size)
+{
+    const size_t packet_size = sync->packet_size;
+    const size_t count = size / packet_size;
+    const size_t valid = mpegts_sync_check(buffer, count, packet_size);
+
+    for(size_t i = 0; i < valid; ++i)
+        sync->callback(sync->arg, &buffer[i * packet_size]);
+
+    if(valid < count)
+    {
+        sync->packet_size = 0;
+        return valid * packet_size;
+    }
+
+    /* M2TS header or RS parity of the last packet is not received yet */
+    const size_t skip = count * packet_size;
+    const size_t tail = size - skip;
+    if(tail >= TS_PACKET_SIZE)
+    {
+        if(buffer[skip] != SYNC_BYTE)
+        {
+            sync->packet_size = 0;
+            return skip;
+        }
+
+        sync->callback(sync->arg, &buffer[skip]);
+        sync->frame_skip = packet_size - tail;
+        return size;
+    }
+
+    return skip;
+}
+
+static void sync_buffer_drop(mpegts_sync_t *sync, size_t size)
+{
+    sync->buffer_size -= size;
+    if(sync->buffer_size > 0)
+        memmove(sync->buffer, &sync->buffer[size], sync->buffer_size);
+}
+
+static void sync_buffer_process(mpegts_sync_t *sync)
+{
+    while(sync->buffer_size > 0)
+    {
+        if(!sync->packet_size)
+        {
+            size_t packet_size;
+            const size_t skip = mpegts_sync_detect(sync->buffer, sync->buffer_size, &packet_size);
+            sync->skip += skip;
+            sync_buffer_drop(sync, skip);
+
+            if(!packet_size)
+                return;
+
+            sync->packet_size = packet_size;
+        }
+
+        if(sync->buffer_size < TS_PACKET_SIZE)
+            return;
+
+        sync_buffer_drop(sync, sync_send(sync, sync->buffer, sync->buffer_size));
+
+        if(sync->packet_size)
+            return;
+    }
+}
+
+void mpegts_sync_push(mpegts_sync_t *sync, const uint8_t *buffer, size_t size)
+{
+    while(size > 0)
+    {
+        if(sync->frame_skip)
+        {
+            const size_t skip = (size < sync->frame_skip) ? size : sync->frame_skip;
+            sync->frame_skip -= skip;
+            buffer += skip;
+            size -= skip;
+            continue;
+        }
+
+        if(sync->packet_size && sync->buffer_size == 0)
+        {
+            const size_t skip = sync_send(sync, buffer, size);
+            buffer += skip;
+            size -= skip;
+
+            if(sync->packet_size)
+            {
+                /* incomplete packet */
+                memcpy(sync->buffer, buffer, size);
+                sync->buffer_size = size;
+                return;
+            }
+
+            continue;
+        }
+
+        size_t chunk = SYNC_BUFFER_SIZE - sync->buffer_size;
+        if(sync->packet_size && TS_PACKET_SIZE - sync->buffer_size < chunk)
+            chunk = TS_PACKET_SIZE - sync->buffer_size;
+        if(size < chunk)
+            chunk = size;
+
+        memcpy(&sync->buffer[sync->buffer_size], buffer, chunk);
+        sync->buffer_size += chunk;
+        buffer += chunk;
+        size -= chunk;
+
+        sync_buffer_process(sync);
+    }
+}
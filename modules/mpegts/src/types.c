@@ -42,6 +42,16 @@ const char * mpegts_type_name(mpegts_packet_type_t type)
             return "ECM";
         case MPEGTS_PACKET_EMM:
             return "EMM";
+        case MPEGTS_PACKET_NIT:
+            return "NIT";
+        case MPEGTS_PACKET_SDT:
+            return "SDT";
+        case MPEGTS_PACKET_EIT:
+            return "EIT";
+        case MPEGTS_PACKET_TDT:
+            return "TDT";
+        case MPEGTS_PACKET_NULL:
+            return "NULL";
         default:
             return "UNKN";
     }
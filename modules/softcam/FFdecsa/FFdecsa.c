@@ -358,6 +358,52 @@ static inline __attribute__((always_inline)) void trasp_8_N (unsigned char *in,u
 
 //-----block main function
 
+// int is faster than unsigned char. apparently not
+static const unsigned char block_sbox[0x100] = {
+  0x3A,0xEA,0x68,0xFE,0x33,0xE9,0x88,0x1A, 0x83,0xCF,0xE1,0x7F,0xBA,0xE2,0x38,0x12,
+  0xE8,0x27,0x61,0x95,0x0C,0x36,0xE5,0x70, 0xA2,0x06,0x82,0x7C,0x17,0xA3,0x26,0x49,
+  0xBE,0x7A,0x6D,0x47,0xC1,0x51,0x8F,0xF3, 0xCC,0x5B,0x67,0xBD,0xCD,0x18,0x08,0xC9,
+  0xFF,0x69,0xEF,0x03,0x4E,0x48,0x4A,0x84, 0x3F,0xB4,0x10,0x04,0xDC,0xF5,0x5C,0xC6,
+  0x16,0xAB,0xAC,0x4C,0xF1,0x6A,0x2F,0x3C, 0x3B,0xD4,0xD5,0x94,0xD0,0xC4,0x63,0x62,
+  0x71,0xA1,0xF9,0x4F,0x2E,0xAA,0xC5,0x56, 0xE3,0x39,0x93,0xCE,0x65,0x64,0xE4,0x58,
+  0x6C,0x19,0x42,0x79,0xDD,0xEE,0x96,0xF6, 0x8A,0xEC,0x1E,0x85,0x53,0x45,0xDE,0xBB,
+  0x7E,0x0A,0x9A,0x13,0x2A,0x9D,0xC2,0x5E, 0x5A,0x1F,0x32,0x35,0x9C,0xA8,0x73,0x30,
+
+  0x29,0x3D,0xE7,0x92,0x87,0x1B,0x2B,0x4B, 0xA5,0x57,0x97,0x40,0x15,0xE6,0xBC,0x0E,
+  0xEB,0xC3,0x34,0x2D,0xB8,0x44,0x25,0xA4, 0x1C,0xC7,0x23,0xED,0x90,0x6E,0x50,0x00,
+  0x99,0x9E,0x4D,0xD9,0xDA,0x8D,0x6F,0x5F, 0x3E,0xD7,0x21,0x74,0x86,0xDF,0x6B,0x05,
+  0x8E,0x5D,0x37,0x11,0xD2,0x28,0x75,0xD6, 0xA7,0x77,0x24,0xBF,0xF0,0xB0,0x02,0xB7,
+  0xF8,0xFC,0x81,0x09,0xB1,0x01,0x76,0x91, 0x7D,0x0F,0xC8,0xA0,0xF2,0xCB,0x78,0x60,
+  0xD1,0xF7,0xE0,0xB5,0x98,0x22,0xB3,0x20, 0x1D,0xA6,0xDB,0x7B,0x59,0x9F,0xAE,0x31,
+  0xFB,0xD3,0xB6,0xCA,0x43,0x72,0x07,0xF4, 0xD8,0x41,0x14,0x55,0x0D,0x54,0x8B,0xB9,
+  0xAD,0x46,0x0B,0xAF,0x80,0x52,0x2C,0xFA, 0x8C,0x89,0x66,0xFD,0xB2,0xA9,0x9B,0xC0,
+};
+
+// bit permutation of the sbox output, the same for both directions
+static inline __attribute__((always_inline)) void block_perm_group(unsigned char *so, unsigned char *po){
+  int g;
+//dump_mem("pre perm ",(unsigned char *)so,GROUP_PARALLELISM,GROUP_PARALLELISM);
+  for(g=0;g<GROUP_PARALLELISM;g+=BYTES_PER_BATCH){
+    MEMALIGN batch in,out;
+    in=*(batch *)&so[g];
+
+    out=B_FFOR(
+	B_FFOR(
+	B_FFOR(
+	B_FFOR(
+	B_FFOR(
+	       B_FFSH8L(B_FFAND(in,B_FFN_ALL_29()),1),
+	       B_FFSH8L(B_FFAND(in,B_FFN_ALL_02()),6)),
+	       B_FFSH8L(B_FFAND(in,B_FFN_ALL_04()),3)),
+	       B_FFSH8R(B_FFAND(in,B_FFN_ALL_10()),2)),
+	       B_FFSH8R(B_FFAND(in,B_FFN_ALL_40()),6)),
+	       B_FFSH8R(B_FFAND(in,B_FFN_ALL_80()),4));
+
+    *(batch *)&po[g]=out;
+  }
+//dump_mem("post perm",(unsigned char *)po,GROUP_PARALLELISM,GROUP_PARALLELISM);
+}
+
 // block group
 static void block_decypher_group(
   batch *kkmulti,       // [In]  kkmulti[0]-kkmulti[55] 56 batches | Key schedule (each batch has repeated equal bytes).
@@ -365,26 +411,6 @@ static void block_decypher_group(
   unsigned char *bd,    // [Out] (bd0,bd1,...bd7)...x32 32*8 bytes | Block decipher.
   int count)
 {
-  // int is faster than unsigned char. apparently not
-  static const unsigned char block_sbox[0x100] = {
-    0x3A,0xEA,0x68,0xFE,0x33,0xE9,0x88,0x1A, 0x83,0xCF,0xE1,0x7F,0xBA,0xE2,0x38,0x12,
-    0xE8,0x27,0x61,0x95,0x0C,0x36,0xE5,0x70, 0xA2,0x06,0x82,0x7C,0x17,0xA3,0x26,0x49,
-    0xBE,0x7A,0x6D,0x47,0xC1,0x51,0x8F,0xF3, 0xCC,0x5B,0x67,0xBD,0xCD,0x18,0x08,0xC9,
-    0xFF,0x69,0xEF,0x03,0x4E,0x48,0x4A,0x84, 0x3F,0xB4,0x10,0x04,0xDC,0xF5,0x5C,0xC6,
-    0x16,0xAB,0xAC,0x4C,0xF1,0x6A,0x2F,0x3C, 0x3B,0xD4,0xD5,0x94,0xD0,0xC4,0x63,0x62,
-    0x71,0xA1,0xF9,0x4F,0x2E,0xAA,0xC5,0x56, 0xE3,0x39,0x93,0xCE,0x65,0x64,0xE4,0x58,
-    0x6C,0x19,0x42,0x79,0xDD,0xEE,0x96,0xF6, 0x8A,0xEC,0x1E,0x85,0x53,0x45,0xDE,0xBB,
-    0x7E,0x0A,0x9A,0x13,0x2A,0x9D,0xC2,0x5E, 0x5A,0x1F,0x32,0x35,0x9C,0xA8,0x73,0x30,
-
-    0x29,0x3D,0xE7,0x92,0x87,0x1B,0x2B,0x4B, 0xA5,0x57,0x97,0x40,0x15,0xE6,0xBC,0x0E,
-    0xEB,0xC3,0x34,0x2D,0xB8,0x44,0x25,0xA4, 0x1C,0xC7,0x23,0xED,0x90,0x6E,0x50,0x00,
-    0x99,0x9E,0x4D,0xD9,0xDA,0x8D,0x6F,0x5F, 0x3E,0xD7,0x21,0x74,0x86,0xDF,0x6B,0x05,
-    0x8E,0x5D,0x37,0x11,0xD2,0x28,0x75,0xD6, 0xA7,0x77,0x24,0xBF,0xF0,0xB0,0x02,0xB7,
-    0xF8,0xFC,0x81,0x09,0xB1,0x01,0x76,0x91, 0x7D,0x0F,0xC8,0xA0,0xF2,0xCB,0x78,0x60,
-    0xD1,0xF7,0xE0,0xB5,0x98,0x22,0xB3,0x20, 0x1D,0xA6,0xDB,0x7B,0x59,0x9F,0xAE,0x31,
-    0xFB,0xD3,0xB6,0xCA,0x43,0x72,0x07,0xF4, 0xD8,0x41,0x14,0x55,0x0D,0x54,0x8B,0xB9,
-    0xAD,0x46,0x0B,0xAF,0x80,0x52,0x2C,0xFA, 0x8C,0x89,0x66,0xFD,0xB2,0xA9,0x9B,0xC0,
-  };
   MEMALIGN unsigned char r[GROUP_PARALLELISM*(8+56)];  /* 56 because we will move back in memory while looping */
   MEMALIGN unsigned char sbox_in[GROUP_PARALLELISM],sbox_out[GROUP_PARALLELISM],perm_out[GROUP_PARALLELISM];
   int roff;
@@ -426,30 +452,7 @@ static void block_decypher_group(
     }
 
     // bit permutation
-    {
-      unsigned char *po=(unsigned char *)perm_out;
-      unsigned char *so=(unsigned char *)sbox_out;
-//dump_mem("pre perm ",(unsigned char *)so,GROUP_PARALLELISM,GROUP_PARALLELISM);
-      for(g=0;g<count_all;g+=BYTES_PER_BATCH){
-        MEMALIGN batch in,out;
-        in=*(batch *)&so[g];
-
-        out=B_FFOR(
-	    B_FFOR(
-	    B_FFOR(
-	    B_FFOR(
-	    B_FFOR(
-	           B_FFSH8L(B_FFAND(in,B_FFN_ALL_29()),1),
-	           B_FFSH8L(B_FFAND(in,B_FFN_ALL_02()),6)),
-	           B_FFSH8L(B_FFAND(in,B_FFN_ALL_04()),3)),
-	           B_FFSH8R(B_FFAND(in,B_FFN_ALL_10()),2)),
-	           B_FFSH8R(B_FFAND(in,B_FFN_ALL_40()),6)),
-	           B_FFSH8R(B_FFAND(in,B_FFN_ALL_80()),4));
-
-        *(batch *)&po[g]=out;
-      }
-//dump_mem("post perm",(unsigned char *)po,GROUP_PARALLELISM,GROUP_PARALLELISM);
-    }
+    block_perm_group(sbox_out,perm_out);
 
     roff-=GROUP_PARALLELISM; /* virtual shift of registers */
 
@@ -487,6 +490,54 @@ static void block_decypher_group(
 #endif
 }
 
+// block group, inverse of block_decypher_group
+static void block_encypher_group(
+  batch *kkmulti,       // [In]  kkmulti[0]-kkmulti[55] 56 batches | Key schedule (each batch has repeated equal bytes).
+  unsigned char *ib,    // [In]  (ib0,ib1,...ib7)...x32 32*8 bytes | Plain block.
+  unsigned char *be,    // [Out] (be0,be1,...be7)...x32 32*8 bytes | Block encipher.
+  int count)
+{
+  MEMALIGN unsigned char r[GROUP_PARALLELISM*(8+56)];  /* 56 because we will move forward in memory while looping */
+  MEMALIGN unsigned char sbox_in[GROUP_PARALLELISM],sbox_out[GROUP_PARALLELISM],perm_out[GROUP_PARALLELISM];
+  int roff;
+  int i,g,count_all=GROUP_PARALLELISM;
+
+  roff=0;
+
+  trasp_N_8((unsigned char *)&r[roff],(unsigned char *)ib,count);
+
+  // loop over kk[0]..kk[55]
+  for(i=0;i<56;i++){
+    {
+      MEMALIGN batch tkkmulti=kkmulti[i];
+      batch *si=(batch *)sbox_in;
+      batch *r7_N=(batch *)(r+roff+GROUP_PARALLELISM*7);
+      for(g=0;g<count_all/BYTES_PER_BATCH;g++){
+        si[g]=B_FFXOR(tkkmulti,r7_N[g]);
+      }
+    }
+
+    for(g=0;g<count_all;g++){
+      sbox_out[g]=block_sbox[sbox_in[g]];
+    }
+
+    block_perm_group(sbox_out,perm_out);
+
+    // registers 1..7 of the next round are 2..8 of this one
+    for(g=0;g<count_all;g+=BEST_SPAN){
+      XOR_BEST_BY(&r[roff+GROUP_PARALLELISM*8+g],&r[roff+GROUP_PARALLELISM*0+g],&sbox_out[g]);
+      XOREQ_BEST_BY(&r[roff+GROUP_PARALLELISM*6+g],&perm_out[g]);
+      XOREQ_BEST_BY(&r[roff+GROUP_PARALLELISM*4+g],&r[roff+GROUP_PARALLELISM*0+g]);
+      XOREQ_BEST_BY(&r[roff+GROUP_PARALLELISM*3+g],&r[roff+GROUP_PARALLELISM*0+g]);
+      XOREQ_BEST_BY(&r[roff+GROUP_PARALLELISM*2+g],&r[roff+GROUP_PARALLELISM*0+g]);
+    }
+
+    roff+=GROUP_PARALLELISM; /* virtual shift of registers */
+  }
+
+  trasp_8_N((unsigned char *)&r[roff],(unsigned char *)be,count);
+}
+
 //-----------------------------------EXTERNAL INTERFACE
 
 //-----get internal parallelism
@@ -912,3 +963,196 @@ DBG(dump_mem("23jd_after_ib_decrypt_data ",encp[g],8,8));
 
   return advanced;
 }
+
+//----- encrypt
+
+int encrypt_packets(void *keys, unsigned char **cluster){
+  unsigned char **clst;
+  unsigned char **clst2;
+  int grouped;
+  int group_ev_od;
+  int advanced;
+  unsigned char *g_pkt[GROUP_PARALLELISM];
+  int g_len[GROUP_PARALLELISM];
+  int g_offset[GROUP_PARALLELISM];
+  int g_n[GROUP_PARALLELISM];
+  int g_residue[GROUP_PARALLELISM];
+  unsigned char *pkt;
+  int xc0,ev_od,len,offset,n,residue;
+  struct csa_key_t* k;
+  int i,j,iter,g;
+  int t23,tsmall;
+  int alive[24];
+  unsigned char *encp[GROUP_PARALLELISM];
+  MEMALIGN unsigned char stream_in[GROUP_PARALLELISM*8];
+  MEMALIGN unsigned char stream_out[GROUP_PARALLELISM*8];
+  MEMALIGN unsigned char ib[GROUP_PARALLELISM*8];
+  MEMALIGN unsigned char block_out[GROUP_PARALLELISM*8];
+  struct stream_regs regs;
+
+  // build a list of packets to be processed
+  // unlike decrypt_packets, the scrambling bits are kept, so every examined
+  // packet is consumed and the group ends on the first parity change
+  clst=cluster;
+  grouped=0;
+  advanced=0;
+  group_ev_od=-1; // silence incorrect compiler warning
+  pkt=*clst;
+  do{ // find a new packet
+    if(grouped==GROUP_PARALLELISM){
+      // full
+      break;
+    }
+    if(pkt==NULL){
+      // no more ranges
+      break;
+    }
+    if(pkt>=*(clst+1)){
+      // out of this range, try next
+      clst++;clst++;
+      pkt=*clst;
+      continue;
+    }
+
+    xc0=pkt[3]&0xc0;
+    if(xc0==0x80||xc0==0xc0){ // to be encrypted
+      ev_od=(xc0&0x40)>>6; // 0 even, 1 odd
+      if(grouped==0) group_ev_od=ev_od; // this group will be all even (or odd)
+      if(group_ev_od!=ev_od){
+        // next call will start a new group
+        break;
+      }
+      if(pkt[3]&0x20){ // incomplete packet
+        offset=4+pkt[4]+1;
+        len=188-offset;
+        n=(len>0)?(len>>3):0;
+        residue=len-(n<<3);
+      }else{
+        len=184;
+        offset=4;
+        n=23;
+        residue=0;
+      }
+      if(n>0){ // otherwise encrypted==clear
+        g_pkt[grouped]=pkt;
+        g_len[grouped]=len;
+        g_offset[grouped]=offset;
+        g_n[grouped]=n;
+        g_residue[grouped]=residue;
+        grouped++;
+      }
+    }
+
+    // move range start forward
+    *clst+=188;
+    advanced++;
+    // next packet, if there is one
+    pkt+=188;
+  } while(1);
+
+  // delete empty ranges and compact list
+  clst2=cluster;
+  for(clst=cluster;*clst!=NULL;clst+=2){
+    // if not empty
+    if(*clst<*(clst+1)){
+      // it will remain
+      *clst2=*clst;
+      *(clst2+1)=*(clst+1);
+      clst2+=2;
+    }
+  }
+  *clst2=NULL;
+
+  if(grouped==0){
+    // no processing needed
+    return advanced;
+  }
+
+  // sort them, longest payload first (see decrypt_packets)
+  t23=0;
+  tsmall=grouped-1;
+  for(;;){
+    for(;t23<grouped;t23++){
+      if(g_n[t23]!=23) break;
+    }
+    for(;tsmall>=0;tsmall--){
+      if(g_n[tsmall]==23) break;
+    }
+    if(tsmall-t23<1) break;
+    g_swap(t23,tsmall);
+    t23++;
+    tsmall--;
+  }
+  for(i=t23;i<grouped;i++){
+    for(j=i+1;j<grouped;j++){
+      if(g_n[j]>g_n[i]){
+        g_swap(i,j);
+      }
+    }
+  }
+
+  // alive[i] is the number of packets with more than i blocks
+  for(i=0;i<=23;i++){
+    alive[i]=0;
+  }
+  alive[23-1]=t23;
+  for(i=t23;i<grouped;i++){
+    alive[g_n[i]-1]++;
+  }
+  for(i=22;i>=0;i--){
+    alive[i]+=alive[i+1];
+  }
+
+  // choose key
+  if(group_ev_od==0){
+    k=&((struct csa_keys_t *)keys)->even;
+  }
+  else{
+    k=&((struct csa_keys_t *)keys)->odd;
+  }
+
+  for(g=0;g<grouped;g++){
+    encp[g]=g_pkt[g]+g_offset[g]; // skip header
+  }
+
+  // BLOCK: from the last block to the first one, each block is chained
+  // with the cipher of the next one. packets are aligned by the last block
+  for(iter=0;iter<23&&alive[iter]>0;iter++){
+    for(g=0;g<alive[iter];g++){
+      unsigned char *p=encp[g]+8*(g_n[g]-1-iter);
+      if(iter==0){
+        COPY_8_BY(ib+8*g,p);
+      }
+      else{
+        XOR_8_BY(ib+8*g,p,block_out+8*g);
+      }
+    }
+    block_encypher_group(k->kkmulti,ib,block_out,alive[iter]);
+    for(g=0;g<alive[iter];g++){
+      COPY_8_BY(encp[g]+8*(g_n[g]-1-iter),block_out+8*g);
+    }
+  }
+
+  // STREAM: the first block is the initialization vector and stays as is
+  for(g=0;g<grouped;g++){
+    FFTABLEIN(stream_in,g,encp[g]);
+  }
+  stream_cypher_group_init(&regs,k->iA_g,k->iB_g,stream_in);
+  for(iter=1;iter<23&&alive[iter-1]>0;iter++){
+    stream_cypher_group_normal(&regs,stream_out);
+    // alive packets: encrypt the next block
+    for(g=0;g<alive[iter];g++){
+      FFTABLEOUT(ib+8*g,stream_out,g);
+      XOREQ_4_BY(encp[g]+8*iter,ib+8*g);
+      XOREQ_4_BY(encp[g]+8*iter+4,ib+8*g+4);
+    }
+    // just dead packets: encrypt residue
+    for(g=alive[iter];g<alive[iter-1];g++){
+      FFTABLEOUTXORNBY(g_residue[g],encp[g]+8*iter,stream_out,g);
+    }
+  }
+
+  M_EMPTY(); // restore CPU multimedia state
+
+  return advanced;
+}
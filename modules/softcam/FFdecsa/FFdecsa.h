@@ -59,4 +59,11 @@ void set_odd_control_word(void *keys, const unsigned char *odd);
 // Please read doc/how_to_use.txt.
 int decrypt_packets(void *keys, unsigned char **cluster);
 
+// -- encrypt many TS packets
+// Same cluster layout as decrypt_packets. Packets with the scrambling bits
+// set to 10 (even) or 11 (odd) are encrypted with the related key, the bits
+// are kept. Other packets are skipped. Every examined packet is consumed,
+// the group ends on a parity change. Returns the number of consumed packets.
+int encrypt_packets(void *keys, unsigned char **cluster);
+
 #endif
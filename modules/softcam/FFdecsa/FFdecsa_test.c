@@ -57,6 +57,7 @@ int compare(unsigned char *p1, unsigned char *p2, int n, int silently){
 #define TS_PKTS_FOR_TEST 30*1000
 //#define TS_PKTS_FOR_TEST 1000*1000
 unsigned char megabuf[188*TS_PKTS_FOR_TEST];
+unsigned char testbuf[188*TS_PKTS_FOR_TEST];
 unsigned char onebuf[188];
 
 unsigned char *cluster[10];
@@ -101,6 +102,36 @@ int main(void){
   decrypt_packets(keys,cluster);
   ok*=compare(onebuf,test_p_1_6_expected,188,0);
 
+/* begin encryption testing */
+
+  set_control_words(keys,test_invalid_key,test_1_key);
+  memcpy(onebuf,test_1_expected,188);
+  onebuf[3]=test_1_encrypted[3];
+  cluster[0]=onebuf;cluster[1]=onebuf+188;cluster[2]=NULL;
+  encrypt_packets(keys,cluster);
+  ok*=compare(onebuf,test_1_encrypted,188,0);
+
+  set_control_words(keys,test_2_key,test_invalid_key);
+  memcpy(onebuf,test_2_expected,188);
+  onebuf[3]=test_2_encrypted[3];
+  cluster[0]=onebuf;cluster[1]=onebuf+188;cluster[2]=NULL;
+  encrypt_packets(keys,cluster);
+  ok*=compare(onebuf,test_2_encrypted,188,0);
+
+  set_control_words(keys,test_p_10_0_key,test_invalid_key);
+  memcpy(onebuf,test_p_10_0_expected,188);
+  onebuf[3]=test_p_10_0_encrypted[3];
+  cluster[0]=onebuf;cluster[1]=onebuf+188;cluster[2]=NULL;
+  encrypt_packets(keys,cluster);
+  ok*=compare(onebuf,test_p_10_0_encrypted,188,0);
+
+  set_control_words(keys,test_p_1_6_key,test_invalid_key);
+  memcpy(onebuf,test_p_1_6_expected,188);
+  onebuf[3]=test_p_1_6_encrypted[3];
+  cluster[0]=onebuf;cluster[1]=onebuf+188;cluster[2]=NULL;
+  encrypt_packets(keys,cluster);
+  ok*=compare(onebuf,test_p_1_6_encrypted,188,0);
+
 /* begin speed testing */
 
 #if 0
@@ -172,5 +203,51 @@ int main(void){
     };
   }
 
+/* begin round-trip testing */
+
+  // even and odd parts, full and short packets
+  for(i=0;i<TS_PKTS_FOR_TEST;i++){
+    unsigned char *p=megabuf+188*i;
+    int j;
+    memcpy(p,(i%7==0)?test_p_1_6_expected:test_2_expected,188);
+    p[3]=(p[3]&0x3f)|((i<TS_PKTS_FOR_TEST/2)?0x80:0xc0);
+    for(j=(p[3]&0x20)?(5+p[4]):4;j<188;j++) p[j]=(i*31+j)&0xff;
+  }
+  memcpy(testbuf,megabuf,sizeof(megabuf));
+
+  set_control_words(keys,test_2_key,test_1_key);
+  gettimeofday(&tvs,NULL);
+  {
+    int done=0;
+    while(done<TS_PKTS_FOR_TEST){
+      cluster[0]=megabuf+188*done;cluster[1]=megabuf+188*TS_PKTS_FOR_TEST;cluster[2]=NULL;
+      done+=encrypt_packets(keys,cluster);
+    }
+  }
+  gettimeofday(&tve,NULL);
+
+  fprintf(stderr,"encrypt speed=%f Mbit/s\n",(184*TS_PKTS_FOR_TEST*8)/((tve.tv_sec-tvs.tv_sec)+1e-6*(tve.tv_usec-tvs.tv_usec))/1000000);
+  fprintf(stderr,"encrypt speed=%f pkts/s\n",TS_PKTS_FOR_TEST/((tve.tv_sec-tvs.tv_sec)+1e-6*(tve.tv_usec-tvs.tv_usec)));
+
+  if(!memcmp(megabuf+188*1,testbuf+188*1,188)){
+    fprintf(stderr,"FAILED! packet is not encrypted\n");
+    ok=0;
+  }
+
+  {
+    int done=0;
+    while(done<TS_PKTS_FOR_TEST){
+      cluster[0]=megabuf+188*done;cluster[1]=megabuf+188*TS_PKTS_FOR_TEST;cluster[2]=NULL;
+      done+=decrypt_packets(keys,cluster);
+    }
+  }
+
+  for(i=0;i<TS_PKTS_FOR_TEST;i++){
+    if(!compare(megabuf+188*i,testbuf+188*i,188,1)){
+      fprintf(stderr,"FAILED ROUND-TRIP OF PACKET %10i\n",i);
+      ok=0;
+    };
+  }
+
   return ok ? 0 : 10;
 }
@@ -20,32 +20,92 @@
 
 #include "../module_cam.h"
 
+/* ECM goes to the packet_queue, EMM to the emm_queue. ECM is always sent first */
+
+void module_cam_queue_push(module_cam_t *cam, em_packet_t *packet)
+{
+    if(packet->buffer[0] == 0x80 || packet->buffer[0] == 0x81)
+        asc_list_insert_tail(cam->packet_queue, packet);
+    else
+        asc_list_insert_tail(cam->emm_queue, packet);
+}
+
 em_packet_t * module_cam_queue_pop(module_cam_t *cam)
 {
-    asc_list_first(cam->packet_queue);
-    if(asc_list_eol(cam->packet_queue))
-        return NULL;
-    em_packet_t *packet = asc_list_data(cam->packet_queue);
-    asc_list_remove_current(cam->packet_queue);
+    asc_list_t *queue = cam->packet_queue;
+    asc_list_first(queue);
+    if(asc_list_eol(queue))
+    {
+        queue = cam->emm_queue;
+        asc_list_first(queue);
+        if(asc_list_eol(queue))
+            return NULL;
+    }
+    em_packet_t *packet = asc_list_data(queue);
+    asc_list_remove_current(queue);
     return packet;
 }
 
-void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt)
+size_t module_cam_queue_size(module_cam_t *cam)
 {
-    asc_list_first(cam->packet_queue);
-    while(!asc_list_eol(cam->packet_queue))
+    return asc_list_size(cam->packet_queue) + asc_list_size(cam->emm_queue);
+}
+
+static void __module_cam_queue_flush(asc_list_t *queue, module_decrypt_t *decrypt)
+{
+    asc_list_first(queue);
+    while(!asc_list_eol(queue))
     {
-        em_packet_t *packet = asc_list_data(cam->packet_queue);
+        em_packet_t *packet = asc_list_data(queue);
         if(!decrypt || packet->decrypt == decrypt)
         {
             free(packet);
-            asc_list_remove_current(cam->packet_queue);
+            asc_list_remove_current(queue);
         }
         else
-            asc_list_next(cam->packet_queue);
+            asc_list_next(queue);
     }
 }
 
+void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt)
+{
+    __module_cam_queue_flush(cam->packet_queue, decrypt);
+    __module_cam_queue_flush(cam->emm_queue, decrypt);
+}
+
+/* EMM is repeated by the carousel and each decrypt on the same transponder gets the same
+ * sections. Drops EMM if it was already forwarded in the TTL or the queue is full */
+
+bool module_cam_emm_check(module_cam_t *cam, const uint8_t *buffer, size_t size)
+{
+    if(asc_list_size(cam->emm_queue) >= EMM_QUEUE_LIMIT)
+    {
+        ++cam->emm.overflow;
+        return false;
+    }
+
+    if(cam->emm.ttl)
+    {
+        const uint32_t hash = crc32b(buffer, size);
+        const size_t slot = hash & (EMM_CACHE_SIZE - 1);
+        const uint64_t current_time = asc_utime();
+
+        if(   cam->emm.cache_hash[slot] == hash
+           && cam->emm.cache_time[slot] != 0
+           && current_time - cam->emm.cache_time[slot] < cam->emm.ttl)
+        {
+            ++cam->emm.duplicate;
+            return false;
+        }
+
+        cam->emm.cache_hash[slot] = hash;
+        cam->emm.cache_time[slot] = current_time;
+    }
+
+    ++cam->emm.forward;
+    return true;
+}
+
 void module_cam_ready(module_cam_t *cam)
 {
     cam->is_ready = true;
@@ -77,6 +137,8 @@ void module_cam_reset(module_cam_t *cam)
         asc_list_remove_current(cam->prov_list);
     }
     module_cam_queue_flush(cam, NULL);
+
+    memset(cam->emm.cache_time, 0, EMM_CACHE_SIZE * sizeof(uint64_t));
 }
 
 void module_cam_attach_decrypt(module_cam_t *cam, module_decrypt_t *decrypt)
@@ -18,15 +18,33 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <astra.h>
-#include "../module_cam.h"
+/*
+ * Module Name:
+ *      newcamd
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      host        - string, server address
+ *      port        - number, server port
+ *      user        - string, login
+ *      pass        - string, password
+ *      key         - string, DES key, 28 chars length
+ *      disable_emm - boolean, do not send EMM to the server
+ *      timeout     - number, response timeout in seconds. default: 8
+ *      pool        - number, connections to the server. default: 1
+ *      pipeline    - number, requests in flight on each connection. default: 1
+ *      emm_ttl     - number, seconds to drop repeated EMM. default: 10. 0 - disabled
+ *
+ * Module Methods:
+ *      status()    - return table with the request counters
+ */
 
-#include <openssl/des.h>
+#include <astra.h>
+#include "newcamd.h"
 
-#define NEWCAMD_HEADER_SIZE 12
-#define NEWCAMD_MSG_SIZE (NEWCAMD_HEADER_SIZE + EM_MAX_SIZE)
+#define NEWCAMD_MAX_POOL 8
+#define NEWCAMD_MAX_PIPELINE 16
 #define MAX_PROV_COUNT 16
-#define KEY_SIZE 14
 
 #define MSG(_msg) "[newcamd %s] " _msg, mod->config.name
 
@@ -39,6 +57,37 @@ typedef union {
     uint64_t l;
 } csa_key_t;
 
+typedef struct
+{
+    em_packet_t *packet;
+    uint16_t msg_id;
+    uint64_t send_time;
+} newcamd_request_t;
+
+typedef struct
+{
+    module_data_t *mod;
+    int id;
+
+    int status;
+    asc_socket_t *sock;
+    asc_timer_t *timeout;
+
+    newcamd_des_t triple_des;
+
+    newcamd_request_t request[NEWCAMD_MAX_PIPELINE];
+    int request_count;
+
+    bool is_message;        // message in the send_buffer
+
+    uint8_t send_buffer[NEWCAMD_MSG_SIZE];
+    size_t payload_size;    // to send
+
+    uint8_t buffer[NEWCAMD_MSG_SIZE];
+    size_t buffer_size;     // to recv
+    size_t buffer_skip;     // to recv
+} newcamd_conn_t;
+
 struct module_data_t
 {
     MODULE_CAM_DATA();
@@ -54,98 +103,165 @@ struct module_data_t
         const char *user;
         char pass[36];
 
-        uint8_t key[KEY_SIZE];
+        uint8_t key[NEWCAMD_KEY_SIZE];
 
         bool disable_emm;
+
+        int pool;
+        int pipeline;
     } config;
 
-    int status;
-    asc_socket_t *sock;
-    asc_timer_t *timeout;
+    newcamd_conn_t *pool;
+    int pool_next;
 
     uint8_t *prov_buffer;
 
-    struct
-    {
-        uint8_t key[16];
-        DES_key_schedule ks1;
-        DES_key_schedule ks2;
-    } triple_des;
-
-    uint16_t msg_id;        // curren message id
-    em_packet_t *packet;    // current packet
+    uint16_t msg_id;        // last message id
     csa_key_t last_key[2];  // NDS
 
-    uint8_t buffer[NEWCAMD_MSG_SIZE];
-    size_t payload_size;    // to send
-    size_t buffer_skip;     // to recv
+    struct
+    {
+        uint64_t ecm_count;
+        uint64_t emm_count;
+        uint64_t ecm_time_total;
+        uint64_t ecm_time_max;
+        uint64_t ecm_time_last;
+        uint64_t timeout_count;
+        uint64_t drop_count;
+    } stat;
 };
 
-typedef enum {
-    NEWCAMD_MSG_ERROR = 0,
-    NEWCAMD_MSG_FIRST = 0xDF,
-    NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN,
-    NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_ACK,
-    NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_NAK,
-    NEWCAMD_MSG_CARD_DATA_REQ,
-    NEWCAMD_MSG_CARD_DATA,
-    NEWCAMD_MSG_KEEPALIVE = 0xFD,
-} newcamd_cmd_t;
-
 static void newcamd_connect(module_data_t *mod);
-static void newcamd_reconnect(module_data_t *mod, bool timeout);
+static void newcamd_conn_connect(newcamd_conn_t *conn);
+static void newcamd_conn_reconnect(newcamd_conn_t *conn, bool timeout);
 
 /*
- * ooooooooooo ooooooooo  ooooooooooo      o
- * 88  888  88  888    88o 888    88      888
- *     888      888    888 888ooo8       8  88
- *     888      888    888 888    oo    8oooo88
- *    o888o    o888ooo88  o888ooo8888 o88o  o888o
- *
+ * oooooooooo  ooooooooooo  ooooooo  ooooo  oooo ooooooooooo  oooooooo8 ooooooooooo
+ *  888    888  888    88 o888   888o 888    88   888    88  888         88  888  88
+ *  888oooo88   888ooo8   888     888 888    88   888ooo8     888oooooo      888
+ *  888  88o    888    oo 888o  8o888 888    88   888    oo          888     888
+ * o888o  88o8 o888ooo8888  88ooo88    888oo88   o888ooo8888 o88oooo888     o888o
+ *                               88o8
  */
 
-static void triple_des_set_key(module_data_t *mod, const uint8_t *key, size_t key_size)
+static void on_timeout(void *arg);
+
+static bool is_decrypt_attached(module_data_t *mod, module_decrypt_t *decrypt)
+{
+    asc_list_for(mod->__cam.decrypt_list)
+    {
+        if(asc_list_data(mod->__cam.decrypt_list) == decrypt)
+            return true;
+    }
+    return false;
+}
+
+static void newcamd_request_timer(newcamd_conn_t *conn)
+{
+    module_data_t *mod = conn->mod;
+
+    if(conn->timeout)
+    {
+        asc_timer_destroy(conn->timeout);
+        conn->timeout = NULL;
+    }
+
+    if(conn->request_count == 0)
+        return;
+
+    uint64_t send_time = conn->request[0].send_time;
+    for(int i = 1; i < conn->request_count; ++i)
+    {
+        if(conn->request[i].send_time < send_time)
+            send_time = conn->request[i].send_time;
+    }
+
+    const uint64_t timeout = (uint64_t)mod->config.timeout * 1000;
+    const uint64_t elapsed = asc_utime() - send_time;
+    const unsigned int ms = (elapsed < timeout) ? ((timeout - elapsed) / 1000) : 0;
+
+    conn->timeout = asc_timer_init(ms, on_timeout, conn);
+}
+
+/* returns true if the queue has the newer ECM for the same stream */
+static bool is_newer_queued(module_data_t *mod, const em_packet_t *packet)
+{
+    asc_list_for(mod->__cam.packet_queue)
+    {
+        em_packet_t *queue_item = asc_list_data(mod->__cam.packet_queue);
+        if(   queue_item->decrypt == packet->decrypt
+           && queue_item->arg == packet->arg
+           && queue_item->recv_time >= packet->recv_time)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* returns request packets to the queue. newest ECM is going first.
+ * ECM is dropped if the newer one for the same stream is pending */
+static void newcamd_request_flush(newcamd_conn_t *conn)
 {
-    uint8_t tmp_key[14];
-    memcpy(tmp_key, mod->config.key, sizeof(tmp_key));
-
-    // set key
-    for(size_t i = 0; i < key_size; ++i)
-        tmp_key[i % sizeof(tmp_key)] ^= key[i];
-
-    uint8_t *triple_des_key = mod->triple_des.key;
-    triple_des_key[0] = tmp_key[0] & 0xfe;
-    triple_des_key[1] = ((tmp_key[0] << 7) | (tmp_key[1] >> 1)) & 0xfe;
-    triple_des_key[2] = ((tmp_key[1] << 6) | (tmp_key[2] >> 2)) & 0xfe;
-    triple_des_key[3] = ((tmp_key[2] << 5) | (tmp_key[3] >> 3)) & 0xfe;
-    triple_des_key[4] = ((tmp_key[3] << 4) | (tmp_key[4] >> 4)) & 0xfe;
-    triple_des_key[5] = ((tmp_key[4] << 3) | (tmp_key[5] >> 5)) & 0xfe;
-    triple_des_key[6] = ((tmp_key[5] << 2) | (tmp_key[6] >> 6)) & 0xfe;
-    triple_des_key[7] = tmp_key[6] << 1;
-    triple_des_key[8] = tmp_key[7] & 0xfe;
-    triple_des_key[9] = ((tmp_key[7] << 7) | (tmp_key[8] >> 1)) & 0xfe;
-    triple_des_key[10] = ((tmp_key[8] << 6) | (tmp_key[9] >> 2)) & 0xfe;
-    triple_des_key[11] = ((tmp_key[9] << 5) | (tmp_key[10] >> 3)) & 0xfe;
-    triple_des_key[12] = ((tmp_key[10] << 4) | (tmp_key[11] >> 4)) & 0xfe;
-    triple_des_key[13] = ((tmp_key[11] << 3) | (tmp_key[12] >> 5)) & 0xfe;
-    triple_des_key[14] = ((tmp_key[12] << 2) | (tmp_key[13] >> 6)) & 0xfe;
-    triple_des_key[15] = tmp_key[13] << 1;
-
-    DES_set_odd_parity((DES_cblock *)&triple_des_key[0]);
-    DES_set_odd_parity((DES_cblock *)&triple_des_key[8]);
-    DES_key_sched((DES_cblock *)&triple_des_key[0], &mod->triple_des.ks1);
-    DES_key_sched((DES_cblock *)&triple_des_key[8], &mod->triple_des.ks2);
-} /* triple_des_set_key */
-
-static uint8_t xor_sum(const uint8_t *mem, int len)
+    module_data_t *mod = conn->mod;
+
+    for(int i = 0; i < conn->request_count; ++i)
+    {
+        em_packet_t *packet = conn->request[i].packet;
+        conn->request[i].packet = NULL;
+
+        if(   (packet->buffer[0] == 0x80 || packet->buffer[0] == 0x81)
+           && is_decrypt_attached(mod, packet->decrypt))
+        {
+            if(is_newer_queued(mod, packet))
+            {
+                free(packet);
+                ++mod->stat.drop_count;
+                continue;
+            }
+
+            /* older ECM of the same stream could be requeued by another connection */
+            asc_list_for(mod->__cam.packet_queue)
+            {
+                em_packet_t *queue_item = asc_list_data(mod->__cam.packet_queue);
+                if(queue_item->decrypt == packet->decrypt && queue_item->arg == packet->arg)
+                {
+                    asc_list_remove_current(mod->__cam.packet_queue);
+                    free(queue_item);
+                    ++mod->stat.drop_count;
+                    break;
+                }
+            }
+
+            asc_list_insert_head(mod->__cam.packet_queue, packet);
+        }
+        else
+            free(packet);
+    }
+    conn->request_count = 0;
+}
+
+static void on_newcamd_ready(void *arg);
+
+static void newcamd_dispatch(module_data_t *mod)
 {
-    uint8_t cs = 0;
-    while(len > 0)
+    size_t queue_size = module_cam_queue_size(&mod->__cam);
+
+    for(int i = 0; i < mod->config.pool && queue_size > 0; ++i)
     {
-        cs ^= *mem++;
-        len--;
+        newcamd_conn_t *conn = &mod->pool[(mod->pool_next + i) % mod->config.pool];
+        if(conn->status != 3)
+            continue;
+
+        const size_t request_free = mod->config.pipeline - conn->request_count;
+        if(request_free == 0)
+            continue;
+
+        asc_socket_set_on_ready(conn->sock, on_newcamd_ready);
+        queue_size -= (request_free < queue_size) ? request_free : queue_size;
     }
-    return cs;
+
+    mod->pool_next = (mod->pool_next + 1) % mod->config.pool;
 }
 
 /*
@@ -159,69 +275,86 @@ static uint8_t xor_sum(const uint8_t *mem, int len)
 
 static void on_timeout(void *arg)
 {
-    module_data_t *mod = arg;
+    newcamd_conn_t *conn = arg;
+    module_data_t *mod = conn->mod;
 
-    asc_timer_destroy(mod->timeout);
-    mod->timeout = NULL;
+    asc_timer_destroy(conn->timeout);
+    conn->timeout = NULL;
 
-    switch(mod->status)
+    switch(conn->status)
     {
         case -1:
-            newcamd_connect(mod);
+            newcamd_conn_connect(conn);
             return;
         case 0:
             asc_log_error(MSG("connection timeout"));
             break;
+        case 3:
+            ++mod->stat.timeout_count;
+            asc_log_error(  MSG("response timeout (connection:%d requests:%d)")
+                          , conn->id, conn->request_count);
+            break;
         default:
             asc_log_error(MSG("response timeout"));
             break;
     }
 
-    newcamd_reconnect(mod, false);
+    newcamd_conn_reconnect(conn, false);
+}
+
+static bool is_pool_ready(module_data_t *mod)
+{
+    for(int i = 0; i < mod->config.pool; ++i)
+    {
+        if(mod->pool[i].status == 3)
+            return true;
+    }
+    return false;
 }
 
 static void on_newcamd_close(void *arg)
 {
-    module_data_t *mod = arg;
+    newcamd_conn_t *conn = arg;
+    module_data_t *mod = conn->mod;
 
-    if(!mod->sock)
+    if(!conn->sock)
         return;
 
-    asc_socket_close(mod->sock);
-    mod->sock = NULL;
+    asc_socket_close(conn->sock);
+    conn->sock = NULL;
 
-    if(mod->timeout)
+    if(conn->timeout)
     {
-        asc_timer_destroy(mod->timeout);
-        mod->timeout = NULL;
+        asc_timer_destroy(conn->timeout);
+        conn->timeout = NULL;
     }
 
-    module_cam_reset(&mod->__cam);
+    const int status = conn->status;
+    conn->status = (status != -1) ? -1 : 0;
 
-    if(mod->prov_buffer)
-    {
-        free(mod->prov_buffer);
-        mod->prov_buffer = NULL;
-    }
+    newcamd_request_flush(conn);
+    conn->is_message = false;
 
-    if(mod->packet)
+    if(!is_pool_ready(mod))
     {
-        free(mod->packet);
-        mod->packet = NULL;
+        module_cam_reset(&mod->__cam);
+
+        if(mod->prov_buffer)
+        {
+            free(mod->prov_buffer);
+            mod->prov_buffer = NULL;
+        }
     }
+    else
+        newcamd_dispatch(mod);
 
-    if(mod->status == 0)
+    if(status == 0)
         asc_log_error(MSG("connection failed"));
-    else if(mod->status == 1)
+    else if(status == 1)
         asc_log_error(MSG("failed to parse response"));
 
-    if(mod->status != -1)
-    {
-        mod->status = -1;
-        mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
-    }
-    else
-        mod->status = 0;
+    if(status != -1)
+        conn->timeout = asc_timer_init(mod->config.timeout, on_timeout, conn);
 }
 
 /*
@@ -233,80 +366,88 @@ static void on_newcamd_close(void *arg)
  *
  */
 
-static void on_newcamd_ready(void *arg)
+static bool newcamd_send_message(newcamd_conn_t *conn, uint16_t msg_id, uint16_t pnr)
 {
-    module_data_t *mod = arg;
-
-    memset(mod->buffer, 0, NEWCAMD_HEADER_SIZE);
+    module_data_t *mod = conn->mod;
+    uint8_t *const message = conn->send_buffer;
 
-    uint8_t *buffer = &mod->buffer[NEWCAMD_HEADER_SIZE];
+    memset(message, 0, NEWCAMD_HEADER_SIZE);
+    message[2] = msg_id >> 8;
+    message[3] = msg_id & 0xff;
+    message[4] = pnr >> 8;
+    message[5] = pnr & 0xff;
 
-    if(mod->packet)
+    const size_t packet_size = newcamd_encrypt(&conn->triple_des, message, conn->payload_size);
+    if(!packet_size)
     {
-        memcpy(buffer, mod->packet->buffer, mod->packet->buffer_size);
-        mod->payload_size = mod->packet->buffer_size - 3;
+        asc_log_error(MSG("failed to encrypt message"));
+        newcamd_conn_reconnect(conn, true);
+        return false;
+    }
 
-        mod->msg_id = (mod->msg_id + 1) & 0xFFFF;
-        mod->buffer[2] = mod->msg_id >> 8;
-        mod->buffer[3] = mod->msg_id & 0xff;
+    conn->payload_size = 0;
 
-        const uint16_t pnr = mod->packet->decrypt->cas_pnr;
-        mod->buffer[4] = pnr >> 8;
-        mod->buffer[5] = pnr & 0xff;
+    if(asc_socket_send(conn->sock, message, packet_size) != (ssize_t)packet_size)
+    {
+        asc_log_error(MSG("failed to send message"));
+        newcamd_conn_reconnect(conn, true);
+        return false;
     }
 
-    buffer[1] = (mod->payload_size >> 8) & 0x0F;
-    buffer[2] = (mod->payload_size     ) & 0xFF;
+    return true;
+}
 
-    size_t packet_size = NEWCAMD_HEADER_SIZE + 3 + mod->payload_size;
-    const uint8_t no_pad_bytes = (8 - ((packet_size - 1) % 8)) % 8;
+static bool newcamd_send_packet(newcamd_conn_t *conn, em_packet_t *packet)
+{
+    module_data_t *mod = conn->mod;
 
-    if((packet_size + no_pad_bytes + 1) >= (NEWCAMD_MSG_SIZE - 8))
-    {
-        asc_log_error(MSG("failed to pad message"));
-        newcamd_reconnect(mod, true);
-        return;
-    }
+    memcpy(&conn->send_buffer[NEWCAMD_HEADER_SIZE], packet->buffer, packet->buffer_size);
+    conn->payload_size = packet->buffer_size - 3;
+
+    mod->msg_id = (mod->msg_id + 1) & 0xFFFF;
+
+    newcamd_request_t *request = &conn->request[conn->request_count];
+    request->packet = packet;
+    request->msg_id = mod->msg_id;
+    request->send_time = asc_utime();
+    ++conn->request_count;
 
-    DES_cblock pad_bytes;
-    DES_random_key((DES_cblock *)pad_bytes);
-    memcpy(&mod->buffer[packet_size], pad_bytes, no_pad_bytes);
-    packet_size += no_pad_bytes;
-    mod->buffer[packet_size] = xor_sum(&mod->buffer[2], packet_size - 2);
-    ++packet_size;
+    return newcamd_send_message(conn, mod->msg_id, packet->decrypt->cas_pnr);
+}
+
+static void on_newcamd_ready(void *arg)
+{
+    newcamd_conn_t *conn = arg;
+    module_data_t *mod = conn->mod;
 
-    // encrypt
-    DES_cblock ivec;
-    DES_random_key((DES_cblock *)ivec);
-    if(packet_size + sizeof(ivec) >= NEWCAMD_MSG_SIZE)
+    asc_socket_set_on_ready(conn->sock, NULL);
+
+    if(conn->is_message)
     {
-        asc_log_error(MSG("failed to encrypt message"));
-        newcamd_reconnect(mod, true);
-        return;
+        conn->is_message = false;
+        if(!newcamd_send_message(conn, 0, 0))
+            return;
     }
-    memcpy(&mod->buffer[packet_size], ivec, sizeof(ivec));
-    DES_ede2_cbc_encrypt(  &mod->buffer[2], &mod->buffer[2], packet_size - 2
-                         , &mod->triple_des.ks1, &mod->triple_des.ks2
-                         , (DES_cblock *)ivec, DES_ENCRYPT);
-    packet_size += sizeof(ivec);
 
-    mod->buffer[0] = ((packet_size - 2) >> 8) & 0xFF;
-    mod->buffer[1] = ((packet_size - 2)     ) & 0xFF;
-
-    if(asc_socket_send(mod->sock, mod->buffer, packet_size) != (ssize_t)packet_size)
+    if(conn->status != 3)
     {
-        asc_log_error(MSG("failed to send message"));
-        newcamd_reconnect(mod, true);
+        if(!conn->timeout)
+            conn->timeout = asc_timer_init(mod->config.timeout, on_timeout, conn);
         return;
     }
 
-    asc_socket_set_on_ready(mod->sock, NULL);
-
-    mod->buffer_skip = 0;
-    mod->payload_size = 0;
+    const int request_count = conn->request_count;
+    while(conn->request_count < mod->config.pipeline)
+    {
+        em_packet_t *packet = module_cam_queue_pop(&mod->__cam);
+        if(!packet)
+            break;
+        if(!newcamd_send_packet(conn, packet))
+            return;
+    }
 
-    if(!mod->timeout)
-        mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
+    if(request_count == 0 && conn->request_count > 0)
+        newcamd_request_timer(conn);
 }
 
 /*
@@ -318,184 +459,227 @@ static void on_newcamd_ready(void *arg)
  *
  */
 
-static void on_newcamd_read_packet(void *arg)
+static void on_newcamd_response(newcamd_conn_t *conn, uint8_t msg_type)
 {
-    module_data_t *mod = arg;
+    module_data_t *mod = conn->mod;
+    uint8_t *buffer = &conn->buffer[NEWCAMD_HEADER_SIZE];
 
-    if(mod->buffer_skip < 2)
+    if(msg_type == NEWCAMD_MSG_KEEPALIVE)
     {
-        const ssize_t len = asc_socket_recv(  mod->sock
-                                            , &mod->buffer[mod->buffer_skip]
-                                            , 2 - mod->buffer_skip);
-        if(len <= 0)
-        {
-            asc_log_error(MSG("failed to read header"));
-            newcamd_reconnect(mod, true);
-            return;
-        }
-        mod->buffer_skip += len;
-        if(mod->buffer_skip != 2)
-            return;
-
-        mod->payload_size = 2 + ((mod->buffer[0] << 8) | mod->buffer[1]);
-        if(mod->payload_size > NEWCAMD_MSG_SIZE)
-        {
-            asc_log_error(MSG("wrong message size"));
-            newcamd_reconnect(mod, true);
-            return;
-        }
+        buffer = &conn->send_buffer[NEWCAMD_HEADER_SIZE];
+        buffer[0] = NEWCAMD_MSG_KEEPALIVE;
+        buffer[1] = 0;
+        buffer[2] = 0;
+        conn->payload_size = 0;
+        conn->is_message = true;
 
+        asc_socket_set_on_ready(conn->sock, on_newcamd_ready);
         return;
     }
 
-    const ssize_t len = asc_socket_recv(  mod->sock
-                                        , &mod->buffer[mod->buffer_skip]
-                                        , mod->payload_size - mod->buffer_skip);
-    if(len <= 0)
+    if(msg_type < 0x80 || msg_type > 0x8F)
     {
-        asc_log_error(MSG("failed to read message"));
-        newcamd_reconnect(mod, true);
+        asc_log_warning(MSG("unknown packet type [0x%02X]"), msg_type);
         return;
     }
 
-    mod->buffer_skip += len;
-    if(mod->buffer_skip != mod->payload_size)
-        return;
-
-    size_t packet_size = mod->payload_size - 2;
-    mod->payload_size = 0;
-    mod->buffer_skip = 0;
+    const uint16_t msg_id = (conn->buffer[2] << 8) | conn->buffer[3];
 
-    // decrypt
-    if(   (packet_size % 8 == 0)
-       && (packet_size > NEWCAMD_HEADER_SIZE + 3))
+    int request_id = 0;
+    for(; request_id < conn->request_count; ++request_id)
     {
-        DES_cblock ivec;
-        packet_size -= sizeof(ivec);
-        memcpy(ivec, &mod->buffer[packet_size + 2], sizeof(ivec));
-        DES_ede2_cbc_encrypt(  &mod->buffer[2], &mod->buffer[2], packet_size
-                             , &mod->triple_des.ks1, &mod->triple_des.ks2
-                             , (DES_cblock *)ivec, DES_DECRYPT);
+        if(conn->request[request_id].msg_id == msg_id)
+            break;
     }
-    if(xor_sum(&mod->buffer[2], packet_size))
+    if(request_id == conn->request_count)
     {
-        asc_log_error(MSG("bad message checksum"));
-        newcamd_reconnect(mod, true);
+        asc_log_warning(MSG("unknown message id [%d]"), msg_id);
         return;
     }
 
-    const uint8_t msg_type = mod->buffer[NEWCAMD_HEADER_SIZE];
+    em_packet_t *packet = conn->request[request_id].packet;
+    const uint64_t response_time = asc_utime() - conn->request[request_id].send_time;
 
-    uint8_t *buffer = &mod->buffer[NEWCAMD_HEADER_SIZE];
-    mod->payload_size = ((buffer[1] & 0x0F) << 8) | buffer[2];
+    --conn->request_count;
+    conn->request[request_id] = conn->request[conn->request_count];
+    conn->request[conn->request_count].packet = NULL;
 
-    if(mod->status == 3)
+    newcamd_request_timer(conn);
+    if(module_cam_queue_size(&mod->__cam) > 0)
+        asc_socket_set_on_ready(conn->sock, on_newcamd_ready);
+
+    if(!is_decrypt_attached(mod, packet->decrypt))
     {
-        if(!mod->packet && msg_type == NEWCAMD_MSG_KEEPALIVE)
-        {
-            buffer[0] = NEWCAMD_MSG_KEEPALIVE;
-            buffer[1] = 0;
-            buffer[2] = 0;
-            mod->payload_size = 0;
+        /* the decrypt module was detached */
+        ++mod->stat.drop_count;
+        free(packet);
+        return;
+    }
 
-            asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
-            return;
-        }
+    if(packet->buffer[0] != 0x80 && packet->buffer[0] != 0x81)
+        ++mod->stat.emm_count;
+    else
+    {
+        ++mod->stat.ecm_count;
+        mod->stat.ecm_time_last = response_time;
+        mod->stat.ecm_time_total += response_time;
+        if(response_time > mod->stat.ecm_time_max)
+            mod->stat.ecm_time_max = response_time;
 
-        if(!mod->packet || msg_type < 0x80 || msg_type > 0x8F)
+        if(asc_log_is_debug())
         {
-            asc_log_warning(MSG("unknown packet type [0x%02X]"), msg_type);
-            return;
+            asc_log_debug(  MSG("response pnr:%d id:%d time:%"PRIu64"ms requests:%d")
+                          , packet->decrypt->pnr, msg_id, response_time / 1000
+                          , conn->request_count);
         }
+    }
 
-        asc_timer_destroy(mod->timeout);
-        mod->timeout = NULL;
-
-        asc_list_for(mod->__cam.decrypt_list)
+    const size_t payload_size = ((buffer[1] & 0x0F) << 8) | buffer[2];
+    if(payload_size == ECM_PAYLOAD_SIZE)
+    {
+        // NDS
+        csa_key_t key_0, key_1;
+        memcpy(key_0.a, &buffer[3], CSA_KEY_SIZE);
+        memcpy(key_1.a, &buffer[11], CSA_KEY_SIZE);
+        if(key_0.l == 0)
         {
-            if(asc_list_data(mod->__cam.decrypt_list) == mod->packet->decrypt)
-                break;
+            memcpy(&buffer[3], mod->last_key[0].a, CSA_KEY_SIZE);
+            mod->last_key[1].l = key_1.l;
         }
-        if(asc_list_eol(mod->__cam.decrypt_list))
+        else if(key_1.l == 0)
         {
-            /* the decrypt module was detached */
-            free(mod->packet);
-            mod->packet = module_cam_queue_pop(&mod->__cam);
-            if(mod->packet)
-                asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
-            return;
+            memcpy(&buffer[11], mod->last_key[1].a, CSA_KEY_SIZE);
+            mod->last_key[0].l = key_0.l;
         }
 
-        if(mod->payload_size == ECM_PAYLOAD_SIZE)
-        {
-            // NDS
-            csa_key_t key_0, key_1;
-            memcpy(key_0.a, &buffer[3], CSA_KEY_SIZE);
-            memcpy(key_1.a, &buffer[11], CSA_KEY_SIZE);
-            if(key_0.l == 0)
-            {
-                memcpy(&buffer[3], mod->last_key[0].a, CSA_KEY_SIZE);
-                mod->last_key[1].l = key_1.l;
-            }
-            else if(key_1.l == 0)
-            {
-                memcpy(&buffer[11], mod->last_key[1].a, CSA_KEY_SIZE);
-                mod->last_key[0].l = key_0.l;
-            }
+        memcpy(packet->buffer, buffer, ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE);
+        packet->buffer_size = ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE;
+    }
+    else if(payload_size == 0)
+    {
+        memcpy(packet->buffer, buffer, ECM_HEADER_SIZE);
+        packet->buffer_size = ECM_HEADER_SIZE;
+    }
+    else
+    {
+        packet->buffer[2] = 0x00;
+        packet->buffer[3] = 0x00;
+        packet->buffer_size = ECM_HEADER_SIZE;
+    }
 
-            memcpy(mod->packet->buffer, buffer, ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE);
-            mod->packet->buffer_size = ECM_HEADER_SIZE + ECM_PAYLOAD_SIZE;
-        }
-        else if(mod->payload_size == 0)
+    on_cam_response(packet->decrypt->self, packet->arg, packet->buffer);
+    free(packet);
+}
+
+static void on_newcamd_read_packet(void *arg)
+{
+    newcamd_conn_t *conn = arg;
+    module_data_t *mod = conn->mod;
+
+    if(conn->buffer_skip < 2)
+    {
+        const ssize_t len = asc_socket_recv(  conn->sock
+                                            , &conn->buffer[conn->buffer_skip]
+                                            , 2 - conn->buffer_skip);
+        if(len <= 0)
         {
-            memcpy(mod->packet->buffer, buffer, ECM_HEADER_SIZE);
-            mod->packet->buffer_size = ECM_HEADER_SIZE;
+            asc_log_error(MSG("failed to read header"));
+            newcamd_conn_reconnect(conn, true);
+            return;
         }
-        else
+        conn->buffer_skip += len;
+        if(conn->buffer_skip != 2)
+            return;
+
+        conn->buffer_size = 2 + ((conn->buffer[0] << 8) | conn->buffer[1]);
+        if(conn->buffer_size > NEWCAMD_MSG_SIZE)
         {
-            mod->packet->buffer[2] = 0x00;
-            mod->packet->buffer[3] = 0x00;
-            mod->packet->buffer_size = ECM_HEADER_SIZE;
+            asc_log_error(MSG("wrong message size"));
+            newcamd_conn_reconnect(conn, true);
+            return;
         }
 
-        on_cam_response(mod->packet->decrypt->self, mod->packet->arg, mod->packet->buffer);
-        free(mod->packet);
+        return;
+    }
 
-        mod->packet = module_cam_queue_pop(&mod->__cam);
-        if(mod->packet)
-            asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+    const ssize_t len = asc_socket_recv(  conn->sock
+                                        , &conn->buffer[conn->buffer_skip]
+                                        , conn->buffer_size - conn->buffer_skip);
+    if(len <= 0)
+    {
+        asc_log_error(MSG("failed to read message"));
+        newcamd_conn_reconnect(conn, true);
+        return;
     }
-    else if(mod->status == 1)
+
+    conn->buffer_skip += len;
+    if(conn->buffer_skip != conn->buffer_size)
+        return;
+
+    const size_t message_size = conn->buffer_size;
+    conn->buffer_size = 0;
+    conn->buffer_skip = 0;
+
+    if(!newcamd_decrypt(&conn->triple_des, conn->buffer, message_size))
+    {
+        asc_log_error(MSG("bad message checksum"));
+        newcamd_conn_reconnect(conn, true);
+        return;
+    }
+
+    const uint8_t msg_type = conn->buffer[NEWCAMD_HEADER_SIZE];
+
+    uint8_t *buffer = &conn->buffer[NEWCAMD_HEADER_SIZE];
+
+    if(conn->status == 3)
+    {
+        on_newcamd_response(conn, msg_type);
+    }
+    else if(conn->status == 1)
     {
         if(msg_type != NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_ACK)
         {
             asc_log_error(MSG("login failed [0x%02X]"), msg_type);
-            newcamd_reconnect(mod, true);
+            newcamd_conn_reconnect(conn, true);
             return;
         }
 
-        mod->status = 2;
+        conn->status = 2;
 
         const size_t p_len = 35; /* strlen(mod->config.pass) */
-        triple_des_set_key(mod, (uint8_t *)mod->config.pass, p_len - 1);
+        newcamd_des_set_key(  &conn->triple_des, mod->config.key
+                            , (uint8_t *)mod->config.pass, p_len - 1);
 
+        buffer = &conn->send_buffer[NEWCAMD_HEADER_SIZE];
         buffer[0] = NEWCAMD_MSG_CARD_DATA_REQ;
         buffer[1] = 0;
         buffer[2] = 0;
-        mod->payload_size = 0;
+        conn->payload_size = 0;
+        conn->is_message = true;
 
-        asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+        asc_socket_set_on_ready(conn->sock, on_newcamd_ready);
     }
-    else if(mod->status == 2)
+    else if(conn->status == 2)
     {
         if(msg_type != NEWCAMD_MSG_CARD_DATA)
         {
             asc_log_error(MSG("NEWCAMD_MSG_CARD_DATA"));
-            newcamd_reconnect(mod, true);
+            newcamd_conn_reconnect(conn, true);
             return;
         }
 
-        mod->status = 3;
+        conn->status = 3;
+
+        asc_timer_destroy(conn->timeout);
+        conn->timeout = NULL;
+
+        if(mod->__cam.is_ready)
+        {
+            /* additional connection in the pool */
+            asc_log_info(MSG("connection %d is ready"), conn->id);
+            newcamd_dispatch(mod);
+            return;
+        }
 
         mod->__cam.caid = (buffer[4] << 8) | buffer[5];
         memcpy(mod->__cam.ua, &buffer[6], 8);
@@ -526,33 +710,33 @@ static void on_newcamd_read_packet(void *arg)
                          , hex_to_str(&hex_str[8], &p[3], 8));
         }
 
-        asc_timer_destroy(mod->timeout);
-        mod->timeout = NULL;
-
         module_cam_ready(&mod->__cam);
     }
 }
 
 static void on_newcamd_read_init(void *arg)
 {
-    module_data_t *mod = arg;
+    newcamd_conn_t *conn = arg;
+    module_data_t *mod = conn->mod;
 
-    const ssize_t len = asc_socket_recv(  mod->sock
-                                        , &mod->buffer[mod->buffer_skip]
-                                        , KEY_SIZE - mod->buffer_skip);
+    const ssize_t len = asc_socket_recv(  conn->sock
+                                        , &conn->buffer[conn->buffer_skip]
+                                        , NEWCAMD_KEY_SIZE - conn->buffer_skip);
     if(len <= 0)
     {
         asc_log_error(MSG("failed to read initial response"));
-        newcamd_reconnect(mod, true);
+        newcamd_conn_reconnect(conn, true);
         return;
     }
-    mod->buffer_skip += len;
-    if(mod->buffer_skip != KEY_SIZE)
+    conn->buffer_skip += len;
+    if(conn->buffer_skip != NEWCAMD_KEY_SIZE)
         return;
 
-    triple_des_set_key(mod, mod->buffer, KEY_SIZE);
+    conn->buffer_skip = 0;
+
+    newcamd_des_set_key(&conn->triple_des, mod->config.key, conn->buffer, NEWCAMD_KEY_SIZE);
 
-    uint8_t *buffer = &mod->buffer[NEWCAMD_HEADER_SIZE];
+    uint8_t *buffer = &conn->send_buffer[NEWCAMD_HEADER_SIZE];
 
     buffer[0] = NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN;
     const size_t u_len = strlen(mod->config.user) + 1;
@@ -560,10 +744,11 @@ static void on_newcamd_read_init(void *arg)
     const size_t p_len = 35; /* strlen(mod->config.pass) */
     memcpy(&buffer[3 + u_len], mod->config.pass, p_len);
 
-    mod->payload_size = u_len + p_len;
+    conn->payload_size = u_len + p_len;
+    conn->is_message = true;
 
-    asc_socket_set_on_read(mod->sock, on_newcamd_read_packet);
-    asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+    asc_socket_set_on_read(conn->sock, on_newcamd_read_packet);
+    asc_socket_set_on_ready(conn->sock, on_newcamd_ready);
 }
 
 /*
@@ -577,57 +762,82 @@ static void on_newcamd_read_init(void *arg)
 
 static void on_newcamd_connect(void *arg)
 {
-    module_data_t *mod = arg;
+    newcamd_conn_t *conn = arg;
+    module_data_t *mod = conn->mod;
 
-    mod->status = 1;
+    conn->status = 1;
 
-    asc_timer_destroy(mod->timeout);
-    mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
+    asc_timer_destroy(conn->timeout);
+    conn->timeout = asc_timer_init(mod->config.timeout, on_timeout, conn);
 
-    mod->buffer_skip = 0;
+    conn->buffer_skip = 0;
 
-    asc_socket_set_on_read(mod->sock, on_newcamd_read_init);
+    asc_socket_set_on_read(conn->sock, on_newcamd_read_init);
 }
 
-static void newcamd_connect(module_data_t *mod)
+static void newcamd_conn_connect(newcamd_conn_t *conn)
 {
-    if(mod->sock)
+    module_data_t *mod = conn->mod;
+
+    if(conn->sock)
         return;
 
-    mod->status = 0;
-    mod->payload_size = 0;
-    mod->buffer_skip = 0;
+    conn->status = 0;
+    conn->payload_size = 0;
+    conn->buffer_size = 0;
+    conn->buffer_skip = 0;
+    conn->is_message = false;
 
-    mod->sock = asc_socket_open_tcp4(mod);
-    asc_socket_connect(  mod->sock
+    conn->sock = asc_socket_open_tcp4(conn);
+    asc_socket_connect(  conn->sock
                        , mod->config.host, mod->config.port
                        , on_newcamd_connect, on_newcamd_close);
 
-    mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
+    if(conn->timeout)
+        asc_timer_destroy(conn->timeout);
+    conn->timeout = asc_timer_init(mod->config.timeout, on_timeout, conn);
 }
 
-static void newcamd_disconnect(module_data_t *mod)
+static void newcamd_conn_reconnect(newcamd_conn_t *conn, bool timeout)
 {
-    mod->status = -1;
-    on_newcamd_close(mod);
-}
+    module_data_t *mod = conn->mod;
 
-static void newcamd_reconnect(module_data_t *mod, bool timeout)
-{
-    mod->status = -1;
-    on_newcamd_close(mod);
+    conn->status = -1;
+    on_newcamd_close(conn);
 
     if(timeout)
-        mod->timeout = asc_timer_init(mod->config.timeout, on_timeout, mod);
+        conn->timeout = asc_timer_init(mod->config.timeout, on_timeout, conn);
     else
-        newcamd_connect(mod);
+        newcamd_conn_connect(conn);
+}
+
+static void newcamd_connect(module_data_t *mod)
+{
+    for(int i = 0; i < mod->config.pool; ++i)
+        newcamd_conn_connect(&mod->pool[i]);
+}
+
+static void newcamd_disconnect(module_data_t *mod)
+{
+    for(int i = 0; i < mod->config.pool; ++i)
+    {
+        newcamd_conn_t *conn = &mod->pool[i];
+        conn->status = -1;
+        on_newcamd_close(conn);
+
+        if(conn->timeout)
+        {
+            asc_timer_destroy(conn->timeout);
+            conn->timeout = NULL;
+        }
+    }
 }
 
 void newcamd_send_em(  module_data_t *mod
                      , module_decrypt_t *decrypt, void *arg
                      , const uint8_t *buffer, uint16_t size)
 {
-    if(mod->status != 3)
+    if(!mod->__cam.is_ready)
         return;
 
     const size_t packet_size = NEWCAMD_HEADER_SIZE + size;
@@ -644,34 +854,90 @@ void newcamd_send_em(  module_data_t *mod
     packet->buffer_size = size;
     packet->decrypt = decrypt;
     packet->arg = arg;
+    packet->recv_time = asc_utime();
 
     if(packet->buffer[0] == 0x80 || packet->buffer[0] == 0x81)
     {
         asc_list_for(mod->__cam.packet_queue)
         {
             em_packet_t *queue_item = asc_list_data(mod->__cam.packet_queue);
-            if(   queue_item->decrypt == decrypt
-               && queue_item->arg == arg
-               && (queue_item->buffer[0] == 0x80 || queue_item->buffer[0] == 0x81))
+            if(queue_item->decrypt == decrypt && queue_item->arg == arg)
             {
                 asc_log_warning(  MSG("drop old packet (pnr:%d drop:0x%02X set:0x%02X)")
                                 , decrypt->pnr, queue_item->buffer[0], packet->buffer[0]);
                 asc_list_remove_current(mod->__cam.packet_queue);
                 free(queue_item);
+                ++mod->stat.drop_count;
                 break;
             }
         }
     }
 
-    if(mod->packet)
+    module_cam_queue_push(&mod->__cam, packet);
+    newcamd_dispatch(mod);
+}
+
+/*
+ * oooo     oooo ooooooooooo ooooooooooo ooooo ooooo  ooooooo  ooooooooo    oooooooo8
+ *  8888o   888   888    88  88  888  88  888   888 o888   888o 888    88o 888
+ *  88 888o8 88   888ooo8        888      888ooo888 888     888 888    888  888oooooo
+ *  88  888  88   888    oo      888      888   888 888o   o888 888    888         888
+ * o88o  8  o88o o888ooo8888    o888o    o888o o888o  88ooo88  o888ooo88   o88oooo888
+ *
+ */
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    int ready = 0;
+    int requests = 0;
+    for(int i = 0; i < mod->config.pool; ++i)
     {
-        // newcamd is busy
-        asc_list_insert_tail(mod->__cam.packet_queue, packet);
-        return;
+        if(mod->pool[i].status == 3)
+            ++ready;
+        requests += mod->pool[i].request_count;
     }
 
-    mod->packet = packet;
-    asc_socket_set_on_ready(mod->sock, on_newcamd_ready);
+    lua_pushnumber(lua, ready);
+    lua_setfield(lua, -2, "ready");
+    lua_pushnumber(lua, requests);
+    lua_setfield(lua, -2, "requests");
+    lua_pushnumber(lua, asc_list_size(mod->__cam.packet_queue));
+    lua_setfield(lua, -2, "ecm_queue");
+    lua_pushnumber(lua, asc_list_size(mod->__cam.emm_queue));
+    lua_setfield(lua, -2, "emm_queue");
+
+    lua_pushnumber(lua, mod->stat.ecm_count);
+    lua_setfield(lua, -2, "ecm_count");
+    lua_pushnumber(lua, mod->stat.emm_count);
+    lua_setfield(lua, -2, "emm_count");
+    lua_pushnumber(lua, mod->stat.timeout_count);
+    lua_setfield(lua, -2, "timeout_count");
+    lua_pushnumber(lua, mod->stat.drop_count);
+    lua_setfield(lua, -2, "drop_count");
+
+    lua_pushnumber(lua, mod->__cam.emm.forward);
+    lua_setfield(lua, -2, "emm_forward");
+    lua_pushnumber(lua, mod->__cam.emm.drop);
+    lua_setfield(lua, -2, "emm_drop");
+    lua_pushnumber(lua, mod->__cam.emm.duplicate);
+    lua_setfield(lua, -2, "emm_duplicate");
+    lua_pushnumber(lua, mod->__cam.emm.overflow);
+    lua_setfield(lua, -2, "emm_overflow");
+
+    /* milliseconds */
+    const uint64_t ecm_time_avg = (mod->stat.ecm_count > 0)
+                                ? (mod->stat.ecm_time_total / mod->stat.ecm_count)
+                                : 0;
+    lua_pushnumber(lua, (double)ecm_time_avg / 1000.0);
+    lua_setfield(lua, -2, "ecm_time_avg");
+    lua_pushnumber(lua, (double)mod->stat.ecm_time_max / 1000.0);
+    lua_setfield(lua, -2, "ecm_time_max");
+    lua_pushnumber(lua, (double)mod->stat.ecm_time_last / 1000.0);
+    lua_setfield(lua, -2, "ecm_time_last");
+
+    return 1;
 }
 
 static void module_init(module_data_t *mod)
@@ -705,20 +971,43 @@ static void module_init(module_data_t *mod)
         mod->config.timeout = 8;
     mod->config.timeout *= 1000;
 
+    mod->config.pool = 1;
+    module_option_number("pool", &mod->config.pool);
+    asc_assert(  mod->config.pool > 0 && mod->config.pool <= NEWCAMD_MAX_POOL
+               , MSG("option 'pool' must be in range 1..%d"), NEWCAMD_MAX_POOL);
+
+    mod->config.pipeline = 1;
+    module_option_number("pipeline", &mod->config.pipeline);
+    asc_assert(  mod->config.pipeline > 0 && mod->config.pipeline <= NEWCAMD_MAX_PIPELINE
+               , MSG("option 'pipeline' must be in range 1..%d"), NEWCAMD_MAX_PIPELINE);
+
+    mod->pool = calloc(mod->config.pool, sizeof(newcamd_conn_t));
+    for(int i = 0; i < mod->config.pool; ++i)
+    {
+        mod->pool[i].mod = mod;
+        mod->pool[i].id = i;
+    }
+
     module_cam_init(mod, newcamd_connect, newcamd_disconnect, newcamd_send_em);
+
+    int emm_ttl = EMM_CACHE_TTL;
+    module_option_number("emm_ttl", &emm_ttl);
+    mod->__cam.emm.ttl = (uint64_t)emm_ttl * 1000000;
 }
 
 static void module_destroy(module_data_t *mod)
 {
-    mod->status = -1;
-    on_newcamd_close(mod);
+    newcamd_disconnect(mod);
 
     module_cam_destroy(mod);
+
+    free(mod->pool);
 }
 
 MODULE_CAM_METHODS()
 MODULE_LUA_METHODS()
 {
-    MODULE_CAM_METHODS_REF()
+    MODULE_CAM_METHODS_REF(),
+    { "status", method_status },
 };
 MODULE_LUA_REGISTER(newcamd)
@@ -0,0 +1,62 @@
+/*
+ * Astra Module: SoftCAM. Newcamd Protocol
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NEWCAMD_H_
+#define _NEWCAMD_H_ 1
+
+#include "../module_cam.h"
+
+#include <openssl/des.h>
+
+#define NEWCAMD_HEADER_SIZE 12
+#define NEWCAMD_MSG_SIZE (NEWCAMD_HEADER_SIZE + EM_MAX_SIZE)
+#define NEWCAMD_KEY_SIZE 14
+
+typedef enum {
+    NEWCAMD_MSG_ERROR = 0,
+    NEWCAMD_MSG_FIRST = 0xDF,
+    NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN,
+    NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_ACK,
+    NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_NAK,
+    NEWCAMD_MSG_CARD_DATA_REQ,
+    NEWCAMD_MSG_CARD_DATA,
+    NEWCAMD_MSG_KEEPALIVE = 0xFD,
+} newcamd_cmd_t;
+
+typedef struct
+{
+    uint8_t key[16];
+    DES_key_schedule ks1;
+    DES_key_schedule ks2;
+} newcamd_des_t;
+
+/* des_key - 14 bytes of the config key. key - session key or password */
+void newcamd_des_set_key(  newcamd_des_t *des, const uint8_t *des_key
+                         , const uint8_t *key, size_t key_size);
+
+/* message - header and payload (payload_size bytes after the 3 bytes of command and size).
+ * Sets payload size, pads, encrypts and returns size of the message. 0 on error */
+size_t newcamd_encrypt(newcamd_des_t *des, uint8_t *message, size_t payload_size);
+
+/* message_size - size of the received message with the 2 bytes of length.
+ * Returns false if checksum is wrong */
+bool newcamd_decrypt(newcamd_des_t *des, uint8_t *message, size_t message_size);
+
+#endif /* _NEWCAMD_H_ */
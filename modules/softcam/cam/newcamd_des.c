@@ -0,0 +1,121 @@
+/*
+ * Astra Module: SoftCAM. Newcamd Protocol
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "newcamd.h"
+
+void newcamd_des_set_key(  newcamd_des_t *des, const uint8_t *des_key
+                         , const uint8_t *key, size_t key_size)
+{
+    uint8_t tmp_key[14];
+    memcpy(tmp_key, des_key, sizeof(tmp_key));
+
+    // set key
+    for(size_t i = 0; i < key_size; ++i)
+        tmp_key[i % sizeof(tmp_key)] ^= key[i];
+
+    uint8_t *triple_des_key = des->key;
+    triple_des_key[0] = tmp_key[0] & 0xfe;
+    triple_des_key[1] = ((tmp_key[0] << 7) | (tmp_key[1] >> 1)) & 0xfe;
+    triple_des_key[2] = ((tmp_key[1] << 6) | (tmp_key[2] >> 2)) & 0xfe;
+    triple_des_key[3] = ((tmp_key[2] << 5) | (tmp_key[3] >> 3)) & 0xfe;
+    triple_des_key[4] = ((tmp_key[3] << 4) | (tmp_key[4] >> 4)) & 0xfe;
+    triple_des_key[5] = ((tmp_key[4] << 3) | (tmp_key[5] >> 5)) & 0xfe;
+    triple_des_key[6] = ((tmp_key[5] << 2) | (tmp_key[6] >> 6)) & 0xfe;
+    triple_des_key[7] = tmp_key[6] << 1;
+    triple_des_key[8] = tmp_key[7] & 0xfe;
+    triple_des_key[9] = ((tmp_key[7] << 7) | (tmp_key[8] >> 1)) & 0xfe;
+    triple_des_key[10] = ((tmp_key[8] << 6) | (tmp_key[9] >> 2)) & 0xfe;
+    triple_des_key[11] = ((tmp_key[9] << 5) | (tmp_key[10] >> 3)) & 0xfe;
+    triple_des_key[12] = ((tmp_key[10] << 4) | (tmp_key[11] >> 4)) & 0xfe;
+    triple_des_key[13] = ((tmp_key[11] << 3) | (tmp_key[12] >> 5)) & 0xfe;
+    triple_des_key[14] = ((tmp_key[12] << 2) | (tmp_key[13] >> 6)) & 0xfe;
+    triple_des_key[15] = tmp_key[13] << 1;
+
+    DES_set_odd_parity((DES_cblock *)&triple_des_key[0]);
+    DES_set_odd_parity((DES_cblock *)&triple_des_key[8]);
+    DES_key_sched((DES_cblock *)&triple_des_key[0], &des->ks1);
+    DES_key_sched((DES_cblock *)&triple_des_key[8], &des->ks2);
+} /* newcamd_des_set_key */
+
+static uint8_t xor_sum(const uint8_t *mem, int len)
+{
+    uint8_t cs = 0;
+    while(len > 0)
+    {
+        cs ^= *mem++;
+        len--;
+    }
+    return cs;
+}
+
+size_t newcamd_encrypt(newcamd_des_t *des, uint8_t *message, size_t payload_size)
+{
+    uint8_t *buffer = &message[NEWCAMD_HEADER_SIZE];
+    buffer[1] = (payload_size >> 8) & 0x0F;
+    buffer[2] = (payload_size     ) & 0xFF;
+
+    size_t packet_size = NEWCAMD_HEADER_SIZE + 3 + payload_size;
+    const uint8_t no_pad_bytes = (8 - ((packet_size - 1) % 8)) % 8;
+
+    if((packet_size + no_pad_bytes + 1) >= (NEWCAMD_MSG_SIZE - 8))
+        return 0;
+
+    DES_cblock pad_bytes;
+    DES_random_key((DES_cblock *)pad_bytes);
+    memcpy(&message[packet_size], pad_bytes, no_pad_bytes);
+    packet_size += no_pad_bytes;
+    message[packet_size] = xor_sum(&message[2], packet_size - 2);
+    ++packet_size;
+
+    // encrypt
+    DES_cblock ivec;
+    DES_random_key((DES_cblock *)ivec);
+    if(packet_size + sizeof(ivec) >= NEWCAMD_MSG_SIZE)
+        return 0;
+
+    memcpy(&message[packet_size], ivec, sizeof(ivec));
+    DES_ede2_cbc_encrypt(  &message[2], &message[2], packet_size - 2
+                         , &des->ks1, &des->ks2
+                         , (DES_cblock *)ivec, DES_ENCRYPT);
+    packet_size += sizeof(ivec);
+
+    message[0] = ((packet_size - 2) >> 8) & 0xFF;
+    message[1] = ((packet_size - 2)     ) & 0xFF;
+
+    return packet_size;
+}
+
+bool newcamd_decrypt(newcamd_des_t *des, uint8_t *message, size_t message_size)
+{
+    size_t packet_size = message_size - 2;
+
+    if(   (packet_size % 8 == 0)
+       && (packet_size > NEWCAMD_HEADER_SIZE + 3))
+    {
+        DES_cblock ivec;
+        packet_size -= sizeof(ivec);
+        memcpy(ivec, &message[packet_size + 2], sizeof(ivec));
+        DES_ede2_cbc_encrypt(  &message[2], &message[2], packet_size
+                             , &des->ks1, &des->ks2
+                             , (DES_cblock *)ivec, DES_DECRYPT);
+    }
+
+    return (xor_sum(&message[2], packet_size) == 0);
+}
@@ -154,6 +154,7 @@ static bool cas_check_em(module_data_t *mod, mpegts_psi_t *em)
             memcpy(&emm[size], &mod->shared.data[3], s_data_size);
             size += s_data_size;
 
+            mpegts_psi_reserve(em, size + 7);
             em->buffer[2] = size + 4;
             sort_nanos(&em->buffer[7], emm, size);
             em->buffer_size = PSI_BUFFER_GET_SIZE(em->buffer);
@@ -530,6 +530,7 @@ static void on_pmt(void *arg, mpegts_psi_t *psi)
     bool is_ecm_selected;
 
     uint16_t skip = 12;
+    mpegts_psi_reserve(mod->pmt, psi->buffer_size);
     memcpy(mod->pmt->buffer, psi->buffer, 10);
 
     is_ecm_selected = false;
@@ -663,6 +664,12 @@ static void on_em(void *arg, mpegts_psi_t *psi)
             return;
 
         if(!module_cas_check_em(mod->__decrypt.cas, psi))
+        {
+            ++mod->__decrypt.cam->emm.drop;
+            return;
+        }
+
+        if(!module_cam_emm_check(mod->__decrypt.cam, psi->buffer, psi->buffer_size))
             return;
     }
     else
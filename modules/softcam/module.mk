@@ -23,6 +23,13 @@ SOURCES_CAS="cas/bulcrypt.c cas/conax.c cas/cryptoworks.c cas/dgcrypt.c cas/dre.
 
 MODULES="decrypt"
 
+# Simulator, only with ./configure.sh --with-simulators
+SOURCES_SIM=""
+if [ $ARG_SIMULATORS -eq 1 ] ; then
+    SOURCES_SIM="sim/csa_check.c sim/csa_generator.c"
+    MODULES="$MODULES csa_check csa_generator"
+fi
+
 libssl_test_c()
 {
     cat <<EOF
@@ -49,18 +56,28 @@ check_libssl()
     return 0
 }
 
+check_libssl_sim()
+{
+    if [ $ARG_SIMULATORS -eq 1 ] ; then
+        SOURCES_SIM="$SOURCES_SIM sim/newcamd_server.c"
+        MODULES="$MODULES newcamd_server"
+    fi
+}
+
 check_libssl_all()
 {
     if check_libssl ; then
-        SOURCES_CAM="$SOURCES_CAM cam/newcamd.c"
+        SOURCES_CAM="$SOURCES_CAM cam/newcamd_des.c cam/newcamd.c"
         MODULES="$MODULES newcamd"
+        check_libssl_sim
         return 0
     fi
 
     if check_libssl "-lcrypto" ; then
         LDFLAGS="-lcrypto"
-        SOURCES_CAM="$SOURCES_CAM cam/newcamd.c"
+        SOURCES_CAM="$SOURCES_CAM cam/newcamd_des.c cam/newcamd.c"
         MODULES="$MODULES newcamd"
+        check_libssl_sim
         return 0
     fi
 
@@ -70,7 +87,7 @@ check_libssl_all()
 
 check_libssl_all
 
-SOURCES="$SOURCES_CSA $SOURCES_CAM $SOURCES_CAS decrypt.c"
+SOURCES="$SOURCES_CSA $SOURCES_CAM $SOURCES_CAS $SOURCES_SIM decrypt.c"
 
 # SSE2
 
@@ -25,6 +25,10 @@
 
 #define EM_MAX_SIZE 1024
 
+#define EMM_CACHE_SIZE 1024     /* must be power of 2 */
+#define EMM_CACHE_TTL 10        /* seconds */
+#define EMM_QUEUE_LIMIT 256
+
 typedef struct module_decrypt_t module_decrypt_t;
 typedef struct module_cam_t module_cam_t;
 typedef struct module_cas_t module_cas_t;
@@ -47,6 +51,8 @@ struct em_packet_t
 
     module_decrypt_t *decrypt;
     void *arg;
+
+    uint64_t recv_time;
 };
 
 /*
@@ -70,7 +76,20 @@ struct module_cam_t
 
     asc_list_t *prov_list;
     asc_list_t *decrypt_list;
-    asc_list_t *packet_queue;
+    asc_list_t *packet_queue; /* ECM */
+    asc_list_t *emm_queue;
+
+    struct
+    {
+        uint64_t ttl;           /* microseconds. 0 - do not drop repeated EMM */
+        uint32_t *cache_hash;
+        uint64_t *cache_time;
+
+        uint64_t forward;
+        uint64_t drop;          /* addressed to other cards */
+        uint64_t duplicate;     /* repeated in the TTL */
+        uint64_t overflow;      /* queue is full */
+    } emm;
 
     void (*connect)(module_data_t *mod);
     void (*disconnect)(module_data_t *mod);
@@ -87,15 +106,23 @@ void module_cam_detach_decrypt(module_cam_t *cam, module_decrypt_t *decrypt);
 void module_cam_ready(module_cam_t *cam);
 void module_cam_reset(module_cam_t *cam);
 
+void module_cam_queue_push(module_cam_t *cam, em_packet_t *packet);
 em_packet_t * module_cam_queue_pop(module_cam_t *cam);
+size_t module_cam_queue_size(module_cam_t *cam);
 void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt);
 
+bool module_cam_emm_check(module_cam_t *cam, const uint8_t *buffer, size_t size);
+
 #define module_cam_init(_mod, _connect, _disconnect, _send_em)                                  \
     {                                                                                           \
         _mod->__cam.self = _mod;                                                                \
         _mod->__cam.decrypt_list = asc_list_init();                                             \
         _mod->__cam.prov_list = asc_list_init();                                                \
         _mod->__cam.packet_queue = asc_list_init();                                             \
+        _mod->__cam.emm_queue = asc_list_init();                                                \
+        _mod->__cam.emm.ttl = EMM_CACHE_TTL * 1000000;                                          \
+        _mod->__cam.emm.cache_hash = calloc(EMM_CACHE_SIZE, sizeof(uint32_t));                  \
+        _mod->__cam.emm.cache_time = calloc(EMM_CACHE_SIZE, sizeof(uint64_t));                  \
         _mod->__cam.connect = _connect;                                                         \
         _mod->__cam.disconnect = _disconnect;                                                   \
         _mod->__cam.send_em = _send_em;                                                         \
@@ -113,6 +140,9 @@ void module_cam_queue_flush(module_cam_t *cam, module_decrypt_t *decrypt);
         asc_list_destroy(_mod->__cam.decrypt_list);                                             \
         asc_list_destroy(_mod->__cam.prov_list);                                                \
         asc_list_destroy(_mod->__cam.packet_queue);                                             \
+        asc_list_destroy(_mod->__cam.emm_queue);                                                \
+        free(_mod->__cam.emm.cache_hash);                                                       \
+        free(_mod->__cam.emm.cache_time);                                                       \
     }
 
 #define MODULE_CAM_METHODS()                                                                    \
@@ -0,0 +1,148 @@
+/*
+ * Astra Module: SoftCAM. CSA Stream Checker
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      csa_check
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      pid         - number, PID to check. default: 257
+ *
+ * Module Methods:
+ *      status()    - return table with the counters
+ *
+ * Checks the payload pattern of the csa_generator after descrambling.
+ */
+
+#include <astra.h>
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *name;
+        int pid;
+    } config;
+
+    uint64_t packets;
+    uint64_t ok;
+    uint64_t error;
+    uint64_t scrambled;
+
+    uint64_t error_time;    /* last error */
+
+    uint64_t status_time;   /* last status() call */
+    uint64_t status_packets;
+};
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(TS_GET_PID(ts) != mod->config.pid)
+        return;
+
+    ++mod->packets;
+
+    if(TS_IS_SCRAMBLED(ts))
+    {
+        ++mod->scrambled;
+        return;
+    }
+
+    const uint8_t *payload = &ts[TS_HEADER_SIZE];
+    const uint32_t count = (payload[0] << 24) | (payload[1] << 16)
+                         | (payload[2] << 8) | payload[3];
+
+    for(int i = 4; i < TS_BODY_SIZE; ++i)
+    {
+        if(payload[i] != ((count + i) & 0xFF))
+        {
+            ++mod->error;
+            mod->error_time = asc_utime();
+            return;
+        }
+    }
+
+    ++mod->ok;
+}
+
+static int method_status(module_data_t *mod)
+{
+    const uint64_t current_time = asc_utime();
+
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, mod->packets);
+    lua_setfield(lua, -2, "packets");
+    lua_pushnumber(lua, mod->ok);
+    lua_setfield(lua, -2, "ok");
+    lua_pushnumber(lua, mod->error);
+    lua_setfield(lua, -2, "error");
+    lua_pushnumber(lua, mod->scrambled);
+    lua_setfield(lua, -2, "scrambled");
+
+    /* seconds since the last error. -1 if no errors */
+    const double error_time = (mod->error_time)
+                            ? (double)(current_time - mod->error_time) / 1000000.0
+                            : -1.0;
+    lua_pushnumber(lua, error_time);
+    lua_setfield(lua, -2, "error_time");
+
+    /* kbit/s since the last call */
+    double bitrate = 0.0;
+    if(mod->status_time && current_time > mod->status_time)
+    {
+        bitrate = (double)((mod->packets - mod->status_packets) * TS_PACKET_SIZE * 8)
+                * 1000.0 / (double)(current_time - mod->status_time);
+    }
+    lua_pushnumber(lua, bitrate);
+    lua_setfield(lua, -2, "bitrate");
+
+    mod->status_time = current_time;
+    mod->status_packets = mod->packets;
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, on_ts);
+
+    module_option_string("name", &mod->config.name, NULL);
+    asc_assert(mod->config.name != NULL, "[csa_check] option 'name' is required");
+
+    mod->config.pid = 257;
+    module_option_number("pid", &mod->config.pid);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
+};
+MODULE_LUA_REGISTER(csa_check)
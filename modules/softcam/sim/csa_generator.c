@@ -0,0 +1,307 @@
+/*
+ * Astra Module: SoftCAM. CSA Stream Generator
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      csa_generator
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      pnr         - number, program number. default: 1
+ *      pmt_pid     - number, default: 256
+ *      pid         - number, scrambled PID. default: 257
+ *      ecm_pid     - number, default: 258
+ *      caid        - number, CAID in the CA descriptor. default: 0x4AB0
+ *      bitrate     - number, bitrate of the scrambled PID in kbit/s. default: 4000
+ *      period      - number, crypto period in seconds. default: 10
+ *
+ * Module Methods:
+ *      status()    - return table with the counters
+ *
+ * Generates a program with one PID scrambled with the control words
+ * from sim_ecm_keys(). Payload of the each packet is a counter pattern
+ * checked by the csa_check module after descrambling.
+ */
+
+#include <astra.h>
+#include "sim.h"
+
+#ifndef FFDECSA
+#   define FFDECSA 1
+#endif
+
+#ifndef LIBDVBCSA
+#   define LIBDVBCSA 0
+#endif
+
+#if FFDECSA == 1
+#   include "../FFdecsa/FFdecsa.h"
+#elif LIBDVBCSA == 1
+#   include <dvbcsa/dvbcsa.h>
+#else
+#   error "DVB-CSA is not defined"
+#endif
+
+#define MSG(_msg) "[csa_generator %s] " _msg, mod->config.name
+
+#define TIMER_INTERVAL 10   /* ms */
+#define PSI_INTERVAL 100    /* ms */
+#define MAX_BURST 20000     /* packets in the one timer tick */
+#define BATCH_SIZE 256      /* packets encrypted at once */
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    struct
+    {
+        const char *name;
+        int pnr;
+        int pmt_pid;
+        int pid;
+        int ecm_pid;
+        int caid;
+        int bitrate;
+        int period;
+    } config;
+
+    mpegts_psi_t *pat;
+    mpegts_psi_t *pmt;
+    mpegts_psi_t *ecm;
+    mpegts_carousel_t *carousel;
+
+    asc_timer_t *timer;
+
+    uint64_t start_time;
+
+    uint32_t period;
+#if FFDECSA == 1
+    void *keys;
+#elif LIBDVBCSA == 1
+    struct dvbcsa_key_s *key[2]; /* even, odd */
+#endif
+
+    uint64_t packet_count;
+    uint8_t cc;
+
+    uint8_t *batch;
+    int batch_count;
+};
+
+static void set_period(module_data_t *mod, uint32_t period)
+{
+    mod->period = period;
+
+    uint8_t keys[16];
+    sim_ecm_keys(mod->config.pnr, period, keys);
+#if FFDECSA == 1
+    set_control_words(mod->keys, &keys[0], &keys[8]);
+#elif LIBDVBCSA == 1
+    dvbcsa_key_set(&keys[0], mod->key[0]);
+    dvbcsa_key_set(&keys[8], mod->key[1]);
+#endif
+
+    uint8_t *buffer = mod->ecm->buffer;
+    buffer[0] = 0x80 | (period & 1);
+    buffer[1] = 0x70;
+    buffer[2] = SIM_ECM_SIZE - 3;
+    buffer[3] = mod->config.pnr >> 8;
+    buffer[4] = mod->config.pnr & 0xFF;
+    buffer[5] = period >> 24;
+    buffer[6] = (period >> 16) & 0xFF;
+    buffer[7] = (period >> 8) & 0xFF;
+    buffer[8] = period & 0xFF;
+    mod->ecm->buffer_size = SIM_ECM_SIZE;
+
+    mpegts_carousel_set(mod->carousel, mod->ecm, PSI_INTERVAL);
+}
+
+static void send_batch(module_data_t *mod)
+{
+    if(mod->batch_count == 0)
+        return;
+
+    const size_t size = mod->batch_count * TS_PACKET_SIZE;
+
+#if FFDECSA == 1
+    uint8_t *cluster[3] = { mod->batch, &mod->batch[size], NULL };
+    int i = 0;
+    while(i < mod->batch_count)
+        i += encrypt_packets(mod->keys, cluster);
+#elif LIBDVBCSA == 1
+    for(size_t skip = 0; skip < size; skip += TS_PACKET_SIZE)
+    {
+        dvbcsa_encrypt(  mod->key[mod->period & 1]
+                       , &mod->batch[skip + TS_HEADER_SIZE], TS_BODY_SIZE);
+    }
+#endif
+
+    for(size_t skip = 0; skip < size; skip += TS_PACKET_SIZE)
+        module_stream_send(mod, &mod->batch[skip]);
+
+    mod->batch_count = 0;
+}
+
+static void send_packet(module_data_t *mod)
+{
+    uint8_t *ts = &mod->batch[mod->batch_count * TS_PACKET_SIZE];
+    const uint32_t count = mod->packet_count & 0xFFFFFFFF;
+
+    ts[0] = 0x47;
+    ts[1] = mod->config.pid >> 8;
+    ts[2] = mod->config.pid & 0xFF;
+    ts[3] = ((mod->period & 1) ? 0xC0 : 0x80) | 0x10 | mod->cc;
+    mod->cc = (mod->cc + 1) & 0x0F;
+
+    uint8_t *payload = &ts[TS_HEADER_SIZE];
+    payload[0] = count >> 24;
+    payload[1] = (count >> 16) & 0xFF;
+    payload[2] = (count >> 8) & 0xFF;
+    payload[3] = count & 0xFF;
+    for(int i = 4; i < TS_BODY_SIZE; ++i)
+        payload[i] = (count + i) & 0xFF;
+
+    ++mod->packet_count;
+    ++mod->batch_count;
+    if(mod->batch_count == BATCH_SIZE)
+        send_batch(mod);
+}
+
+static void on_timer(void *arg)
+{
+    module_data_t *mod = arg;
+
+    const uint64_t current_time = asc_utime();
+    const uint64_t elapsed = current_time - mod->start_time;
+
+    const uint32_t period = elapsed / ((uint64_t)mod->config.period * 1000000);
+    if(period != mod->period)
+        set_period(mod, period);
+
+    /* kbit/s to packets */
+    const uint64_t packet_count = elapsed * mod->config.bitrate / (TS_PACKET_SIZE * 8 * 1000);
+    for(int i = 0; mod->packet_count < packet_count && i < MAX_BURST; ++i)
+        send_packet(mod);
+    send_batch(mod);
+}
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, mod->packet_count);
+    lua_setfield(lua, -2, "packets");
+    lua_pushnumber(lua, mod->period);
+    lua_setfield(lua, -2, "period");
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, NULL);
+
+    module_option_string("name", &mod->config.name, NULL);
+    asc_assert(mod->config.name != NULL, "[csa_generator] option 'name' is required");
+
+    mod->config.pnr = 1;
+    module_option_number("pnr", &mod->config.pnr);
+    mod->config.pmt_pid = 256;
+    module_option_number("pmt_pid", &mod->config.pmt_pid);
+    mod->config.pid = 257;
+    module_option_number("pid", &mod->config.pid);
+    mod->config.ecm_pid = 258;
+    module_option_number("ecm_pid", &mod->config.ecm_pid);
+    mod->config.caid = SIM_CAID;
+    module_option_number("caid", &mod->config.caid);
+    mod->config.bitrate = 4000;
+    module_option_number("bitrate", &mod->config.bitrate);
+    mod->config.period = 10;
+    module_option_number("period", &mod->config.period);
+    asc_assert(mod->config.period > 0, MSG("option 'period' must be greater than 0"));
+
+    mod->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    PAT_INIT(mod->pat, 1, 0);
+    PAT_ITEMS_APPEND(mod->pat, mod->config.pnr, mod->config.pmt_pid);
+    PSI_SET_CRC32(mod->pat);
+
+    mod->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, mod->config.pmt_pid);
+    PMT_INIT(mod->pmt, mod->config.pnr, 0, mod->config.pid, NULL, 0);
+    /* CA descriptor */
+    uint8_t *desc = PMT_DESC_FIRST(mod->pmt);
+    desc[0] = 0x09;
+    desc[1] = 4;
+    desc[2] = mod->config.caid >> 8;
+    desc[3] = mod->config.caid & 0xFF;
+    desc[4] = 0xE0 | ((mod->config.ecm_pid >> 8) & 0x1F);
+    desc[5] = mod->config.ecm_pid & 0xFF;
+    mod->pmt->buffer[11] = 6;
+    mod->pmt->buffer_size += 6;
+    PMT_ITEMS_APPEND(mod->pmt, 0x06, mod->config.pid, NULL, 0);
+    PSI_SET_CRC32(mod->pmt);
+
+    mod->ecm = mpegts_psi_init(MPEGTS_PACKET_ECM, mod->config.ecm_pid);
+
+    mod->carousel = mpegts_carousel_init((ts_callback_t)__module_stream_send, &mod->__stream);
+    mpegts_carousel_set(mod->carousel, mod->pat, PSI_INTERVAL);
+    mpegts_carousel_set(mod->carousel, mod->pmt, PSI_INTERVAL);
+
+    mod->batch = malloc(BATCH_SIZE * TS_PACKET_SIZE);
+
+#if FFDECSA == 1
+    mod->keys = get_key_struct();
+#elif LIBDVBCSA == 1
+    mod->key[0] = dvbcsa_key_alloc();
+    mod->key[1] = dvbcsa_key_alloc();
+#endif
+    set_period(mod, 0);
+
+    mod->start_time = asc_utime();
+    mod->timer = asc_timer_init(TIMER_INTERVAL, on_timer, mod);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    asc_timer_destroy(mod->timer);
+    mpegts_carousel_destroy(mod->carousel);
+
+#if FFDECSA == 1
+    free_key_struct(mod->keys);
+#elif LIBDVBCSA == 1
+    dvbcsa_key_free(mod->key[0]);
+    dvbcsa_key_free(mod->key[1]);
+#endif
+
+    mpegts_psi_destroy(mod->pat);
+    mpegts_psi_destroy(mod->pmt);
+    mpegts_psi_destroy(mod->ecm);
+
+    free(mod->batch);
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "status", method_status },
+};
+MODULE_LUA_REGISTER(csa_generator)
@@ -0,0 +1,481 @@
+/*
+ * Astra Module: SoftCAM. Newcamd Server Simulator
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      newcamd_server
+ *
+ * Module Options:
+ *      name        - string, instance name
+ *      addr        - string, local address. default: 127.0.0.1
+ *      port        - number, local port
+ *      user        - string, login
+ *      pass        - string, password
+ *      key         - string, DES key, 28 chars length
+ *      caid        - number, CAID of the card. default: 0x4AB0
+ *      delay       - number, response delay in milliseconds. default: 0
+ *      jitter      - number, random addition to the delay in milliseconds. default: 0
+ *      error       - number, percent of the ECM answered with error. default: 0
+ *      seed        - number, seed for the jitter and the errors. default: 1
+ *
+ * Module Methods:
+ *      status()    - return table with the counters
+ *
+ * Answers ECM generated by the csa_generator with the control words
+ * from sim_ecm_keys(). For load testing of the decrypt and the newcamd.
+ */
+
+#include <astra.h>
+#include "../cam/newcamd.h"
+#include "sim.h"
+
+#define MSG(_msg) "[newcamd_server %s] " _msg, mod->config.name
+
+typedef struct
+{
+    module_data_t *mod;
+    asc_socket_t *sock;
+
+    int status; // 0 - login, 1 - card data, 2 - ready
+
+    newcamd_des_t triple_des;
+
+    asc_list_t *response_list;
+
+    uint8_t buffer[NEWCAMD_MSG_SIZE];
+    size_t buffer_size;
+    size_t buffer_skip;
+
+    uint8_t send_buffer[NEWCAMD_MSG_SIZE];
+} client_t;
+
+typedef struct
+{
+    client_t *client;
+    asc_timer_t *timer;
+
+    uint8_t header[NEWCAMD_HEADER_SIZE];
+    uint8_t em_type;
+    uint16_t pnr;
+    uint32_t period;
+    bool is_error;
+} response_t;
+
+struct module_data_t
+{
+    struct
+    {
+        const char *name;
+
+        const char *addr;
+        int port;
+
+        const char *user;
+        char pass[36];
+
+        uint8_t key[NEWCAMD_KEY_SIZE];
+
+        int caid;
+        int delay;
+        int jitter;
+        int error;
+    } config;
+
+    uint32_t seed;
+
+    asc_socket_t *sock;
+    asc_list_t *client_list;
+
+    struct
+    {
+        uint64_t ecm_count;
+        uint64_t error_count;
+        uint64_t client_count;
+    } stat;
+};
+
+static uint32_t sim_random(module_data_t *mod)
+{
+    mod->seed = mod->seed * 1103515245 + 12345;
+    return (mod->seed >> 16) & 0x7FFF;
+}
+
+/*
+ *   oooooooo8 ooooo       ooooo ooooooooooo oooo   oooo ooooooooooo
+ * o888     88  888         888   888    88   8888o  88  88  888  88
+ * 888          888         888   888ooo8     88 888o88      888
+ * 888o     oo  888      o  888   888    oo   88   8888      888
+ *  888oooo88  o888ooooo88 o888o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static void on_client_close(void *arg)
+{
+    client_t *client = arg;
+    module_data_t *mod = client->mod;
+
+    if(!client->sock)
+        return;
+
+    asc_socket_close(client->sock);
+    client->sock = NULL;
+
+    for(  asc_list_first(client->response_list)
+        ; !asc_list_eol(client->response_list)
+        ; asc_list_first(client->response_list))
+    {
+        response_t *response = asc_list_data(client->response_list);
+        asc_timer_destroy(response->timer);
+        free(response);
+        asc_list_remove_current(client->response_list);
+    }
+    asc_list_destroy(client->response_list);
+
+    asc_list_remove_item(mod->client_list, client);
+    free(client);
+}
+
+static bool client_send(client_t *client, const uint8_t *header, size_t payload_size)
+{
+    module_data_t *mod = client->mod;
+
+    memcpy(client->send_buffer, header, NEWCAMD_HEADER_SIZE);
+
+    const size_t size = newcamd_encrypt(&client->triple_des, client->send_buffer, payload_size);
+    if(!size || asc_socket_send(client->sock, client->send_buffer, size) != (ssize_t)size)
+    {
+        asc_log_error(MSG("failed to send message"));
+        on_client_close(client);
+        return false;
+    }
+
+    return true;
+}
+
+static void on_response_timer(void *arg)
+{
+    response_t *response = arg;
+    client_t *client = response->client;
+
+    asc_timer_destroy(response->timer);
+    asc_list_remove_item(client->response_list, response);
+
+    uint8_t *buffer = &client->send_buffer[NEWCAMD_HEADER_SIZE];
+    buffer[0] = response->em_type;
+
+    size_t payload_size = 0;
+    if(!response->is_error)
+    {
+        sim_ecm_keys(response->pnr, response->period, &buffer[3]);
+        payload_size = 16;
+    }
+
+    client_send(client, response->header, payload_size);
+    free(response);
+}
+
+static void on_client_ecm(client_t *client)
+{
+    module_data_t *mod = client->mod;
+    const uint8_t *buffer = &client->buffer[NEWCAMD_HEADER_SIZE];
+
+    const size_t size = ((buffer[1] & 0x0F) << 8) | buffer[2];
+    if(size + 3 < SIM_ECM_SIZE)
+    {
+        asc_log_warning(MSG("wrong ECM size %d"), (int)size);
+        return;
+    }
+
+    ++mod->stat.ecm_count;
+
+    response_t *response = malloc(sizeof(response_t));
+    response->client = client;
+    memcpy(response->header, client->buffer, NEWCAMD_HEADER_SIZE);
+    response->em_type = buffer[0];
+    response->pnr = (buffer[3] << 8) | buffer[4];
+    response->period = (buffer[5] << 24) | (buffer[6] << 16) | (buffer[7] << 8) | buffer[8];
+    response->is_error = (mod->config.error > 0
+                          && (int)(sim_random(mod) % 100) < mod->config.error);
+    if(response->is_error)
+        ++mod->stat.error_count;
+
+    int delay = mod->config.delay;
+    if(mod->config.jitter > 0)
+        delay += sim_random(mod) % (mod->config.jitter + 1);
+
+    asc_list_insert_tail(client->response_list, response);
+    response->timer = asc_timer_init(delay, on_response_timer, response);
+}
+
+static void on_client_read(void *arg)
+{
+    client_t *client = arg;
+    module_data_t *mod = client->mod;
+
+    if(client->buffer_skip < 2)
+    {
+        const ssize_t len = asc_socket_recv(  client->sock
+                                            , &client->buffer[client->buffer_skip]
+                                            , 2 - client->buffer_skip);
+        if(len <= 0)
+        {
+            on_client_close(client);
+            return;
+        }
+        client->buffer_skip += len;
+        if(client->buffer_skip != 2)
+            return;
+
+        client->buffer_size = 2 + ((client->buffer[0] << 8) | client->buffer[1]);
+        if(client->buffer_size > NEWCAMD_MSG_SIZE)
+        {
+            asc_log_error(MSG("wrong message size"));
+            on_client_close(client);
+        }
+        return;
+    }
+
+    const ssize_t len = asc_socket_recv(  client->sock
+                                        , &client->buffer[client->buffer_skip]
+                                        , client->buffer_size - client->buffer_skip);
+    if(len <= 0)
+    {
+        on_client_close(client);
+        return;
+    }
+    client->buffer_skip += len;
+    if(client->buffer_skip != client->buffer_size)
+        return;
+
+    const size_t message_size = client->buffer_size;
+    client->buffer_size = 0;
+    client->buffer_skip = 0;
+
+    if(!newcamd_decrypt(&client->triple_des, client->buffer, message_size))
+    {
+        asc_log_error(MSG("bad message checksum"));
+        on_client_close(client);
+        return;
+    }
+
+    const uint8_t *buffer = &client->buffer[NEWCAMD_HEADER_SIZE];
+    const uint8_t msg_type = buffer[0];
+
+    uint8_t header[NEWCAMD_HEADER_SIZE];
+    memcpy(header, client->buffer, NEWCAMD_HEADER_SIZE);
+
+    uint8_t *response = &client->send_buffer[NEWCAMD_HEADER_SIZE];
+
+    if(client->status == 2)
+    {
+        if(msg_type == 0x80 || msg_type == 0x81)
+            on_client_ecm(client);
+        else if(msg_type == NEWCAMD_MSG_KEEPALIVE)
+        {
+            response[0] = NEWCAMD_MSG_KEEPALIVE;
+            client_send(client, header, 0);
+        }
+        /* EMM is ignored */
+    }
+    else if(client->status == 0)
+    {
+        if(msg_type != NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN)
+        {
+            on_client_close(client);
+            return;
+        }
+
+        const char *user = (const char *)&buffer[3];
+        const size_t u_len = strnlen(user, 64) + 1;
+        const char *pass = (const char *)&buffer[3 + u_len];
+
+        const bool is_ok = (   !strcmp(user, mod->config.user)
+                            && !strncmp(pass, mod->config.pass, 34));
+
+        response[0] = (is_ok)
+                    ? NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_ACK
+                    : NEWCAMD_MSG_CLIENT_2_SERVER_LOGIN_NAK;
+        if(!client_send(client, header, 0))
+            return;
+
+        if(!is_ok)
+        {
+            asc_log_warning(MSG("login failed [%s]"), user);
+            on_client_close(client);
+            return;
+        }
+
+        newcamd_des_set_key(  &client->triple_des, mod->config.key
+                            , (const uint8_t *)mod->config.pass, 34);
+        client->status = 1;
+    }
+    else if(client->status == 1)
+    {
+        if(msg_type != NEWCAMD_MSG_CARD_DATA_REQ)
+        {
+            on_client_close(client);
+            return;
+        }
+
+        memset(response, 0, 3 + 12 + 11);
+        response[0] = NEWCAMD_MSG_CARD_DATA;
+        response[3] = 0; // no EMM
+        response[4] = mod->config.caid >> 8;
+        response[5] = mod->config.caid & 0xFF;
+        response[13] = 0x01; // UA
+        response[14] = 1; // provider count
+        if(!client_send(client, header, 12 + 11))
+            return;
+
+        client->status = 2;
+    }
+}
+
+static void on_server_accept(void *arg)
+{
+    module_data_t *mod = arg;
+
+    client_t *client = calloc(1, sizeof(client_t));
+    client->mod = mod;
+
+    if(!asc_socket_accept(mod->sock, &client->sock, client))
+    {
+        free(client);
+        return;
+    }
+
+    client->response_list = asc_list_init();
+    asc_list_insert_tail(mod->client_list, client);
+    ++mod->stat.client_count;
+
+    asc_socket_set_non_delay(client->sock, 1);
+
+    uint8_t key[NEWCAMD_KEY_SIZE];
+    for(size_t i = 0; i < sizeof(key); ++i)
+        key[i] = sim_random(mod) & 0xFF;
+    newcamd_des_set_key(&client->triple_des, mod->config.key, key, sizeof(key));
+
+    asc_socket_set_on_read(client->sock, on_client_read);
+    asc_socket_set_on_close(client->sock, on_client_close);
+
+    if(asc_socket_send(client->sock, key, sizeof(key)) != sizeof(key))
+        on_client_close(client);
+}
+
+static void on_server_close(void *arg)
+{
+    module_data_t *mod = arg;
+
+    if(!mod->sock)
+        return;
+
+    asc_socket_close(mod->sock);
+    mod->sock = NULL;
+
+    for(  asc_list_first(mod->client_list)
+        ; !asc_list_eol(mod->client_list)
+        ; asc_list_first(mod->client_list))
+    {
+        on_client_close(asc_list_data(mod->client_list));
+    }
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
+static int method_status(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, asc_list_size(mod->client_list));
+    lua_setfield(lua, -2, "clients");
+    lua_pushnumber(lua, mod->stat.client_count);
+    lua_setfield(lua, -2, "client_count");
+    lua_pushnumber(lua, mod->stat.ecm_count);
+    lua_setfield(lua, -2, "ecm_count");
+    lua_pushnumber(lua, mod->stat.error_count);
+    lua_setfield(lua, -2, "error_count");
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_option_string("name", &mod->config.name, NULL);
+    asc_assert(mod->config.name != NULL, "[newcamd_server] option 'name' is required");
+
+    mod->config.addr = "127.0.0.1";
+    module_option_string("addr", &mod->config.addr, NULL);
+    module_option_number("port", &mod->config.port);
+    asc_assert(mod->config.port != 0, MSG("option 'port' is required"));
+
+    module_option_string("user", &mod->config.user, NULL);
+    asc_assert(mod->config.user != NULL, MSG("option 'user' is required"));
+
+    const char *pass = NULL;
+    module_option_string("pass", &pass, NULL);
+    asc_assert(pass != NULL, MSG("option 'pass' is required"));
+    md5_crypt(pass, "$1$abcdefgh$", mod->config.pass);
+
+    const char *key = "0102030405060708091011121314";
+    size_t key_size = 28;
+    module_option_string("key", &key, &key_size);
+    asc_assert(key_size == 28, MSG("option 'key' must be 28 chars length"));
+    str_to_hex(key, mod->config.key, sizeof(mod->config.key));
+
+    mod->config.caid = SIM_CAID;
+    module_option_number("caid", &mod->config.caid);
+    module_option_number("delay", &mod->config.delay);
+    module_option_number("jitter", &mod->config.jitter);
+    module_option_number("error", &mod->config.error);
+
+    int seed = 1;
+    module_option_number("seed", &seed);
+    mod->seed = seed;
+
+    mod->client_list = asc_list_init();
+
+    mod->sock = asc_socket_open_tcp4(mod);
+    asc_socket_set_reuseaddr(mod->sock, 1);
+    if(!asc_socket_bind(mod->sock, mod->config.addr, mod->config.port))
+    {
+        on_server_close(mod);
+        astra_abort();
+    }
+    asc_socket_listen(mod->sock, on_server_accept, on_server_close);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    on_server_close(mod);
+    asc_list_destroy(mod->client_list);
+}
+
+MODULE_LUA_METHODS()
+{
+    { "status", method_status },
+};
+MODULE_LUA_REGISTER(newcamd_server)
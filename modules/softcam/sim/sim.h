@@ -0,0 +1,68 @@
+/*
+ * Astra Module: SoftCAM. Simulator
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2014, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_ 1
+
+#include <astra.h>
+
+/*
+ * The simulator ECM is a private section:
+ * table_id :8 (0x80 - even crypto period, 0x81 - odd)
+ * length   :16
+ * pnr      :16
+ * period   :32 (crypto period number)
+ *
+ * Control words are derived from the pnr and the crypto period number,
+ * so the csa_generator and the newcamd_server need no shared state.
+ */
+
+#define SIM_CAID 0x4AB0
+#define SIM_ECM_SIZE (3 + 2 + 4)
+
+static inline void sim_key(uint16_t pnr, uint32_t period, uint8_t key[8])
+{
+    const uint8_t seed[] =
+    {
+        pnr >> 8, pnr & 0xFF,
+        period >> 24, (period >> 16) & 0xFF, (period >> 8) & 0xFF, period & 0xFF,
+    };
+
+    uint8_t digest[MD5_DIGEST_SIZE];
+    md5_ctx_t ctx;
+    md5_init(&ctx);
+    md5_update(&ctx, seed, sizeof(seed));
+    md5_final(&ctx, digest);
+
+    memcpy(key, digest, 8);
+    key[3] = (key[0] + key[1] + key[2]) & 0xFF;
+    key[7] = (key[4] + key[5] + key[6]) & 0xFF;
+}
+
+/* keys - 16 bytes. even key for the period and the next one, then odd key */
+static inline void sim_ecm_keys(uint16_t pnr, uint32_t period, uint8_t keys[16])
+{
+    const uint32_t even = (period & 1) ? period + 1 : period;
+    const uint32_t odd = (period & 1) ? period : period + 1;
+    sim_key(pnr, even, &keys[0]);
+    sim_key(pnr, odd, &keys[8]);
+}
+
+#endif /* _SIM_H_ */
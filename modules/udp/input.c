@@ -62,6 +62,10 @@ struct module_data_t
     asc_socket_t *sock;
     asc_timer_t *timer_renew;
 
+    /* the framing is kept between datagrams to find the sync
+     * in the stream with 1 or 2 packets in the each datagram */
+    mpegts_sync_t *sync;
+
     uint8_t buffer[UDP_BUFFER_SIZE];
 };
 
@@ -110,13 +114,39 @@ static void on_read(void *arg)
         }
     }
 
-    for(; i <= len - TS_PACKET_SIZE; i += TS_PACKET_SIZE)
-        module_stream_send(mod, &mod->buffer[i]);
+    const uint8_t *buffer = &mod->buffer[i];
+    const size_t size = (len > i) ? (len - i) : 0;
+    const size_t count = size / TS_PACKET_SIZE;
+
+    /* datagram with the whole packets is checked without the search */
+    if(   size % TS_PACKET_SIZE == 0
+       && mpegts_sync_packet_size(mod->sync) != M2TS_PACKET_SIZE
+       && mpegts_sync_packet_size(mod->sync) != RS_PACKET_SIZE
+       && mpegts_sync_check(buffer, count, TS_PACKET_SIZE) == count)
+    {
+        mpegts_sync_reset(mod->sync);
+        for(size_t j = 0; j < count; ++j)
+            module_stream_send(mod, &buffer[j * TS_PACKET_SIZE]);
+        return;
+    }
+
+    const uint64_t skip = mpegts_sync_skip(mod->sync);
+    mpegts_sync_push(mod->sync, buffer, size);
 
-    if(i != len && !mod->is_error_message)
+    if(!mod->is_error_message)
     {
-        asc_log_error(MSG("wrong stream format. drop %d bytes"), len - i);
-        mod->is_error_message = true;
+        const size_t packet_size = mpegts_sync_packet_size(mod->sync);
+        if(mpegts_sync_skip(mod->sync) != skip)
+        {
+            asc_log_error(  MSG("wrong stream format. drop %"PRIu64" bytes")
+                          , mpegts_sync_skip(mod->sync) - skip);
+            mod->is_error_message = true;
+        }
+        else if(packet_size && packet_size != TS_PACKET_SIZE)
+        {
+            asc_log_warning(MSG("stream with %zu bytes packets"), packet_size);
+            mod->is_error_message = true;
+        }
     }
 }
 
@@ -137,6 +167,8 @@ static void module_init(module_data_t *mod)
 {
     module_stream_init(mod, NULL);
 
+    mod->sync = mpegts_sync_init((ts_callback_t)__module_stream_send, &mod->__stream);
+
     module_option_string("addr", &mod->config.addr, NULL);
     asc_assert(mod->config.addr != NULL, "[udp_input] option 'addr' is required");
 
@@ -172,6 +204,8 @@ static void module_destroy(module_data_t *mod)
     module_stream_destroy(mod);
 
     on_close(mod);
+
+    mpegts_sync_destroy(mod->sync);
 }
 
 MODULE_STREAM_METHODS()
@@ -85,9 +85,7 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
 {
     if(mod->is_rtp && mod->packet.skip == 0)
     {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        const uint64_t msec = ((tv.tv_sec % 1000000) * 1000) + (tv.tv_usec / 1000);
+        const uint64_t msec = asc_clock_fast() / 1000;
 
         mod->packet.buffer[2] = (mod->rtpseq >> 8) & 0xFF;
         mod->packet.buffer[3] = (mod->rtpseq     ) & 0xFF;
@@ -232,7 +230,7 @@ static void thread_loop(void *arg)
             if(reset)
             {
                 reset = false;
-                block_time_total = asc_utime();
+                block_time_total = asc_clock_fast();
             }
 
             if(mod->is_thread_started &&
@@ -272,7 +270,7 @@ static void thread_loop(void *arg)
                 continue;
             }
 
-            system_time = asc_utime();
+            system_time = asc_clock_fast();
             if(block_time_total > system_time + 100)
                 asc_usleep(block_time_total - system_time);
 
@@ -286,7 +284,7 @@ static void thread_loop(void *arg)
             uint32_t ts_sync = block_time / ts_count;
             uint32_t block_time_tail = block_time % ts_count;
 
-            system_time_check = asc_utime();
+            system_time_check = asc_clock_fast();
 
             for(uint32_t i = 0; mod->is_thread_started && i < ts_count; ++i)
             {
@@ -305,7 +303,7 @@ static void thread_loop(void *arg)
                     on_ts(mod, null_ts);
                 }
 
-                system_time = asc_utime();
+                system_time = asc_clock_fast();
                 block_time_total += ts_sync;
 
                 if(  (system_time < system_time_check) /* <-0s */
@@ -328,7 +326,7 @@ static void thread_loop(void *arg)
             if(reset)
                 continue;
 
-            system_time = asc_utime();
+            system_time = asc_clock_fast();
             if(system_time > block_time_total + 100000)
             {
                 asc_log_warning(MSG("wrong syncing time. -%"PRIu64"ms"),
@@ -0,0 +1,98 @@
+-- Load test for the decrypt and the newcamd client without a card server.
+-- newcamd_server answers ECM of the csa_generator with the known control words,
+-- csa_check counts packets with the correct payload after descrambling.
+--
+-- Requires the simulators: ./configure.sh --with-simulators
+--
+-- Usage: astra newcamd_bench.lua
+--
+-- Check the output:
+--   ecm time   - ECM response time in milliseconds (avg/max)
+--   error      - packets with wrong payload. Grows only at start
+--                and if the ECM response is slower than the crypto period
+--   scrambled  - packets not descrambled
+
+channels = 8            -- number of channels
+bitrate = 4000          -- kbit/s for each channel
+period = 10             -- crypto period in seconds
+delay = 50              -- server response delay in milliseconds
+jitter = 50             -- random addition to the delay
+error = 0               -- percent of the ECM answered with error
+pool = 2                -- connections to the server
+pipeline = 8            -- requests in flight on each connection
+duration = 60           -- seconds
+
+log.set({ debug = false })
+
+server = newcamd_server({
+    name = "sim",
+    port = 15050,
+    user = "bench",
+    pass = "bench",
+    delay = delay,
+    jitter = jitter,
+    error = error,
+})
+
+cam = newcamd({
+    name = "bench",
+    host = "127.0.0.1",
+    port = 15050,
+    user = "bench",
+    pass = "bench",
+    pool = pool,
+    pipeline = pipeline,
+    disable_emm = true,
+})
+
+bench = {}
+
+for i = 1, channels do
+    local channel = {}
+    channel.generator = csa_generator({
+        name = "ch" .. i,
+        pnr = i,
+        bitrate = bitrate,
+        period = period,
+    })
+    channel.decrypt = decrypt({
+        upstream = channel.generator:stream(),
+        name = "ch" .. i,
+        cam = cam:cam(),
+    })
+    channel.check = csa_check({
+        upstream = channel.decrypt:stream(),
+        name = "ch" .. i,
+    })
+    table.insert(bench, channel)
+end
+
+elapsed = 0
+
+timer({
+    interval = 5,
+    callback = function(self)
+        elapsed = elapsed + 5
+
+        local packets, ok, err, scrambled, rate = 0, 0, 0, 0, 0
+        for _, channel in ipairs(bench) do
+            local s = channel.check:status()
+            packets = packets + s.packets
+            ok = ok + s.ok
+            err = err + s.error
+            scrambled = scrambled + s.scrambled
+            rate = rate + s.bitrate
+        end
+
+        local c = cam:status()
+        log.info(string.format(
+            "%ds: ecm:%d ecm time:%.1f/%.1fms timeout:%d packets:%d ok:%d error:%d " ..
+            "scrambled:%d bitrate:%dkbit/s",
+            elapsed, c.ecm_count, c.ecm_time_avg, c.ecm_time_max, c.timeout_count,
+            packets, ok, err, scrambled, rate))
+
+        if elapsed >= duration then
+            astra.exit()
+        end
+    end
+})
@@ -164,7 +164,6 @@ function on_request_stat(server, client, request)
         code = 200,
         headers = {
             "Content-Type: text/html; charset=utf-8",
-            "Connection: close",
         },
         content = render_stat_html(),
     })
@@ -190,7 +189,6 @@ function on_request_playlist(server, client, request)
                 code = 200,
                 headers = {
                     "Content-Type: " .. content_type,
-                    "Connection: close",
                 },
                 content = content,
             })
@@ -281,6 +279,71 @@ function on_request_http(server, client, request)
     allow_channel()
 end
 
+-- shared origin connections of the pass-through relay
+passthrough_list = {}
+
+function kill_passthrough(server, client)
+    local client_data = server:data(client)
+    local relay = client_data.relay
+    if not relay then return nil end
+    client_data.relay = nil
+
+    relay.instance(server, client, nil)
+    if relay.instance:status().clients == 0 then
+        relay.instance:close()
+        if passthrough_list[relay.url] == relay then
+            passthrough_list[relay.url] = nil
+        end
+    end
+end
+
+function on_request_http_passthrough(server, client, request)
+    local client_data = server:data(client)
+
+    if not request then -- on_close
+        kill_passthrough(server, client)
+        xproxy_kill_client(server, client)
+        return nil
+    end
+
+    local url = "http://" .. request.path:sub(7)
+    local conf = parse_url(url)
+    if not conf then
+        server:abort(client, 404)
+        return nil
+    end
+
+    xproxy_init_client(server, client, request, url)
+
+    local relay = passthrough_list[url]
+    if not relay or not relay.instance:status().active then
+        local headers = {
+            "User-Agent: " .. http_user_agent,
+            "Host: " .. conf.host .. ":" .. conf.port,
+        }
+        if conf.login and conf.password then
+            local auth = base64.encode(conf.login .. ":" .. conf.password)
+            table.insert(headers, "Authorization: Basic " .. auth)
+        end
+
+        relay = {
+            url = url,
+            instance = http_relay({
+                host = conf.host,
+                port = conf.port,
+                path = conf.path,
+                headers = headers,
+                buffer_size = relay_buffer_size,
+                buffer_fill = relay_buffer_fill,
+            }),
+        }
+        passthrough_list[url] = relay
+    end
+
+    client_data.relay = relay
+    relay.instance(server, client, request)
+end
+
 --  oo    oo
 --   88oo88
 -- o88888888o
@@ -349,6 +412,7 @@ relay_buffer_fill = nil
 
 relay_allow_udp = true
 relay_allow_http = true
+relay_passthrough = false
 
 relay_stat_pass = nil
 
@@ -366,6 +430,7 @@ options_usage = [[
     --buffer-fill       minimal packet size in Kb (default: 128)
     --no-udp            disable direct access the to UDP/RTP source
     --no-http           disable direct access the to HTTP source
+    --passthrough       relay HTTP sources without remux, one origin connection per url
     --pass              basic authentication for statistics. login:password
     FILE                full path to the Lua-script
 ]]
@@ -412,6 +477,10 @@ options = {
         relay_allow_http = false
         return 0
     end,
+    ["--passthrough"] = function(idx)
+        relay_passthrough = true
+        return 0
+    end,
     ["--pass"] = function(idx)
         relay_stat_pass = "Basic " .. base64.encode(argv[idx + 1])
         return 1
@@ -445,7 +514,11 @@ function main()
     end
 
     if relay_allow_http then
-        table.insert(route, { "/http/*", http_upstream({ callback = on_request_http }) })
+        if relay_passthrough then
+            table.insert(route, { "/http/*", on_request_http_passthrough })
+        else
+            table.insert(route, { "/http/*", http_upstream({ callback = on_request_http }) })
+        end
     end
 
     if playlist_request then
@@ -106,35 +106,49 @@ function on_analyze_spts(channel_data, input_id, data)
             log.error("[" .. input_data.config.name .. "] Unknown PSI: " .. data.psi)
         end
 
-    elseif data.analyze then
+    elseif data.on_air ~= nil then
+        if input_data.analyze_timer then input_data.analyze_timer:close() end
+        input_data.analyze_timer = timer({
+            interval = 1,
+            callback = function(self)
+                on_analyze_on_air(channel_data, input_id, data)
+            end,
+        })
+        on_analyze_on_air(channel_data, input_id, data)
+    end
+end
 
-        if data.on_air ~= input_data.on_air then
-            local analyze_message = "[" .. input_data.config.name .. "] Bitrate:" .. data.total.bitrate .. "Kbit/s"
+-- analyze sends on_air only on changes. the delay is counted in seconds,
+-- so the last status is checked again by the timer
+function on_analyze_on_air(channel_data, input_id, data)
+    local input_data = channel_data.input[input_id]
 
-            if data.on_air == false then
-                local m = nil
-                if data.total.scrambled then
-                    m = " Scrambled"
-                else
-                    m = " PES:" .. data.total.pes_errors .. " CC:" .. data.total.cc_errors
-                end
-                log.error(analyze_message .. m)
+    if data.on_air ~= input_data.on_air then
+        local analyze_message = "[" .. input_data.config.name .. "] Bitrate:" .. data.total.bitrate .. "Kbit/s"
+
+        if data.on_air == false then
+            local m = nil
+            if data.total.scrambled then
+                m = " Scrambled"
             else
-                log.info(analyze_message)
+                m = " PES:" .. data.total.pes_errors .. " CC:" .. data.total.cc_errors
             end
+            log.error(analyze_message .. m)
+        else
+            log.info(analyze_message)
+        end
 
-            input_data.on_air = data.on_air
+        input_data.on_air = data.on_air
 
-            if channel_data.delay > 0 then
-                if input_data.on_air == true and channel_data.active_input_id == 0 then
-                    start_reserve(channel_data)
-                else
-                    channel_data.delay = channel_data.delay - 1
-                    input_data.on_air = nil
-                end
-            else
+        if channel_data.delay > 0 then
+            if input_data.on_air == true and channel_data.active_input_id == 0 then
                 start_reserve(channel_data)
+            else
+                channel_data.delay = channel_data.delay - 1
+                input_data.on_air = nil
             end
+        else
+            start_reserve(channel_data)
         end
     end
 end
@@ -200,6 +214,7 @@ function channel_init_input(channel_data, input_id)
             name = input_data.config.name,
             cc_limit = input_data.config.cc_limit,
             bitrate_limit = input_data.config.bitrate_limit,
+            events = true,
             callback = function(data)
                 on_analyze_spts(channel_data, input_id, data)
             end,
@@ -216,6 +231,10 @@ function channel_kill_input(channel_data, input_id)
 
     -- TODO: kill additional modules
 
+    if input_data.analyze_timer then
+        input_data.analyze_timer:close()
+        input_data.analyze_timer = nil
+    end
     input_data.analyze = nil
     input_data.on_air = nil
 
@@ -246,6 +265,8 @@ init_output_option.biss = function(channel_data, output_id)
     output_data.biss = biss_encrypt({
         upstream = channel_data.tail:stream(),
         key = output_data.config.biss,
+        threads = output_data.config.biss_threads,
+        latency = output_data.config.biss_latency,
     })
     channel_data.tail = output_data.biss
 end